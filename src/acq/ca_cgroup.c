@@ -0,0 +1,1043 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+
+#define CA_CGROUP_ROOT          "/sys/fs/cgroup"
+#define CA_CGROUP_BUF_SIZE      8192
+#define CA_CGROUP_DIR_MASK      (IN_CREATE|IN_DELETE|IN_MOVED_TO       \
+                                 |IN_MOVED_FROM|IN_DELETE_SELF|IN_ONLYDIR)
+
+
+typedef struct {
+    int64_t  usage_usec;
+    int64_t  nr_periods;
+    int64_t  nr_throttled;
+    int64_t  throttled_usec;
+    int64_t  rbytes;
+    int64_t  wbytes;
+    int64_t  rios;
+    int64_t  wios;
+} ca_cgroup_counters_t;
+
+
+typedef struct {
+    char                  *path;         /* relative to the root, "" for it */
+    int                    dirfd;
+    int                    wd;
+    int                    events_wd;
+    unsigned               populated:1;
+    ca_cgroup_counters_t   last;
+    int64_t                mem_current;
+    int64_t                mem_anon;
+    int64_t                mem_file;
+    double                 cpu_usage;
+    double                 cpu_throttled;
+    double                 cpu_throttled_time;
+    double                 io_read_bytes;
+    double                 io_write_bytes;
+    double                 io_read_ops;
+    double                 io_write_ops;
+    uint64_t               last_us;
+    time_t                 updated;
+} ca_cgroup_t;
+
+
+typedef struct {
+    int           wd;
+    ca_cgroup_t  *cgroup;
+} ca_cgroup_watch_t;
+
+
+typedef struct {
+    ca_str_t          root;
+    int               root_fd;
+    int               inotify_fd;
+    ca_acq_event_t    event;
+    ca_array_t       *cgroups;      /* ca_cgroup_t *, sorted by path */
+    ca_array_t       *watches;      /* ca_cgroup_watch_t, sorted by wd */
+    u_char           *buf;
+    unsigned          opened:1;
+    unsigned          resync:1;
+} ca_cgroup_info_t;
+
+
+static ca_cgroup_info_t  ca_s_cgroup_info = {
+    .root       = ca_string(CA_CGROUP_ROOT),
+    .root_fd    = CA_INVALID_FILE,
+    .inotify_fd = CA_INVALID_FILE,
+};
+
+
+static void ca_cgroup_remove(ca_cgroup_t *cg);
+
+
+/*
+ * Both lookup tables are kept sorted, so that a lookup is a binary
+ * search and a change costs one memmove().
+ */
+static ca_uint_t
+ca_cgroup_path_index(const char *path, size_t len, ca_uint_t *found)
+{
+    int            rc;
+    ca_uint_t      lo, hi, mid;
+    ca_cgroup_t  **cgp;
+
+    cgp = ca_s_cgroup_info.cgroups->elem;
+    lo = 0;
+    hi = ca_s_cgroup_info.cgroups->nelem;
+    *found = 0;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        rc = strncmp(cgp[mid]->path, path, len);
+        if (rc == 0 && cgp[mid]->path[len] != '\0') {
+            rc = 1;
+        }
+
+        if (rc == 0) {
+            *found = 1;
+            return mid;
+        }
+
+        if (rc < 0) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+static ca_cgroup_t *
+ca_cgroup_find(const char *path, size_t len)
+{
+    ca_uint_t      i, found;
+    ca_cgroup_t  **cgp;
+
+    if (ca_s_cgroup_info.cgroups == NULL) {
+        return NULL;
+    }
+
+    i = ca_cgroup_path_index(path, len, &found);
+    if (!found) {
+        return NULL;
+    }
+
+    cgp = ca_s_cgroup_info.cgroups->elem;
+
+    return cgp[i];
+}
+
+
+static ca_uint_t
+ca_cgroup_watch_index(int wd, ca_uint_t *found)
+{
+    ca_uint_t           lo, hi, mid;
+    ca_cgroup_watch_t  *w;
+
+    w = ca_s_cgroup_info.watches->elem;
+    lo = 0;
+    hi = ca_s_cgroup_info.watches->nelem;
+    *found = 0;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if (w[mid].wd == wd) {
+            *found = 1;
+            return mid;
+        }
+
+        if (w[mid].wd < wd) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+static ca_int_t
+ca_cgroup_watch_add(const char *path, uint32_t mask, ca_cgroup_t *cg)
+{
+    int                 wd;
+    ca_uint_t           i, found;
+    ca_cgroup_watch_t  *w;
+
+    wd = inotify_add_watch(ca_s_cgroup_info.inotify_fd, path, mask);
+    if (wd == -1) {
+        ca_log_err(errno, "inotify_add_watch(\"%s\") failed", path);
+        return CA_ERROR;
+    }
+
+    i = ca_cgroup_watch_index(wd, &found);
+    if (!found) {
+        if (ca_array_push(ca_s_cgroup_info.watches) == NULL) {
+            inotify_rm_watch(ca_s_cgroup_info.inotify_fd, wd);
+            return CA_ERROR;
+        }
+
+        w = ca_s_cgroup_info.watches->elem;
+        ca_memmove(&w[i + 1], &w[i], (ca_s_cgroup_info.watches->nelem - i - 1)
+                                     * sizeof(ca_cgroup_watch_t));
+    }
+
+    w = ca_s_cgroup_info.watches->elem;
+    w[i].wd = wd;
+    w[i].cgroup = cg;
+
+    return wd;
+}
+
+
+static void
+ca_cgroup_watch_del(int wd)
+{
+    ca_uint_t           i, found;
+    ca_cgroup_watch_t  *w;
+
+    if (wd == -1) {
+        return;
+    }
+
+    i = ca_cgroup_watch_index(wd, &found);
+    if (!found) {
+        return;
+    }
+
+    w = ca_s_cgroup_info.watches->elem;
+    ca_memmove(&w[i], &w[i + 1], (ca_s_cgroup_info.watches->nelem - i - 1)
+                                 * sizeof(ca_cgroup_watch_t));
+    ca_s_cgroup_info.watches->nelem--;
+
+    /* the watch is gone already if the cgroup was removed */
+    inotify_rm_watch(ca_s_cgroup_info.inotify_fd, wd);
+}
+
+
+static ssize_t
+ca_cgroup_read(ca_cgroup_t *cg, const char *name)
+{
+    int      fd;
+    ssize_t  n;
+
+    fd = openat(cg->dirfd, name, O_RDONLY|O_CLOEXEC);
+    if (fd == CA_INVALID_FILE) {
+        return CA_ERROR;
+    }
+
+    n = read(fd, ca_s_cgroup_info.buf, CA_CGROUP_BUF_SIZE - 1);
+    close(fd);
+
+    if (n < 0) {
+        return CA_ERROR;
+    }
+
+    ca_s_cgroup_info.buf[n] = '\0';
+
+    return n;
+}
+
+
+static char *
+ca_cgroup_next_line(char **line)
+{
+    char  *p, *next;
+
+    p = *line;
+    if (*p == '\0') {
+        return NULL;
+    }
+
+    next = strchr(p, '\n');
+    if (next == NULL) {
+        *line = p + strlen(p);
+
+    } else {
+        *next = '\0';
+        *line = next + 1;
+    }
+
+    return p;
+}
+
+
+static void
+ca_cgroup_read_populated(ca_cgroup_t *cg)
+{
+    char  *p, *line, *fields[2];
+
+    if (ca_cgroup_read(cg, "cgroup.events") == CA_ERROR) {
+        return;
+    }
+
+    p = (char *) ca_s_cgroup_info.buf;
+
+    while ((line = ca_cgroup_next_line(&p)) != NULL) {
+        if (ca_strsplit(line, fields, 2) == 2
+            && strcmp(fields[0], "populated") == 0)
+        {
+            cg->populated = atoi(fields[1]) ? 1 : 0;
+        }
+    }
+}
+
+
+static ca_cgroup_t *
+ca_cgroup_add(int parent_fd, const char *path, const char *name)
+{
+    int             fd, dfd;
+    char           *child, abs[PATH_MAX];
+    size_t          len;
+    ca_uint_t       i, found;
+    DIR            *dir;
+    struct dirent  *de;
+    ca_cgroup_t    *cg, **cgp;
+
+    len = strlen(path);
+
+    i = ca_cgroup_path_index(path, len, &found);
+    if (found) {
+        cgp = ca_s_cgroup_info.cgroups->elem;
+        return cgp[i];
+    }
+
+    fd = openat(parent_fd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd == CA_INVALID_FILE) {
+        return NULL;
+    }
+
+    cg = ca_calloc(1, sizeof(ca_cgroup_t));
+    if (cg == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    cg->path = ca_strdup(path);
+    if (cg->path == NULL) {
+        ca_free(cg);
+        close(fd);
+        return NULL;
+    }
+
+    cg->dirfd = fd;
+    cg->wd = -1;
+    cg->events_wd = -1;
+    cg->mem_current = -1;
+    cg->mem_anon = -1;
+    cg->mem_file = -1;
+
+    if (ca_array_push(ca_s_cgroup_info.cgroups) == NULL) {
+        ca_free(cg->path);
+        ca_free(cg);
+        close(fd);
+        return NULL;
+    }
+
+    cgp = ca_s_cgroup_info.cgroups->elem;
+    ca_memmove(&cgp[i + 1], &cgp[i],
+               (ca_s_cgroup_info.cgroups->nelem - i - 1)
+               * sizeof(ca_cgroup_t *));
+    cgp[i] = cg;
+
+    ca_snprintf((u_char *) abs, sizeof(abs), "%V%s%s%Z",
+                &ca_s_cgroup_info.root, len ? "/" : "", path);
+    cg->wd = ca_cgroup_watch_add(abs, CA_CGROUP_DIR_MASK, cg);
+
+    /* the root cgroup has no cgroup.events and is always populated */
+
+    if (len) {
+        ca_snprintf((u_char *) abs, sizeof(abs), "%V/%s/cgroup.events%Z",
+                    &ca_s_cgroup_info.root, path);
+        cg->events_wd = ca_cgroup_watch_add(abs, IN_MODIFY, cg);
+
+        ca_cgroup_read_populated(cg);
+
+    } else {
+        cg->populated = 1;
+    }
+
+    /* the new cgroup may already have children */
+
+    dfd = dup(fd);
+    if (dfd == CA_INVALID_FILE) {
+        return cg;
+    }
+
+    dir = fdopendir(dfd);
+    if (dir == NULL) {
+        close(dfd);
+        return cg;
+    }
+
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_type != DT_DIR || de->d_name[0] == '.') {
+            continue;
+        }
+
+        child = ca_alloc(len + 1 + strlen(de->d_name) + 1);
+        if (child == NULL) {
+            break;
+        }
+
+        ca_sprintf((u_char *) child, "%s%s%s%Z", path, len ? "/" : "",
+                   de->d_name);
+
+        ca_cgroup_add(fd, child, de->d_name);
+
+        ca_free(child);
+    }
+
+    closedir(dir);
+
+    return cg;
+}
+
+
+static void
+ca_cgroup_remove(ca_cgroup_t *cg)
+{
+    ca_uint_t      i, found;
+    ca_cgroup_t  **cgp;
+
+    i = ca_cgroup_path_index(cg->path, strlen(cg->path), &found);
+    if (found) {
+        cgp = ca_s_cgroup_info.cgroups->elem;
+        ca_memmove(&cgp[i], &cgp[i + 1],
+                   (ca_s_cgroup_info.cgroups->nelem - i - 1)
+                   * sizeof(ca_cgroup_t *));
+        ca_s_cgroup_info.cgroups->nelem--;
+    }
+
+    ca_cgroup_watch_del(cg->wd);
+    ca_cgroup_watch_del(cg->events_wd);
+
+    close(cg->dirfd);
+    ca_free(cg->path);
+    ca_free(cg);
+}
+
+
+/* the cgroup of the path and all those below it */
+static void
+ca_cgroup_remove_tree(const char *path, size_t len)
+{
+    ca_uint_t      i, found;
+    ca_cgroup_t  **cgp;
+
+    i = ca_cgroup_path_index(path, len, &found);
+
+    /* the paths starting with it follow it, "a-b" may sit before "a/b" */
+
+    while (i < ca_s_cgroup_info.cgroups->nelem) {
+        cgp = ca_s_cgroup_info.cgroups->elem;
+
+        if (strncmp(cgp[i]->path, path, len) != 0) {
+            break;
+        }
+
+        if (cgp[i]->path[len] != '\0' && cgp[i]->path[len] != '/') {
+            i++;
+            continue;
+        }
+
+        ca_log_debug(0, "cgroup \"%s\" removed", cgp[i]->path);
+        ca_cgroup_remove(cgp[i]);
+    }
+}
+
+
+static void
+ca_cgroup_remove_all(void)
+{
+    ca_cgroup_t  **cgp;
+
+    while (ca_s_cgroup_info.cgroups->nelem) {
+        cgp = ca_s_cgroup_info.cgroups->elem;
+        ca_cgroup_remove(cgp[ca_s_cgroup_info.cgroups->nelem - 1]);
+    }
+}
+
+
+static void
+ca_cgroup_handle_event(struct inotify_event *ie)
+{
+    char               *path;
+    size_t              len;
+    ca_uint_t           i, found;
+    ca_cgroup_t        *cg;
+    ca_cgroup_watch_t  *w;
+
+    if (ie->mask & IN_Q_OVERFLOW) {
+        ca_s_cgroup_info.resync = 1;
+        return;
+    }
+
+    i = ca_cgroup_watch_index(ie->wd, &found);
+    if (!found) {
+        return;
+    }
+
+    w = ca_s_cgroup_info.watches->elem;
+    cg = w[i].cgroup;
+
+    if (ie->wd == cg->events_wd) {
+        if (ie->mask & IN_MODIFY) {
+            ca_cgroup_read_populated(cg);
+        }
+
+        return;
+    }
+
+    if (ie->mask & (IN_DELETE_SELF|IN_IGNORED)) {
+        ca_log_debug(0, "cgroup \"%s\" removed", cg->path);
+        ca_cgroup_remove(cg);
+        return;
+    }
+
+    if (!(ie->mask & IN_ISDIR) || ie->len == 0) {
+        return;
+    }
+
+    len = strlen(cg->path);
+    path = ca_alloc(len + 1 + strlen(ie->name) + 1);
+    if (path == NULL) {
+        return;
+    }
+
+    ca_sprintf((u_char *) path, "%s%s%s%Z", cg->path, len ? "/" : "",
+               ie->name);
+
+    if (ie->mask & (IN_CREATE|IN_MOVED_TO)) {
+        ca_log_debug(0, "cgroup \"%s\" created", path);
+        ca_cgroup_add(cg->dirfd, path, ie->name);
+
+    } else if (ie->mask & (IN_DELETE|IN_MOVED_FROM)) {
+
+        /*
+         * the cgroups below a renamed one are under the new name now,
+         * they are found again as it is added on IN_MOVED_TO
+         */
+
+        ca_cgroup_remove_tree(path, strlen(path));
+    }
+
+    ca_free(path);
+}
+
+
+static void
+ca_cgroup_inotify_handler(ca_acq_event_t *ev)
+{
+    char                  *p;
+    ssize_t                n;
+    struct inotify_event  *ie;
+    char                   buf[4096]
+                           __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for ( ;; ) {
+        n = read(ev->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ie->len) {
+            ie = (struct inotify_event *) p;
+            ca_cgroup_handle_event(ie);
+        }
+    }
+
+    if (ca_s_cgroup_info.resync) {
+        ca_log_warn(0, "cgroup inotify queue overflow, rescanning");
+        ca_s_cgroup_info.resync = 0;
+        ca_cgroup_remove_all();
+        ca_cgroup_add(ca_s_cgroup_info.root_fd, "", ".");
+    }
+}
+
+
+static ca_int_t
+ca_cgroup_open(void)
+{
+    ca_s_cgroup_info.opened = 1;
+
+    ca_s_cgroup_info.buf = ca_alloc(CA_CGROUP_BUF_SIZE);
+    ca_s_cgroup_info.cgroups = ca_array_create(64, sizeof(ca_cgroup_t *));
+    ca_s_cgroup_info.watches = ca_array_create(128,
+                                               sizeof(ca_cgroup_watch_t));
+
+    if (ca_s_cgroup_info.buf == NULL
+        || ca_s_cgroup_info.cgroups == NULL
+        || ca_s_cgroup_info.watches == NULL)
+    {
+        return CA_ERROR;
+    }
+
+    ca_s_cgroup_info.root_fd = open((char *) ca_s_cgroup_info.root.data,
+                                    O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (ca_s_cgroup_info.root_fd == CA_INVALID_FILE) {
+        ca_log_err(errno, "open cgroup root \"%V\" failed",
+                   &ca_s_cgroup_info.root);
+        return CA_ERROR;
+    }
+
+    ca_s_cgroup_info.inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (ca_s_cgroup_info.inotify_fd == CA_INVALID_FILE) {
+        ca_log_err(errno, "inotify_init1() failed");
+        return CA_ERROR;
+    }
+
+    ca_s_cgroup_info.event.fd = ca_s_cgroup_info.inotify_fd;
+    ca_s_cgroup_info.event.events = POLLIN;
+    ca_s_cgroup_info.event.handler = ca_cgroup_inotify_handler;
+    ca_s_cgroup_info.event.data = NULL;
+
+    if (ca_acq_add_event(&ca_s_cgroup_info.event) != CA_OK) {
+        return CA_ERROR;
+    }
+
+    ca_cgroup_add(ca_s_cgroup_info.root_fd, "", ".");
+
+    ca_log_debug(0, "%ud cgroups found under \"%V\"",
+                 ca_s_cgroup_info.cgroups->nelem, &ca_s_cgroup_info.root);
+
+    return CA_OK;
+}
+
+
+static void
+ca_cgroup_parse_io(ca_cgroup_counters_t *c)
+{
+    int    i, n;
+    char  *p, *line, *fields[8];
+
+    p = (char *) ca_s_cgroup_info.buf;
+
+    /* 8:0 rbytes=1 wbytes=2 rios=3 wios=4 dbytes=0 dios=0 */
+
+    while ((line = ca_cgroup_next_line(&p)) != NULL) {
+        n = ca_strsplit(line, fields, 8);
+
+        for (i = 1; i < n; i++) {
+            if (strncmp(fields[i], "rbytes=", 7) == 0) {
+                c->rbytes += atoll(fields[i] + 7);
+
+            } else if (strncmp(fields[i], "wbytes=", 7) == 0) {
+                c->wbytes += atoll(fields[i] + 7);
+
+            } else if (strncmp(fields[i], "rios=", 5) == 0) {
+                c->rios += atoll(fields[i] + 5);
+
+            } else if (strncmp(fields[i], "wios=", 5) == 0) {
+                c->wios += atoll(fields[i] + 5);
+            }
+        }
+    }
+}
+
+
+static double
+ca_cgroup_rate(int64_t cur, int64_t last, double elapsed)
+{
+    if (cur < last || elapsed <= 0) {
+        return -1;
+    }
+
+    return (cur - last) / elapsed;
+}
+
+
+static void
+ca_get_cgroup_info(ca_cgroup_t *cg)
+{
+    char                  *p, *line, *fields[2];
+    double                 elapsed;
+    uint64_t               now_us;
+    ca_cgroup_counters_t   c;
+
+    now_us = ca_time_us();
+    elapsed = (now_us - cg->last_us) / 1000000.0;
+
+    if (ca_cgroup_read(cg, "memory.current") != CA_ERROR) {
+        cg->mem_current = atoll((char *) ca_s_cgroup_info.buf);
+    }
+
+    if (ca_cgroup_read(cg, "memory.stat") != CA_ERROR) {
+        p = (char *) ca_s_cgroup_info.buf;
+
+        while ((line = ca_cgroup_next_line(&p)) != NULL) {
+            if (ca_strsplit(line, fields, 2) != 2) {
+                continue;
+            }
+
+            if (strcmp(fields[0], "anon") == 0) {
+                cg->mem_anon = atoll(fields[1]);
+
+            } else if (strcmp(fields[0], "file") == 0) {
+                cg->mem_file = atoll(fields[1]);
+            }
+        }
+    }
+
+    /*
+     * The cpu and io counters of a cgroup without tasks cannot move,
+     * so only its first read is paid for.
+     */
+
+    if (!cg->populated && cg->last_us != 0) {
+        cg->cpu_usage = 0;
+        cg->cpu_throttled = 0;
+        cg->cpu_throttled_time = 0;
+        cg->io_read_bytes = 0;
+        cg->io_write_bytes = 0;
+        cg->io_read_ops = 0;
+        cg->io_write_ops = 0;
+        cg->last_us = now_us;
+        cg->updated = time(NULL);
+        return;
+    }
+
+    ca_memzero(&c, sizeof(ca_cgroup_counters_t));
+
+    if (ca_cgroup_read(cg, "cpu.stat") != CA_ERROR) {
+        p = (char *) ca_s_cgroup_info.buf;
+
+        while ((line = ca_cgroup_next_line(&p)) != NULL) {
+            if (ca_strsplit(line, fields, 2) != 2) {
+                continue;
+            }
+
+            if (strcmp(fields[0], "usage_usec") == 0) {
+                c.usage_usec = atoll(fields[1]);
+
+            } else if (strcmp(fields[0], "nr_periods") == 0) {
+                c.nr_periods = atoll(fields[1]);
+
+            } else if (strcmp(fields[0], "nr_throttled") == 0) {
+                c.nr_throttled = atoll(fields[1]);
+
+            } else if (strcmp(fields[0], "throttled_usec") == 0) {
+                c.throttled_usec = atoll(fields[1]);
+            }
+        }
+    }
+
+    if (ca_cgroup_read(cg, "io.stat") != CA_ERROR) {
+        ca_cgroup_parse_io(&c);
+    }
+
+    if (cg->last_us != 0) {
+        cg->cpu_usage = ca_cgroup_rate(c.usage_usec, cg->last.usage_usec,
+                                       elapsed) / 10000.0;
+        cg->cpu_throttled_time = ca_cgroup_rate(c.throttled_usec,
+                                                cg->last.throttled_usec,
+                                                elapsed);
+
+        if (c.nr_periods > cg->last.nr_periods) {
+            cg->cpu_throttled = (c.nr_throttled - cg->last.nr_throttled)
+                                * 100.0
+                                / (c.nr_periods - cg->last.nr_periods);
+        } else {
+            cg->cpu_throttled = 0;
+        }
+
+        cg->io_read_bytes = ca_cgroup_rate(c.rbytes, cg->last.rbytes,
+                                           elapsed);
+        cg->io_write_bytes = ca_cgroup_rate(c.wbytes, cg->last.wbytes,
+                                            elapsed);
+        cg->io_read_ops = ca_cgroup_rate(c.rios, cg->last.rios, elapsed);
+        cg->io_write_ops = ca_cgroup_rate(c.wios, cg->last.wios, elapsed);
+
+    } else {
+        cg->cpu_usage = -1;
+        cg->cpu_throttled = -1;
+        cg->cpu_throttled_time = -1;
+        cg->io_read_bytes = -1;
+        cg->io_write_bytes = -1;
+        cg->io_read_ops = -1;
+        cg->io_write_ops = -1;
+    }
+
+    cg->last = c;
+    cg->last_us = now_us;
+    cg->updated = time(NULL);
+}
+
+
+static ca_cgroup_t *
+ca_cgroup_lookup(ca_str_t *key, time_t now, time_t freq)
+{
+    u_char       *path;
+    size_t        len;
+    ca_cgroup_t  *cg;
+
+    if (!ca_s_cgroup_info.opened && ca_cgroup_open() != CA_OK) {
+        return NULL;
+    }
+
+    if (ca_s_cgroup_info.cgroups == NULL) {
+        return NULL;
+    }
+
+    path = key->data;
+    len = key->len;
+
+    while (len && *path == '/') {
+        path++;
+        len--;
+    }
+
+    cg = ca_cgroup_find((char *) path, len);
+    if (cg == NULL) {
+        return NULL;
+    }
+
+    if (cg->updated + freq <= now) {
+        ca_get_cgroup_info(cg);
+    }
+
+    return cg;
+}
+
+
+ca_int_t
+ca_cgroup_init(void *dummy)
+{
+    ca_conf_ctx_t  *conf = dummy;
+
+    if (conf->cgroup_root.len) {
+        ca_s_cgroup_info.root = conf->cgroup_root;
+    }
+
+    return CA_OK;
+}
+
+
+u_char *
+ca_get_cgroup_count(time_t now, time_t freq)
+{
+    static u_char  cgroup_count[20];
+
+    if (!ca_s_cgroup_info.opened) {
+        ca_cgroup_open();
+    }
+
+    if (ca_s_cgroup_info.cgroups != NULL && ca_s_cgroup_info.root_fd >= 0) {
+        ca_snprintf(cgroup_count, sizeof(cgroup_count), "%ud%Z",
+                    ca_s_cgroup_info.cgroups->nelem);
+
+    } else {
+        cgroup_count[0] = '\0';
+    }
+
+    return cgroup_count;
+}
+
+
+u_char *
+ca_get_cgroup_cpu_usage(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  cpu_usage[20];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->cpu_usage >= 0) {
+        ca_snprintf(cpu_usage, sizeof(cpu_usage), "%.1f%Z", cg->cpu_usage);
+
+    } else {
+        cpu_usage[0] = '\0';
+    }
+
+    return cpu_usage;
+}
+
+
+u_char *
+ca_get_cgroup_cpu_throttled(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  cpu_throttled[20];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->cpu_throttled >= 0) {
+        ca_snprintf(cpu_throttled, sizeof(cpu_throttled), "%.1f%Z",
+                    cg->cpu_throttled);
+
+    } else {
+        cpu_throttled[0] = '\0';
+    }
+
+    return cpu_throttled;
+}
+
+
+u_char *
+ca_get_cgroup_cpu_throttled_time(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  cpu_throttled_time[20];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->cpu_throttled_time >= 0) {
+        ca_snprintf(cpu_throttled_time, sizeof(cpu_throttled_time), "%.0f%Z",
+                    cg->cpu_throttled_time);
+
+    } else {
+        cpu_throttled_time[0] = '\0';
+    }
+
+    return cpu_throttled_time;
+}
+
+
+u_char *
+ca_get_cgroup_mem_current(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  mem_current[24];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->mem_current >= 0) {
+        ca_snprintf(mem_current, sizeof(mem_current), "%L%Z",
+                    cg->mem_current);
+
+    } else {
+        mem_current[0] = '\0';
+    }
+
+    return mem_current;
+}
+
+
+u_char *
+ca_get_cgroup_mem_anon(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  mem_anon[24];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->mem_anon >= 0) {
+        ca_snprintf(mem_anon, sizeof(mem_anon), "%L%Z", cg->mem_anon);
+
+    } else {
+        mem_anon[0] = '\0';
+    }
+
+    return mem_anon;
+}
+
+
+u_char *
+ca_get_cgroup_mem_file(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  mem_file[24];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->mem_file >= 0) {
+        ca_snprintf(mem_file, sizeof(mem_file), "%L%Z", cg->mem_file);
+
+    } else {
+        mem_file[0] = '\0';
+    }
+
+    return mem_file;
+}
+
+
+u_char *
+ca_get_cgroup_io_read_bytes(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  io_read_bytes[24];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->io_read_bytes >= 0) {
+        ca_snprintf(io_read_bytes, sizeof(io_read_bytes), "%.0f%Z",
+                    cg->io_read_bytes);
+
+    } else {
+        io_read_bytes[0] = '\0';
+    }
+
+    return io_read_bytes;
+}
+
+
+u_char *
+ca_get_cgroup_io_write_bytes(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  io_write_bytes[24];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->io_write_bytes >= 0) {
+        ca_snprintf(io_write_bytes, sizeof(io_write_bytes), "%.0f%Z",
+                    cg->io_write_bytes);
+
+    } else {
+        io_write_bytes[0] = '\0';
+    }
+
+    return io_write_bytes;
+}
+
+
+u_char *
+ca_get_cgroup_io_read_ops(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  io_read_ops[24];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->io_read_ops >= 0) {
+        ca_snprintf(io_read_ops, sizeof(io_read_ops), "%.0f%Z",
+                    cg->io_read_ops);
+
+    } else {
+        io_read_ops[0] = '\0';
+    }
+
+    return io_read_ops;
+}
+
+
+u_char *
+ca_get_cgroup_io_write_ops(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  io_write_ops[24];
+    ca_cgroup_t   *cg;
+
+    cg = ca_cgroup_lookup(key, now, freq);
+
+    if (cg != NULL && cg->io_write_ops >= 0) {
+        ca_snprintf(io_write_ops, sizeof(io_write_ops), "%.0f%Z",
+                    cg->io_write_ops);
+
+    } else {
+        io_write_ops[0] = '\0';
+    }
+
+    return io_write_ops;
+}
@@ -0,0 +1,20 @@
+#ifndef __CA_CGROUP_H_INCLUDED__
+#define __CA_CGROUP_H_INCLUDED__
+
+
+ca_int_t ca_cgroup_init(void *conf);
+u_char *ca_get_cgroup_count(time_t now, time_t freq);
+u_char *ca_get_cgroup_cpu_usage(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_cpu_throttled(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_cpu_throttled_time(ca_str_t *key, time_t now,
+    time_t freq);
+u_char *ca_get_cgroup_mem_current(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_mem_anon(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_mem_file(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_io_read_bytes(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_io_write_bytes(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_io_read_ops(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_cgroup_io_write_ops(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_CGROUP_H_INCLUDED__ */
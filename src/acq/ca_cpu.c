@@ -5,15 +5,29 @@
 
 #define BUF_SIZE    1024
 
+#define CA_CPU_CTXT         0
+#define CA_CPU_INTR         1
+#define CA_CPU_FORKS        2
+#define CA_CPU_SOFTIRQ      3
+#define CA_CPU_NCOUNTERS    4
+
+
+typedef struct ca_cpu_counter_s {
+    int64_t  value;
+    double   rate;               /* per second, -1 if unknown */
+} ca_cpu_counter_t;
+
 
 typedef struct ca_cpu_info_s {
-    double  cpu_system;
-    double  cpu_user;
-    double  cpu_io;
-    double  cpu_idle;
-    int     procs_running;
-    int     procs_blocked;
-    time_t  updated;
+    double            cpu_system;
+    double            cpu_user;
+    double            cpu_io;
+    double            cpu_idle;
+    int               procs_running;
+    int               procs_blocked;
+    time_t            updated;
+    ca_cpu_counter_t  counter[CA_CPU_NCOUNTERS];
+    uint64_t          last_us;
 } ca_cpu_info_t;
 
 
@@ -33,6 +47,10 @@ ca_get_cpu_info(void)
     char            *fields[9];
     int              numfields;
     int64_t          user, nice, syst, idle, iowait, total, diff_total;
+    int64_t          value[CA_CPU_NCOUNTERS];
+    double           elapsed;
+    uint64_t         now_us;
+    ca_int_t         i;
     FILE            *fh;
 
     fh = fopen("/proc/stat", "r");
@@ -41,6 +59,10 @@ ca_get_cpu_info(void)
         return;
     }
 
+    for (i = 0; i < CA_CPU_NCOUNTERS; i++) {
+        value[i] = -1;
+    }
+
     while (fgets(buf, sizeof(buf), fh) != NULL) {
         if (strncasecmp(buf, "cpu ", 4) == 0) {
             numfields = ca_strsplit(buf, fields, 9);
@@ -94,12 +116,44 @@ ca_get_cpu_info(void)
             }
             ca_s_cpu_info.procs_blocked = atoi(fields[1]);
 
+        } else if (strncmp(buf, "ctxt ", 5) == 0) {
+            value[CA_CPU_CTXT] = atoll(buf + 5);
+
+        } else if (strncmp(buf, "intr ", 5) == 0) {
+            /* the total, the line goes on with a count per irq */
+            value[CA_CPU_INTR] = atoll(buf + 5);
+
+        } else if (strncmp(buf, "processes ", 10) == 0) {
+            value[CA_CPU_FORKS] = atoll(buf + 10);
+
+        } else if (strncmp(buf, "softirq ", 8) == 0) {
+            value[CA_CPU_SOFTIRQ] = atoll(buf + 8);
+
         } else {
             continue;
         }
     }
 
     fclose(fh);
+
+    now_us = ca_time_us();
+    elapsed = (now_us - ca_s_cpu_info.last_us) / 1000000.0;
+
+    for (i = 0; i < CA_CPU_NCOUNTERS; i++) {
+        if (ca_s_cpu_info.last_us != 0 && elapsed > 0 && value[i] >= 0
+            && value[i] >= ca_s_cpu_info.counter[i].value)
+        {
+            ca_s_cpu_info.counter[i].rate = (value[i]
+                                             - ca_s_cpu_info.counter[i].value)
+                                            / elapsed;
+        } else {
+            ca_s_cpu_info.counter[i].rate = -1;
+        }
+
+        ca_s_cpu_info.counter[i].value = value[i];
+    }
+
+    ca_s_cpu_info.last_us = now_us;
     ca_s_cpu_info.updated = time(NULL);
 }
 
@@ -238,3 +292,95 @@ ca_get_procs_blocked(time_t now, time_t freq)
 
     return procs_blocked;  
 }
+
+
+u_char *
+ca_get_ctxt_rate(time_t now, time_t freq)
+{
+    static u_char  ctxt_rate[24];
+
+    if (ca_s_cpu_info.updated + freq <= now) {
+        ca_get_cpu_info();
+    }
+
+    if (ca_s_cpu_info.counter[CA_CPU_CTXT].rate >= 0) {
+        ca_snprintf(ctxt_rate, sizeof(ctxt_rate), "%.1f%Z",
+                    ca_s_cpu_info.counter[CA_CPU_CTXT].rate);
+
+    } else {
+        ctxt_rate[0] = '\0';
+    }
+
+    ca_s_cpu_info.counter[CA_CPU_CTXT].rate = -1;
+
+    return ctxt_rate;
+}
+
+
+u_char *
+ca_get_intr_rate(time_t now, time_t freq)
+{
+    static u_char  intr_rate[24];
+
+    if (ca_s_cpu_info.updated + freq <= now) {
+        ca_get_cpu_info();
+    }
+
+    if (ca_s_cpu_info.counter[CA_CPU_INTR].rate >= 0) {
+        ca_snprintf(intr_rate, sizeof(intr_rate), "%.1f%Z",
+                    ca_s_cpu_info.counter[CA_CPU_INTR].rate);
+
+    } else {
+        intr_rate[0] = '\0';
+    }
+
+    ca_s_cpu_info.counter[CA_CPU_INTR].rate = -1;
+
+    return intr_rate;
+}
+
+
+u_char *
+ca_get_fork_rate(time_t now, time_t freq)
+{
+    static u_char  fork_rate[24];
+
+    if (ca_s_cpu_info.updated + freq <= now) {
+        ca_get_cpu_info();
+    }
+
+    if (ca_s_cpu_info.counter[CA_CPU_FORKS].rate >= 0) {
+        ca_snprintf(fork_rate, sizeof(fork_rate), "%.1f%Z",
+                    ca_s_cpu_info.counter[CA_CPU_FORKS].rate);
+
+    } else {
+        fork_rate[0] = '\0';
+    }
+
+    ca_s_cpu_info.counter[CA_CPU_FORKS].rate = -1;
+
+    return fork_rate;
+}
+
+
+u_char *
+ca_get_softirq_rate(time_t now, time_t freq)
+{
+    static u_char  softirq_rate[24];
+
+    if (ca_s_cpu_info.updated + freq <= now) {
+        ca_get_cpu_info();
+    }
+
+    if (ca_s_cpu_info.counter[CA_CPU_SOFTIRQ].rate >= 0) {
+        ca_snprintf(softirq_rate, sizeof(softirq_rate), "%.1f%Z",
+                    ca_s_cpu_info.counter[CA_CPU_SOFTIRQ].rate);
+
+    } else {
+        softirq_rate[0] = '\0';
+    }
+
+    ca_s_cpu_info.counter[CA_CPU_SOFTIRQ].rate = -1;
+
+    return softirq_rate;
+}
@@ -8,6 +8,10 @@ u_char *ca_get_cpu_io(time_t now, time_t freq);
 u_char *ca_get_cpu_idle(time_t now, time_t freq);
 u_char *ca_get_procs_running(time_t now, time_t freq);
 u_char *ca_get_procs_blocked(time_t now, time_t freq);
+u_char *ca_get_ctxt_rate(time_t now, time_t freq);
+u_char *ca_get_intr_rate(time_t now, time_t freq);
+u_char *ca_get_fork_rate(time_t now, time_t freq);
+u_char *ca_get_softirq_rate(time_t now, time_t freq);
 
 
 #endif /* __CA_CPU_H_INCLUDED__ */
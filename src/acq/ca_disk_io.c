@@ -18,6 +18,7 @@ typedef struct ca_disk_io_s {
     int64_t  wuse;
     int64_t  use;
     int64_t  aveq;
+    double   util;                      /* -1 before the second read */
 } ca_disk_io_t;
 
 
@@ -93,10 +94,13 @@ ca_get_disk_io_info(void)
             continue;
         }
 
-        if (ca_get_disk_index(fields[3]) < 0) {
+        if (ca_get_disk_index(fields[3]) < 0
+            && ca_s_disk_io_info.disk_num < MAX_PARTITION_NUM)
+        {
             strncpy(ca_s_disk_io_info.disk_io[ca_s_disk_io_info.disk_num].name,
                     fields[3], MAX_NAME_LENGTH);
             ca_s_disk_io_info.disk_io[ca_s_disk_io_info.disk_num].rio = -1;
+            ca_s_disk_io_info.disk_io[ca_s_disk_io_info.disk_num].util = -1.0;
             ca_s_disk_io_info.disk_num++;
         }
     }
@@ -108,6 +112,14 @@ ca_get_disk_io_info(void)
         return;
     }
 
+    /* a disk no longer in diskstats has no util, not the last one */
+
+    if (diff_time > 0) {
+        for (index = 0; index < ca_s_disk_io_info.disk_num; index++) {
+            ca_s_disk_io_info.disk_io[index].util = -1.0;
+        }
+    }
+
     while (fgets(buf, sizeof(buf), fh) != NULL) {
         numfields = ca_strsplit(buf, fields, 14);
         if (numfields < 14) {
@@ -133,6 +145,7 @@ ca_get_disk_io_info(void)
         if (ca_s_disk_io_info.disk_io[index].rio >= 0 && diff_time > 0) {
             util = (use - ca_s_disk_io_info.disk_io[index].use) * 100.0 
                    / (diff_time * 1000);
+            ca_s_disk_io_info.disk_io[index].util = util;
             if (util > ca_s_disk_io_info.disk_io_util_max) {
                 ca_s_disk_io_info.disk_io_util_max = util;
             }
@@ -177,3 +190,39 @@ ca_get_disk_io_util_max(time_t now, time_t freq)
 
     return disk_io_util_max;
 }
+
+
+/* the util of every disk, or of those whose name starts with the key */
+void
+ca_get_disk_io_util(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_multi_t *m)
+{
+    int              i;
+    ca_disk_io_t    *disk;
+    ca_acq_value_t  *v;
+
+    if (ca_s_last_time + freq <= now) {
+        ca_get_disk_io_info();
+    }
+
+    for (i = 0; i < ca_s_disk_io_info.disk_num; i++) {
+        disk = &ca_s_disk_io_info.disk_io[i];
+
+        if (disk->util < 0) {
+            continue;
+        }
+
+        if (key != NULL
+            && ca_strncmp(disk->name, key->data, key->len) != 0)
+        {
+            continue;
+        }
+
+        v = ca_acq_multi_add(m, "disk=%s", disk->name);
+        if (v == NULL) {
+            return;
+        }
+
+        ca_acq_value_double(v, disk->util, 2, "%");
+    }
+}
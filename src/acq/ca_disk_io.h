@@ -3,6 +3,8 @@
 
 
 u_char *ca_get_disk_io_util_max(time_t now, time_t freq);
+void ca_get_disk_io_util(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_multi_t *m);
 
 
 #endif /* __CA_DISK_IO_H_INCLUDED__ */
@@ -1,49 +1,153 @@
 #include "../clagent.h"
+#include "../ca_threadpool.h"
 #include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include <sys/statvfs.h>
 
 
-#define MAX_PARTITION_NUM          50
-#define MAX_PATTITION_NAME_LENGTH  50
+#define MAX_FS_TYPE_NUM            64
+#define MAX_FS_TYPE_LENGTH         32
+#define CA_MOUNTINFO_BUF_SIZE      16384
+#define CA_STATVFS_TIMEOUT         2000     /* ms */
+#define CA_STATVFS_THREADS         4
 
 
-typedef struct ca_partition_info_s {
-    char  name[MAX_PATTITION_NAME_LENGTH];
-    int   urate;
-} ca_partition_info_t;
+typedef struct ca_mount_s {
+    char       *path;
+    ca_uint_t   refs;          /* list + in-flight statvfs() */
+    ca_uint_t   gen;           /* tick generation it was dispatched in */
+    int         urate;         /* written by the helper thread */
+    int         inode_urate;
+    int         last_urate;    /* published to the items, acq thread only */
+    int         last_inode_urate;
+    unsigned    busy:1;
+    unsigned    done:1;
+} ca_mount_t;
 
 
 typedef struct ca_disk_urate_info_s {
-    char                 fs_type[MAX_PARTITION_NUM][MAX_PATTITION_NAME_LENGTH];
-    int                  fs_type_num;
-    ca_partition_info_t  partition_info[MAX_PARTITION_NUM];
-    int                  partition_num;
-    int                  partition_max_urate;
-    time_t               updated;
+    char              fs_type[MAX_FS_TYPE_NUM][MAX_FS_TYPE_LENGTH];
+    int               fs_type_num;
+    ca_array_t       *mounts;           /* ca_mount_t * */
+    int               mountinfo_fd;
+    u_char           *buf;
+    size_t            buf_size;
+    ca_threadpool_t  *pool;
+    ca_uint_t         threads;
+    ca_uint_t         timeout;
+    ca_uint_t         gen;
+    ca_uint_t         pending;
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;
+    int               partition_max_urate;
+    int               partition_max_inode_urate;
+    time_t            updated;
 } ca_disk_urate_info_t;
 
 
-static ca_disk_urate_info_t  ca_s_disk_urate_info = { 
-    .fs_type_num         = 0,
-    .partition_num       = 0,
-    .partition_max_urate = -1,
-    .updated             = 0,
+static ca_disk_urate_info_t  ca_s_disk_urate_info = {
+    .fs_type_num               = 0,
+    .mounts                    = NULL,
+    .mountinfo_fd              = CA_INVALID_FILE,
+    .buf                       = NULL,
+    .buf_size                  = 0,
+    .pool                      = NULL,
+    .threads                   = CA_STATVFS_THREADS,
+    .timeout                   = CA_STATVFS_TIMEOUT,
+    .gen                       = 0,
+    .pending                   = 0,
+    .mutex                     = PTHREAD_MUTEX_INITIALIZER,
+    .cond                      = PTHREAD_COND_INITIALIZER,
+    .partition_max_urate       = -1,
+    .partition_max_inode_urate = -1,
+    .updated                   = 0,
 };
 
 
 static const char *black_fs_type[] = { "iso9660" };
 
 
+/* must be called with ca_s_disk_urate_info.mutex held */
 static void
-ca_get_disk_urate_info(void)
+ca_mount_release_locked(ca_mount_t *m)
 {
-    int              i, n;
-    char             buf[1024];
-    char            *fields[6];
-    int              numfields;
-    const char      *fs_type = NULL;
-    FILE            *fh;
-    struct statvfs   fs_stat;
+    if (--m->refs == 0) {
+        ca_free(m->path);
+        ca_free(m);
+    }
+}
+
+
+static void
+ca_mount_release(ca_mount_t *m)
+{
+    pthread_mutex_lock(&ca_s_disk_urate_info.mutex);
+    ca_mount_release_locked(m);
+    pthread_mutex_unlock(&ca_s_disk_urate_info.mutex);
+}
+
+
+static ca_mount_t *
+ca_mount_create(const char *path)
+{
+    ca_mount_t  *m;
+
+    m = ca_calloc(1, sizeof(ca_mount_t));
+    if (m == NULL) {
+        return NULL;
+    }
+
+    m->path = ca_strdup(path);
+    if (m->path == NULL) {
+        ca_free(m);
+        return NULL;
+    }
+
+    m->refs = 1;
+    m->urate = -1;
+    m->inode_urate = -1;
+    m->last_urate = -1;
+    m->last_inode_urate = -1;
+
+    return m;
+}
+
+
+static ca_mount_t *
+ca_mount_find(ca_array_t *mounts, const char *path, size_t len)
+{
+    ca_uint_t    i;
+    ca_mount_t  **mp;
+
+    if (mounts == NULL) {
+        return NULL;
+    }
+
+    mp = mounts->elem;
+
+    for (i = 0; i < mounts->nelem; i++) {
+        if (mp[i] != NULL
+            && ca_strncmp(mp[i]->path, path, len) == 0
+            && mp[i]->path[len] == '\0')
+        {
+            return mp[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ca_get_fs_types(void)
+{
+    int          n;
+    char         buf[1024];
+    const char  *fs_type;
+    FILE        *fh;
 
     fh = fopen("/proc/filesystems", "r");
     if (fh == NULL) {
@@ -51,89 +155,443 @@ ca_get_disk_urate_info(void)
     }
 
     ca_s_disk_urate_info.fs_type_num = 0;
-    while (fgets(buf, sizeof(buf), fh) != NULL) {
+    while (fgets(buf, sizeof(buf), fh) != NULL
+           && ca_s_disk_urate_info.fs_type_num < MAX_FS_TYPE_NUM - 2)
+    {
         if (strncasecmp(buf, "nodev", 5) == 0) {
             continue;
         }
 
         fs_type = ca_trim(buf);
-        if (ca_in_array(fs_type, black_fs_type, 
+        if (ca_in_array(fs_type, black_fs_type,
                         sizeof(black_fs_type) / sizeof(black_fs_type[0])))
         {
             continue;
         }
 
         n = ca_s_disk_urate_info.fs_type_num++;
-        strncpy(ca_s_disk_urate_info.fs_type[n], fs_type,
-                MAX_PATTITION_NAME_LENGTH);
+        ca_cpystrn((u_char *) ca_s_disk_urate_info.fs_type[n],
+                   (u_char *) fs_type, MAX_FS_TYPE_LENGTH);
     }
 
     n = ca_s_disk_urate_info.fs_type_num++;
-    strncpy(ca_s_disk_urate_info.fs_type[n], "nfs", MAX_PATTITION_NAME_LENGTH);
+    ca_cpystrn((u_char *) ca_s_disk_urate_info.fs_type[n], (u_char *) "nfs",
+               MAX_FS_TYPE_LENGTH);
     n = ca_s_disk_urate_info.fs_type_num++;
-    strncpy(ca_s_disk_urate_info.fs_type[n], "nfs4", MAX_PATTITION_NAME_LENGTH);
+    ca_cpystrn((u_char *) ca_s_disk_urate_info.fs_type[n], (u_char *) "nfs4",
+               MAX_FS_TYPE_LENGTH);
     fclose(fh);
+}
+
+
+static ca_int_t
+ca_fs_type_valid(const char *type)
+{
+    int  i;
+
+    for (i = 0; i < ca_s_disk_urate_info.fs_type_num; i++) {
+        if (strcmp(type, ca_s_disk_urate_info.fs_type[i]) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Decode the octal escapes (\040 and friends) the kernel uses for
+ * whitespace and backslashes in /proc/self/mountinfo, in place.
+ */
+static void
+ca_mountinfo_unescape(char *s)
+{
+    char  *d;
+
+    for (d = s; *s; d++) {
+        if (s[0] == '\\'
+            && s[1] >= '0' && s[1] <= '3'
+            && s[2] >= '0' && s[2] <= '7'
+            && s[3] >= '0' && s[3] <= '7')
+        {
+            *d = (char) ((s[1] - '0') << 6 | (s[2] - '0') << 3 | (s[3] - '0'));
+            s += 4;
+
+        } else {
+            *d = *s++;
+        }
+    }
+
+    *d = '\0';
+}
+
 
-    if (ca_s_disk_urate_info.fs_type_num == 0) {
+static ssize_t
+ca_mountinfo_read(void)
+{
+    u_char   *tmp;
+    size_t    len;
+    ssize_t   n;
+
+    if (ca_s_disk_urate_info.buf == NULL) {
+        ca_s_disk_urate_info.buf = ca_alloc(CA_MOUNTINFO_BUF_SIZE);
+        if (ca_s_disk_urate_info.buf == NULL) {
+            return CA_ERROR;
+        }
+        ca_s_disk_urate_info.buf_size = CA_MOUNTINFO_BUF_SIZE;
+    }
+
+    if (lseek(ca_s_disk_urate_info.mountinfo_fd, 0, SEEK_SET) == -1) {
+        return CA_ERROR;
+    }
+
+    len = 0;
+
+    for ( ;; ) {
+        if (len + 1 >= ca_s_disk_urate_info.buf_size) {
+            tmp = ca_realloc(ca_s_disk_urate_info.buf,
+                             2 * ca_s_disk_urate_info.buf_size);
+            if (tmp == NULL) {
+                return CA_ERROR;
+            }
+            ca_s_disk_urate_info.buf = tmp;
+            ca_s_disk_urate_info.buf_size *= 2;
+        }
+
+        n = read(ca_s_disk_urate_info.mountinfo_fd,
+                 ca_s_disk_urate_info.buf + len,
+                 ca_s_disk_urate_info.buf_size - len - 1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return CA_ERROR;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        len += n;
+    }
+
+    ca_s_disk_urate_info.buf[len] = '\0';
+
+    return len;
+}
+
+
+/*
+ * Rebuild the mount list from /proc/self/mountinfo.  Mounts which are
+ * still present keep their ca_mount_t, so a statvfs() that is hung on
+ * one of them is never issued twice.
+ */
+static void
+ca_rebuild_mounts(void)
+{
+    int           numfields;
+    char         *line, *next, *sep, *fields[6], *tail[3];
+    ca_uint_t     i;
+    ca_array_t   *mounts;
+    ca_mount_t   *m, **mp;
+
+    if (ca_mountinfo_read() == CA_ERROR) {
+        ca_log_err(errno, "read /proc/self/mountinfo failed");
         return;
     }
-    
-    ca_s_disk_urate_info.partition_num = 0;
-    fh = fopen("/etc/mtab", "r");
-    if (fh == NULL) {
+
+    ca_get_fs_types();
+
+    mounts = ca_array_create(16, sizeof(ca_mount_t *));
+    if (mounts == NULL) {
         return;
     }
 
-    while (fgets(buf, sizeof(buf), fh) != NULL) {
-        if (strncasecmp(buf, "none", 4) == 0) {
+    for (line = (char *) ca_s_disk_urate_info.buf; *line; line = next) {
+        next = strchr(line, '\n');
+        if (next == NULL) {
+            next = line + strlen(line);
+        } else {
+            *next++ = '\0';
+        }
+
+        /*
+         * 36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw
+         */
+
+        sep = strstr(line, " - ");
+        if (sep == NULL) {
+            continue;
+        }
+        *sep = '\0';
+
+        if (ca_strsplit(sep + 3, tail, 3) < 2
+            || strcmp(tail[1], "none") == 0
+            || !ca_fs_type_valid(tail[0]))
+        {
+            continue;
+        }
+
+        numfields = ca_strsplit(line, fields, 6);
+        if (numfields < 5) {
             continue;
         }
 
-        numfields = ca_strsplit(buf, fields, 6);
-        if (numfields < 3) {
+        ca_mountinfo_unescape(fields[4]);
+
+        if (ca_mount_find(mounts, fields[4], strlen(fields[4])) != NULL) {
             continue;
         }
 
-        for (i = 0; i < ca_s_disk_urate_info.fs_type_num; i++) {
-            if (strcmp(fields[2], ca_s_disk_urate_info.fs_type[i]) == 0) {
-                n = ca_s_disk_urate_info.partition_num++;
-                strncpy(ca_s_disk_urate_info.partition_info[n].name, fields[1],
-                        MAX_PATTITION_NAME_LENGTH);
+        m = ca_mount_find(ca_s_disk_urate_info.mounts, fields[4],
+                          strlen(fields[4]));
+        if (m != NULL) {
+            pthread_mutex_lock(&ca_s_disk_urate_info.mutex);
+            m->refs++;
+            pthread_mutex_unlock(&ca_s_disk_urate_info.mutex);
+
+        } else {
+            m = ca_mount_create(fields[4]);
+            if (m == NULL) {
+                continue;
             }
         }
+
+        mp = ca_array_push(mounts);
+        if (mp == NULL) {
+            ca_mount_release(m);
+            continue;
+        }
+
+        *mp = m;
     }
 
-    fclose(fh);
+    if (ca_s_disk_urate_info.mounts != NULL) {
+        mp = ca_s_disk_urate_info.mounts->elem;
+        for (i = 0; i < ca_s_disk_urate_info.mounts->nelem; i++) {
+            ca_mount_release(mp[i]);
+        }
+        ca_array_destroy(ca_s_disk_urate_info.mounts);
+    }
+
+    ca_s_disk_urate_info.mounts = mounts;
+
+    ca_log_debug(0, "mount list rebuilt, %ud partitions", mounts->nelem);
+}
+
+
+/*
+ * The kernel flags /proc/self/mountinfo with POLLPRI|POLLERR whenever
+ * the mount table of our namespace changes.
+ */
+static ca_int_t
+ca_mounts_changed(void)
+{
+    struct pollfd  pfd;
+
+    if (ca_s_disk_urate_info.mountinfo_fd == CA_INVALID_FILE) {
+        ca_s_disk_urate_info.mountinfo_fd = open("/proc/self/mountinfo",
+                                                 O_RDONLY|O_CLOEXEC);
+        if (ca_s_disk_urate_info.mountinfo_fd == CA_INVALID_FILE) {
+            ca_log_err(errno, "open /proc/self/mountinfo failed");
+            return 0;
+        }
+
+        return 1;
+    }
+
+    pfd.fd = ca_s_disk_urate_info.mountinfo_fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
 
-    if (ca_s_disk_urate_info.partition_num == 0) {
+    if (poll(&pfd, 1, 0) <= 0) {
+        return 0;
+    }
+
+    return (pfd.revents & (POLLPRI|POLLERR)) ? 1 : 0;
+}
+
+
+static void
+ca_statvfs_task(void *arg)
+{
+    ca_mount_t      *m = arg;
+    int              urate, inode_urate;
+    struct statvfs   fs_stat;
+
+    urate = -1;
+    inode_urate = -1;
+
+    if (statvfs(m->path, &fs_stat) == 0) {
+        if (fs_stat.f_blocks > 0) {
+            urate = ((fs_stat.f_blocks - fs_stat.f_bfree) * 100)
+                    / (fs_stat.f_blocks - fs_stat.f_bfree + fs_stat.f_bavail)
+                    + 1;
+        }
+
+        if (fs_stat.f_files > 0) {
+            inode_urate = ((fs_stat.f_files - fs_stat.f_ffree) * 100)
+                          / fs_stat.f_files;
+        }
+    }
+
+    pthread_mutex_lock(&ca_s_disk_urate_info.mutex);
+
+    m->urate = urate;
+    m->inode_urate = inode_urate;
+    m->busy = 0;
+    m->done = 1;
+
+    if (m->gen == ca_s_disk_urate_info.gen
+        && ca_s_disk_urate_info.pending > 0)
+    {
+        if (--ca_s_disk_urate_info.pending == 0) {
+            pthread_cond_signal(&ca_s_disk_urate_info.cond);
+        }
+    }
+
+    ca_mount_release_locked(m);
+
+    pthread_mutex_unlock(&ca_s_disk_urate_info.mutex);
+}
+
+
+static void
+ca_get_disk_urate_info(void)
+{
+    int              rc;
+    ca_uint_t        i;
+    ca_mount_t      *m, **mp;
+    struct timeval   tv;
+    struct timespec  ts;
+
+    if (ca_mounts_changed()) {
+        ca_rebuild_mounts();
+    }
+
+    if (ca_s_disk_urate_info.mounts == NULL
+        || ca_s_disk_urate_info.mounts->nelem == 0)
+    {
         return;
     }
-    
-    for (i = 0; i < ca_s_disk_urate_info.partition_num; i++) {
-        if (statvfs(ca_s_disk_urate_info.partition_info[i].name, &fs_stat) == 0
-            && fs_stat.f_blocks > 0)
+
+    if (ca_s_disk_urate_info.pool == NULL) {
+        ca_s_disk_urate_info.pool =
+                 ca_threadpool_create(1, ca_s_disk_urate_info.threads, 0);
+        if (ca_s_disk_urate_info.pool == NULL) {
+            return;
+        }
+    }
+
+    mp = ca_s_disk_urate_info.mounts->elem;
+
+    pthread_mutex_lock(&ca_s_disk_urate_info.mutex);
+
+    ca_s_disk_urate_info.gen++;
+    ca_s_disk_urate_info.pending = 0;
+
+    for (i = 0; i < ca_s_disk_urate_info.mounts->nelem; i++) {
+        m = mp[i];
+
+        if (m->busy) {
+            /* still stuck in a statvfs() from an earlier tick */
+            m->done = 0;
+            continue;
+        }
+
+        m->busy = 1;
+        m->done = 0;
+        m->gen = ca_s_disk_urate_info.gen;
+        m->refs++;
+
+        if (ca_threadpool_add_task(ca_s_disk_urate_info.pool,
+                                   ca_statvfs_task, m, 0)
+            != 0)
         {
-            ca_s_disk_urate_info.partition_info[i].urate = 
-                       ((fs_stat.f_blocks - fs_stat.f_bfree) * 100)
-                       / (fs_stat.f_blocks - fs_stat.f_bfree + fs_stat.f_bavail)
-                       + 1;
-
-            if (ca_s_disk_urate_info.partition_max_urate
-                < ca_s_disk_urate_info.partition_info[i].urate)
-            {
-                ca_s_disk_urate_info.partition_max_urate = 
-                                   ca_s_disk_urate_info.partition_info[i].urate;
-            }
+            m->busy = 0;
+            m->refs--;
+            continue;
+        }
+
+        ca_s_disk_urate_info.pending++;
+    }
+
+    gettimeofday(&tv, NULL);
+    ts.tv_sec = tv.tv_sec + ca_s_disk_urate_info.timeout / 1000;
+    ts.tv_nsec = tv.tv_usec * 1000
+                 + (ca_s_disk_urate_info.timeout % 1000) * 1000000;
+    if (ts.tv_nsec >= BILLION) {
+        ts.tv_sec++;
+        ts.tv_nsec -= BILLION;
+    }
+
+    while (ca_s_disk_urate_info.pending > 0) {
+        rc = pthread_cond_timedwait(&ca_s_disk_urate_info.cond,
+                                    &ca_s_disk_urate_info.mutex, &ts);
+        if (rc == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    if (ca_s_disk_urate_info.pending > 0) {
+        ca_log_warn(0, "statvfs() timed out on %uz partitions",
+                    ca_s_disk_urate_info.pending);
+        ca_s_disk_urate_info.pending = 0;
+    }
+
+    for (i = 0; i < ca_s_disk_urate_info.mounts->nelem; i++) {
+        m = mp[i];
+
+        if (m->done && m->gen == ca_s_disk_urate_info.gen) {
+            m->last_urate = m->urate;
+            m->last_inode_urate = m->inode_urate;
 
         } else {
-            ca_s_disk_urate_info.partition_info[i].urate = -1.0;
+            ca_log_debug(0, "partition \"%s\" is unknown", m->path);
+            m->last_urate = -1;
+            m->last_inode_urate = -1;
+        }
+
+        if (ca_s_disk_urate_info.partition_max_urate < m->last_urate) {
+            ca_s_disk_urate_info.partition_max_urate = m->last_urate;
+        }
+
+        if (ca_s_disk_urate_info.partition_max_inode_urate
+            < m->last_inode_urate)
+        {
+            ca_s_disk_urate_info.partition_max_inode_urate =
+                                                         m->last_inode_urate;
         }
     }
 
+    pthread_mutex_unlock(&ca_s_disk_urate_info.mutex);
+
     ca_s_disk_urate_info.updated = time(NULL);
 }
 
 
+ca_int_t
+ca_disk_urate_init(void *dummy)
+{
+    ca_conf_ctx_t  *conf = dummy;
+
+    if (conf->statvfs_timeout != CA_CONF_UNSET_UINT) {
+        ca_s_disk_urate_info.timeout = conf->statvfs_timeout;
+    }
+
+    if (conf->statvfs_threads != CA_CONF_UNSET_UINT) {
+        if (conf->statvfs_threads == 0) {
+            ca_log_emerg(0, "\"statvfs_threads\" must be greater than 0");
+            return CA_ERROR;
+        }
+
+        ca_s_disk_urate_info.threads = conf->statvfs_threads;
+    }
+
+    return CA_OK;
+}
+
+
 u_char *
 ca_get_partition_max_urate(time_t now, time_t freq)
 {
@@ -150,7 +608,78 @@ ca_get_partition_max_urate(time_t now, time_t freq)
         partition_max_urate[0] = '\0';
     }
 
-    ca_s_disk_urate_info.partition_max_urate = -1.0;
+    ca_s_disk_urate_info.partition_max_urate = -1;
 
     return partition_max_urate;
 }
+
+
+u_char *
+ca_get_partition_max_inode_urate(time_t now, time_t freq)
+{
+    static u_char  partition_max_inode_urate[10];
+
+    if (ca_s_disk_urate_info.updated + freq <= now) {
+        ca_get_disk_urate_info();
+    }
+
+    if (ca_s_disk_urate_info.partition_max_inode_urate >= 0) {
+        ca_snprintf(partition_max_inode_urate,
+                    sizeof(partition_max_inode_urate), "%d%Z",
+                    ca_s_disk_urate_info.partition_max_inode_urate);
+    } else {
+        partition_max_inode_urate[0] = '\0';
+    }
+
+    ca_s_disk_urate_info.partition_max_inode_urate = -1;
+
+    return partition_max_inode_urate;
+}
+
+
+u_char *
+ca_get_partition_urate(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  partition_urate[10];
+    ca_mount_t    *m;
+
+    if (ca_s_disk_urate_info.updated + freq <= now) {
+        ca_get_disk_urate_info();
+    }
+
+    m = ca_mount_find(ca_s_disk_urate_info.mounts, (char *) key->data,
+                      key->len);
+
+    if (m != NULL && m->last_urate >= 0) {
+        ca_snprintf(partition_urate, sizeof(partition_urate), "%d%Z",
+                    m->last_urate);
+    } else {
+        partition_urate[0] = '\0';
+    }
+
+    return partition_urate;
+}
+
+
+u_char *
+ca_get_partition_inode_urate(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  partition_inode_urate[10];
+    ca_mount_t    *m;
+
+    if (ca_s_disk_urate_info.updated + freq <= now) {
+        ca_get_disk_urate_info();
+    }
+
+    m = ca_mount_find(ca_s_disk_urate_info.mounts, (char *) key->data,
+                      key->len);
+
+    if (m != NULL && m->last_inode_urate >= 0) {
+        ca_snprintf(partition_inode_urate, sizeof(partition_inode_urate),
+                    "%d%Z", m->last_inode_urate);
+    } else {
+        partition_inode_urate[0] = '\0';
+    }
+
+    return partition_inode_urate;
+}
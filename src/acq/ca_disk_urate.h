@@ -2,7 +2,11 @@
 #define __CA_DISK_URATE_H_INCLUDED__
 
 
+ca_int_t ca_disk_urate_init(void *conf);
 u_char *ca_get_partition_max_urate(time_t now, time_t freq);
+u_char *ca_get_partition_max_inode_urate(time_t now, time_t freq);
+u_char *ca_get_partition_urate(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_partition_inode_urate(ca_str_t *key, time_t now, time_t freq);
 
 
 #endif /* __CA_DISK_URATE_H_INCLUDED__ */
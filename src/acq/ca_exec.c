@@ -0,0 +1,811 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+
+
+#define CA_EXEC_OUTPUT_SIZE     4096
+#define CA_EXEC_CONCURRENCY     4
+
+#define CA_EXEC_TIMEDOUT        -1
+#define CA_EXEC_FAILED          -2
+
+
+extern char **environ;
+
+
+/*
+ * The acq process asks the runner for a command by its index and gets
+ * back its exit status and output, a datagram each.
+ */
+typedef struct {
+    uint32_t   index;
+    int32_t    status;        /* exit code, CA_EXEC_TIMEDOUT, CA_EXEC_FAILED */
+} ca_exec_hdr_t;
+
+
+typedef struct {
+    ca_exec_hdr_t  hdr;
+    u_char         output[CA_EXEC_OUTPUT_SIZE];
+} ca_exec_msg_t;
+
+
+/* a command running in the runner */
+typedef struct {
+    pid_t          pid;                       /* 0 if the slot is free */
+    int            fd;                        /* its stdout, -1 on eof */
+    uint64_t       deadline;                  /* us */
+    size_t         len;
+    unsigned       exited:1;
+    unsigned       replied:1;
+    ca_exec_msg_t  msg;
+} ca_exec_job_t;
+
+
+typedef struct {
+    ca_exec_command_t  *cmd;
+    ca_exec_hdr_t       hdr;                  /* of the last result */
+    u_char             *output;               /* NUL terminated */
+    time_t              collected;
+    unsigned            running:1;
+    unsigned            valid:1;
+    ca_array_t         *waiting;              /* ca_str_t *, for the result */
+    ca_array_t         *ready;                /* ca_str_t *, not reported */
+} ca_exec_result_t;
+
+
+typedef struct {
+    ca_exec_result_t   *results;
+    ca_uint_t           nresults;
+    ca_uint_t           concurrency;
+    int                 fd;
+    pid_t               pid;
+    ca_acq_event_t      event;
+    ca_exec_msg_t       msg;
+} ca_exec_info_t;
+
+
+static ca_exec_info_t  ca_s_exec_info = {
+    .fd          = CA_INVALID_FILE,
+    .concurrency = CA_EXEC_CONCURRENCY,
+};
+
+
+char *
+ca_conf_exec_command(ca_conf_t *cf, ca_command_t *cmd, void *conf)
+{
+    ca_conf_ctx_t      *ctx = conf;
+    ca_int_t            timeout, ttl;
+    ca_str_t           *value;
+    ca_uint_t           i;
+    ca_exec_command_t  *command;
+
+    value = cf->args->elem;
+
+    timeout = ca_parse_time(&value[2], 0);
+    if (timeout == CA_ERROR || timeout == 0) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0, "invalid timeout \"%V\"",
+                          &value[2]);
+        return CA_CONF_ERROR;
+    }
+
+    ttl = ca_parse_time(&value[3], 1);
+    if (ttl == CA_ERROR) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0, "invalid ttl \"%V\"",
+                          &value[3]);
+        return CA_CONF_ERROR;
+    }
+
+    if (ctx->exec_commands == NULL) {
+        ctx->exec_commands = ca_array_create(4, sizeof(ca_exec_command_t));
+        if (ctx->exec_commands == NULL) {
+            return CA_CONF_ERROR;
+        }
+    }
+
+    command = ctx->exec_commands->elem;
+
+    for (i = 0; i < ctx->exec_commands->nelem; i++) {
+        if (command[i].name.len == value[1].len
+            && ca_strncmp(command[i].name.data, value[1].data,
+                          value[1].len) == 0)
+        {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "duplicate exec command \"%V\"", &value[1]);
+            return CA_CONF_ERROR;
+        }
+    }
+
+    command = ca_array_push(ctx->exec_commands);
+    if (command == NULL) {
+        return CA_CONF_ERROR;
+    }
+
+    command->name = value[1];
+    command->timeout = timeout;
+    command->ttl = ttl;
+    command->command = (char *) value[4].data;
+
+    return CA_CONF_OK;
+}
+
+
+static void
+ca_exec_reply(int fd, ca_exec_job_t *job, int32_t status)
+{
+    job->msg.hdr.status = status;
+    job->replied = 1;
+
+    if (send(fd, &job->msg, sizeof(ca_exec_hdr_t) + job->len, 0) < 0) {
+        ca_log_err(errno, "exec reply failed");
+    }
+}
+
+
+static ca_int_t
+ca_exec_spawn(ca_exec_job_t *job, ca_exec_command_t *cmd)
+{
+    int                         rc, fds[2];
+    char                       *argv[4];
+    sigset_t                    set;
+    posix_spawnattr_t           attr;
+    posix_spawn_file_actions_t  actions;
+
+    /* the runner is single threaded, nothing can be spawned in between */
+
+    if (pipe(fds) == -1) {
+        ca_log_err(errno, "pipe() failed");
+        return CA_ERROR;
+    }
+
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+
+    /* a group of its own to be killed with its children on a timeout */
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP
+                                    |POSIX_SPAWN_SETSIGMASK
+                                    |POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    sigemptyset(&set);
+    posix_spawnattr_setsigmask(&attr, &set);
+
+    sigfillset(&set);
+    posix_spawnattr_setsigdefault(&attr, &set);
+
+    argv[0] = "sh";
+    argv[1] = "-c";
+    argv[2] = cmd->command;
+    argv[3] = NULL;
+
+    rc = posix_spawn(&job->pid, "/bin/sh", &actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(fds[1]);
+
+    if (rc != 0) {
+        ca_log_err(rc, "posix_spawn(\"%s\") failed", cmd->command);
+        close(fds[0]);
+        job->pid = 0;
+        return CA_ERROR;
+    }
+
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+    job->fd = fds[0];
+    job->deadline = ca_time_us() + (uint64_t) cmd->timeout * 1000;
+    job->len = 0;
+    job->exited = 0;
+    job->replied = 0;
+
+    return CA_OK;
+}
+
+
+static void
+ca_exec_job_read(ca_exec_job_t *job)
+{
+    u_char   discard[512];
+    ssize_t  n;
+
+    for ( ;; ) {
+        if (job->len < CA_EXEC_OUTPUT_SIZE) {
+            n = read(job->fd, job->msg.output + job->len,
+                     CA_EXEC_OUTPUT_SIZE - job->len);
+
+        } else {
+            /* the rest of a long output is dropped */
+            n = read(job->fd, discard, sizeof(discard));
+        }
+
+        if (n > 0) {
+            if (job->len < CA_EXEC_OUTPUT_SIZE) {
+                job->len += n;
+            }
+
+            continue;
+        }
+
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+
+        close(job->fd);
+        job->fd = CA_INVALID_FILE;
+        return;
+    }
+}
+
+
+/*
+ * The runner is forked before the acq threads are started, so that the
+ * commands are spawned from a small single threaded process, and a slow
+ * one holds a runner slot instead of the acq thread.
+ */
+static void
+ca_exec_runner(int fd, ca_exec_command_t *cmds, ca_uint_t ncmds,
+    ca_uint_t concurrency)
+{
+    int                       n, sfd, timeout, status;
+    pid_t                     pid;
+    uint32_t                  index, *queue;
+    uint64_t                  now_us, deadline;
+    sigset_t                  set;
+    ca_uint_t                 i, j, head, nqueued, njobs;
+    ca_exec_job_t            *jobs, *job;
+    struct pollfd            *pfds;
+    struct signalfd_siginfo   si;
+
+    ca_set_title(EXEC_PROCESS_NAME);
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+
+    sfd = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC);
+    jobs = ca_calloc(concurrency, sizeof(ca_exec_job_t));
+    pfds = ca_calloc(concurrency + 2, sizeof(struct pollfd));
+    queue = ca_calloc(ncmds, sizeof(uint32_t));
+
+    if (sfd == -1 || jobs == NULL || pfds == NULL || queue == NULL) {
+        ca_log_crit(errno, "exec runner init failed");
+        exit(1);
+    }
+
+    head = 0;
+    nqueued = 0;
+
+    for ( ;; ) {
+
+        /* start what is queued as long as there are free slots */
+
+        for (i = 0; i < concurrency && nqueued; i++) {
+            if (jobs[i].pid != 0) {
+                continue;
+            }
+
+            index = queue[head];
+            head = (head + 1) % ncmds;
+            nqueued--;
+
+            jobs[i].msg.hdr.index = index;
+
+            if (ca_exec_spawn(&jobs[i], &cmds[index]) != CA_OK) {
+                jobs[i].len = 0;
+                ca_exec_reply(fd, &jobs[i], CA_EXEC_FAILED);
+            }
+        }
+
+        pfds[0].fd = fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = sfd;
+        pfds[1].events = POLLIN;
+        njobs = 2;
+
+        deadline = 0;
+
+        for (i = 0; i < concurrency; i++) {
+            job = &jobs[i];
+
+            if (job->pid == 0) {
+                continue;
+            }
+
+            if (job->fd != CA_INVALID_FILE) {
+                pfds[njobs].fd = job->fd;
+                pfds[njobs].events = POLLIN;
+                njobs++;
+            }
+
+            if (!job->replied && (deadline == 0 || job->deadline < deadline)) {
+                deadline = job->deadline;
+            }
+        }
+
+        timeout = -1;
+
+        if (deadline) {
+            now_us = ca_time_us();
+            timeout = deadline > now_us ? (deadline - now_us + 999) / 1000 : 0;
+        }
+
+        n = poll(pfds, njobs, timeout);
+        if (n == -1 && errno != EINTR) {
+            ca_log_crit(errno, "exec runner poll() failed");
+            break;
+        }
+
+        if (pfds[0].revents & (POLLIN|POLLHUP|POLLERR)) {
+            for ( ;; ) {
+                n = recv(fd, &index, sizeof(uint32_t), MSG_DONTWAIT);
+
+                if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+                {
+                    /* the acq process is gone */
+                    goto done;
+                }
+
+                if (n != sizeof(uint32_t)) {
+                    break;
+                }
+
+                if (index >= ncmds || nqueued == ncmds) {
+                    continue;
+                }
+
+                queue[(head + nqueued) % ncmds] = index;
+                nqueued++;
+            }
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            while (read(sfd, &si, sizeof(si)) > 0) {
+                /* void */
+            }
+
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                for (i = 0; i < concurrency; i++) {
+                    if (jobs[i].pid == pid) {
+                        jobs[i].exited = 1;
+                        jobs[i].msg.hdr.status = WIFEXITED(status)
+                                                 ? WEXITSTATUS(status)
+                                                 : CA_EXEC_FAILED;
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (i = 2; i < njobs; i++) {
+            if (pfds[i].revents == 0) {
+                continue;
+            }
+
+            for (j = 0; j < concurrency; j++) {
+                if (jobs[j].pid != 0 && jobs[j].fd == pfds[i].fd) {
+                    ca_exec_job_read(&jobs[j]);
+                    break;
+                }
+            }
+        }
+
+        now_us = ca_time_us();
+
+        for (i = 0; i < concurrency; i++) {
+            job = &jobs[i];
+
+            if (job->pid == 0) {
+                continue;
+            }
+
+            if (!job->replied && job->deadline <= now_us) {
+
+                /*
+                 * Kill the group, or if it has exited, stop waiting for
+                 * what it left behind holding its stdout.
+                 */
+
+                if (!job->exited) {
+                    ca_log_warn(0, "exec command \"%V\" timed out, killed",
+                                &cmds[job->msg.hdr.index].name);
+                    kill(-job->pid, SIGKILL);
+                }
+
+                if (job->fd != CA_INVALID_FILE) {
+                    close(job->fd);
+                    job->fd = CA_INVALID_FILE;
+                }
+
+                ca_exec_reply(fd, job, job->exited ? job->msg.hdr.status
+                                                   : CA_EXEC_TIMEDOUT);
+            }
+
+            if (!job->exited || job->fd != CA_INVALID_FILE) {
+                continue;
+            }
+
+            if (!job->replied) {
+                ca_exec_reply(fd, job, job->msg.hdr.status);
+            }
+
+            job->pid = 0;
+        }
+    }
+
+done:
+
+    for (i = 0; i < concurrency; i++) {
+        if (jobs[i].pid != 0 && !jobs[i].exited) {
+            kill(-jobs[i].pid, SIGKILL);
+        }
+    }
+
+    exit(0);
+}
+
+
+static void
+ca_exec_reply_handler(ca_acq_event_t *ev)
+{
+    ssize_t            n;
+    ca_str_t         **keys, **kp;
+    ca_uint_t          i;
+    ca_exec_result_t  *r;
+
+    for ( ;; ) {
+        n = recv(ev->fd, &ca_s_exec_info.msg, sizeof(ca_exec_msg_t),
+                 MSG_DONTWAIT);
+
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+
+        if (n <= 0) {
+            ca_log_err(n ? errno : 0, "exec runner exited, exec items "
+                       "disabled");
+            close(ev->fd);
+            ev->fd = CA_INVALID_FILE;
+            ca_s_exec_info.fd = CA_INVALID_FILE;
+            waitpid(ca_s_exec_info.pid, NULL, WNOHANG);
+            return;
+        }
+
+        if ((size_t) n < sizeof(ca_exec_hdr_t)
+            || ca_s_exec_info.msg.hdr.index >= ca_s_exec_info.nresults)
+        {
+            continue;
+        }
+
+        r = &ca_s_exec_info.results[ca_s_exec_info.msg.hdr.index];
+
+        n -= sizeof(ca_exec_hdr_t);
+        ca_memcpy(r->output, ca_s_exec_info.msg.output, n);
+        r->output[n] = '\0';
+        r->hdr = ca_s_exec_info.msg.hdr;
+        r->collected = time(NULL);
+        r->running = 0;
+        r->valid = 1;
+
+        if (r->hdr.status == CA_EXEC_TIMEDOUT) {
+            /* logged by the runner */
+
+        } else if (r->hdr.status != 0) {
+            ca_log_warn(0, "exec command \"%V\" exited with %d",
+                        &r->cmd->name, r->hdr.status);
+        }
+
+        /* report the items waiting for it without waiting for the tick */
+
+        keys = r->waiting->elem;
+
+        for (i = 0; i < r->waiting->nelem; i++) {
+            kp = ca_array_push(r->ready);
+            if (kp == NULL) {
+                break;
+            }
+
+            *kp = keys[i];
+            ca_acq_expedite(&ca_get_exec, keys[i]);
+        }
+
+        r->waiting->nelem = 0;
+    }
+}
+
+
+ca_int_t
+ca_exec_init(void *dummy)
+{
+    ca_conf_ctx_t      *conf = dummy;
+    int                 fds[2];
+    pid_t               pid;
+    ca_uint_t           i;
+    ca_exec_command_t  *cmds;
+    ca_exec_result_t   *r;
+
+    if (conf->exec_commands == NULL) {
+        return CA_OK;
+    }
+
+    if (conf->exec_concurrency != CA_CONF_UNSET_UINT) {
+        if (conf->exec_concurrency == 0) {
+            ca_log_emerg(0, "exec_concurrency must not be 0");
+            return CA_ERROR;
+        }
+
+        ca_s_exec_info.concurrency = conf->exec_concurrency;
+    }
+
+    cmds = conf->exec_commands->elem;
+
+    ca_s_exec_info.nresults = conf->exec_commands->nelem;
+    ca_s_exec_info.results = ca_calloc(ca_s_exec_info.nresults,
+                                       sizeof(ca_exec_result_t));
+    if (ca_s_exec_info.results == NULL) {
+        return CA_ERROR;
+    }
+
+    for (i = 0; i < ca_s_exec_info.nresults; i++) {
+        r = &ca_s_exec_info.results[i];
+
+        r->cmd = &cmds[i];
+        r->output = ca_alloc(CA_EXEC_OUTPUT_SIZE + 1);
+        r->waiting = ca_array_create(2, sizeof(ca_str_t *));
+        r->ready = ca_array_create(2, sizeof(ca_str_t *));
+
+        if (r->output == NULL || r->waiting == NULL || r->ready == NULL) {
+            return CA_ERROR;
+        }
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) == -1) {
+        ca_log_err(errno, "socketpair() failed");
+        return CA_ERROR;
+    }
+
+    pid = fork();
+
+    switch (pid) {
+    case -1:
+        ca_log_err(errno, "fork() exec runner failed");
+        close(fds[0]);
+        close(fds[1]);
+        return CA_ERROR;
+
+    case 0:
+        ca_process = CA_PROCESS_EXEC;
+        close(fds[0]);
+        ca_exec_runner(fds[1], cmds, ca_s_exec_info.nresults,
+                       ca_s_exec_info.concurrency);
+        exit(0);
+
+    default:
+        break;
+    }
+
+    close(fds[1]);
+
+    ca_s_exec_info.fd = fds[0];
+    ca_s_exec_info.pid = pid;
+
+    ca_s_exec_info.event.fd = fds[0];
+    ca_s_exec_info.event.events = POLLIN;
+    ca_s_exec_info.event.handler = ca_exec_reply_handler;
+
+    ca_log_debug(0, "exec runner %d started, %ud commands",
+                 pid, ca_s_exec_info.nresults);
+
+    return ca_acq_add_event(&ca_s_exec_info.event);
+}
+
+
+/*
+ * The first line of the output, the value of a "name value" line, or,
+ * if the selector is a number, the n-th field of the first line.
+ */
+static u_char *
+ca_exec_select(u_char *output, u_char *sel, size_t len, u_char *buf,
+    size_t size)
+{
+    u_char     *p, *end;
+    ca_int_t    field;
+
+    p = output;
+
+    if (len == 0) {
+        end = p;
+
+    } else if (sel[0] >= '0' && sel[0] <= '9') {
+        field = ca_atoi(sel, len);
+        if (field <= 0) {
+            return buf;
+        }
+
+        for ( ;; ) {
+            while (*p == ' ' || *p == '\t') {
+                p++;
+            }
+
+            if (*p == '\0' || *p == '\n' || --field == 0) {
+                break;
+            }
+
+            while (*p && *p != ' ' && *p != '\t' && *p != '\n') {
+                p++;
+            }
+        }
+
+        end = p;
+
+        while (*end && *end != ' ' && *end != '\t' && *end != '\n') {
+            end++;
+        }
+
+        goto found;
+
+    } else {
+        for ( ;; ) {
+            while (*p == ' ' || *p == '\t') {
+                p++;
+            }
+
+            if (ca_strncmp(p, sel, len) == 0
+                && (p[len] == ' ' || p[len] == '\t' || p[len] == ':'
+                    || p[len] == '='))
+            {
+                p += len + 1;
+
+                while (*p == ' ' || *p == '\t') {
+                    p++;
+                }
+
+                break;
+            }
+
+            p = (u_char *) strchr((char *) p, '\n');
+            if (p == NULL) {
+                return buf;
+            }
+
+            p++;
+        }
+
+        end = p;
+    }
+
+    while (*end && *end != '\n') {
+        end++;
+    }
+
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+    {
+        end--;
+    }
+
+found:
+
+    if ((size_t) (end - p) >= size) {
+        end = p + size - 1;
+    }
+
+    *ca_cpymem(buf, p, end - p) = '\0';
+
+    return buf;
+}
+
+
+/*
+ * exec[<command>] or exec[<command>:<selector>].  A result younger than
+ * the ttl of the command is reused, otherwise the command is handed to
+ * the runner and the item reported when the result comes back.
+ */
+u_char *
+ca_get_exec(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char      exec[256];
+    u_char            *colon;
+    size_t             len;
+    uint32_t           index;
+    ca_str_t         **kp;
+    ca_uint_t          i, ttl, waiting;
+    ca_exec_result_t  *r;
+
+    exec[0] = '\0';
+
+    colon = ca_strlchr(key->data, key->data + key->len, ':');
+    len = colon ? (size_t) (colon - key->data) : key->len;
+
+    r = NULL;
+
+    for (i = 0; i < ca_s_exec_info.nresults; i++) {
+        if (ca_s_exec_info.results[i].cmd->name.len == len
+            && ca_strncmp(ca_s_exec_info.results[i].cmd->name.data,
+                          key->data, len) == 0)
+        {
+            r = &ca_s_exec_info.results[i];
+            break;
+        }
+    }
+
+    if (r == NULL) {
+        return exec;
+    }
+
+    /* expedited by the result it was waiting for */
+
+    kp = r->ready->elem;
+
+    for (i = 0; i < r->ready->nelem; i++) {
+        if (kp[i] == key) {
+            kp[i] = kp[--r->ready->nelem];
+            goto result;
+        }
+    }
+
+    ttl = r->cmd->ttl ? r->cmd->ttl : (ca_uint_t) freq;
+
+    if (r->valid && now - r->collected < (time_t) ttl) {
+        goto result;
+    }
+
+    if (ca_s_exec_info.fd == CA_INVALID_FILE) {
+        return exec;
+    }
+
+    if (!r->running) {
+        index = r - ca_s_exec_info.results;
+
+        if (send(ca_s_exec_info.fd, &index, sizeof(uint32_t), MSG_DONTWAIT)
+            < 0)
+        {
+            ca_log_err(errno, "exec request \"%V\" failed", &r->cmd->name);
+            return exec;
+        }
+
+        r->running = 1;
+    }
+
+    kp = r->waiting->elem;
+    waiting = 0;
+
+    for (i = 0; i < r->waiting->nelem; i++) {
+        if (kp[i] == key) {
+            waiting = 1;
+            break;
+        }
+    }
+
+    if (!waiting) {
+        kp = ca_array_push(r->waiting);
+        if (kp == NULL) {
+            return exec;
+        }
+
+        *kp = key;
+    }
+
+    return NULL;
+
+result:
+
+    if (r->hdr.status != 0) {
+        return exec;
+    }
+
+    return ca_exec_select(r->output, colon ? colon + 1 : NULL,
+                          colon ? key->data + key->len - colon - 1 : 0,
+                          exec, sizeof(exec));
+}
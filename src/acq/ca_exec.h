@@ -0,0 +1,19 @@
+#ifndef __CA_EXEC_H_INCLUDED__
+#define __CA_EXEC_H_INCLUDED__
+
+
+typedef struct {
+    ca_str_t    name;
+    ca_uint_t   timeout;        /* ms */
+    ca_uint_t   ttl;            /* s, a result is reused for as long */
+    char       *command;        /* run by /bin/sh -c */
+} ca_exec_command_t;
+
+
+char *ca_conf_exec_command(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+
+ca_int_t ca_exec_init(void *conf);
+u_char *ca_get_exec(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_EXEC_H_INCLUDED__ */
@@ -0,0 +1,748 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <regex.h>
+#include <unistd.h>
+
+
+#define CA_FILE_BUF_SIZE        4096
+#define CA_FILE_GLOB_INTERVAL   60            /* s */
+
+#define CA_FILE_RAW             0
+#define CA_FILE_RATE            1
+#define CA_FILE_DELTA           2
+
+#define CA_FILE_SEL_FIRST       0             /* the first number */
+#define CA_FILE_SEL_FIELD       1             /* <line>.<field> or <field> */
+#define CA_FILE_SEL_NAME        2             /* "name value", "name=value" */
+#define CA_FILE_SEL_REGEX       3             /* /regex/ */
+
+
+/* a file, shared by the items reading it */
+typedef struct {
+    char       *path;
+    int         fd;
+    ca_uint_t   refs;
+    u_char     *data;                         /* NUL terminated */
+    size_t      len;
+    size_t      size;
+    ca_uint_t   gen;                          /* bumped on a new content */
+    ca_uint_t   pass;                         /* the tick it was read on */
+    unsigned    valid:1;
+} ca_file_src_t;
+
+
+typedef struct {
+    ca_file_src_t  *src;
+    ca_uint_t       gen;                      /* of the value parsed */
+    double          value;
+    unsigned        parsed:1;
+    unsigned        valid:1;
+} ca_file_ref_t;
+
+
+typedef struct {
+    ca_str_t        key;
+    ca_uint_t       transform;
+    char           *path;
+    unsigned        glob:1;
+    ca_uint_t       sel;
+    ca_uint_t       line;
+    ca_uint_t       field;
+    char           *name;
+    size_t          name_len;
+    regex_t         re;
+    ca_file_ref_t  *refs;
+    ca_uint_t       nrefs;
+    time_t          freq;
+    time_t          collected;
+    time_t          globbed;
+    double          value;
+    double          result;
+    uint64_t        last_us;
+    unsigned        has_last:1;
+    unsigned        valid:1;
+} ca_file_item_t;
+
+
+typedef struct {
+    ca_array_t     *items;                    /* ca_file_item_t * */
+    ca_array_t     *srcs;                     /* ca_file_src_t * */
+    u_char         *buf;
+    size_t          size;
+    ca_uint_t       pass;
+} ca_file_info_t;
+
+
+static ca_file_info_t  ca_s_file_info;
+
+
+static ca_file_src_t *
+ca_file_src_get(char *path)
+{
+    ca_uint_t        i;
+    ca_file_src_t  **sp, *src;
+
+    sp = ca_s_file_info.srcs->elem;
+
+    for (i = 0; i < ca_s_file_info.srcs->nelem; i++) {
+        if (strcmp(sp[i]->path, path) == 0) {
+            sp[i]->refs++;
+            return sp[i];
+        }
+    }
+
+    src = ca_calloc(1, sizeof(ca_file_src_t));
+    if (src == NULL) {
+        return NULL;
+    }
+
+    src->path = ca_strdup(path);
+    if (src->path == NULL) {
+        ca_free(src);
+        return NULL;
+    }
+
+    sp = ca_array_push(ca_s_file_info.srcs);
+    if (sp == NULL) {
+        ca_free(src->path);
+        ca_free(src);
+        return NULL;
+    }
+
+    src->fd = CA_INVALID_FILE;
+    src->refs = 1;
+    *sp = src;
+
+    return src;
+}
+
+
+static void
+ca_file_src_put(ca_file_src_t *src)
+{
+    ca_uint_t        i;
+    ca_file_src_t  **sp;
+
+    if (--src->refs != 0) {
+        return;
+    }
+
+    sp = ca_s_file_info.srcs->elem;
+
+    for (i = 0; i < ca_s_file_info.srcs->nelem; i++) {
+        if (sp[i] == src) {
+            sp[i] = sp[--ca_s_file_info.srcs->nelem];
+            break;
+        }
+    }
+
+    if (src->fd != CA_INVALID_FILE) {
+        close(src->fd);
+    }
+
+    ca_free(src->data);
+    ca_free(src->path);
+    ca_free(src);
+}
+
+
+/*
+ * Read the file into the shared buffer and keep a copy only if it is
+ * not what was read last time, so that the items reading it parse it
+ * again only then.
+ */
+static void
+ca_file_src_read(ca_file_src_t *src)
+{
+    u_char   *buf;
+    ssize_t   n, len;
+
+    if (src->pass == ca_s_file_info.pass) {
+        return;
+    }
+
+    src->pass = ca_s_file_info.pass;
+
+    if (src->fd == CA_INVALID_FILE) {
+        src->fd = open(src->path, O_RDONLY|O_CLOEXEC);
+        if (src->fd == CA_INVALID_FILE) {
+            src->valid = 0;
+            return;
+        }
+    }
+
+    for ( ;; ) {
+        if (ca_s_file_info.buf == NULL) {
+            ca_s_file_info.size = ca_s_file_info.size
+                                  ? ca_s_file_info.size * 2 : CA_FILE_BUF_SIZE;
+
+            ca_s_file_info.buf = ca_alloc(ca_s_file_info.size);
+            if (ca_s_file_info.buf == NULL) {
+                ca_s_file_info.size = 0;
+                src->valid = 0;
+                return;
+            }
+        }
+
+        buf = ca_s_file_info.buf;
+
+        for (len = 0; len < (ssize_t) ca_s_file_info.size - 1; len += n) {
+            n = pread(src->fd, buf + len, ca_s_file_info.size - 1 - len, len);
+            if (n < 0) {
+                /* the device or the process is gone, try to reopen */
+                close(src->fd);
+                src->fd = CA_INVALID_FILE;
+                src->valid = 0;
+                return;
+            }
+
+            if (n == 0) {
+                break;
+            }
+        }
+
+        if (len < (ssize_t) ca_s_file_info.size - 1) {
+            break;
+        }
+
+        ca_free(ca_s_file_info.buf);
+        ca_s_file_info.buf = NULL;
+    }
+
+    if (src->valid && (size_t) len == src->len
+        && ca_memcmp(src->data, buf, len) == 0)
+    {
+        return;
+    }
+
+    if ((size_t) len + 1 > src->size) {
+        ca_free(src->data);
+
+        src->data = ca_alloc(len + 1);
+        if (src->data == NULL) {
+            src->size = 0;
+            src->valid = 0;
+            return;
+        }
+
+        src->size = len + 1;
+    }
+
+    ca_memcpy(src->data, buf, len);
+    src->data[len] = '\0';
+    src->len = len;
+    src->gen++;
+    src->valid = 1;
+}
+
+
+static char *
+ca_file_skip_fields(char *p, ca_uint_t n)
+{
+    for ( ;; ) {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        if (*p == '\0' || *p == '\n' || n == 0) {
+            return p;
+        }
+
+        while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\0') {
+            p++;
+        }
+
+        n--;
+    }
+}
+
+
+static ca_int_t
+ca_file_parse(ca_file_item_t *item, char *data, double *value)
+{
+    char        *p, *end;
+    ca_uint_t    i;
+    regmatch_t   m[2];
+
+    p = data;
+
+    switch (item->sel) {
+
+    case CA_FILE_SEL_FIRST:
+        while (*p && !((*p >= '0' && *p <= '9')
+                       || (*p == '-' && p[1] >= '0' && p[1] <= '9')))
+        {
+            p++;
+        }
+
+        break;
+
+    case CA_FILE_SEL_FIELD:
+        for (i = 1; i < item->line; i++) {
+            p = strchr(p, '\n');
+            if (p == NULL) {
+                return CA_ERROR;
+            }
+
+            p++;
+        }
+
+        p = ca_file_skip_fields(p, item->field - 1);
+        break;
+
+    case CA_FILE_SEL_NAME:
+
+        /* "name value", "name: value" or "name=value" anywhere */
+
+        for ( ;; ) {
+            p = strstr(p, item->name);
+            if (p == NULL) {
+                return CA_ERROR;
+            }
+
+            if ((p == data || p[-1] == ' ' || p[-1] == '\t' || p[-1] == '\n')
+                && (p[item->name_len] == ' ' || p[item->name_len] == '\t'
+                    || p[item->name_len] == ':' || p[item->name_len] == '='))
+            {
+                break;
+            }
+
+            p += item->name_len;
+        }
+
+        p += item->name_len;
+
+        if (*p == ':' || *p == '=') {
+            p++;
+        }
+
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        break;
+
+    default: /* CA_FILE_SEL_REGEX */
+        if (regexec(&item->re, data, 2, m, 0) != 0) {
+            return CA_ERROR;
+        }
+
+        p = data + (m[1].rm_so != -1 ? m[1].rm_so : m[0].rm_so);
+        break;
+    }
+
+    if (*p == '\0' || *p == '\n') {
+        return CA_ERROR;
+    }
+
+    *value = strtod(p, &end);
+
+    return end == p ? CA_ERROR : CA_OK;
+}
+
+
+/*
+ * Match the pattern again, keeping the values parsed of the files that
+ * are still there.
+ */
+static void
+ca_file_glob(ca_file_item_t *item, time_t now)
+{
+    size_t          i, j;
+    glob_t          g;
+    ca_uint_t       changed;
+    ca_file_ref_t  *refs;
+
+    item->globbed = now;
+
+    ca_memzero(&g, sizeof(glob_t));
+
+    if (glob(item->path, 0, NULL, &g) != 0) {
+        globfree(&g);
+        g.gl_pathc = 0;
+    }
+
+    refs = ca_calloc(g.gl_pathc ? g.gl_pathc : 1, sizeof(ca_file_ref_t));
+    if (refs == NULL) {
+        if (g.gl_pathc) {
+            globfree(&g);
+        }
+
+        return;
+    }
+
+    changed = (g.gl_pathc != item->nrefs);
+
+    for (i = 0, j = 0; i < g.gl_pathc; i++) {
+        refs[j].src = ca_file_src_get(g.gl_pathv[i]);
+        if (refs[j].src == NULL) {
+            changed = 1;
+            continue;
+        }
+
+        j++;
+    }
+
+    if (g.gl_pathc) {
+        globfree(&g);
+    }
+
+    /* both are sorted by path */
+
+    for (i = 0; i < j && i < item->nrefs; i++) {
+        if (refs[i].src != item->refs[i].src) {
+            changed = 1;
+            break;
+        }
+
+        refs[i] = item->refs[i];
+    }
+
+    for (i = 0; i < item->nrefs; i++) {
+        ca_file_src_put(item->refs[i].src);
+    }
+
+    ca_free(item->refs);
+
+    item->refs = refs;
+    item->nrefs = j;
+
+    if (changed) {
+        /* the sum is not of the same files any more */
+        item->has_last = 0;
+    }
+}
+
+
+static void
+ca_file_collect(ca_file_item_t *item, time_t now)
+{
+    double          value;
+    uint64_t        now_us;
+    ca_uint_t       i, valid;
+    ca_file_ref_t  *ref;
+
+    item->collected = now;
+    item->valid = 0;
+
+    if (item->glob && item->globbed + CA_FILE_GLOB_INTERVAL <= now) {
+        ca_file_glob(item, now);
+    }
+
+    value = 0;
+    valid = (item->nrefs != 0);
+
+    for (i = 0; i < item->nrefs; i++) {
+        ref = &item->refs[i];
+
+        ca_file_src_read(ref->src);
+
+        if (!ref->src->valid) {
+            valid = 0;
+            continue;
+        }
+
+        if (!ref->parsed || ref->gen != ref->src->gen) {
+            ref->valid = (ca_file_parse(item, (char *) ref->src->data,
+                                        &ref->value)
+                          == CA_OK);
+            ref->gen = ref->src->gen;
+            ref->parsed = 1;
+        }
+
+        if (!ref->valid) {
+            valid = 0;
+            continue;
+        }
+
+        value += ref->value;
+    }
+
+    if (!valid) {
+        item->has_last = 0;
+        return;
+    }
+
+    now_us = ca_time_us();
+
+    switch (item->transform) {
+
+    case CA_FILE_RAW:
+        item->result = value;
+        item->valid = 1;
+        break;
+
+    case CA_FILE_RATE:
+
+        /* a counter that went back, reset or wrapped, starts over */
+
+        if (item->has_last && now_us > item->last_us
+            && value >= item->value)
+        {
+            item->result = (value - item->value)
+                           / ((now_us - item->last_us) / 1000000.0);
+            item->valid = 1;
+        }
+
+        break;
+
+    default: /* CA_FILE_DELTA */
+        if (item->has_last) {
+            item->result = value - item->value;
+            item->valid = 1;
+        }
+
+        break;
+    }
+
+    item->value = value;
+    item->last_us = now_us;
+    item->has_last = 1;
+}
+
+
+/*
+ * <path>[,<selector>], the path may be a glob pattern, the values of
+ * all the files matched are summed up.  The selector is
+ *
+ *   <field> or <line>.<field>   1 based, fields separated by spaces
+ *   <name>                      "name value", "name: value", "name=value"
+ *   /<regex>/                   the first subexpression, or the match
+ *
+ * and without it the first number of the file is taken.
+ */
+static ca_file_item_t *
+ca_file_item_create(ca_str_t *key, ca_uint_t transform)
+{
+    char            *spec, *comma, *p, *end;
+    size_t           len;
+    ca_file_item_t  *item, **ip;
+
+    item = ca_calloc(1, sizeof(ca_file_item_t));
+    if (item == NULL) {
+        return NULL;
+    }
+
+    spec = (char *) key->data;
+
+    comma = strchr(spec, ',');
+    len = comma ? (size_t) (comma - spec) : key->len;
+
+    item->path = strndup(spec, len);
+    if (item->path == NULL) {
+        goto failed;
+    }
+
+    item->glob = (strpbrk(item->path, "*?[") != NULL);
+    item->key = *key;
+    item->transform = transform;
+    item->sel = CA_FILE_SEL_FIRST;
+
+    if (comma == NULL || comma[1] == '\0') {
+        goto selected;
+    }
+
+    p = comma + 1;
+    len = ca_strlen(p);
+
+    if (p[0] == '/' && len > 2 && p[len - 1] == '/') {
+        p = strndup(p + 1, len - 2);
+        if (p == NULL) {
+            goto failed;
+        }
+
+        if (regcomp(&item->re, p, REG_EXTENDED) != 0) {
+            ca_log_err(0, "invalid regex in \"%V\"", key);
+            ca_free(p);
+            goto failed;
+        }
+
+        ca_free(p);
+        item->sel = CA_FILE_SEL_REGEX;
+
+    } else if (p[0] >= '0' && p[0] <= '9') {
+        item->sel = CA_FILE_SEL_FIELD;
+        item->line = 1;
+        item->field = strtoul(p, &end, 10);
+
+        if (*end == '.') {
+            item->line = item->field;
+            item->field = strtoul(end + 1, &end, 10);
+        }
+
+        if (*end != '\0' || item->line == 0 || item->field == 0) {
+            ca_log_err(0, "invalid field in \"%V\"", key);
+            goto failed;
+        }
+
+    } else {
+        item->sel = CA_FILE_SEL_NAME;
+        item->name = p;
+        item->name_len = len;
+    }
+
+selected:
+
+    ip = ca_array_push(ca_s_file_info.items);
+    if (ip == NULL) {
+        goto failed;
+    }
+
+    *ip = item;
+
+    if (!item->glob) {
+        item->refs = ca_calloc(1, sizeof(ca_file_ref_t));
+        if (item->refs == NULL) {
+            ca_s_file_info.items->nelem--;
+            goto failed;
+        }
+
+        item->refs[0].src = ca_file_src_get(item->path);
+        if (item->refs[0].src == NULL) {
+            ca_s_file_info.items->nelem--;
+            ca_free(item->refs);
+            goto failed;
+        }
+
+        item->nrefs = 1;
+    }
+
+    return item;
+
+failed:
+
+    if (item->sel == CA_FILE_SEL_REGEX) {
+        regfree(&item->re);
+    }
+
+    ca_free(item->path);
+    ca_free(item);
+
+    return NULL;
+}
+
+
+static ca_file_item_t *
+ca_file_item(ca_str_t *key, ca_uint_t transform, time_t now, time_t freq)
+{
+    ca_uint_t         i;
+    ca_file_item_t  **ip, *item;
+
+    item = NULL;
+    ip = ca_s_file_info.items->elem;
+
+    for (i = 0; i < ca_s_file_info.items->nelem; i++) {
+        if (ip[i]->transform == transform && ip[i]->key.data == key->data) {
+            item = ip[i];
+            break;
+        }
+    }
+
+    if (item == NULL) {
+        item = ca_file_item_create(key, transform);
+        if (item == NULL) {
+            return NULL;
+        }
+    }
+
+    item->freq = freq;
+
+    /* not collected by the tick of this pass, the first time */
+
+    if (item->collected != now) {
+        ca_s_file_info.pass++;
+        ca_file_collect(item, now);
+    }
+
+    return item->valid ? item : NULL;
+}
+
+
+ca_int_t
+ca_file_value_init(void *dummy)
+{
+    ca_s_file_info.items = ca_array_create(8, sizeof(ca_file_item_t *));
+    ca_s_file_info.srcs = ca_array_create(8, sizeof(ca_file_src_t *));
+
+    if (ca_s_file_info.items == NULL || ca_s_file_info.srcs == NULL) {
+        return CA_ERROR;
+    }
+
+    return CA_OK;
+}
+
+
+/*
+ * Collect all the file items due on this pass together, a file read
+ * by several of them is read once.
+ */
+void
+ca_file_value_tick(time_t now)
+{
+    ca_uint_t         i;
+    ca_file_item_t  **ip;
+
+    ip = ca_s_file_info.items->elem;
+
+    ca_s_file_info.pass++;
+
+    for (i = 0; i < ca_s_file_info.items->nelem; i++) {
+        if (now - ip[i]->collected >= ip[i]->freq
+            || now < ip[i]->collected)
+        {
+            ca_file_collect(ip[i], now);
+        }
+    }
+}
+
+
+static u_char *
+ca_file_format(ca_file_item_t *item, u_char *buf, size_t size)
+{
+    if (item == NULL) {
+        buf[0] = '\0';
+
+    } else if (item->transform == CA_FILE_RATE) {
+        ca_snprintf(buf, size, "%.2f%Z", item->result);
+
+    } else if (item->result == (double) (int64_t) item->result) {
+        ca_snprintf(buf, size, "%L%Z", (int64_t) item->result);
+
+    } else {
+        ca_snprintf(buf, size, "%.3f%Z", item->result);
+    }
+
+    return buf;
+}
+
+
+u_char *
+ca_get_file_value(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  file_value[32];
+
+    return ca_file_format(ca_file_item(key, CA_FILE_RAW, now, freq),
+                          file_value, sizeof(file_value));
+}
+
+
+u_char *
+ca_get_file_rate(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  file_rate[32];
+
+    return ca_file_format(ca_file_item(key, CA_FILE_RATE, now, freq),
+                          file_rate, sizeof(file_rate));
+}
+
+
+u_char *
+ca_get_file_delta(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  file_delta[32];
+
+    return ca_file_format(ca_file_item(key, CA_FILE_DELTA, now, freq),
+                          file_delta, sizeof(file_delta));
+}
@@ -0,0 +1,12 @@
+#ifndef __CA_FILE_VALUE_H_INCLUDED__
+#define __CA_FILE_VALUE_H_INCLUDED__
+
+
+ca_int_t ca_file_value_init(void *conf);
+void ca_file_value_tick(time_t now);
+u_char *ca_get_file_value(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_file_rate(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_file_delta(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_FILE_VALUE_H_INCLUDED__ */
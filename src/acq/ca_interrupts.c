@@ -0,0 +1,428 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#define CA_IRQ_BUF_SIZE     16384
+#define CA_IRQ_NAME_LEN     16
+#define CA_IRQ_PAD          8          /* for 8 byte loads past the end */
+
+
+typedef struct {
+    u_char     name[CA_IRQ_NAME_LEN];
+    size_t     len;
+    ca_uint_t  ncols;
+    int64_t    sum;                   /* delta of all cpus */
+    int64_t    max;                   /* delta of the busiest cpu */
+} ca_irq_row_t;
+
+
+/*
+ * /proc/interrupts or /proc/softirqs, a row per irq with a column per
+ * cpu.  values and last hold nrows x ncpus counters of the last two
+ * reads.
+ */
+typedef struct {
+    const char    *path;
+    int            fd;
+    u_char        *buf;
+    size_t         size;
+    ca_uint_t      ncpus;
+    ca_irq_row_t  *rows;
+    ca_uint_t      nrows;
+    ca_uint_t      nalloc;
+    int64_t       *values;
+    int64_t       *last;
+    double         elapsed;           /* s, 0 if the deltas are not valid */
+    uint64_t       last_us;
+    time_t         updated;
+} ca_irq_file_t;
+
+
+static ca_irq_file_t  ca_s_interrupts = { "/proc/interrupts", CA_INVALID_FILE };
+static ca_irq_file_t  ca_s_softirqs = { "/proc/softirqs", CA_INVALID_FILE };
+
+
+#if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+static const uint64_t  ca_s_pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+
+/*
+ * Parse a decimal 8 bytes at a time: find the digits of a word with
+ * a few masks, then fold them pairwise into a number in 3 multiplies.
+ */
+static uint64_t
+ca_irq_parse_uint(u_char **pp)
+{
+    u_char     *p;
+    uint64_t    chunk, x, v;
+    ca_uint_t   n;
+
+    p = *pp;
+    v = 0;
+
+    for ( ;; ) {
+        ca_memcpy(&chunk, p, 8);
+
+        /* bytes 0x30 - 0x39 turn into 0x33 */
+        x = (chunk & 0xF0F0F0F0F0F0F0F0ULL)
+            | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4);
+        x ^= 0x3333333333333333ULL;
+
+        n = x ? (ca_uint_t) __builtin_ctzll(x) >> 3 : 8;
+        if (n == 0) {
+            break;
+        }
+
+        /* right align the n digits, zero digits before them */
+        chunk = (chunk - 0x3030303030303030ULL) << (8 * (8 - n));
+
+        chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FFULL;
+        chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFFULL;
+        chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFFULL;
+
+        v = v * ca_s_pow10[n] + chunk;
+        p += n;
+
+        if (n < 8) {
+            break;
+        }
+    }
+
+    *pp = p;
+
+    return v;
+}
+
+#else
+
+static uint64_t
+ca_irq_parse_uint(u_char **pp)
+{
+    u_char    *p;
+    uint64_t   v;
+
+    v = 0;
+
+    for (p = *pp; *p >= '0' && *p <= '9'; p++) {
+        v = v * 10 + (*p - '0');
+    }
+
+    *pp = p;
+
+    return v;
+}
+
+#endif
+
+
+static ssize_t
+ca_irq_read(ca_irq_file_t *f)
+{
+    u_char   *buf;
+    ssize_t   n, len;
+
+    if (f->fd == CA_INVALID_FILE) {
+        f->fd = open(f->path, O_RDONLY|O_CLOEXEC);
+        if (f->fd == CA_INVALID_FILE) {
+            return CA_ERROR;
+        }
+    }
+
+    for ( ;; ) {
+        if (f->buf == NULL) {
+            f->size = f->size ? f->size * 2 : CA_IRQ_BUF_SIZE;
+            f->buf = ca_alloc(f->size);
+            if (f->buf == NULL) {
+                f->size = 0;
+                return CA_ERROR;
+            }
+        }
+
+        buf = f->buf;
+
+        for (len = 0; len < (ssize_t) (f->size - CA_IRQ_PAD); len += n) {
+            n = pread(f->fd, buf + len, f->size - CA_IRQ_PAD - len, len);
+            if (n < 0) {
+                return CA_ERROR;
+            }
+
+            if (n == 0) {
+                break;
+            }
+        }
+
+        if (len < (ssize_t) (f->size - CA_IRQ_PAD)) {
+            break;
+        }
+
+        /* the file has outgrown the buffer */
+
+        ca_free(f->buf);
+        f->buf = NULL;
+    }
+
+    ca_memzero(f->buf + len, CA_IRQ_PAD);
+
+    return len;
+}
+
+
+static ca_int_t
+ca_irq_grow(ca_irq_file_t *f)
+{
+    ca_uint_t      n;
+    int64_t       *values, *last;
+    ca_irq_row_t  *rows;
+
+    n = f->nalloc ? f->nalloc * 2 : 64;
+
+    rows = ca_realloc(f->rows, n * sizeof(ca_irq_row_t));
+    if (rows == NULL) {
+        return CA_ERROR;
+    }
+
+    f->rows = rows;
+
+    values = ca_realloc(f->values, n * f->ncpus * sizeof(int64_t));
+    if (values == NULL) {
+        return CA_ERROR;
+    }
+
+    f->values = values;
+
+    last = ca_realloc(f->last, n * f->ncpus * sizeof(int64_t));
+    if (last == NULL) {
+        return CA_ERROR;
+    }
+
+    f->last = last;
+    f->nalloc = n;
+
+    return CA_OK;
+}
+
+
+/*
+ * A single pass over the bytes read: each counter is parsed, stored
+ * and subtracted from its previous value as it is met, so a row ends
+ * up with its sum and busiest cpu without another walk.
+ */
+static void
+ca_get_irq_info(ca_irq_file_t *f)
+{
+    u_char        *p, *last, *name;
+    size_t         len;
+    ssize_t        n;
+    int64_t        v, d, *values, *prev, *tmp;
+    uint64_t       now_us;
+    ca_uint_t      r, c, ncpus, changed;
+    ca_irq_row_t  *row;
+
+    n = ca_irq_read(f);
+    if (n == CA_ERROR) {
+        return;
+    }
+
+    p = f->buf;
+    last = f->buf + n;
+
+    /*            CPU0       CPU1 */
+
+    for (ncpus = 0; p < last && *p != '\n'; p++) {
+        if (p[0] == 'C' && p[1] == 'P' && p[2] == 'U') {
+            ncpus++;
+            p += 2;
+        }
+    }
+
+    p++;
+
+    changed = (f->last_us == 0);
+
+    if (ncpus != f->ncpus) {
+        /* cpu hotplug, start over */
+        ca_free(f->rows);
+        ca_free(f->values);
+        ca_free(f->last);
+        f->rows = NULL;
+        f->values = NULL;
+        f->last = NULL;
+        f->nrows = 0;
+        f->nalloc = 0;
+        f->ncpus = ncpus;
+        changed = 1;
+    }
+
+    tmp = f->last;
+    f->last = f->values;
+    f->values = tmp;
+
+    for (r = 0; p < last; /* void */) {
+        while (*p == ' ') {
+            p++;
+        }
+
+        name = p;
+
+        while (p < last && *p != ':' && *p != '\n') {
+            p++;
+        }
+
+        if (p >= last || *p != ':') {
+            p = ca_strlchr(p, last, '\n');
+            p = p ? p + 1 : last;
+            continue;
+        }
+
+        len = p - name;
+        if (len > CA_IRQ_NAME_LEN) {
+            len = CA_IRQ_NAME_LEN;
+        }
+
+        p++;
+
+        if (r == f->nalloc && ca_irq_grow(f) != CA_OK) {
+            break;
+        }
+
+        row = &f->rows[r];
+
+        if (r >= f->nrows || row->len != len
+            || ca_memcmp(row->name, name, len) != 0)
+        {
+            /* an irq has come or gone */
+            ca_memcpy(row->name, name, len);
+            row->len = len;
+            changed = 1;
+        }
+
+        values = f->values + r * ncpus;
+        prev = f->last + r * ncpus;
+        row->sum = 0;
+        row->max = 0;
+
+        for (c = 0; c < ncpus; c++) {
+            while (*p == ' ') {
+                p++;
+            }
+
+            if (*p < '0' || *p > '9') {
+                break;
+            }
+
+            v = ca_irq_parse_uint(&p);
+            values[c] = v;
+
+            d = v - prev[c];
+            row->sum += d;
+            if (d > row->max) {
+                row->max = d;
+            }
+        }
+
+        row->ncols = c;
+        r++;
+
+        p = ca_strlchr(p, last, '\n');
+        p = p ? p + 1 : last;
+    }
+
+    f->nrows = r;
+
+    now_us = ca_time_us();
+    f->elapsed = changed ? 0 : (now_us - f->last_us) / 1000000.0;
+    f->last_us = now_us;
+    f->updated = time(NULL);
+}
+
+
+/*
+ * <name>, <name>:max or <name>:<cpu>, the rate of all cpus, of the
+ * busiest one, or of one.
+ */
+static u_char *
+ca_irq_rate(ca_irq_file_t *f, ca_str_t *key, time_t now, time_t freq,
+    u_char *buf, size_t size)
+{
+    u_char        *colon, *last;
+    size_t         len;
+    int64_t        delta;
+    ca_int_t       cpu;
+    ca_uint_t      i;
+    ca_irq_row_t  *row;
+
+    buf[0] = '\0';
+
+    if (f->updated + freq <= now) {
+        ca_get_irq_info(f);
+    }
+
+    if (f->elapsed <= 0) {
+        return buf;
+    }
+
+    last = key->data + key->len;
+    colon = ca_strlchr(key->data, last, ':');
+    len = colon ? (size_t) (colon - key->data) : key->len;
+
+    row = NULL;
+
+    for (i = 0; i < f->nrows; i++) {
+        if (f->rows[i].len == len
+            && ca_strncmp(f->rows[i].name, key->data, len) == 0)
+        {
+            row = &f->rows[i];
+            break;
+        }
+    }
+
+    if (row == NULL) {
+        return buf;
+    }
+
+    if (colon == NULL) {
+        delta = row->sum;
+
+    } else if (last - colon - 1 == 3 && ca_strncmp(colon + 1, "max", 3) == 0) {
+        delta = row->max;
+
+    } else {
+        cpu = ca_atoi(colon + 1, last - colon - 1);
+        if (cpu < 0 || (ca_uint_t) cpu >= row->ncols) {
+            return buf;
+        }
+
+        delta = f->values[i * f->ncpus + cpu] - f->last[i * f->ncpus + cpu];
+    }
+
+    if (delta >= 0) {
+        ca_snprintf(buf, size, "%.1f%Z", delta / f->elapsed);
+    }
+
+    return buf;
+}
+
+
+u_char *
+ca_get_interrupt(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  interrupt[24];
+
+    return ca_irq_rate(&ca_s_interrupts, key, now, freq, interrupt,
+                       sizeof(interrupt));
+}
+
+
+u_char *
+ca_get_softirq(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  softirq[24];
+
+    return ca_irq_rate(&ca_s_softirqs, key, now, freq, softirq,
+                       sizeof(softirq));
+}
@@ -0,0 +1,9 @@
+#ifndef __CA_INTERRUPTS_H_INCLUDED__
+#define __CA_INTERRUPTS_H_INCLUDED__
+
+
+u_char *ca_get_interrupt(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_softirq(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_INTERRUPTS_H_INCLUDED__ */
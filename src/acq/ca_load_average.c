@@ -45,68 +45,55 @@ ca_get_loadavg_info(void)
 }
 
 
-u_char *
-ca_get_loadavg_1(time_t now, time_t freq)
+void
+ca_get_loadavg_1(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  loadavg_1[10];
-
     if (ca_s_loadavg_info.updated + freq <= now) {
         ca_get_loadavg_info();
     }
 
     if (ca_s_loadavg_info.loadavg_1 >= 0) {
-        ca_snprintf(loadavg_1, sizeof(loadavg_1), "%.2f%Z",
-                    ca_s_loadavg_info.loadavg_1);
+        ca_acq_value_double(v, ca_s_loadavg_info.loadavg_1, 2, NULL);
+
     } else {
-        loadavg_1[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_loadavg_info.loadavg_1 = -1;
-
-    return loadavg_1;
 }
 
 
-u_char *
-ca_get_loadavg_5(time_t now, time_t freq)
+void
+ca_get_loadavg_5(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  loadavg_5[10];
-
     if (ca_s_loadavg_info.updated + freq <= now) {
         ca_get_loadavg_info();
     }
 
     if (ca_s_loadavg_info.loadavg_5 >= 0) {
-        ca_snprintf(loadavg_5, sizeof(loadavg_5), "%.2f%Z",
-                    ca_s_loadavg_info.loadavg_5);
+        ca_acq_value_double(v, ca_s_loadavg_info.loadavg_5, 2, NULL);
 
     } else {
-        loadavg_5[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_loadavg_info.loadavg_5 = -1;
-
-    return loadavg_5;
 }
 
 
-u_char *
-ca_get_loadavg_15(time_t now, time_t freq)
+void
+ca_get_loadavg_15(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  loadavg_15[10];
-
     if (ca_s_loadavg_info.updated + freq <= now) {
         ca_get_loadavg_info();
     }
 
     if (ca_s_loadavg_info.loadavg_15 >= 0) {
-        ca_snprintf(loadavg_15, sizeof(loadavg_15), "%.2f%Z",
-                    ca_s_loadavg_info.loadavg_15);
+        ca_acq_value_double(v, ca_s_loadavg_info.loadavg_15, 2, NULL);
+
     } else {
-        loadavg_15[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_loadavg_info.loadavg_15 = -1;
-
-    return loadavg_15;
 }
@@ -0,0 +1,628 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+
+#define CA_LOG_TAIL_BUF_SIZE    (1024 * 1024)
+#define CA_LOG_TAIL_BUDGET      (32 * 1024 * 1024)    /* a file, a tick */
+#define CA_LOG_TAIL_PENDING     ((uint64_t) -1)
+
+#define CA_LOG_TAIL_EXACT       0
+#define CA_LOG_TAIL_CASELESS    1
+
+
+typedef struct {
+    ca_str_t   *key;
+    uint64_t    count;
+} ca_log_report_t;
+
+
+typedef struct {
+    ca_log_match_t  *match;
+    uint64_t         count;                   /* lines matched */
+    uint64_t         skip;                    /* end of the line counted */
+    ca_array_t      *reports;                 /* ca_log_report_t */
+} ca_log_pattern_t;
+
+
+typedef struct {
+    char               *path;
+    char               *base;                 /* in path */
+    int                 fd;
+    dev_t               dev;
+    ino_t               ino;
+    uint64_t            offset;
+    int                 wd;
+    int                 dir_wd;
+    unsigned            moved:1;              /* renamed, removed or created */
+    ca_log_pattern_t   *patterns;
+    ca_uint_t           npatterns;
+    ca_uint_t           npending;
+    ca_ac_t             ac[2];
+    uint32_t            state[2];
+    uint32_t           *ids[2];               /* automaton id to pattern */
+} ca_log_file_t;
+
+
+typedef struct {
+    ca_log_file_t      *files;
+    ca_uint_t           nfiles;
+    int                 inotify_fd;
+    ca_acq_event_t      event;
+    u_char             *buf;
+} ca_log_tail_info_t;
+
+
+/* what a scan needs to count a match */
+typedef struct {
+    ca_log_file_t      *file;
+    uint32_t           *ids;
+    u_char             *start;                /* of the chunk */
+    u_char             *last;
+    uint64_t            base;                 /* file offset of start */
+} ca_log_scan_t;
+
+
+static ca_log_tail_info_t  ca_s_log_tail_info = {
+    .inotify_fd = CA_INVALID_FILE,
+};
+
+
+char *
+ca_conf_log_match(ca_conf_t *cf, ca_command_t *cmd, void *conf)
+{
+    ca_conf_ctx_t   *ctx = conf;
+    ca_str_t        *value;
+    ca_uint_t        i;
+    ca_log_match_t  *match;
+
+    value = cf->args->elem;
+
+    if (value[3].len == 0) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0, "empty log pattern");
+        return CA_CONF_ERROR;
+    }
+
+    if (cf->args->nelem == 5 && ca_strcmp(value[4].data, "caseless") != 0) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid parameter \"%V\", "
+                          "it must be \"caseless\"", &value[4]);
+        return CA_CONF_ERROR;
+    }
+
+    if (ctx->log_matches == NULL) {
+        ctx->log_matches = ca_array_create(4, sizeof(ca_log_match_t));
+        if (ctx->log_matches == NULL) {
+            return CA_CONF_ERROR;
+        }
+    }
+
+    match = ctx->log_matches->elem;
+
+    for (i = 0; i < ctx->log_matches->nelem; i++) {
+        if (match[i].name.len == value[1].len
+            && ca_strncmp(match[i].name.data, value[1].data,
+                          value[1].len) == 0)
+        {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "duplicate log match \"%V\"", &value[1]);
+            return CA_CONF_ERROR;
+        }
+    }
+
+    match = ca_array_push(ctx->log_matches);
+    if (match == NULL) {
+        return CA_CONF_ERROR;
+    }
+
+    match->name = value[1];
+    match->path = value[2];
+    match->pattern = value[3];
+    match->caseless = (cf->args->nelem == 5);
+
+    return CA_CONF_OK;
+}
+
+
+static void
+ca_log_tail_reset(ca_log_file_t *file)
+{
+    ca_uint_t  i;
+
+    file->offset = 0;
+    file->state[0] = 0;
+    file->state[1] = 0;
+    file->npending = 0;
+
+    for (i = 0; i < file->npatterns; i++) {
+        file->patterns[i].skip = 0;
+    }
+}
+
+
+/*
+ * Open the file, at its end the first time and at its beginning once
+ * it has been rotated.
+ */
+static void
+ca_log_tail_open(ca_log_file_t *file, ca_uint_t at_end)
+{
+    struct stat  st;
+
+    file->fd = open(file->path, O_RDONLY|O_CLOEXEC);
+    if (file->fd == CA_INVALID_FILE) {
+        if (errno != ENOENT) {
+            ca_log_err(errno, "open(\"%s\") failed", file->path);
+        }
+
+        return;
+    }
+
+    if (fstat(file->fd, &st) == -1) {
+        ca_log_err(errno, "fstat(\"%s\") failed", file->path);
+        close(file->fd);
+        file->fd = CA_INVALID_FILE;
+        return;
+    }
+
+    ca_log_tail_reset(file);
+
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->offset = at_end ? (uint64_t) st.st_size : 0;
+
+    if (file->wd != -1) {
+        inotify_rm_watch(ca_s_log_tail_info.inotify_fd, file->wd);
+    }
+
+    file->wd = inotify_add_watch(ca_s_log_tail_info.inotify_fd, file->path,
+                                 IN_MOVE_SELF|IN_DELETE_SELF);
+
+    ca_log_debug(0, "tailing \"%s\" from %uL", file->path, file->offset);
+}
+
+
+static void
+ca_log_tail_match(void *data, ca_uint_t id, u_char *end)
+{
+    ca_log_scan_t     *scan = data;
+    u_char            *nl;
+    uint64_t           pos;
+    ca_log_pattern_t  *pattern;
+
+    pattern = &scan->file->patterns[scan->ids[id]];
+    pos = scan->base + (end - scan->start);
+
+    /* a line is counted once however many times it matches */
+
+    if (pos <= pattern->skip) {
+        return;
+    }
+
+    pattern->count++;
+
+    nl = ca_strlchr(end - 1, scan->last, '\n');
+
+    if (nl != NULL) {
+        pattern->skip = scan->base + (nl - scan->start) + 1;
+
+    } else {
+        pattern->skip = CA_LOG_TAIL_PENDING;
+        scan->file->npending++;
+    }
+}
+
+
+static void
+ca_log_tail_scan(ca_log_file_t *file, u_char *p, ssize_t n)
+{
+    u_char         *nl;
+    ca_uint_t       i, k;
+    ca_log_scan_t   scan;
+
+    /* the lines matched at the end of the last chunk end in this one */
+
+    if (file->npending) {
+        nl = ca_strlchr(p, p + n, '\n');
+
+        for (i = 0; i < file->npatterns; i++) {
+            if (file->patterns[i].skip == CA_LOG_TAIL_PENDING && nl != NULL) {
+                file->patterns[i].skip = file->offset + (nl - p) + 1;
+                file->npending--;
+            }
+        }
+    }
+
+    scan.file = file;
+    scan.start = p;
+    scan.last = p + n;
+    scan.base = file->offset;
+
+    for (k = 0; k < 2; k++) {
+        if (file->ids[k] == NULL) {
+            continue;
+        }
+
+        scan.ids = file->ids[k];
+        file->state[k] = ca_ac_scan(&file->ac[k], file->state[k], p, p + n,
+                                    ca_log_tail_match, &scan);
+    }
+}
+
+
+static void
+ca_log_tail_read(ca_log_file_t *file)
+{
+    ssize_t      n;
+    uint64_t     budget;
+    struct stat  st;
+
+    if (fstat(file->fd, &st) == -1) {
+        return;
+    }
+
+    if ((uint64_t) st.st_size < file->offset) {
+        ca_log_info(0, "\"%s\" truncated", file->path);
+        ca_log_tail_reset(file);
+    }
+
+    for (budget = 0; budget < CA_LOG_TAIL_BUDGET; budget += n) {
+        if ((uint64_t) st.st_size <= file->offset) {
+            break;
+        }
+
+        n = pread(file->fd, ca_s_log_tail_info.buf, CA_LOG_TAIL_BUF_SIZE,
+                  file->offset);
+        if (n <= 0) {
+            if (n < 0) {
+                ca_log_err(errno, "pread(\"%s\") failed", file->path);
+            }
+
+            break;
+        }
+
+        ca_log_tail_scan(file, ca_s_log_tail_info.buf, n);
+        file->offset += n;
+
+        if (n < CA_LOG_TAIL_BUF_SIZE) {
+            break;
+        }
+    }
+}
+
+
+/*
+ * The path is another file now: finish the old one, whatever was
+ * written to it before it was renamed, and go on with the new one.
+ */
+static void
+ca_log_tail_rotate(ca_log_file_t *file)
+{
+    struct stat  st;
+
+    file->moved = 0;
+
+    if (stat(file->path, &st) == -1) {
+        /* not created yet, the directory watch tells when it is */
+        return;
+    }
+
+    if (file->fd != CA_INVALID_FILE) {
+        if (st.st_dev == file->dev && st.st_ino == file->ino) {
+            return;
+        }
+
+        ca_log_tail_read(file);
+        close(file->fd);
+        file->fd = CA_INVALID_FILE;
+
+        ca_log_info(0, "\"%s\" rotated", file->path);
+    }
+
+    ca_log_tail_open(file, 0);
+}
+
+
+static void
+ca_log_tail_inotify_handler(ca_acq_event_t *ev)
+{
+    char                  *p;
+    ssize_t                n;
+    ca_uint_t              i;
+    ca_log_file_t         *file;
+    struct inotify_event  *ie;
+    char                   buf[4096]
+                           __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    for ( ;; ) {
+        n = read(ev->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ie->len) {
+            ie = (struct inotify_event *) p;
+
+            for (i = 0; i < ca_s_log_tail_info.nfiles; i++) {
+                file = &ca_s_log_tail_info.files[i];
+
+                if (ie->mask & IN_Q_OVERFLOW) {
+                    file->moved = 1;
+
+                } else if (ie->wd == file->wd) {
+                    file->moved = 1;
+
+                } else if (ie->wd == file->dir_wd && ie->len
+                           && strcmp(ie->name, file->base) == 0)
+                {
+                    file->moved = 1;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < ca_s_log_tail_info.nfiles; i++) {
+        if (ca_s_log_tail_info.files[i].moved) {
+            ca_log_tail_rotate(&ca_s_log_tail_info.files[i]);
+        }
+    }
+}
+
+
+static ca_log_file_t *
+ca_log_tail_file(ca_log_match_t *match, ca_uint_t *nfiles)
+{
+    ca_uint_t       i;
+    ca_log_file_t  *file;
+
+    for (i = 0; i < *nfiles; i++) {
+        file = &ca_s_log_tail_info.files[i];
+
+        if (ca_strcmp(file->path, match->path.data) == 0) {
+            return file;
+        }
+    }
+
+    file = &ca_s_log_tail_info.files[(*nfiles)++];
+
+    file->path = (char *) match->path.data;
+    file->base = strrchr(file->path, '/');
+    file->base = file->base ? file->base + 1 : file->path;
+    file->fd = CA_INVALID_FILE;
+    file->wd = -1;
+    file->dir_wd = -1;
+
+    ca_ac_init(&file->ac[CA_LOG_TAIL_EXACT], 0);
+    ca_ac_init(&file->ac[CA_LOG_TAIL_CASELESS], 1);
+
+    return file;
+}
+
+
+static ca_int_t
+ca_log_tail_compile(ca_log_file_t *file)
+{
+    ca_int_t           id;
+    ca_uint_t          i, k, n;
+    ca_log_pattern_t  *pattern;
+
+    for (k = 0; k < 2; k++) {
+        n = 0;
+
+        for (i = 0; i < file->npatterns; i++) {
+            n += (file->patterns[i].match->caseless == k);
+        }
+
+        if (n == 0) {
+            continue;
+        }
+
+        file->ids[k] = ca_alloc(n * sizeof(uint32_t));
+        if (file->ids[k] == NULL) {
+            return CA_ERROR;
+        }
+
+        for (i = 0; i < file->npatterns; i++) {
+            pattern = &file->patterns[i];
+
+            if (pattern->match->caseless != k) {
+                continue;
+            }
+
+            id = ca_ac_add(&file->ac[k], pattern->match->pattern.data,
+                           pattern->match->pattern.len);
+            if (id == CA_ERROR) {
+                return CA_ERROR;
+            }
+
+            file->ids[k][id] = i;
+        }
+
+        if (ca_ac_compile(&file->ac[k]) != CA_OK) {
+            return CA_ERROR;
+        }
+    }
+
+    return CA_OK;
+}
+
+
+ca_int_t
+ca_log_tail_init(void *dummy)
+{
+    ca_conf_ctx_t     *conf = dummy;
+    char              *dir;
+    size_t             len;
+    ca_uint_t          i, nfiles;
+    ca_log_file_t     *file;
+    ca_log_match_t    *match;
+    ca_log_pattern_t  *pattern;
+
+    if (conf->log_matches == NULL) {
+        return CA_OK;
+    }
+
+    match = conf->log_matches->elem;
+
+    ca_s_log_tail_info.buf = ca_alloc(CA_LOG_TAIL_BUF_SIZE);
+    ca_s_log_tail_info.files = ca_calloc(conf->log_matches->nelem,
+                                         sizeof(ca_log_file_t));
+    if (ca_s_log_tail_info.buf == NULL || ca_s_log_tail_info.files == NULL) {
+        return CA_ERROR;
+    }
+
+    ca_s_log_tail_info.inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (ca_s_log_tail_info.inotify_fd == CA_INVALID_FILE) {
+        ca_log_err(errno, "inotify_init1() failed");
+        return CA_ERROR;
+    }
+
+    /* the patterns of a file go into the same automata */
+
+    nfiles = 0;
+
+    for (i = 0; i < conf->log_matches->nelem; i++) {
+        file = ca_log_tail_file(&match[i], &nfiles);
+
+        if (file->patterns == NULL) {
+            file->patterns = ca_calloc(conf->log_matches->nelem,
+                                       sizeof(ca_log_pattern_t));
+            if (file->patterns == NULL) {
+                return CA_ERROR;
+            }
+        }
+
+        pattern = &file->patterns[file->npatterns++];
+        pattern->match = &match[i];
+        pattern->reports = ca_array_create(1, sizeof(ca_log_report_t));
+        if (pattern->reports == NULL) {
+            return CA_ERROR;
+        }
+    }
+
+    ca_s_log_tail_info.nfiles = nfiles;
+
+    for (i = 0; i < nfiles; i++) {
+        file = &ca_s_log_tail_info.files[i];
+
+        if (ca_log_tail_compile(file) != CA_OK) {
+            return CA_ERROR;
+        }
+
+        len = file->base - file->path;
+        dir = len > 1 ? strndup(file->path, len - 1)
+                      : ca_strdup(len ? "/" : ".");
+        if (dir == NULL) {
+            return CA_ERROR;
+        }
+
+        file->dir_wd = inotify_add_watch(ca_s_log_tail_info.inotify_fd, dir,
+                                         IN_CREATE|IN_MOVED_TO);
+        if (file->dir_wd == -1) {
+            ca_log_err(errno, "inotify_add_watch(\"%s\") failed", dir);
+        }
+
+        ca_free(dir);
+
+        ca_log_tail_open(file, 1);
+    }
+
+    ca_s_log_tail_info.event.fd = ca_s_log_tail_info.inotify_fd;
+    ca_s_log_tail_info.event.events = POLLIN;
+    ca_s_log_tail_info.event.handler = ca_log_tail_inotify_handler;
+    ca_s_log_tail_info.event.data = NULL;
+
+    return ca_acq_add_event(&ca_s_log_tail_info.event);
+}
+
+
+/*
+ * Read what the files have grown by on every pass, inotify is only
+ * asked about rotation: IN_MODIFY would wake the acq thread for every
+ * write to a busy log.
+ */
+void
+ca_log_tail_tick(time_t now)
+{
+    ca_uint_t       i;
+    ca_log_file_t  *file;
+
+    for (i = 0; i < ca_s_log_tail_info.nfiles; i++) {
+        file = &ca_s_log_tail_info.files[i];
+
+        if (file->moved) {
+            ca_log_tail_rotate(file);
+        }
+
+        if (file->fd != CA_INVALID_FILE) {
+            ca_log_tail_read(file);
+        }
+    }
+}
+
+
+/*
+ * log_match[<name>], the lines matched since the item was last reported.
+ */
+u_char *
+ca_get_log_match(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char      log_match[24];
+    ca_uint_t          i, j;
+    ca_log_file_t     *file;
+    ca_log_report_t   *report;
+    ca_log_pattern_t  *pattern;
+
+    log_match[0] = '\0';
+
+    for (i = 0; i < ca_s_log_tail_info.nfiles; i++) {
+        file = &ca_s_log_tail_info.files[i];
+
+        for (j = 0; j < file->npatterns; j++) {
+            pattern = &file->patterns[j];
+
+            if (pattern->match->name.len == key->len
+                && ca_strncmp(pattern->match->name.data, key->data,
+                              key->len) == 0)
+            {
+                goto found;
+            }
+        }
+    }
+
+    return log_match;
+
+found:
+
+    report = pattern->reports->elem;
+
+    for (i = 0; i < pattern->reports->nelem; i++) {
+        if (report[i].key == key) {
+            break;
+        }
+    }
+
+    if (i == pattern->reports->nelem) {
+        report = ca_array_push(pattern->reports);
+        if (report == NULL) {
+            return log_match;
+        }
+
+        report->key = key;
+        report->count = 0;
+
+    } else {
+        report = &report[i];
+    }
+
+    ca_snprintf(log_match, sizeof(log_match), "%uL%Z",
+                pattern->count - report->count);
+
+    report->count = pattern->count;
+
+    return log_match;
+}
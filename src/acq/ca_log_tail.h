@@ -0,0 +1,20 @@
+#ifndef __CA_LOG_TAIL_H_INCLUDED__
+#define __CA_LOG_TAIL_H_INCLUDED__
+
+
+typedef struct {
+    ca_str_t    name;
+    ca_str_t    path;
+    ca_str_t    pattern;
+    ca_uint_t   caseless;
+} ca_log_match_t;
+
+
+char *ca_conf_log_match(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+
+ca_int_t ca_log_tail_init(void *conf);
+void ca_log_tail_tick(time_t now);
+u_char *ca_get_log_match(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_LOG_TAIL_H_INCLUDED__ */
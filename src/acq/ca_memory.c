@@ -1,5 +1,10 @@
 #include "../clagent.h"
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#define CA_MEM_BUF_SIZE     32768
 
 
 typedef struct ca_mem_info_s {
@@ -17,59 +22,204 @@ typedef struct ca_mem_info_s {
 } ca_mem_info_t;
 
 
+/*
+ * A "name value" per line file, /proc/meminfo or /proc/vmstat.  The
+ * lines never change order while the system is up, so the names are
+ * indexed by line on the first read, and later reads just parse the
+ * value of each line into values[line].
+ */
+typedef struct {
+    const char  *path;
+    int          fd;
+    ca_str_t    *names;
+    int64_t     *values;
+    int64_t     *last;
+    ca_uint_t    nvalues;
+    uint64_t     last_us;
+    double       elapsed;         /* s between the last two reads */
+    time_t       updated;
+} ca_mem_file_t;
+
+
 static ca_mem_info_t  ca_s_mem_info = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1.0, -1.0, 0
 };
 
 
-static void
-ca_get_mem_info(void)
+static ca_mem_file_t  ca_s_meminfo = { "/proc/meminfo", CA_INVALID_FILE };
+static ca_mem_file_t  ca_s_vmstat = { "/proc/vmstat", CA_INVALID_FILE };
+
+
+static u_char  ca_s_mem_buf[CA_MEM_BUF_SIZE];
+
+
+static ca_int_t
+ca_mem_file_index(ca_mem_file_t *f, size_t len)
 {
-    char      buffer[1024];
-    char     *fields[8];
-    FILE     *fh;
-    int       numfields;
-    int64_t  *val;
-
-    fh = fopen("/proc/meminfo", "r");
-    if (fh == NULL) {
-        return;
+    u_char     *p, *last, *name;
+    ca_uint_t   n;
+
+    last = ca_s_mem_buf + len;
+    n = 0;
+
+    for (p = ca_s_mem_buf; p < last; p++) {
+        if (*p == '\n') {
+            n++;
+        }
+    }
+
+    if (len && last[-1] != '\n') {
+        n++;
     }
 
-    while (fgets(buffer, sizeof(buffer), fh) != NULL) {
-        val = NULL;
+    f->names = ca_calloc(n, sizeof(ca_str_t));
+    f->values = ca_calloc(n, sizeof(int64_t));
+    f->last = ca_calloc(n, sizeof(int64_t));
 
-		if (strncasecmp(buffer, "MemTotal:", 9) == 0) {
-            val = &ca_s_mem_info.mem_total;
+    if (f->names == NULL || f->values == NULL || f->last == NULL) {
+        return CA_ERROR;
+    }
+
+    for (p = ca_s_mem_buf, n = 0; p < last; n++) {
+        name = p;
+
+        while (p < last && *p != ':' && *p != ' ' && *p != '\n') {
+            p++;
+        }
+
+        f->names[n].len = p - name;
+        f->names[n].data = ca_alloc(f->names[n].len);
+        if (f->names[n].data == NULL) {
+            return CA_ERROR;
+        }
+
+        ca_memcpy(f->names[n].data, name, f->names[n].len);
+
+        p = ca_strlchr(p, last, '\n');
+        if (p == NULL) {
+            break;
+        }
+
+        p++;
+    }
 
-        } else if (strncasecmp(buffer, "MemFree:", 8) == 0) {
-            val = &ca_s_mem_info.mem_free;
+    f->nvalues = n;
 
-        } else if (strncasecmp(buffer, "Buffers:", 8) == 0) {
-            val = &ca_s_mem_info.mem_buffer;
+    ca_log_debug(0, "%ud fields indexed in \"%s\"", f->nvalues, f->path);
 
-        } else if (strncasecmp(buffer, "Cached:", 7) == 0) {
-            val = &ca_s_mem_info.mem_cache;
+    return CA_OK;
+}
 
-        } else if (strncasecmp(buffer, "SwapTotal:", 10) == 0) {
-            val = &ca_s_mem_info.swap_total;
 
-        } else if (strncasecmp(buffer, "SwapFree:", 9) == 0) {
-            val = &ca_s_mem_info.swap_free;
+static ca_int_t
+ca_mem_file_read(ca_mem_file_t *f)
+{
+    u_char     *p, *last;
+    int64_t    *tmp;
+    ssize_t     n, len;
+    uint64_t    now_us;
+    ca_uint_t   i;
+
+    if (f->fd == CA_INVALID_FILE) {
+        f->fd = open(f->path, O_RDONLY|O_CLOEXEC);
+        if (f->fd == CA_INVALID_FILE) {
+            return CA_ERROR;
+        }
+    }
 
-        } else {
-            continue;
+    for (len = 0; len < CA_MEM_BUF_SIZE - 1; len += n) {
+        n = pread(f->fd, ca_s_mem_buf + len, CA_MEM_BUF_SIZE - 1 - len, len);
+        if (n < 0) {
+            return CA_ERROR;
         }
 
-		numfields = ca_strsplit(buffer, fields, 8);
-		if (numfields < 2) {
-            continue;
+        if (n == 0) {
+            break;
         }
+    }
 
-		*val = atoll(fields[1]);
+    if (f->names == NULL && ca_mem_file_index(f, len) != CA_OK) {
+        return CA_ERROR;
     }
 
-    fclose(fh);
+    tmp = f->last;
+    f->last = f->values;
+    f->values = tmp;
+
+    p = ca_s_mem_buf;
+    last = ca_s_mem_buf + len;
+
+    for (i = 0; i < f->nvalues && p < last; i++) {
+        p += f->names[i].len;
+
+        while (p < last && (*p == ':' || *p == ' ')) {
+            p++;
+        }
+
+        f->values[i] = 0;
+
+        while (p < last && *p >= '0' && *p <= '9') {
+            f->values[i] = f->values[i] * 10 + (*p++ - '0');
+        }
+
+        p = ca_strlchr(p, last, '\n');
+        if (p == NULL) {
+            break;
+        }
+
+        p++;
+    }
+
+    now_us = ca_time_us();
+    f->elapsed = f->last_us ? (now_us - f->last_us) / 1000000.0 : 0;
+    f->last_us = now_us;
+    f->updated = time(NULL);
+
+    return CA_OK;
+}
+
+
+static ca_int_t
+ca_mem_file_field(ca_mem_file_t *f, u_char *name, size_t len)
+{
+    ca_uint_t  i;
+
+    for (i = 0; i < f->nvalues; i++) {
+        if (f->names[i].len == len
+            && ca_strncmp(f->names[i].data, name, len) == 0)
+        {
+            return i;
+        }
+    }
+
+    return CA_ERROR;
+}
+
+
+static int64_t
+ca_meminfo_value(const char *name)
+{
+    ca_int_t  i;
+
+    i = ca_mem_file_field(&ca_s_meminfo, (u_char *) name, ca_strlen(name));
+
+    return i == CA_ERROR ? -1 : ca_s_meminfo.values[i];
+}
+
+
+static void
+ca_get_mem_info(void)
+{
+    if (ca_mem_file_read(&ca_s_meminfo) != CA_OK) {
+        return;
+    }
+
+    ca_s_mem_info.mem_total = ca_meminfo_value("MemTotal");
+    ca_s_mem_info.mem_free = ca_meminfo_value("MemFree");
+    ca_s_mem_info.mem_buffer = ca_meminfo_value("Buffers");
+    ca_s_mem_info.mem_cache = ca_meminfo_value("Cached");
+    ca_s_mem_info.swap_total = ca_meminfo_value("SwapTotal");
+    ca_s_mem_info.swap_free = ca_meminfo_value("SwapFree");
 
     ca_s_mem_info.mem_free = ca_s_mem_info.mem_free
                              + ca_s_mem_info.mem_buffer
@@ -94,230 +244,286 @@ ca_get_mem_info(void)
 }
 
 
-u_char *
-ca_get_mem_total(time_t now, time_t freq)
+void
+ca_get_mem_total(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  mem_total[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.mem_total >= 0) {
-        ca_snprintf(mem_total, sizeof(mem_total), "%L%Z",
-                    ca_s_mem_info.mem_total);
+        ca_acq_value_int(v, ca_s_mem_info.mem_total, "kB");
 
     } else {
-        mem_total[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.mem_total = -1;
-
-    return mem_total;
 }
 
 
-u_char *
-ca_get_mem_used(time_t now, time_t freq)
+void
+ca_get_mem_used(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  mem_used[20];
-    
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.mem_used >= 0) {
-        ca_snprintf(mem_used, sizeof(mem_used), "%L%Z",
-                    ca_s_mem_info.mem_used);
+        ca_acq_value_int(v, ca_s_mem_info.mem_used, "kB");
 
     } else {
-        mem_used[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.mem_used = -1;
-
-    return mem_used;
 }
 
 
-u_char *
-ca_get_mem_free(time_t now, time_t freq)
+void
+ca_get_mem_free(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  mem_free[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.mem_free >= 0) {
-        ca_snprintf(mem_free, sizeof(mem_free), "%L%Z",
-                    ca_s_mem_info.mem_free);
+        ca_acq_value_int(v, ca_s_mem_info.mem_free, "kB");
 
     } else {
-        mem_free[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.mem_free = -1;
-
-    return mem_free;
 }
 
 
-u_char *
-ca_get_swap_total(time_t now, time_t freq)
+void
+ca_get_swap_total(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  swap_total[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.swap_total >= 0) {
-        ca_snprintf(swap_total, sizeof(swap_total), "%L%Z",
-                    ca_s_mem_info.swap_total);
+        ca_acq_value_int(v, ca_s_mem_info.swap_total, "kB");
 
     } else {
-        swap_total[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.swap_total = -1;
-
-    return swap_total;
 }
 
 
-u_char *
-ca_get_swap_used(time_t now, time_t freq)
+void
+ca_get_swap_used(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  swap_used[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.swap_used >= 0) {
-        ca_snprintf(swap_used, sizeof(swap_used), "%L%Z",
-                    ca_s_mem_info.swap_used);
+        ca_acq_value_int(v, ca_s_mem_info.swap_used, "kB");
 
     } else {
-        swap_used[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.swap_used = -1;
-
-    return swap_used;
 }
 
 
-u_char *
-ca_get_swap_free(time_t now, time_t freq)
+void
+ca_get_swap_free(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  swap_free[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.swap_free >= 0) {
-        ca_snprintf(swap_free, sizeof(swap_free), "%L%Z",
-                    ca_s_mem_info.swap_free);
+        ca_acq_value_int(v, ca_s_mem_info.swap_free, "kB");
 
     } else {
-        swap_free[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.swap_free = -1;
-
-    return swap_free;
 }
 
 
-u_char *
-ca_get_mem_cache(time_t now, time_t freq)
+void
+ca_get_mem_cache(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  mem_cache[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.mem_cache >= 0) {
-        ca_snprintf(mem_cache, sizeof(mem_cache), "%L%Z",
-                    ca_s_mem_info.mem_cache);
+        ca_acq_value_int(v, ca_s_mem_info.mem_cache, "kB");
+
     } else {
-        mem_cache[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.mem_cache = -1;
-
-    return mem_cache;
 }
 
 
-u_char *
-ca_get_mem_buffer(time_t now, time_t freq)
+void
+ca_get_mem_buffer(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  mem_buffer[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.mem_buffer >= 0) {
-        ca_snprintf(mem_buffer, sizeof(mem_buffer), "%L%Z",
-                    ca_s_mem_info.mem_buffer);
+        ca_acq_value_int(v, ca_s_mem_info.mem_buffer, "kB");
 
     } else {
-        mem_buffer[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.mem_buffer = -1;
-
-    return mem_buffer;
 }
 
 
-u_char *
-ca_get_mem_urate(time_t now, time_t freq)
+void
+ca_get_mem_urate(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  mem_urate[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.mem_urate >= 0) {
-        ca_snprintf(mem_urate, sizeof(mem_urate), "%.0f%Z",
-                    ca_s_mem_info.mem_urate);
+        ca_acq_value_double(v, ca_s_mem_info.mem_urate, 0, "%");
 
     } else {
-        mem_urate[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.mem_urate = -1;
-
-    return mem_urate;
 }
 
 
-u_char *
-ca_get_swap_urate(time_t now, time_t freq)
+void
+ca_get_swap_urate(time_t now, time_t freq, ca_acq_value_t *v)
 {
-    static u_char  swap_urate[20];
-
     if (ca_s_mem_info.updated + freq <= now) {
         ca_get_mem_info();
     }
 
     if (ca_s_mem_info.swap_urate >= 0) {
-        ca_snprintf(swap_urate, sizeof(swap_urate), "%.0f%Z",
-                    ca_s_mem_info.swap_urate);
+        ca_acq_value_double(v, ca_s_mem_info.swap_urate, 0, "%");
 
     } else {
-        swap_urate[0] = '\0';
+        ca_acq_value_invalid(v);
     }
 
     ca_s_mem_info.swap_urate = -1;
+}
+
+
+/*
+ * meminfo[<field>], any field of /proc/meminfo as it is found there,
+ * kB for most of them.
+ */
+void
+ca_get_meminfo(ca_str_t *key, time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_int_t  i;
+
+    if (ca_s_meminfo.updated + freq <= now) {
+        ca_get_mem_info();
+    }
 
-    return swap_urate;
+    i = ca_mem_file_field(&ca_s_meminfo, key->data, key->len);
+
+    if (i != CA_ERROR) {
+        ca_acq_value_int(v, ca_s_meminfo.values[i], NULL);
+
+    } else {
+        ca_acq_value_invalid(v);
+    }
+}
+
+
+/*
+ * The counters an aggregate key sums: the pages scanned or stolen by
+ * reclaim of any kind.  pgscan_anon and pgscan_file of 5.8 count the
+ * same pages again, pgscan_direct_throttle counts stalls, not pages.
+ */
+typedef struct {
+    char                   *name;
+    char                   *counters[4];
+} ca_vmstat_sum_t;
+
+
+static ca_vmstat_sum_t  ca_vmstat_sums[] = {
+    { "pgscan",
+      { "pgscan_kswapd", "pgscan_direct", "pgscan_khugepaged", NULL } },
+    { "pgsteal",
+      { "pgsteal_kswapd", "pgsteal_direct", "pgsteal_khugepaged", NULL } },
+    { NULL, { NULL } }
+};
+
+
+/*
+ * vmstat[<counter>], the rate per second of a /proc/vmstat counter, or
+ * of the counters of an aggregate key of ca_vmstat_sums, as pgscan.
+ */
+void
+ca_get_vmstat(ca_str_t *key, time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_int_t          i;
+    ca_uint_t         n, j;
+    int64_t           delta;
+    ca_mem_file_t    *f;
+    ca_vmstat_sum_t  *sum;
+
+    f = &ca_s_vmstat;
+
+    if (f->updated + freq <= now) {
+        ca_mem_file_read(f);
+    }
+
+    ca_acq_value_invalid(v);
+
+    if (f->elapsed <= 0) {
+        return;
+    }
+
+    i = ca_mem_file_field(f, key->data, key->len);
+
+    if (i != CA_ERROR) {
+        delta = f->values[i] - f->last[i];
+        n = 1;
+
+    } else {
+        delta = 0;
+        n = 0;
+
+        for (sum = ca_vmstat_sums; sum->name != NULL; sum++) {
+            if (ca_strlen(sum->name) == key->len
+                && ca_strncmp(sum->name, key->data, key->len) == 0)
+            {
+                break;
+            }
+        }
+
+        /* a counter of an older kernel may be missing */
+
+        for (j = 0; sum->name != NULL && sum->counters[j] != NULL; j++) {
+            i = ca_mem_file_field(f, (u_char *) sum->counters[j],
+                                  ca_strlen(sum->counters[j]));
+            if (i != CA_ERROR) {
+                delta += f->values[i] - f->last[i];
+                n++;
+            }
+        }
+    }
+
+    if (n != 0 && delta >= 0) {
+        ca_acq_value_double(v, delta / f->elapsed, 2, "/s");
+    }
 }
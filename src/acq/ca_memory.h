@@ -2,16 +2,20 @@
 #define __CA_MEMORY_H_INCLUDED__
 
 
-u_char *ca_get_mem_total(time_t now, time_t freq);
-u_char *ca_get_mem_used(time_t now, time_t freq);
-u_char *ca_get_mem_free(time_t now, time_t freq);
-u_char *ca_get_swap_total(time_t now, time_t freq);
-u_char *ca_get_swap_used(time_t now, time_t freq);
-u_char *ca_get_swap_free(time_t now, time_t freq);
-u_char *ca_get_mem_cache(time_t now, time_t freq);
-u_char *ca_get_mem_buffer(time_t now, time_t freq);
-u_char *ca_get_mem_urate(time_t now, time_t freq);
-u_char *ca_get_swap_urate(time_t now, time_t freq);
+void ca_get_mem_total(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_mem_used(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_mem_free(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_swap_total(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_swap_used(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_swap_free(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_mem_cache(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_mem_buffer(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_mem_urate(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_swap_urate(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_meminfo(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v);
+void ca_get_vmstat(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v);
 
 
 #endif /* __CA_MEMORY_H_INCLUDED__ */
@@ -0,0 +1,439 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+#define CA_NET_STAT_BUF_SIZE    65536
+
+#define CA_NET_SNMP             0
+#define CA_NET_NETSTAT          1
+#define CA_NET_SOCKSTAT         2
+#define CA_NET_NFILES           3
+
+
+/* where "Proto.Field" is found in the file */
+typedef struct {
+    u_char     *name;
+    size_t      len;
+    ca_uint_t   line;
+    ca_uint_t   column;
+} ca_net_field_t;
+
+
+typedef struct {
+    ca_str_t    key;
+    ca_uint_t   line;
+    ca_uint_t   column;
+    int64_t     value;
+    double      rate;              /* per second, -1 if unknown */
+    unsigned    valid:1;
+} ca_net_counter_t;
+
+
+typedef struct {
+    const char  *path;
+    unsigned     pairs:1;          /* header line, then value line */
+    int          fd;
+    ca_array_t  *fields;           /* ca_net_field_t, built once */
+    ca_array_t  *counters;         /* ca_net_counter_t *, by line, column */
+    uint64_t     last_us;
+    time_t       updated;
+} ca_net_file_t;
+
+
+static ca_net_file_t  ca_s_net_files[CA_NET_NFILES] = {
+    { "/proc/net/snmp",     1, CA_INVALID_FILE },
+    { "/proc/net/netstat",  1, CA_INVALID_FILE },
+    { "/proc/net/sockstat", 0, CA_INVALID_FILE },
+};
+
+
+static u_char  *ca_s_net_buf;
+
+
+static ssize_t
+ca_net_stat_read(ca_net_file_t *f)
+{
+    ssize_t  n, len;
+
+    if (ca_s_net_buf == NULL) {
+        ca_s_net_buf = ca_alloc(CA_NET_STAT_BUF_SIZE);
+        if (ca_s_net_buf == NULL) {
+            return CA_ERROR;
+        }
+    }
+
+    if (f->fd == CA_INVALID_FILE) {
+        f->fd = open(f->path, O_RDONLY|O_CLOEXEC);
+        if (f->fd == CA_INVALID_FILE) {
+            return CA_ERROR;
+        }
+    }
+
+    /* seq files may return less than asked for */
+
+    for (len = 0; len < CA_NET_STAT_BUF_SIZE - 1; len += n) {
+        n = pread(f->fd, ca_s_net_buf + len, CA_NET_STAT_BUF_SIZE - 1 - len,
+                  len);
+        if (n < 0) {
+            return CA_ERROR;
+        }
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    ca_s_net_buf[len] = '\0';
+
+    return len;
+}
+
+
+/*
+ * Index every field of the file once:
+ *
+ *   Tcp: RtoAlgorithm RtoMin ...        TCP: inuse 4 orphan 0 tw 1
+ *   Tcp: 1 200 ...
+ *
+ * "Tcp.RtoMin" is column 2 of the value line, "TCP.tw" column 6.
+ */
+static ca_int_t
+ca_net_stat_index(ca_net_file_t *f)
+{
+    char            *p, *line, *next, *fields[512];
+    size_t           plen;
+    ca_int_t         i, n, step;
+    ca_uint_t        lineno;
+    ca_net_field_t  *field;
+
+    f->fields = ca_array_create(256, sizeof(ca_net_field_t));
+    if (f->fields == NULL) {
+        return CA_ERROR;
+    }
+
+    if (ca_net_stat_read(f) == CA_ERROR) {
+        return CA_ERROR;
+    }
+
+    lineno = 0;
+
+    for (line = (char *) ca_s_net_buf; *line; line = next, lineno++) {
+        next = strchr(line, '\n');
+        if (next == NULL) {
+            next = line + strlen(line);
+
+        } else {
+            *next++ = '\0';
+        }
+
+        if (f->pairs && lineno % 2) {
+            continue;
+        }
+
+        n = ca_strsplit(line, fields, 512);
+        if (n < 2) {
+            continue;
+        }
+
+        plen = strlen(fields[0]);
+        if (plen < 2 || fields[0][plen - 1] != ':') {
+            continue;
+        }
+
+        plen--;
+
+        step = f->pairs ? 1 : 2;
+
+        for (i = 1; i < n; i += step) {
+            field = ca_array_push(f->fields);
+            if (field == NULL) {
+                return CA_ERROR;
+            }
+
+            field->len = plen + 1 + strlen(fields[i]);
+            field->name = ca_alloc(field->len + 1);
+            if (field->name == NULL) {
+                f->fields->nelem--;
+                return CA_ERROR;
+            }
+
+            p = (char *) ca_cpymem(field->name, fields[0], plen);
+            *p++ = '.';
+            ca_memcpy(p, fields[i], strlen(fields[i]) + 1);
+
+            if (f->pairs) {
+                field->line = lineno + 1;
+                field->column = i;
+
+            } else {
+                field->line = lineno;
+                field->column = i + 1;
+            }
+        }
+    }
+
+    ca_log_debug(0, "%ud fields indexed in \"%s\"", f->fields->nelem,
+                 f->path);
+
+    return CA_OK;
+}
+
+
+/*
+ * Walk the lines holding the selected counters, and the columns of
+ * each only as far as its last selected counter.
+ */
+static void
+ca_get_net_stat_info(ca_net_file_t *f)
+{
+    char               *p, *end;
+    double              elapsed;
+    int64_t             v;
+    uint64_t            now_us;
+    ca_uint_t           i, lineno, column;
+    ca_net_counter_t  **cp, *c;
+
+    if (ca_net_stat_read(f) == CA_ERROR) {
+        return;
+    }
+
+    now_us = ca_time_us();
+    elapsed = (now_us - f->last_us) / 1000000.0;
+
+    cp = f->counters->elem;
+    p = (char *) ca_s_net_buf;
+    lineno = 0;
+
+    for (i = 0; i < f->counters->nelem && *p; /* void */) {
+        c = cp[i];
+
+        /* skip to the line */
+
+        while (lineno < c->line && *p) {
+            p = strchr(p, '\n');
+            if (p == NULL) {
+                goto done;
+            }
+
+            p++;
+            lineno++;
+        }
+
+        column = 0;
+
+        while (i < f->counters->nelem && cp[i]->line == lineno) {
+            c = cp[i];
+
+            /* skip to the column */
+
+            for ( ;; ) {
+                while (*p == ' ') {
+                    p++;
+                }
+
+                if (*p == '\0' || *p == '\n') {
+                    goto next;
+                }
+
+                if (column == c->column) {
+                    break;
+                }
+
+                while (*p != ' ' && *p != '\n' && *p != '\0') {
+                    p++;
+                }
+
+                column++;
+            }
+
+            v = strtoll(p, &end, 10);
+            p = end;
+            column++;
+
+            if (c->valid && f->last_us != 0 && elapsed > 0 && v >= c->value) {
+                c->rate = (v - c->value) / elapsed;
+
+            } else {
+                c->rate = -1;
+            }
+
+            c->value = v;
+            c->valid = 1;
+
+            i++;
+        }
+
+        continue;
+
+    next:
+
+        /* the line is shorter than expected */
+        i++;
+    }
+
+done:
+
+    f->last_us = now_us;
+    f->updated = time(NULL);
+}
+
+
+static int
+ca_net_counter_cmp(const void *one, const void *two)
+{
+    const ca_net_counter_t  *a = *(ca_net_counter_t **) one;
+    const ca_net_counter_t  *b = *(ca_net_counter_t **) two;
+
+    if (a->line != b->line) {
+        return a->line < b->line ? -1 : 1;
+    }
+
+    if (a->column != b->column) {
+        return a->column < b->column ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+static ca_net_counter_t *
+ca_net_counter_add(ca_net_file_t *f, ca_net_field_t *field)
+{
+    ca_net_counter_t  *c, **cp;
+
+    if (f->counters == NULL) {
+        f->counters = ca_array_create(16, sizeof(ca_net_counter_t *));
+        if (f->counters == NULL) {
+            return NULL;
+        }
+    }
+
+    c = ca_calloc(1, sizeof(ca_net_counter_t));
+    if (c == NULL) {
+        return NULL;
+    }
+
+    cp = ca_array_push(f->counters);
+    if (cp == NULL) {
+        ca_free(c);
+        return NULL;
+    }
+
+    c->key.data = field->name;
+    c->key.len = field->len;
+    c->line = field->line;
+    c->column = field->column;
+    c->rate = -1;
+
+    *cp = c;
+
+    ca_array_sort(f->counters, ca_net_counter_cmp);
+
+    /* read the new counter on this pass */
+    f->updated = 0;
+
+    return c;
+}
+
+
+static ca_net_counter_t *
+ca_net_counter(ca_str_t *key, time_t now, time_t freq)
+{
+    ca_uint_t           i, j;
+    ca_net_file_t      *f;
+    ca_net_field_t     *field;
+    ca_net_counter_t  **cp, *c;
+
+    c = NULL;
+    f = NULL;
+
+    for (i = 0; i < CA_NET_NFILES && c == NULL; i++) {
+        f = &ca_s_net_files[i];
+
+        if (f->counters == NULL) {
+            continue;
+        }
+
+        cp = f->counters->elem;
+
+        for (j = 0; j < f->counters->nelem; j++) {
+            if (cp[j]->key.len == key->len
+                && ca_strncmp(cp[j]->key.data, key->data, key->len) == 0)
+            {
+                c = cp[j];
+                break;
+            }
+        }
+    }
+
+    /* first use of this counter, find it in the field index */
+
+    for (i = 0; i < CA_NET_NFILES && c == NULL; i++) {
+        f = &ca_s_net_files[i];
+
+        if (f->fields == NULL && ca_net_stat_index(f) != CA_OK) {
+            continue;
+        }
+
+        field = f->fields->elem;
+
+        for (j = 0; j < f->fields->nelem; j++) {
+            if (field[j].len == key->len
+                && ca_strncmp(field[j].name, key->data, key->len) == 0)
+            {
+                c = ca_net_counter_add(f, &field[j]);
+                break;
+            }
+        }
+    }
+
+    if (c == NULL) {
+        return NULL;
+    }
+
+    if (f->updated + freq <= now) {
+        ca_get_net_stat_info(f);
+    }
+
+    return c->valid ? c : NULL;
+}
+
+
+u_char *
+ca_get_net_stat(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char      net_stat[24];
+    ca_net_counter_t  *c;
+
+    c = ca_net_counter(key, now, freq);
+
+    if (c != NULL && c->rate >= 0) {
+        ca_snprintf(net_stat, sizeof(net_stat), "%.2f%Z", c->rate);
+
+    } else {
+        net_stat[0] = '\0';
+    }
+
+    return net_stat;
+}
+
+
+u_char *
+ca_get_net_stat_value(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char      net_stat_value[24];
+    ca_net_counter_t  *c;
+
+    c = ca_net_counter(key, now, freq);
+
+    if (c != NULL) {
+        ca_snprintf(net_stat_value, sizeof(net_stat_value), "%L%Z", c->value);
+
+    } else {
+        net_stat_value[0] = '\0';
+    }
+
+    return net_stat_value;
+}
@@ -0,0 +1,9 @@
+#ifndef __CA_NET_STAT_H_INCLUDED__
+#define __CA_NET_STAT_H_INCLUDED__
+
+
+u_char *ca_get_net_stat(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_net_stat_value(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_NET_STAT_H_INCLUDED__ */
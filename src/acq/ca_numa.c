@@ -0,0 +1,480 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+
+#define CA_NUMA_NODE_DIR        "/sys/devices/system/node"
+#define CA_NUMA_BUF_SIZE        8192
+
+#define CA_NUMA_MEM_TOTAL       0
+#define CA_NUMA_MEM_FREE        1
+#define CA_NUMA_MEM_USED        2
+#define CA_NUMA_NMEM            3
+
+#define CA_NUMA_HIT             0
+#define CA_NUMA_MISS            1
+#define CA_NUMA_FOREIGN         2
+#define CA_NUMA_OTHER_NODE      3
+#define CA_NUMA_NSTAT           4
+
+
+typedef struct {
+    ca_uint_t   id;
+    int         meminfo_fd;
+    int         numastat_fd;
+    int64_t     mem[CA_NUMA_NMEM];          /* kB, -1 if unknown */
+    int64_t     stat[CA_NUMA_NSTAT];        /* pages */
+    double      rate[CA_NUMA_NSTAT];        /* per second, -1 if unknown */
+} ca_numa_node_t;
+
+
+typedef struct {
+    ca_numa_node_t  *nodes;                 /* by id */
+    ca_uint_t        nnodes;
+    unsigned         discovered:1;
+    u_char          *buf;
+    uint64_t         last_us;
+    time_t           updated;
+} ca_numa_info_t;
+
+
+static ca_numa_info_t  ca_s_numa_info;
+
+
+/* "Node 0 MemTotal:  4685560 kB", the first three lines */
+static const char  *ca_s_numa_mem_fields[CA_NUMA_NMEM] = {
+    "MemTotal:",
+    "MemFree:",
+    "MemUsed:",
+};
+
+
+static const char  *ca_s_numa_stat_fields[CA_NUMA_NSTAT] = {
+    "numa_hit",
+    "numa_miss",
+    "numa_foreign",
+    "other_node",
+};
+
+
+static int
+ca_numa_node_cmp(const void *one, const void *two)
+{
+    const ca_numa_node_t  *a = one;
+    const ca_numa_node_t  *b = two;
+
+    if (a->id != b->id) {
+        return a->id < b->id ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Nodes do not come and go without a reboot on the machines we run on,
+ * so they are looked for once and their files kept open.
+ */
+static void
+ca_numa_discover(void)
+{
+    char             path[256];
+    DIR             *dir;
+    size_t           len;
+    ca_int_t         id;
+    ca_uint_t        nalloc;
+    struct dirent   *de;
+    ca_numa_node_t  *node, *nodes;
+
+    ca_s_numa_info.discovered = 1;
+
+    ca_s_numa_info.buf = ca_alloc(CA_NUMA_BUF_SIZE);
+    if (ca_s_numa_info.buf == NULL) {
+        return;
+    }
+
+    dir = opendir(CA_NUMA_NODE_DIR);
+    if (dir == NULL) {
+        ca_log_warn(errno, "opendir(\"%s\") failed", CA_NUMA_NODE_DIR);
+        return;
+    }
+
+    nalloc = 0;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (ca_strncmp(de->d_name, "node", 4) != 0) {
+            continue;
+        }
+
+        len = ca_strlen(de->d_name + 4);
+
+        id = ca_atoi((u_char *) de->d_name + 4, len);
+        if (id == CA_ERROR) {
+            continue;
+        }
+
+        if (ca_s_numa_info.nnodes == nalloc) {
+            nalloc = nalloc ? nalloc * 2 : 4;
+
+            nodes = ca_realloc(ca_s_numa_info.nodes,
+                               nalloc * sizeof(ca_numa_node_t));
+            if (nodes == NULL) {
+                break;
+            }
+
+            ca_s_numa_info.nodes = nodes;
+        }
+
+        node = &ca_s_numa_info.nodes[ca_s_numa_info.nnodes];
+        ca_memzero(node, sizeof(ca_numa_node_t));
+
+        ca_snprintf((u_char *) path, sizeof(path), "%s/%s/meminfo%Z",
+                    CA_NUMA_NODE_DIR, de->d_name);
+        node->meminfo_fd = open(path, O_RDONLY|O_CLOEXEC);
+
+        ca_snprintf((u_char *) path, sizeof(path), "%s/%s/numastat%Z",
+                    CA_NUMA_NODE_DIR, de->d_name);
+        node->numastat_fd = open(path, O_RDONLY|O_CLOEXEC);
+
+        if (node->meminfo_fd == CA_INVALID_FILE
+            || node->numastat_fd == CA_INVALID_FILE)
+        {
+            ca_log_warn(errno, "numa node%d skipped", id);
+
+            if (node->meminfo_fd != CA_INVALID_FILE) {
+                close(node->meminfo_fd);
+            }
+
+            if (node->numastat_fd != CA_INVALID_FILE) {
+                close(node->numastat_fd);
+            }
+
+            continue;
+        }
+
+        node->id = id;
+        ca_s_numa_info.nnodes++;
+    }
+
+    closedir(dir);
+
+    if (ca_s_numa_info.nnodes > 1) {
+        qsort(ca_s_numa_info.nodes, ca_s_numa_info.nnodes,
+              sizeof(ca_numa_node_t), ca_numa_node_cmp);
+    }
+
+    ca_log_debug(0, "%ud numa nodes found", ca_s_numa_info.nnodes);
+}
+
+
+static ssize_t
+ca_numa_read(int fd)
+{
+    ssize_t  n, len;
+
+    for (len = 0; len < CA_NUMA_BUF_SIZE - 1; len += n) {
+        n = pread(fd, ca_s_numa_info.buf + len, CA_NUMA_BUF_SIZE - 1 - len,
+                  len);
+        if (n < 0) {
+            return CA_ERROR;
+        }
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    ca_s_numa_info.buf[len] = '\0';
+
+    return len;
+}
+
+
+static void
+ca_numa_parse_meminfo(ca_numa_node_t *node)
+{
+    char       *line, *next, *fields[5];
+    ca_int_t    i, n;
+    ca_uint_t   found;
+
+    for (i = 0; i < CA_NUMA_NMEM; i++) {
+        node->mem[i] = -1;
+    }
+
+    if (ca_numa_read(node->meminfo_fd) == CA_ERROR) {
+        return;
+    }
+
+    found = 0;
+
+    for (line = (char *) ca_s_numa_info.buf;
+         *line && found < CA_NUMA_NMEM;
+         line = next)
+    {
+        next = strchr(line, '\n');
+        if (next == NULL) {
+            next = line + strlen(line);
+
+        } else {
+            *next++ = '\0';
+        }
+
+        n = ca_strsplit(line, fields, 5);
+        if (n < 4) {
+            continue;
+        }
+
+        for (i = 0; i < CA_NUMA_NMEM; i++) {
+            if (strcmp(fields[2], ca_s_numa_mem_fields[i]) == 0) {
+                node->mem[i] = strtoll(fields[3], NULL, 10);
+                found++;
+                break;
+            }
+        }
+    }
+}
+
+
+static void
+ca_numa_parse_numastat(ca_numa_node_t *node, double elapsed)
+{
+    char       *line, *next, *fields[2];
+    int64_t     v;
+    ca_int_t    i, n;
+    ca_uint_t   found;
+
+    for (i = 0; i < CA_NUMA_NSTAT; i++) {
+        node->rate[i] = -1;
+    }
+
+    if (ca_numa_read(node->numastat_fd) == CA_ERROR) {
+        return;
+    }
+
+    found = 0;
+
+    for (line = (char *) ca_s_numa_info.buf;
+         *line && found < CA_NUMA_NSTAT;
+         line = next)
+    {
+        next = strchr(line, '\n');
+        if (next == NULL) {
+            next = line + strlen(line);
+
+        } else {
+            *next++ = '\0';
+        }
+
+        n = ca_strsplit(line, fields, 2);
+        if (n < 2) {
+            continue;
+        }
+
+        for (i = 0; i < CA_NUMA_NSTAT; i++) {
+            if (strcmp(fields[0], ca_s_numa_stat_fields[i]) != 0) {
+                continue;
+            }
+
+            v = strtoll(fields[1], NULL, 10);
+
+            if (elapsed > 0 && v >= node->stat[i]) {
+                node->rate[i] = (v - node->stat[i]) / elapsed;
+            }
+
+            node->stat[i] = v;
+            found++;
+            break;
+        }
+    }
+}
+
+
+static void
+ca_get_numa_info(void)
+{
+    double      elapsed;
+    uint64_t    now_us;
+    ca_uint_t   i;
+
+    if (!ca_s_numa_info.discovered) {
+        ca_numa_discover();
+    }
+
+    if (ca_s_numa_info.buf == NULL) {
+        return;
+    }
+
+    now_us = ca_time_us();
+    elapsed = ca_s_numa_info.last_us
+              ? (now_us - ca_s_numa_info.last_us) / 1000000.0 : 0;
+
+    for (i = 0; i < ca_s_numa_info.nnodes; i++) {
+        ca_numa_parse_meminfo(&ca_s_numa_info.nodes[i]);
+        ca_numa_parse_numastat(&ca_s_numa_info.nodes[i], elapsed);
+    }
+
+    ca_s_numa_info.last_us = now_us;
+    ca_s_numa_info.updated = time(NULL);
+}
+
+
+/*
+ * <node> or "all", the sum of the nodes; -1 if the node is unknown or
+ * one of the values summed is.
+ */
+static double
+ca_numa_value(ca_str_t *key, time_t now, time_t freq, ca_uint_t mem,
+    ca_uint_t index)
+{
+    double           v, sum;
+    ca_int_t         id;
+    ca_uint_t        i;
+    ca_numa_node_t  *node;
+
+    if (ca_s_numa_info.updated + freq <= now) {
+        ca_get_numa_info();
+    }
+
+    if (key->len == 3 && ca_strncmp(key->data, "all", 3) == 0) {
+        id = -1;
+
+    } else {
+        id = ca_atoi(key->data, key->len);
+        if (id == CA_ERROR) {
+            return -1;
+        }
+    }
+
+    sum = -1;
+
+    for (i = 0; i < ca_s_numa_info.nnodes; i++) {
+        node = &ca_s_numa_info.nodes[i];
+
+        if (id != -1 && node->id != (ca_uint_t) id) {
+            continue;
+        }
+
+        v = mem ? node->mem[index] : node->rate[index];
+        if (v < 0) {
+            return -1;
+        }
+
+        sum = (sum < 0) ? v : sum + v;
+
+        if (id != -1) {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+
+static u_char *
+ca_numa_mem(ca_str_t *key, time_t now, time_t freq, ca_uint_t index,
+    u_char *buf, size_t size)
+{
+    double  v;
+
+    v = ca_numa_value(key, now, freq, 1, index);
+
+    if (v >= 0) {
+        ca_snprintf(buf, size, "%.0f%Z", v);
+
+    } else {
+        buf[0] = '\0';
+    }
+
+    return buf;
+}
+
+
+static u_char *
+ca_numa_rate(ca_str_t *key, time_t now, time_t freq, ca_uint_t index,
+    u_char *buf, size_t size)
+{
+    double  v;
+
+    v = ca_numa_value(key, now, freq, 0, index);
+
+    if (v >= 0) {
+        ca_snprintf(buf, size, "%.2f%Z", v);
+
+    } else {
+        buf[0] = '\0';
+    }
+
+    return buf;
+}
+
+
+u_char *
+ca_get_numa_mem_total(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  numa_mem_total[24];
+
+    return ca_numa_mem(key, now, freq, CA_NUMA_MEM_TOTAL, numa_mem_total,
+                       sizeof(numa_mem_total));
+}
+
+
+u_char *
+ca_get_numa_mem_free(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  numa_mem_free[24];
+
+    return ca_numa_mem(key, now, freq, CA_NUMA_MEM_FREE, numa_mem_free,
+                       sizeof(numa_mem_free));
+}
+
+
+u_char *
+ca_get_numa_mem_used(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  numa_mem_used[24];
+
+    return ca_numa_mem(key, now, freq, CA_NUMA_MEM_USED, numa_mem_used,
+                       sizeof(numa_mem_used));
+}
+
+
+u_char *
+ca_get_numa_hit(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  numa_hit[24];
+
+    return ca_numa_rate(key, now, freq, CA_NUMA_HIT, numa_hit,
+                        sizeof(numa_hit));
+}
+
+
+u_char *
+ca_get_numa_miss(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  numa_miss[24];
+
+    return ca_numa_rate(key, now, freq, CA_NUMA_MISS, numa_miss,
+                        sizeof(numa_miss));
+}
+
+
+u_char *
+ca_get_numa_foreign(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  numa_foreign[24];
+
+    return ca_numa_rate(key, now, freq, CA_NUMA_FOREIGN, numa_foreign,
+                        sizeof(numa_foreign));
+}
+
+
+u_char *
+ca_get_numa_other_node(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  numa_other_node[24];
+
+    return ca_numa_rate(key, now, freq, CA_NUMA_OTHER_NODE, numa_other_node,
+                        sizeof(numa_other_node));
+}
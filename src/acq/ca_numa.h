@@ -0,0 +1,14 @@
+#ifndef __CA_NUMA_H_INCLUDED__
+#define __CA_NUMA_H_INCLUDED__
+
+
+u_char *ca_get_numa_mem_total(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_numa_mem_free(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_numa_mem_used(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_numa_hit(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_numa_miss(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_numa_foreign(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_numa_other_node(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_NUMA_H_INCLUDED__ */
@@ -0,0 +1,257 @@
+#include "../clagent.h"
+#include "../ca_so.h"
+
+
+/*
+ * A plugin is loaded when its directive is read, before the acq block,
+ * so that its items are known there; the acq process inherits it.
+ */
+typedef struct {
+    ca_str_t             path;
+    void                *handle;
+    ca_acq_plugin_t     *plugin;
+    ca_acq_slot_t       *slots;
+    ca_uint_t            nslots;
+    ca_uint_t            inited;
+} ca_plugin_t;
+
+
+static ca_plugin_t  ca_s_plugins[CA_ACQ_PLUGINS];
+static ca_uint_t    ca_s_nplugins;
+
+
+char *
+ca_conf_acq_plugin(ca_conf_t *cf, ca_command_t *cmd, void *conf)
+{
+    ca_str_t                   *value;
+    ca_uint_t                   i;
+    ca_plugin_t                *p;
+    ca_symbol_t                 syms[2];
+    ca_acq_plugin_register_pt   reg;
+
+    value = cf->args->elem;
+
+    if (ca_s_nplugins == CA_ACQ_PLUGINS) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "too many acq plugins, at most %d",
+                          CA_ACQ_PLUGINS);
+        return CA_CONF_ERROR;
+    }
+
+    for (i = 0; i < ca_s_nplugins; i++) {
+        if (ca_s_plugins[i].path.len == value[1].len
+            && ca_strncmp(ca_s_plugins[i].path.data, value[1].data,
+                          value[1].len)
+               == 0)
+        {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "duplicate acq plugin \"%V\"", &value[1]);
+            return CA_CONF_ERROR;
+        }
+    }
+
+    p = &ca_s_plugins[ca_s_nplugins];
+    ca_memzero(p, sizeof(ca_plugin_t));
+
+    reg = NULL;
+    syms[0].sym_name = CA_ACQ_PLUGIN_REGISTER;
+    syms[0].sym_ptr = (void **) &reg;
+    syms[0].no_error = 0;
+    syms[1].sym_name = NULL;
+
+    if (ca_load_so(&p->handle, syms, (char *) value[1].data) < 0) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "load acq plugin \"%V\" failed", &value[1]);
+        return CA_CONF_ERROR;
+    }
+
+    p->plugin = reg();
+
+    if (p->plugin == NULL
+        || p->plugin->version != CA_ACQ_PLUGIN_VERSION
+        || p->plugin->items == NULL
+        || p->plugin->collect == NULL)
+    {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "acq plugin \"%V\" is not of version %d or "
+                          "declares no items", &value[1],
+                          CA_ACQ_PLUGIN_VERSION);
+        ca_unload_so(&p->handle);
+        return CA_CONF_ERROR;
+    }
+
+    p->path = value[1];
+    ca_s_nplugins++;
+
+    ca_log_debug(0, "acq plugin \"%s\" loaded from \"%V\"",
+                 p->plugin->name ? p->plugin->name : "", &value[1]);
+
+    return CA_CONF_OK;
+}
+
+
+/* the plugin and the index of the item it declares as name */
+ca_int_t
+ca_plugin_item(ca_str_t *name, ca_uint_t *plugin, ca_uint_t *item)
+{
+    size_t        len;
+    ca_uint_t     i, j;
+    const char  **items;
+
+    for (i = 0; i < ca_s_nplugins; i++) {
+        items = ca_s_plugins[i].plugin->items;
+
+        for (j = 0; items[j] != NULL; j++) {
+            len = ca_strlen(items[j]);
+
+            if (len == name->len
+                && ca_strncasecmp((u_char *) items[j], name->data, len)
+                   == 0)
+            {
+                *plugin = i;
+                *item = j;
+                return CA_OK;
+            }
+        }
+    }
+
+    return CA_ERROR;
+}
+
+
+/* the plugin of the name it declares */
+ca_int_t
+ca_plugin_index(ca_str_t *name)
+{
+    ca_uint_t     i;
+    const char   *p;
+
+    for (i = 0; i < ca_s_nplugins; i++) {
+        p = ca_s_plugins[i].plugin->name;
+
+        if (p != NULL && ca_strlen(p) == name->len
+            && ca_strncmp(p, name->data, name->len) == 0)
+        {
+            return i;
+        }
+    }
+
+    return CA_ERROR;
+}
+
+
+/* NULL if there is no such plugin */
+const char *
+ca_plugin_name(ca_uint_t plugin)
+{
+    const char  *p;
+
+    if (plugin >= ca_s_nplugins) {
+        return NULL;
+    }
+
+    p = ca_s_plugins[plugin].plugin->name;
+
+    return p ? p : "";
+}
+
+
+ca_int_t
+ca_plugin_init(void *conf)
+{
+    ca_uint_t     i;
+    ca_plugin_t  *p;
+
+    for (i = 0; i < ca_s_nplugins; i++) {
+        p = &ca_s_plugins[i];
+
+        if (p->plugin->init != NULL && p->plugin->init() != CA_OK) {
+            ca_log_crit(0, "init acq plugin \"%V\" failed", &p->path);
+            return CA_ERROR;
+        }
+
+        p->inited = 1;
+    }
+
+    return CA_OK;
+}
+
+
+/*
+ * Sample the due items of a plugin with one call of its collect(), the
+ * values are left in the slots of the items as a handler does.
+ */
+void
+ca_plugin_collect(ca_uint_t plugin, time_t now, ca_acq_t **items,
+    ca_uint_t n)
+{
+    ca_uint_t        i;
+    ca_plugin_t     *p;
+    ca_acq_slot_t   *slot;
+    ca_acq_value_t  *v;
+
+    p = &ca_s_plugins[plugin];
+
+    if (n > p->nslots) {
+        slot = ca_realloc(p->slots, n * sizeof(ca_acq_slot_t));
+        if (slot == NULL) {
+            return;
+        }
+
+        p->slots = slot;
+        p->nslots = n;
+    }
+
+    for (i = 0; i < n; i++) {
+        v = &items[i]->sample;
+        v->type = CA_ACQ_VALUE_NONE;
+        v->prec = 0;
+        v->unit = NULL;
+
+        slot = &p->slots[i];
+        slot->item = items[i]->plugin_item;
+        slot->key = items[i]->key.len ? &items[i]->key : NULL;
+        slot->freq = items[i]->forced ? 0 : items[i]->freq;
+        slot->value = v;
+    }
+
+    p->plugin->collect(now, p->slots, n);
+
+    for (i = 0; i < n; i++) {
+        items[i]->forced = 0;
+        items[i]->sampled = now;
+        items[i]->ready = 1;
+    }
+}
+
+
+void
+ca_plugin_exit(void)
+{
+    ca_uint_t     i;
+    ca_plugin_t  *p;
+
+    for (i = 0; i < ca_s_nplugins; i++) {
+        p = &ca_s_plugins[i];
+
+        if (p->inited && p->plugin->exit != NULL) {
+            p->plugin->exit();
+        }
+
+        p->inited = 0;
+    }
+}
+
+
+void
+ca_plugin_unload(void)
+{
+    ca_uint_t  i;
+
+    for (i = 0; i < ca_s_nplugins; i++) {
+        ca_free(ca_s_plugins[i].slots);
+        ca_unload_so(&ca_s_plugins[i].handle);
+    }
+
+    ca_s_nplugins = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef __CA_PLUGIN_H_INCLUDED__
+#define __CA_PLUGIN_H_INCLUDED__
+
+
+#define CA_ACQ_PLUGIN_VERSION   1
+#define CA_ACQ_PLUGIN_REGISTER  "ca_acq_plugin_register"
+#define CA_ACQ_PLUGINS          16
+
+
+/*
+ * A due item of a plugin: item is the index of its name in the items
+ * the plugin declared, key is NULL if the item has none.  The plugin
+ * writes the value into the slot, a value left NONE is not shipped.
+ */
+typedef struct {
+    ca_uint_t           item;
+    ca_str_t           *key;
+    time_t              freq;
+    ca_acq_value_t     *value;
+} ca_acq_slot_t;
+
+/*
+ * What the registration symbol of a plugin, a function returning it,
+ * declares.  collect() is called on an acq pool thread with all the due
+ * items of the plugin at once, so a source read once may serve all of
+ * them.  init() and exit() are optional, and are called in the acq
+ * process.
+ */
+typedef struct {
+    ca_uint_t           version;
+    const char         *name;
+    const char        **items;                /* NULL terminated */
+    ca_int_t          (*init)(void);
+    void              (*collect)(time_t now, ca_acq_slot_t *slots,
+                                 ca_uint_t n);
+    void              (*exit)(void);
+} ca_acq_plugin_t;
+
+typedef ca_acq_plugin_t *(*ca_acq_plugin_register_pt)(void);
+
+
+char *ca_conf_acq_plugin(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+
+ca_int_t ca_plugin_item(ca_str_t *name, ca_uint_t *plugin, ca_uint_t *item);
+ca_int_t ca_plugin_index(ca_str_t *name);
+const char *ca_plugin_name(ca_uint_t plugin);
+ca_int_t ca_plugin_init(void *conf);
+void ca_plugin_collect(ca_uint_t plugin, time_t now, ca_acq_t **items,
+    ca_uint_t n);
+void ca_plugin_exit(void);
+void ca_plugin_unload(void);
+
+
+#endif /* __CA_PLUGIN_H_INCLUDED__ */
@@ -0,0 +1,439 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+
+#define CA_PRESSURE_CPU     0
+#define CA_PRESSURE_MEMORY  1
+#define CA_PRESSURE_IO      2
+#define CA_PRESSURE_NUM     3
+
+#define CA_PRESSURE_SOME    0
+#define CA_PRESSURE_FULL    1
+
+
+typedef struct {
+    double    avg10;
+    double    avg60;
+    int64_t   total;           /* us */
+    int64_t   last_total;
+    double    rate;            /* stalled us per second */
+} ca_pressure_line_t;
+
+
+typedef struct {
+    const char          *name;
+    const char          *path;
+    int                  fd;
+    ca_pressure_line_t   line[2];
+    uint64_t             last_us;
+    time_t               updated;
+} ca_pressure_info_t;
+
+
+static ca_pressure_info_t  ca_s_pressure_info[CA_PRESSURE_NUM] = {
+    { "cpu",    "/proc/pressure/cpu",    CA_INVALID_FILE },
+    { "memory", "/proc/pressure/memory", CA_INVALID_FILE },
+    { "io",     "/proc/pressure/io",     CA_INVALID_FILE },
+};
+
+
+static ca_acq_key_handler_pt  ca_s_pressure_handlers[] = {
+    &ca_get_pressure_some_avg10,
+    &ca_get_pressure_some_avg60,
+    &ca_get_pressure_full_avg10,
+    &ca_get_pressure_full_avg60,
+    &ca_get_pressure_some_rate,
+    &ca_get_pressure_full_rate,
+    NULL
+};
+
+
+static ca_pressure_info_t *
+ca_pressure_lookup(u_char *name, size_t len)
+{
+    ca_int_t  i;
+
+    for (i = 0; i < CA_PRESSURE_NUM; i++) {
+        if (len == ca_strlen(ca_s_pressure_info[i].name)
+            && ca_strncmp(name, ca_s_pressure_info[i].name, len) == 0)
+        {
+            return &ca_s_pressure_info[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ * full avg10=0.00 avg60=0.00 avg300=0.00 total=0
+ */
+static void
+ca_get_pressure_info(ca_pressure_info_t *info)
+{
+    char                 buf[256], *line, *next, *fields[6];
+    int                  n, numfields;
+    uint64_t             now_us;
+    double               elapsed;
+    ssize_t              len;
+    ca_pressure_line_t  *pl;
+
+    if (info->fd == CA_INVALID_FILE) {
+        info->fd = open(info->path, O_RDONLY|O_CLOEXEC);
+        if (info->fd == CA_INVALID_FILE) {
+            return;
+        }
+    }
+
+    len = pread(info->fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        return;
+    }
+    buf[len] = '\0';
+
+    now_us = ca_time_us();
+    elapsed = (now_us - info->last_us) / 1000000.0;
+
+    for (line = buf; *line; line = next) {
+        next = strchr(line, '\n');
+        if (next == NULL) {
+            next = line + strlen(line);
+        } else {
+            *next++ = '\0';
+        }
+
+        numfields = ca_strsplit(line, fields, 6);
+        if (numfields < 5) {
+            continue;
+        }
+
+        if (strcmp(fields[0], "some") == 0) {
+            pl = &info->line[CA_PRESSURE_SOME];
+
+        } else if (strcmp(fields[0], "full") == 0) {
+            pl = &info->line[CA_PRESSURE_FULL];
+
+        } else {
+            continue;
+        }
+
+        for (n = 1; n < numfields; n++) {
+            if (strncmp(fields[n], "avg10=", 6) == 0) {
+                pl->avg10 = atof(fields[n] + 6);
+
+            } else if (strncmp(fields[n], "avg60=", 6) == 0) {
+                pl->avg60 = atof(fields[n] + 6);
+
+            } else if (strncmp(fields[n], "total=", 6) == 0) {
+                pl->total = atoll(fields[n] + 6);
+            }
+        }
+
+        if (info->last_us != 0 && elapsed > 0 && pl->last_total >= 0
+            && pl->total >= pl->last_total)
+        {
+            pl->rate = (pl->total - pl->last_total) / elapsed;
+
+        } else {
+            pl->rate = -1;
+        }
+
+        pl->last_total = pl->total;
+    }
+
+    info->last_us = now_us;
+    info->updated = time(NULL);
+}
+
+
+static ca_pressure_line_t *
+ca_pressure_line(ca_str_t *key, time_t now, time_t freq, ca_int_t type)
+{
+    ca_pressure_info_t  *info;
+
+    info = ca_pressure_lookup(key->data, key->len);
+    if (info == NULL) {
+        return NULL;
+    }
+
+    if (info->updated + freq <= now) {
+        ca_get_pressure_info(info);
+    }
+
+    if (info->updated == 0) {
+        return NULL;
+    }
+
+    return &info->line[type];
+}
+
+
+static void
+ca_pressure_trigger_handler(ca_acq_event_t *ev)
+{
+    ca_int_t             i;
+    ca_str_t             key;
+    ca_pressure_info_t  *info = ev->data;
+
+    ca_log_info(0, "%s pressure trigger fired", info->name);
+
+    /* force a fresh read of this resource and collect its items now */
+
+    info->updated = 0;
+
+    key.len = ca_strlen(info->name);
+    key.data = (u_char *) info->name;
+
+    for (i = 0; ca_s_pressure_handlers[i] != NULL; i++) {
+        ca_acq_expedite(ca_s_pressure_handlers[i], &key);
+    }
+}
+
+
+char *
+ca_conf_pressure_trigger(ca_conf_t *cf, ca_command_t *cmd, void *conf)
+{
+    ca_conf_ctx_t          *ctx = conf;
+    ca_str_t               *value;
+    ca_int_t                threshold, window;
+    ca_pressure_trigger_t  *trigger;
+
+    value = cf->args->elem;
+
+    if (ca_pressure_lookup(value[1].data, value[1].len) == NULL) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid resource \"%V\", "
+                          "it must be \"cpu\", \"memory\" or \"io\"",
+                          &value[1]);
+        return CA_CONF_ERROR;
+    }
+
+    if (ca_strcmp(value[2].data, "some") != 0
+        && ca_strcmp(value[2].data, "full") != 0)
+    {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid type \"%V\", it must be \"some\" or \"full\"",
+                          &value[2]);
+        return CA_CONF_ERROR;
+    }
+
+    threshold = ca_parse_time(&value[3], 0);
+    window = ca_parse_time(&value[4], 0);
+
+    if (threshold == CA_ERROR || window == CA_ERROR || threshold == 0
+        || threshold > window)
+    {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid threshold or window of pressure trigger");
+        return CA_CONF_ERROR;
+    }
+
+    if (ctx->pressure_triggers == NULL) {
+        ctx->pressure_triggers = ca_array_create(4,
+                                                 sizeof(ca_pressure_trigger_t));
+        if (ctx->pressure_triggers == NULL) {
+            return CA_CONF_ERROR;
+        }
+    }
+
+    trigger = ca_array_push(ctx->pressure_triggers);
+    if (trigger == NULL) {
+        return CA_CONF_ERROR;
+    }
+
+    trigger->resource = value[1];
+    trigger->type = value[2];
+    trigger->threshold = threshold;
+    trigger->window = window;
+
+    return CA_CONF_OK;
+}
+
+
+/*
+ * Register the configured PSI triggers.  Each one gets its own fd on
+ * /proc/pressure/<resource>, which the kernel flags with POLLPRI when
+ * the stall time within the window exceeds the threshold.
+ */
+ca_int_t
+ca_pressure_init(void *dummy)
+{
+    int                     fd;
+    ca_uint_t               i;
+    ssize_t                 len;
+    u_char                  buf[64], *p;
+    ca_conf_ctx_t          *conf = dummy;
+    ca_acq_event_t         *ev;
+    ca_pressure_info_t     *info;
+    ca_pressure_trigger_t  *trigger;
+
+    if (conf->pressure_triggers == NULL) {
+        return CA_OK;
+    }
+
+    trigger = conf->pressure_triggers->elem;
+
+    for (i = 0; i < conf->pressure_triggers->nelem; i++) {
+        info = ca_pressure_lookup(trigger[i].resource.data,
+                                  trigger[i].resource.len);
+
+        fd = open(info->path, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+        if (fd == CA_INVALID_FILE) {
+            ca_log_err(errno, "open \"%s\" failed", info->path);
+            continue;
+        }
+
+        p = ca_snprintf(buf, sizeof(buf), "%V %uL %uL%Z", &trigger[i].type,
+                        (uint64_t) trigger[i].threshold * 1000,
+                        (uint64_t) trigger[i].window * 1000);
+
+        len = p - buf;
+
+        if (write(fd, buf, len) != len) {
+            ca_log_err(errno, "register %s pressure trigger \"%s\" failed",
+                       info->name, buf);
+            close(fd);
+            continue;
+        }
+
+        ev = ca_calloc(1, sizeof(ca_acq_event_t));
+        if (ev == NULL) {
+            close(fd);
+            return CA_ERROR;
+        }
+
+        ev->fd = fd;
+        ev->events = POLLPRI;
+        ev->handler = ca_pressure_trigger_handler;
+        ev->data = info;
+
+        if (ca_acq_add_event(ev) != CA_OK) {
+            close(fd);
+            ca_free(ev);
+            return CA_ERROR;
+        }
+
+        ca_log_debug(0, "%s pressure trigger \"%s\" registered",
+                     info->name, buf);
+    }
+
+    return CA_OK;
+}
+
+
+u_char *
+ca_get_pressure_some_avg10(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char        some_avg10[20];
+    ca_pressure_line_t  *pl;
+
+    pl = ca_pressure_line(key, now, freq, CA_PRESSURE_SOME);
+
+    if (pl != NULL) {
+        ca_snprintf(some_avg10, sizeof(some_avg10), "%.2f%Z", pl->avg10);
+
+    } else {
+        some_avg10[0] = '\0';
+    }
+
+    return some_avg10;
+}
+
+
+u_char *
+ca_get_pressure_some_avg60(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char        some_avg60[20];
+    ca_pressure_line_t  *pl;
+
+    pl = ca_pressure_line(key, now, freq, CA_PRESSURE_SOME);
+
+    if (pl != NULL) {
+        ca_snprintf(some_avg60, sizeof(some_avg60), "%.2f%Z", pl->avg60);
+
+    } else {
+        some_avg60[0] = '\0';
+    }
+
+    return some_avg60;
+}
+
+
+u_char *
+ca_get_pressure_full_avg10(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char        full_avg10[20];
+    ca_pressure_line_t  *pl;
+
+    pl = ca_pressure_line(key, now, freq, CA_PRESSURE_FULL);
+
+    if (pl != NULL) {
+        ca_snprintf(full_avg10, sizeof(full_avg10), "%.2f%Z", pl->avg10);
+
+    } else {
+        full_avg10[0] = '\0';
+    }
+
+    return full_avg10;
+}
+
+
+u_char *
+ca_get_pressure_full_avg60(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char        full_avg60[20];
+    ca_pressure_line_t  *pl;
+
+    pl = ca_pressure_line(key, now, freq, CA_PRESSURE_FULL);
+
+    if (pl != NULL) {
+        ca_snprintf(full_avg60, sizeof(full_avg60), "%.2f%Z", pl->avg60);
+
+    } else {
+        full_avg60[0] = '\0';
+    }
+
+    return full_avg60;
+}
+
+
+u_char *
+ca_get_pressure_some_rate(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char        some_rate[20];
+    ca_pressure_line_t  *pl;
+
+    pl = ca_pressure_line(key, now, freq, CA_PRESSURE_SOME);
+
+    if (pl != NULL && pl->rate >= 0) {
+        ca_snprintf(some_rate, sizeof(some_rate), "%.0f%Z", pl->rate);
+
+    } else {
+        some_rate[0] = '\0';
+    }
+
+    return some_rate;
+}
+
+
+u_char *
+ca_get_pressure_full_rate(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char        full_rate[20];
+    ca_pressure_line_t  *pl;
+
+    pl = ca_pressure_line(key, now, freq, CA_PRESSURE_FULL);
+
+    if (pl != NULL && pl->rate >= 0) {
+        ca_snprintf(full_rate, sizeof(full_rate), "%.0f%Z", pl->rate);
+
+    } else {
+        full_rate[0] = '\0';
+    }
+
+    return full_rate;
+}
@@ -0,0 +1,24 @@
+#ifndef __CA_PRESSURE_H_INCLUDED__
+#define __CA_PRESSURE_H_INCLUDED__
+
+
+typedef struct {
+    ca_str_t   resource;       /* cpu, memory or io */
+    ca_str_t   type;           /* some or full */
+    ca_uint_t  threshold;      /* ms */
+    ca_uint_t  window;         /* ms */
+} ca_pressure_trigger_t;
+
+
+char *ca_conf_pressure_trigger(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+
+ca_int_t ca_pressure_init(void *conf);
+u_char *ca_get_pressure_some_avg10(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_pressure_some_avg60(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_pressure_full_avg10(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_pressure_full_avg60(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_pressure_some_rate(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_pressure_full_rate(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_PRESSURE_H_INCLUDED__ */
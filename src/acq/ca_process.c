@@ -0,0 +1,1019 @@
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+
+#define CA_PROC_MAX_GROUPS      32
+#define CA_PROC_TOP_MAX         32
+#define CA_PROC_COMM_LEN        16
+#define CA_PROC_DENTS_SIZE      32768
+#define CA_PROC_CHECK_EVERY     32
+
+#define CA_PROC_TOP_CPU         0
+#define CA_PROC_TOP_RSS         1
+#define CA_PROC_TOP_IO          2
+#define CA_PROC_TOP_NUM         3
+
+#define CA_PROC_SCAN_INTERVAL   10        /* s */
+#define CA_PROC_SCAN_BUDGET     10        /* ms */
+
+
+typedef struct {
+    uint64_t        d_ino;
+    int64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+} ca_dirent64_t;
+
+
+typedef struct {
+    pid_t      pid;
+    int        stat_fd;
+    int        statm_fd;
+    int        io_fd;
+    char       comm[CA_PROC_COMM_LEN];
+    uint32_t   groups;              /* bit per matching group */
+    unsigned   matched:1;           /* groups is valid for comm */
+    uint64_t   starttime;
+    uint64_t   ticks;               /* utime + stime */
+    int64_t    read_bytes;
+    int64_t    write_bytes;
+    double     cpu;                 /* % of one cpu */
+    double     io_read;             /* bytes per second */
+    double     io_write;
+    int64_t    rss;                 /* bytes */
+    int64_t    fds;
+    uint64_t   sampled_us;
+} ca_proc_t;
+
+
+typedef struct {
+    ca_str_t   name;
+    ca_uint_t  count;
+    double     cpu;
+    int64_t    rss;
+    double     io_read;
+    double     io_write;
+    int64_t    fds;
+} ca_proc_group_t;
+
+
+typedef struct {
+    pid_t      pid;
+    char       comm[CA_PROC_COMM_LEN];
+    double     value;
+} ca_proc_top_t;
+
+
+typedef struct {
+    ca_proc_match_t  *matches;
+    ca_uint_t         nmatches;
+    ca_proc_group_t   groups[CA_PROC_MAX_GROUPS];
+    ca_uint_t         ngroups;
+
+    ca_proc_top_t     top[CA_PROC_TOP_NUM][CA_PROC_TOP_MAX];
+    ca_uint_t         ntop[CA_PROC_TOP_NUM];     /* filled */
+    ca_uint_t         top_n[CA_PROC_TOP_NUM];    /* requested */
+
+    int               proc_fd;
+    ca_array_t       *procs;        /* ca_proc_t *, sorted by pid */
+    ca_array_t       *next;         /* the scan in progress */
+    ca_uint_t         cur;          /* next unmerged entry of procs */
+
+    u_char           *dents;
+    ssize_t           dents_pos;
+    ssize_t           dents_len;
+
+    ca_uint_t         nfds;         /* cached per-pid fds */
+    ca_uint_t         max_fds;
+    long              clk_tck;
+    long              page_size;
+
+    time_t            interval;
+    uint64_t          budget;       /* us of scanning per tick */
+    time_t            started;
+    ca_uint_t         rounds;
+
+    unsigned          enabled:1;
+    unsigned          scanning:1;
+    unsigned          need_io:1;
+    unsigned          need_fds:1;
+} ca_proc_info_t;
+
+
+static ca_proc_info_t  ca_s_proc_info = {
+    .proc_fd  = CA_INVALID_FILE,
+    .interval = CA_PROC_SCAN_INTERVAL,
+    .budget   = CA_PROC_SCAN_BUDGET * 1000,
+};
+
+
+static void
+ca_proc_close(int *fdp)
+{
+    if (*fdp != CA_INVALID_FILE) {
+        close(*fdp);
+        *fdp = CA_INVALID_FILE;
+        ca_s_proc_info.nfds--;
+    }
+}
+
+
+static void
+ca_proc_free(ca_proc_t *p)
+{
+    ca_proc_close(&p->stat_fd);
+    ca_proc_close(&p->statm_fd);
+    ca_proc_close(&p->io_fd);
+    ca_free(p);
+}
+
+
+/*
+ * Read /proc/<pid>/<name>.  The fd is kept open in *fdp while the
+ * budget of cached fds allows it, later reads are a single pread().
+ */
+static ssize_t
+ca_proc_read(ca_proc_t *p, int *fdp, const char *name, char *buf,
+    size_t size)
+{
+    int      fd;
+    char     path[64];
+    ssize_t  n;
+
+    if (*fdp != CA_INVALID_FILE) {
+        n = pread(*fdp, buf, size - 1, 0);
+        if (n > 0) {
+            buf[n] = '\0';
+            return n;
+        }
+
+        /* the task has gone, its pid may have been reused */
+        ca_proc_close(fdp);
+    }
+
+    ca_sprintf((u_char *) path, "%d/%s%Z", (int) p->pid, name);
+
+    fd = openat(ca_s_proc_info.proc_fd, path, O_RDONLY|O_CLOEXEC);
+    if (fd == CA_INVALID_FILE) {
+        return CA_ERROR;
+    }
+
+    n = read(fd, buf, size - 1);
+    if (n <= 0) {
+        close(fd);
+        return CA_ERROR;
+    }
+
+    buf[n] = '\0';
+
+    if (ca_s_proc_info.nfds < ca_s_proc_info.max_fds) {
+        *fdp = fd;
+        ca_s_proc_info.nfds++;
+
+    } else {
+        close(fd);
+    }
+
+    return n;
+}
+
+
+static void
+ca_proc_match(ca_proc_t *p)
+{
+    int         fd;
+    char        path[64], buf[1024], *line, *next, *paths[16];
+    ssize_t     n;
+    ca_uint_t   i, j, npaths;
+    ca_uint_t   loaded;
+
+    p->groups = 0;
+    p->matched = 1;
+    npaths = 0;
+    loaded = 0;
+
+    for (i = 0; i < ca_s_proc_info.nmatches; i++) {
+        if (p->groups & (1U << ca_s_proc_info.matches[i].index)) {
+            continue;
+        }
+
+        if (ca_s_proc_info.matches[i].type == CA_PROC_MATCH_NAME) {
+            if (fnmatch((char *) ca_s_proc_info.matches[i].pattern.data,
+                        p->comm, 0) == 0)
+            {
+                p->groups |= 1U << ca_s_proc_info.matches[i].index;
+            }
+
+            continue;
+        }
+
+        /* the cgroup file is read once for all cgroup matches */
+
+        if (!loaded) {
+            loaded = 1;
+
+            ca_sprintf((u_char *) path, "%d/cgroup%Z", (int) p->pid);
+
+            fd = openat(ca_s_proc_info.proc_fd, path, O_RDONLY|O_CLOEXEC);
+            if (fd == CA_INVALID_FILE) {
+                continue;
+            }
+
+            n = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+
+            if (n <= 0) {
+                continue;
+            }
+
+            buf[n] = '\0';
+
+            /* 0::/system.slice/nginx.service */
+
+            for (line = buf; *line && npaths < 16; line = next) {
+                next = strchr(line, '\n');
+                if (next == NULL) {
+                    next = line + strlen(line);
+
+                } else {
+                    *next++ = '\0';
+                }
+
+                line = strchr(line, ':');
+                if (line != NULL && (line = strchr(line + 1, ':')) != NULL) {
+                    paths[npaths++] = line + 1;
+                }
+            }
+        }
+
+        for (j = 0; j < npaths; j++) {
+            if (fnmatch((char *) ca_s_proc_info.matches[i].pattern.data,
+                        paths[j], 0) == 0)
+            {
+                p->groups |= 1U << ca_s_proc_info.matches[i].index;
+                break;
+            }
+        }
+    }
+}
+
+
+static int64_t
+ca_proc_count_fds(pid_t pid)
+{
+    int             fd;
+    char            path[64];
+    u_char          buf[4096];
+    long            n, pos;
+    int64_t         count;
+    ca_dirent64_t  *de;
+
+    ca_sprintf((u_char *) path, "%d/fd%Z", (int) pid);
+
+    fd = openat(ca_s_proc_info.proc_fd, path,
+                O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd == CA_INVALID_FILE) {
+        return -1;
+    }
+
+    count = 0;
+
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (pos = 0; pos < n; pos += de->d_reclen) {
+            de = (ca_dirent64_t *) (buf + pos);
+            if (de->d_name[0] != '.') {
+                count++;
+            }
+        }
+    }
+
+    close(fd);
+
+    return count;
+}
+
+
+/*
+ * pid (comm) state ppid pgrp session tty_nr tpgid flags minflt cminflt
+ * majflt cmajflt utime stime cutime cstime priority nice num_threads
+ * itrealvalue starttime vsize rss ...
+ */
+static ca_int_t
+ca_proc_sample(ca_proc_t *p, uint64_t now_us)
+{
+    char      buf[1024], *s, *e, *fields[24];
+    size_t    len;
+    double    elapsed;
+    ssize_t   n;
+    int64_t   read_bytes, write_bytes, v;
+    uint64_t  ticks, starttime;
+
+    if (ca_proc_read(p, &p->stat_fd, "stat", buf, sizeof(buf)) == CA_ERROR) {
+        return CA_ERROR;
+    }
+
+    s = strchr(buf, '(');
+    e = strrchr(buf, ')');
+    if (s == NULL || e == NULL || e < s) {
+        return CA_ERROR;
+    }
+
+    *e = '\0';
+    n = ca_strsplit(e + 2, fields, 24);
+    if (n < 22) {
+        return CA_ERROR;
+    }
+
+    ticks = strtoull(fields[11], NULL, 10) + strtoull(fields[12], NULL, 10);
+    starttime = strtoull(fields[19], NULL, 10);
+
+    if (p->starttime != starttime) {
+        /* a new task, or the pid has been reused */
+        ca_proc_close(&p->statm_fd);
+        ca_proc_close(&p->io_fd);
+        p->starttime = starttime;
+        p->sampled_us = 0;
+        p->matched = 0;
+    }
+
+    len = e - s - 1;
+    if (len > CA_PROC_COMM_LEN - 1) {
+        len = CA_PROC_COMM_LEN - 1;
+    }
+
+    if (ca_strncmp(p->comm, s + 1, len) != 0 || p->comm[len] != '\0') {
+        /* exec(), the cgroup may have been changed as well */
+        ca_memcpy(p->comm, s + 1, len);
+        p->comm[len] = '\0';
+        p->matched = 0;
+    }
+
+    if (!p->matched) {
+        ca_proc_match(p);
+    }
+
+    elapsed = (now_us - p->sampled_us) / 1000000.0;
+
+    if (p->sampled_us != 0 && elapsed > 0 && ticks >= p->ticks) {
+        p->cpu = (ticks - p->ticks) * 100.0 / ca_s_proc_info.clk_tck
+                 / elapsed;
+
+    } else {
+        p->cpu = 0;
+    }
+
+    p->ticks = ticks;
+    p->rss = atoll(fields[21]) * ca_s_proc_info.page_size;
+
+    if (p->groups) {
+        /* size resident shared text lib data dt */
+        if (ca_proc_read(p, &p->statm_fd, "statm", buf, sizeof(buf))
+            != CA_ERROR
+            && ca_strsplit(buf, fields, 3) >= 2)
+        {
+            p->rss = atoll(fields[1]) * ca_s_proc_info.page_size;
+        }
+
+        if (ca_s_proc_info.need_fds) {
+            p->fds = ca_proc_count_fds(p->pid);
+        }
+    }
+
+    if (ca_s_proc_info.need_io
+        && (p->groups || ca_s_proc_info.top_n[CA_PROC_TOP_IO]))
+    {
+        read_bytes = -1;
+        write_bytes = -1;
+
+        if (ca_proc_read(p, &p->io_fd, "io", buf, sizeof(buf)) != CA_ERROR) {
+            for (s = buf; s != NULL && *s; s = e) {
+                e = strchr(s, '\n');
+                if (e != NULL) {
+                    *e++ = '\0';
+                }
+
+                if (ca_strsplit(s, fields, 2) != 2) {
+                    continue;
+                }
+
+                v = atoll(fields[1]);
+
+                if (strcmp(fields[0], "read_bytes:") == 0) {
+                    read_bytes = v;
+
+                } else if (strcmp(fields[0], "write_bytes:") == 0) {
+                    write_bytes = v;
+                }
+            }
+        }
+
+        if (p->sampled_us != 0 && elapsed > 0 && p->read_bytes >= 0
+            && read_bytes >= p->read_bytes && write_bytes >= p->write_bytes)
+        {
+            p->io_read = (read_bytes - p->read_bytes) / elapsed;
+            p->io_write = (write_bytes - p->write_bytes) / elapsed;
+
+        } else {
+            p->io_read = 0;
+            p->io_write = 0;
+        }
+
+        p->read_bytes = read_bytes;
+        p->write_bytes = write_bytes;
+    }
+
+    p->sampled_us = now_us;
+
+    return CA_OK;
+}
+
+
+static void
+ca_proc_top_add(ca_uint_t m, ca_proc_t *p, double value)
+{
+    ca_uint_t       i, n, max;
+    ca_proc_top_t  *top;
+
+    top = ca_s_proc_info.top[m];
+    n = ca_s_proc_info.ntop[m];
+    max = ca_s_proc_info.top_n[m];
+
+    if (value <= 0 || (n == max && value <= top[n - 1].value)) {
+        return;
+    }
+
+    if (n < max) {
+        ca_s_proc_info.ntop[m]++;
+
+    } else {
+        n--;
+    }
+
+    for (i = n; i > 0 && top[i - 1].value < value; i--) {
+        top[i] = top[i - 1];
+    }
+
+    top[i].pid = p->pid;
+    top[i].value = value;
+    ca_memcpy(top[i].comm, p->comm, CA_PROC_COMM_LEN);
+}
+
+
+/*
+ * A scan round is complete, publish the per-group sums and the top-N
+ * lists of it.
+ */
+static void
+ca_proc_publish(void)
+{
+    ca_uint_t         i, g;
+    ca_proc_t       **pp, *p;
+    ca_proc_group_t  *grp;
+
+    for (g = 0; g < ca_s_proc_info.ngroups; g++) {
+        grp = &ca_s_proc_info.groups[g];
+        grp->count = 0;
+        grp->cpu = 0;
+        grp->rss = 0;
+        grp->io_read = 0;
+        grp->io_write = 0;
+        grp->fds = 0;
+    }
+
+    for (i = 0; i < CA_PROC_TOP_NUM; i++) {
+        ca_s_proc_info.ntop[i] = 0;
+    }
+
+    pp = ca_s_proc_info.procs->elem;
+
+    for (i = 0; i < ca_s_proc_info.procs->nelem; i++) {
+        p = pp[i];
+
+        for (g = 0; p->groups >> g; g++) {
+            if (!(p->groups & (1U << g))) {
+                continue;
+            }
+
+            grp = &ca_s_proc_info.groups[g];
+            grp->count++;
+            grp->cpu += p->cpu;
+            grp->rss += p->rss;
+            grp->io_read += p->io_read;
+            grp->io_write += p->io_write;
+            grp->fds += p->fds > 0 ? p->fds : 0;
+        }
+
+        if (ca_s_proc_info.top_n[CA_PROC_TOP_CPU]) {
+            ca_proc_top_add(CA_PROC_TOP_CPU, p, p->cpu);
+        }
+
+        if (ca_s_proc_info.top_n[CA_PROC_TOP_RSS]) {
+            ca_proc_top_add(CA_PROC_TOP_RSS, p, (double) p->rss);
+        }
+
+        if (ca_s_proc_info.top_n[CA_PROC_TOP_IO]) {
+            ca_proc_top_add(CA_PROC_TOP_IO, p, p->io_read + p->io_write);
+        }
+    }
+
+    ca_s_proc_info.rounds++;
+}
+
+
+/*
+ * Merge the next entries of /proc into the pid table.  /proc lists the
+ * pids in ascending order, as is the table, so the merge is a single
+ * pass: entries skipped over have exited, new pids are inserted.  The
+ * work stops when the budget of this tick is spent and carries on
+ * from there on the next tick.
+ */
+void
+ca_process_tick(time_t now)
+{
+    pid_t            pid;
+    uint64_t         now_us, deadline;
+    ca_uint_t        n;
+    ca_proc_t      **pp, *p, **np;
+    ca_array_t      *tmp;
+    ca_dirent64_t   *de;
+
+    if (!ca_s_proc_info.enabled || ca_s_proc_info.proc_fd == CA_INVALID_FILE)
+    {
+        return;
+    }
+
+    if (!ca_s_proc_info.scanning) {
+        if (ca_s_proc_info.started + ca_s_proc_info.interval > now
+            && ca_s_proc_info.started <= now)
+        {
+            return;
+        }
+
+        if (lseek(ca_s_proc_info.proc_fd, 0, SEEK_SET) == -1) {
+            ca_log_err(errno, "lseek(\"/proc\") failed");
+            return;
+        }
+
+        ca_s_proc_info.next->nelem = 0;
+        ca_s_proc_info.cur = 0;
+        ca_s_proc_info.dents_pos = 0;
+        ca_s_proc_info.dents_len = 0;
+        ca_s_proc_info.started = now;
+        ca_s_proc_info.scanning = 1;
+    }
+
+    now_us = ca_time_us();
+    deadline = now_us + ca_s_proc_info.budget;
+    pp = ca_s_proc_info.procs->elem;
+
+    for (n = 1; /* void */; n++) {
+
+        if (n % CA_PROC_CHECK_EVERY == 0) {
+            now_us = ca_time_us();
+            if (now_us > deadline) {
+                return;
+            }
+        }
+
+        if (ca_s_proc_info.dents_pos >= ca_s_proc_info.dents_len) {
+            ca_s_proc_info.dents_len = syscall(SYS_getdents64,
+                                               ca_s_proc_info.proc_fd,
+                                               ca_s_proc_info.dents,
+                                               CA_PROC_DENTS_SIZE);
+            ca_s_proc_info.dents_pos = 0;
+
+            if (ca_s_proc_info.dents_len <= 0) {
+                break;
+            }
+        }
+
+        de = (ca_dirent64_t *) (ca_s_proc_info.dents
+                                + ca_s_proc_info.dents_pos);
+        ca_s_proc_info.dents_pos += de->d_reclen;
+
+        if (de->d_name[0] < '1' || de->d_name[0] > '9') {
+            continue;
+        }
+
+        pid = atoi(de->d_name);
+
+        while (ca_s_proc_info.cur < ca_s_proc_info.procs->nelem
+               && pp[ca_s_proc_info.cur]->pid < pid)
+        {
+            ca_proc_free(pp[ca_s_proc_info.cur++]);
+        }
+
+        if (ca_s_proc_info.cur < ca_s_proc_info.procs->nelem
+            && pp[ca_s_proc_info.cur]->pid == pid)
+        {
+            p = pp[ca_s_proc_info.cur++];
+
+        } else {
+            p = ca_calloc(1, sizeof(ca_proc_t));
+            if (p == NULL) {
+                continue;
+            }
+
+            p->pid = pid;
+            p->stat_fd = CA_INVALID_FILE;
+            p->statm_fd = CA_INVALID_FILE;
+            p->io_fd = CA_INVALID_FILE;
+            p->read_bytes = -1;
+            p->fds = -1;
+        }
+
+        if (ca_proc_sample(p, now_us) != CA_OK) {
+            ca_proc_free(p);
+            continue;
+        }
+
+        np = ca_array_push(ca_s_proc_info.next);
+        if (np == NULL) {
+            ca_proc_free(p);
+            continue;
+        }
+
+        *np = p;
+    }
+
+    if (ca_s_proc_info.dents_len < 0) {
+        ca_log_err(errno, "getdents64(\"/proc\") failed");
+    }
+
+    while (ca_s_proc_info.cur < ca_s_proc_info.procs->nelem) {
+        ca_proc_free(pp[ca_s_proc_info.cur++]);
+    }
+
+    tmp = ca_s_proc_info.procs;
+    ca_s_proc_info.procs = ca_s_proc_info.next;
+    ca_s_proc_info.next = tmp;
+    ca_s_proc_info.scanning = 0;
+
+    ca_proc_publish();
+
+    ca_log_debug(0, "process scan done, %ud pids, %ud cached fds",
+                 ca_s_proc_info.procs->nelem, ca_s_proc_info.nfds);
+}
+
+
+char *
+ca_conf_process_match(ca_conf_t *cf, ca_command_t *cmd, void *conf)
+{
+    ca_conf_ctx_t    *ctx = conf;
+    ca_str_t         *value;
+    ca_uint_t         i, type, ngroups;
+    ca_proc_match_t  *match;
+
+    value = cf->args->elem;
+
+    if (ca_strcmp(value[2].data, "name") == 0) {
+        type = CA_PROC_MATCH_NAME;
+
+    } else if (ca_strcmp(value[2].data, "cgroup") == 0) {
+        type = CA_PROC_MATCH_CGROUP;
+
+    } else {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid match \"%V\", "
+                          "it must be \"name\" or \"cgroup\"", &value[2]);
+        return CA_CONF_ERROR;
+    }
+
+    if (ctx->process_matches == NULL) {
+        ctx->process_matches = ca_array_create(4, sizeof(ca_proc_match_t));
+        if (ctx->process_matches == NULL) {
+            return CA_CONF_ERROR;
+        }
+    }
+
+    match = ctx->process_matches->elem;
+    ngroups = 0;
+
+    for (i = 0; i < ctx->process_matches->nelem; i++) {
+        if (match[i].group.len == value[1].len
+            && ca_strncmp(match[i].group.data, value[1].data,
+                          value[1].len) == 0)
+        {
+            break;
+        }
+
+        if (match[i].index >= ngroups) {
+            ngroups = match[i].index + 1;
+        }
+    }
+
+    if (i == ctx->process_matches->nelem) {
+        if (ngroups == CA_PROC_MAX_GROUPS) {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "too many process groups, at most %d",
+                              CA_PROC_MAX_GROUPS);
+            return CA_CONF_ERROR;
+        }
+
+    } else {
+        ngroups = match[i].index;
+    }
+
+    match = ca_array_push(ctx->process_matches);
+    if (match == NULL) {
+        return CA_CONF_ERROR;
+    }
+
+    match->group = value[1];
+    match->type = type;
+    match->pattern = value[3];
+    match->index = ngroups;
+
+    return CA_CONF_OK;
+}
+
+
+ca_int_t
+ca_process_init(void *dummy)
+{
+    ca_uint_t         i;
+    struct rlimit     rl;
+    ca_conf_ctx_t    *conf = dummy;
+    ca_proc_match_t  *match;
+
+    if (conf->process_scan_interval != CA_CONF_UNSET_UINT) {
+        ca_s_proc_info.interval = conf->process_scan_interval;
+    }
+
+    if (conf->process_scan_budget != CA_CONF_UNSET_UINT) {
+        ca_s_proc_info.budget = (uint64_t) conf->process_scan_budget * 1000;
+    }
+
+    if (conf->process_matches != NULL) {
+        match = conf->process_matches->elem;
+        ca_s_proc_info.matches = match;
+        ca_s_proc_info.nmatches = conf->process_matches->nelem;
+
+        for (i = 0; i < ca_s_proc_info.nmatches; i++) {
+            ca_s_proc_info.groups[match[i].index].name = match[i].group;
+            if (match[i].index >= ca_s_proc_info.ngroups) {
+                ca_s_proc_info.ngroups = match[i].index + 1;
+            }
+        }
+    }
+
+    ca_s_proc_info.clk_tck = sysconf(_SC_CLK_TCK);
+    ca_s_proc_info.page_size = sysconf(_SC_PAGESIZE);
+
+    /* leave half of the fd limit to the rest of the agent */
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        ca_s_proc_info.max_fds = rl.rlim_cur / 2;
+
+    } else {
+        ca_s_proc_info.max_fds = 512;
+    }
+
+    ca_s_proc_info.dents = ca_alloc(CA_PROC_DENTS_SIZE);
+    ca_s_proc_info.procs = ca_array_create(1024, sizeof(ca_proc_t *));
+    ca_s_proc_info.next = ca_array_create(1024, sizeof(ca_proc_t *));
+
+    if (ca_s_proc_info.dents == NULL
+        || ca_s_proc_info.procs == NULL
+        || ca_s_proc_info.next == NULL)
+    {
+        return CA_ERROR;
+    }
+
+    ca_s_proc_info.proc_fd = open("/proc", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (ca_s_proc_info.proc_fd == CA_INVALID_FILE) {
+        ca_log_err(errno, "open(\"/proc\") failed");
+    }
+
+    return CA_OK;
+}
+
+
+static ca_proc_group_t *
+ca_proc_group(ca_str_t *key)
+{
+    ca_uint_t  i;
+
+    ca_s_proc_info.enabled = 1;
+
+    for (i = 0; i < ca_s_proc_info.ngroups; i++) {
+        if (ca_s_proc_info.groups[i].name.len == key->len
+            && ca_strncmp(ca_s_proc_info.groups[i].name.data, key->data,
+                          key->len) == 0)
+        {
+            /* the first round has no rates yet */
+            return ca_s_proc_info.rounds >= 2 ? &ca_s_proc_info.groups[i]
+                                              : NULL;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * "<comm>:<pid>:<value>,..." for the top N processes, N being the key.
+ */
+static u_char *
+ca_proc_top(ca_str_t *key, ca_uint_t m, u_char *buf, size_t size)
+{
+    u_char         *p, *last;
+    ca_int_t        n;
+    ca_uint_t       i;
+    ca_proc_top_t  *top;
+
+    ca_s_proc_info.enabled = 1;
+
+    buf[0] = '\0';
+
+    n = ca_atoi(key->data, key->len);
+    if (n <= 0 || n > CA_PROC_TOP_MAX) {
+        return buf;
+    }
+
+    if ((ca_uint_t) n > ca_s_proc_info.top_n[m]) {
+        ca_s_proc_info.top_n[m] = n;
+        return buf;
+    }
+
+    if (ca_s_proc_info.rounds < 2) {
+        return buf;
+    }
+
+    top = ca_s_proc_info.top[m];
+    p = buf;
+    last = buf + size - 1;
+
+    for (i = 0; i < ca_s_proc_info.ntop[m] && i < (ca_uint_t) n; i++) {
+        p = ca_slprintf(p, last, "%s%s:%d:", i ? "," : "",
+                        top[i].comm, (int) top[i].pid);
+
+        if (m == CA_PROC_TOP_CPU) {
+            p = ca_slprintf(p, last, "%.1f", top[i].value);
+
+        } else {
+            p = ca_slprintf(p, last, "%.0f", top[i].value);
+        }
+    }
+
+    *p = '\0';
+
+    return buf;
+}
+
+
+u_char *
+ca_get_proc_count(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char     proc_count[20];
+    ca_proc_group_t  *grp;
+
+    grp = ca_proc_group(key);
+
+    if (grp != NULL) {
+        ca_snprintf(proc_count, sizeof(proc_count), "%ud%Z", grp->count);
+
+    } else {
+        proc_count[0] = '\0';
+    }
+
+    return proc_count;
+}
+
+
+u_char *
+ca_get_proc_cpu(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char     proc_cpu[20];
+    ca_proc_group_t  *grp;
+
+    grp = ca_proc_group(key);
+
+    if (grp != NULL) {
+        ca_snprintf(proc_cpu, sizeof(proc_cpu), "%.1f%Z", grp->cpu);
+
+    } else {
+        proc_cpu[0] = '\0';
+    }
+
+    return proc_cpu;
+}
+
+
+u_char *
+ca_get_proc_rss(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char     proc_rss[24];
+    ca_proc_group_t  *grp;
+
+    grp = ca_proc_group(key);
+
+    if (grp != NULL) {
+        ca_snprintf(proc_rss, sizeof(proc_rss), "%L%Z", grp->rss);
+
+    } else {
+        proc_rss[0] = '\0';
+    }
+
+    return proc_rss;
+}
+
+
+u_char *
+ca_get_proc_io_read(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char     proc_io_read[24];
+    ca_proc_group_t  *grp;
+
+    ca_s_proc_info.need_io = 1;
+
+    grp = ca_proc_group(key);
+
+    if (grp != NULL) {
+        ca_snprintf(proc_io_read, sizeof(proc_io_read), "%.0f%Z",
+                    grp->io_read);
+
+    } else {
+        proc_io_read[0] = '\0';
+    }
+
+    return proc_io_read;
+}
+
+
+u_char *
+ca_get_proc_io_write(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char     proc_io_write[24];
+    ca_proc_group_t  *grp;
+
+    ca_s_proc_info.need_io = 1;
+
+    grp = ca_proc_group(key);
+
+    if (grp != NULL) {
+        ca_snprintf(proc_io_write, sizeof(proc_io_write), "%.0f%Z",
+                    grp->io_write);
+
+    } else {
+        proc_io_write[0] = '\0';
+    }
+
+    return proc_io_write;
+}
+
+
+u_char *
+ca_get_proc_fds(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char     proc_fds[24];
+    ca_proc_group_t  *grp;
+
+    ca_s_proc_info.need_fds = 1;
+
+    grp = ca_proc_group(key);
+
+    if (grp != NULL) {
+        ca_snprintf(proc_fds, sizeof(proc_fds), "%L%Z", grp->fds);
+
+    } else {
+        proc_fds[0] = '\0';
+    }
+
+    return proc_fds;
+}
+
+
+u_char *
+ca_get_proc_top_cpu(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  top_cpu[CA_PROC_TOP_MAX * 48];
+
+    return ca_proc_top(key, CA_PROC_TOP_CPU, top_cpu, sizeof(top_cpu));
+}
+
+
+u_char *
+ca_get_proc_top_rss(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  top_rss[CA_PROC_TOP_MAX * 48];
+
+    return ca_proc_top(key, CA_PROC_TOP_RSS, top_rss, sizeof(top_rss));
+}
+
+
+u_char *
+ca_get_proc_top_io(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  top_io[CA_PROC_TOP_MAX * 48];
+
+    ca_s_proc_info.need_io = 1;
+
+    return ca_proc_top(key, CA_PROC_TOP_IO, top_io, sizeof(top_io));
+}
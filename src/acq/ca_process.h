@@ -0,0 +1,32 @@
+#ifndef __CA_PROCESS_H_INCLUDED__
+#define __CA_PROCESS_H_INCLUDED__
+
+
+#define CA_PROC_MATCH_NAME      0
+#define CA_PROC_MATCH_CGROUP    1
+
+
+typedef struct {
+    ca_str_t   group;
+    ca_uint_t  type;           /* CA_PROC_MATCH_NAME or CA_PROC_MATCH_CGROUP */
+    ca_str_t   pattern;        /* fnmatch(3) glob */
+    ca_uint_t  index;          /* of the group */
+} ca_proc_match_t;
+
+
+char *ca_conf_process_match(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+
+ca_int_t ca_process_init(void *conf);
+void ca_process_tick(time_t now);
+u_char *ca_get_proc_count(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_cpu(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_rss(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_io_read(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_io_write(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_fds(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_top_cpu(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_top_rss(ca_str_t *key, time_t now, time_t freq);
+u_char *ca_get_proc_top_io(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_PROCESS_H_INCLUDED__ */
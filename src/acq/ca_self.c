@@ -0,0 +1,275 @@
+#include "../clagent.h"
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+
+#define CA_SELF_THREADS     64
+#define CA_SELF_CACHELINE   64
+#define CA_SELF_COUNTERS    (CA_SELF_COLLECTOR_RUNS + CA_ACQ_COLLECTORS      \
+                             + CA_ACQ_PLUGINS)
+#define CA_SELF_GAUGES      (CA_SELF_COLLECTOR_TIME + CA_ACQ_COLLECTORS      \
+                             + CA_ACQ_PLUGINS)
+
+
+/*
+ * The counters of a thread, on cache lines of its own: only the thread
+ * writes them, without a lock, and they are summed when an item reads
+ * them.  The threads beyond CA_SELF_THREADS - 1 share the last slot.
+ */
+typedef struct {
+    uint64_t            v[CA_SELF_COUNTERS];
+} __attribute__ ((aligned(CA_SELF_CACHELINE))) ca_self_slot_t;
+
+
+static ca_self_slot_t          ca_s_slots[CA_SELF_THREADS];
+static ca_uint_t               ca_s_nslots;
+static __thread ca_self_slot_t *ca_s_slot;
+static double                  ca_s_gauges[CA_SELF_GAUGES];
+static ca_conf_ctx_t          *ca_s_conf;
+
+
+void
+ca_self_add(ca_uint_t counter, uint64_t n)
+{
+    ca_uint_t        i;
+    ca_self_slot_t  *s;
+
+    s = ca_s_slot;
+
+    if (s == NULL) {
+        i = __atomic_fetch_add(&ca_s_nslots, 1, __ATOMIC_RELAXED);
+        s = &ca_s_slots[CA_MIN(i, CA_SELF_THREADS - 1)];
+        ca_s_slot = s;
+    }
+
+    if (s == &ca_s_slots[CA_SELF_THREADS - 1]) {
+        __atomic_fetch_add(&s->v[counter], n, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_store_n(&s->v[counter], s->v[counter] + n, __ATOMIC_RELAXED);
+}
+
+
+void
+ca_self_set(ca_uint_t gauge, double v)
+{
+    __atomic_store(&ca_s_gauges[gauge], &v, __ATOMIC_RELAXED);
+}
+
+
+double
+ca_self_msec(void)
+{
+    struct timeval  tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+
+uint64_t
+ca_self_counter(ca_uint_t counter)
+{
+    uint64_t   sum;
+    ca_uint_t  i;
+
+    sum = 0;
+
+    for (i = 0; i < CA_SELF_THREADS; i++) {
+        sum += __atomic_load_n(&ca_s_slots[i].v[counter], __ATOMIC_RELAXED);
+    }
+
+    return sum;
+}
+
+
+double
+ca_self_gauge(ca_uint_t gauge)
+{
+    double  v;
+
+    __atomic_load(&ca_s_gauges[gauge], &v, __ATOMIC_RELAXED);
+
+    return v;
+}
+
+
+ca_int_t
+ca_self_init(void *conf)
+{
+    ca_s_conf = conf;
+
+    ca_self_set(CA_SELF_SUBMIT_SERVER, -1);
+
+    return CA_OK;
+}
+
+
+void
+ca_get_self_collector_time(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v)
+{
+    ca_int_t  c;
+
+    c = ca_acq_collector_index(key);
+    if (c == CA_ERROR) {
+        ca_acq_value_invalid(v);
+        return;
+    }
+
+    ca_acq_value_double(v, ca_self_gauge(CA_SELF_COLLECTOR_TIME + c), 3,
+                        "ms");
+}
+
+
+void
+ca_get_self_collector_runs(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v)
+{
+    ca_int_t  c;
+
+    c = ca_acq_collector_index(key);
+    if (c == CA_ERROR) {
+        ca_acq_value_invalid(v);
+        return;
+    }
+
+    ca_acq_value_int(v, ca_self_counter(CA_SELF_COLLECTOR_RUNS + c), NULL);
+}
+
+
+/* the key is the server as configured, "host", or as "addr:port" */
+void
+ca_get_self_connect_failures(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v)
+{
+    ca_uint_t     i;
+    ca_server_t  *server;
+
+    server = ca_s_conf->servers->elem;
+
+    for (i = 0; i < ca_s_conf->servers->nelem && i < CA_SELF_SERVERS; i++) {
+        if ((server[i].host_str.len == key->len
+             && ca_strncmp(server[i].host_str.data, key->data, key->len)
+                == 0)
+            || (ca_strlen(server[i].addr_str) == key->len
+                && ca_strncmp(server[i].addr_str, key->data, key->len)
+                   == 0))
+        {
+            ca_acq_value_int(v,
+                ca_self_counter(CA_SELF_CONNECT_FAILURES + i), NULL);
+            return;
+        }
+    }
+
+    ca_acq_value_invalid(v);
+}
+
+
+void
+ca_get_self_tick_lateness(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_acq_value_double(v, ca_self_gauge(CA_SELF_TICK_LATENESS), 3, "ms");
+}
+
+
+void
+ca_get_self_ntask(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_uint_t  ntask, nfree;
+
+    ca_acq_queues(&ntask, &nfree);
+
+    ca_acq_value_int(v, ntask, NULL);
+}
+
+
+void
+ca_get_self_nfree(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_uint_t  ntask, nfree;
+
+    ca_acq_queues(&ntask, &nfree);
+
+    ca_acq_value_int(v, nfree, NULL);
+}
+
+
+void
+ca_get_self_payloads(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_acq_value_int(v, ca_self_counter(CA_SELF_PAYLOADS), NULL);
+}
+
+
+void
+ca_get_self_payload_bytes(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_acq_value_int(v, ca_self_counter(CA_SELF_PAYLOAD_BYTES), "B");
+}
+
+
+void
+ca_get_self_submit_latency(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_acq_value_double(v, ca_self_gauge(CA_SELF_SUBMIT_LATENCY), 3, "ms");
+}
+
+
+void
+ca_get_self_submit_failures(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_acq_value_int(v, ca_self_counter(CA_SELF_SUBMIT_FAILURES), NULL);
+}
+
+
+void
+ca_get_self_log_errors(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    ca_acq_value_int(v, ca_log_nerror(), NULL);
+}
+
+
+void
+ca_get_self_rss(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    long   size, rss;
+    FILE  *fp;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL) {
+        ca_acq_value_invalid(v);
+        return;
+    }
+
+    if (fscanf(fp, "%ld %ld", &size, &rss) != 2) {
+        fclose(fp);
+        ca_acq_value_invalid(v);
+        return;
+    }
+
+    fclose(fp);
+
+    ca_acq_value_int(v, (int64_t) rss * sysconf(_SC_PAGESIZE) / 1024, "kB");
+}
+
+
+/* user and system time of all the threads of the acq process */
+void
+ca_get_self_cpu_time(time_t now, time_t freq, ca_acq_value_t *v)
+{
+    struct rusage  ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        ca_acq_value_invalid(v);
+        return;
+    }
+
+    ca_acq_value_int(v, (int64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)
+                        * 1000
+                        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000,
+                     "ms");
+}
@@ -0,0 +1,48 @@
+#ifndef __CA_SELF_H_INCLUDED__
+#define __CA_SELF_H_INCLUDED__
+
+
+#define CA_SELF_SERVERS            16
+
+/* counters, summed over the threads when they are read */
+#define CA_SELF_PAYLOADS           0
+#define CA_SELF_PAYLOAD_BYTES      1
+#define CA_SELF_SUBMIT_FAILURES    2
+#define CA_SELF_CONNECT_FAILURES   3          /* + server index */
+#define CA_SELF_COLLECTOR_RUNS     (CA_SELF_CONNECT_FAILURES              \
+                                    + CA_SELF_SERVERS)  /* + collector */
+
+/* gauges, the last value set */
+#define CA_SELF_TICK_LATENESS      0
+#define CA_SELF_SUBMIT_LATENCY     1
+#define CA_SELF_SUBMIT_SERVER      2          /* index, -1 if none */
+#define CA_SELF_COLLECTOR_TIME     3          /* + collector */
+
+
+void ca_self_add(ca_uint_t counter, uint64_t n);
+void ca_self_set(ca_uint_t gauge, double v);
+uint64_t ca_self_counter(ca_uint_t counter);
+double ca_self_gauge(ca_uint_t gauge);
+double ca_self_msec(void);
+
+ca_int_t ca_self_init(void *conf);
+void ca_get_self_collector_time(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v);
+void ca_get_self_collector_runs(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v);
+void ca_get_self_connect_failures(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v);
+void ca_get_self_tick_lateness(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_ntask(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_nfree(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_payloads(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_payload_bytes(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_submit_latency(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_submit_failures(time_t now, time_t freq,
+    ca_acq_value_t *v);
+void ca_get_self_log_errors(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_rss(time_t now, time_t freq, ca_acq_value_t *v);
+void ca_get_self_cpu_time(time_t now, time_t freq, ca_acq_value_t *v);
+
+
+#endif /* __CA_SELF_H_INCLUDED__ */
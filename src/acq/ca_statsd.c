@@ -0,0 +1,1035 @@
+#define _GNU_SOURCE                               /* recvmmsg() */
+#include "../clagent.h"
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+
+#define CA_STATSD_VLEN              64        /* datagrams a recvmmsg() */
+#define CA_STATSD_MSG_SIZE          8192
+#define CA_STATSD_BATCHES           16        /* recvmmsg() a socket a wakeup */
+#define CA_STATSD_RCVBUF            (8 * 1024 * 1024)
+#define CA_STATSD_NAME_LEN          128
+#define CA_STATSD_MAX_METRICS       4096
+#define CA_STATSD_FLUSH_INTERVAL    10        /* s */
+#define CA_STATSD_EXPIRE            600       /* s without an update */
+
+#define CA_STATSD_COUNTER           1
+#define CA_STATSD_GAUGE             2
+#define CA_STATSD_TIMER             3
+
+#define CA_STATSD_FNV_BASIS         2166136261u
+#define CA_STATSD_FNV_PRIME         16777619u
+
+
+/* what a metric got in a flush interval */
+typedef struct {
+    double              count;                /* scaled by sample rate */
+    double              gauge;
+    ca_uint_t           gauge_set;
+    uint32_t            n;                    /* updates */
+    ca_sketch_t        *sketch;               /* timers */
+} ca_statsd_window_t;
+
+
+typedef struct {
+    ca_uint_t           type;                 /* 0 if the slot is free */
+    uint32_t            hash;
+    uint32_t            len;
+    time_t              updated;
+    double              gauge;
+    ca_uint_t           gauge_set;
+    ca_statsd_window_t  window[2];
+    u_char              name[CA_STATSD_NAME_LEN];
+} ca_statsd_metric_t;
+
+
+/*
+ * The listener thread owns the metrics.  It fills window[cur] without
+ * a lock, the handlers read window[cur ^ 1] under the mutex, which is
+ * also held to flip cur and to add or drop a metric.
+ */
+typedef struct {
+    ca_array_t          *listens;
+    ca_uint_t            flush_interval;      /* ms */
+    ca_uint_t            max_metrics;
+
+    struct pollfd       *pfds;
+    ca_uint_t            nfds;
+
+    ca_statsd_metric_t  *metrics;
+    uint32_t            *free;                /* free metric slots */
+    ca_uint_t            nfree;
+    uint32_t            *index;               /* hash to metric slot + 1 */
+    uint32_t             mask;
+
+    ca_uint_t            cur;
+    uint64_t             flushed;             /* ms */
+    double               interval;            /* s, of window[cur ^ 1] */
+
+    struct mmsghdr      *msgs;
+    u_char              *bufs;
+
+    uint64_t             packets;
+    uint64_t             lines;
+    uint64_t             bad;
+    uint64_t             truncated;
+    uint64_t             dropped;             /* new metrics, table full */
+
+    pthread_mutex_t      mutex;
+} ca_statsd_info_t;
+
+
+static ca_statsd_info_t  ca_s_statsd_info = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+
+char *
+ca_conf_statsd_listen(ca_conf_t *cf, ca_command_t *cmd, void *conf)
+{
+    ca_conf_ctx_t  *ctx = conf;
+    ca_str_t       *value, *listen;
+    u_char         *port;
+
+    value = cf->args->elem;
+
+    if (value[1].len > 5 && ca_strncmp(value[1].data, "unix:", 5) == 0) {
+        if (value[1].len - 5 >= sizeof(((struct sockaddr_un *) 0)->sun_path)) {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "too long unix socket path in \"%V\"",
+                              &value[1]);
+            return CA_CONF_ERROR;
+        }
+
+    } else {
+        for (port = value[1].data + value[1].len;
+             port > value[1].data && port[-1] != ':';
+             port--)
+        {
+            /* void */
+        }
+
+        if (ca_atoi(port, value[1].data + value[1].len - port) <= 0) {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "invalid statsd address \"%V\", it must be "
+                              "\"[host:]port\" or \"unix:path\"", &value[1]);
+            return CA_CONF_ERROR;
+        }
+    }
+
+    if (ctx->statsd_listens == NULL) {
+        ctx->statsd_listens = ca_array_create(2, sizeof(ca_str_t));
+        if (ctx->statsd_listens == NULL) {
+            return CA_CONF_ERROR;
+        }
+    }
+
+    listen = ca_array_push(ctx->statsd_listens);
+    if (listen == NULL) {
+        return CA_CONF_ERROR;
+    }
+
+    *listen = value[1];
+
+    return CA_CONF_OK;
+}
+
+
+static void
+ca_statsd_set_rcvbuf(int fd)
+{
+    int  size;
+
+    size = CA_STATSD_RCVBUF;
+
+    /* SO_RCVBUFFORCE passes net.core.rmem_max when running as root */
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(int)) == 0) {
+        return;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(int)) == -1) {
+        ca_log_warn(errno, "setsockopt(SO_RCVBUF) failed");
+    }
+}
+
+
+static int
+ca_statsd_open_unix(ca_str_t *listen)
+{
+    int                  fd;
+    struct stat          st;
+    struct sockaddr_un   sun;
+
+    ca_memzero(&sun, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    ca_memcpy(sun.sun_path, listen->data + 5, listen->len - 5);
+
+    if (lstat(sun.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(sun.sun_path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ca_log_err(errno, "socket() for statsd \"%V\" failed", listen);
+        return CA_INVALID_FILE;
+    }
+
+    if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) == -1) {
+        ca_log_err(errno, "bind() statsd to \"%V\" failed", listen);
+        close(fd);
+        return CA_INVALID_FILE;
+    }
+
+    /* any local process may push, as to the udp port */
+
+    if (chmod(sun.sun_path, 0666) == -1) {
+        ca_log_warn(errno, "chmod() \"%s\" failed", sun.sun_path);
+    }
+
+    return fd;
+}
+
+
+static int
+ca_statsd_open_udp(ca_str_t *listen)
+{
+    int               fd, rc, one;
+    char              host[NI_MAXHOST], port[NI_MAXSERV];
+    u_char           *p, *last, *colon;
+    size_t            len;
+    struct addrinfo   hints, *res;
+
+    p = listen->data;
+    last = p + listen->len;
+
+    colon = NULL;
+    for (p = last; p > listen->data; p--) {
+        if (p[-1] == ':') {
+            colon = p - 1;
+            break;
+        }
+    }
+
+    p = listen->data;
+    host[0] = '\0';
+
+    if (colon != NULL) {
+        len = colon - p;
+
+        if (len >= 2 && p[0] == '[' && p[len - 1] == ']') {
+            p++;
+            len -= 2;
+        }
+
+        if (len >= sizeof(host)) {
+            ca_log_err(0, "invalid statsd host in \"%V\"", listen);
+            return CA_INVALID_FILE;
+        }
+
+        ca_memcpy(host, p, len);
+        host[len] = '\0';
+
+        p = colon + 1;
+    }
+
+    len = last - p;
+    if (len >= sizeof(port)) {
+        len = sizeof(port) - 1;
+    }
+
+    ca_memcpy(port, p, len);
+    port[len] = '\0';
+
+    ca_memzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE|AI_NUMERICSERV;
+
+    rc = getaddrinfo((host[0] == '\0' || ca_strcmp(host, "*") == 0)
+                     ? NULL : host, port, &hints, &res);
+    if (rc != 0) {
+        ca_log_err(0, "getaddrinfo() statsd \"%V\" failed: %s",
+                   listen, gai_strerror(rc));
+        return CA_INVALID_FILE;
+    }
+
+    fd = socket(res->ai_family, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ca_log_err(errno, "socket() for statsd \"%V\" failed", listen);
+        freeaddrinfo(res);
+        return CA_INVALID_FILE;
+    }
+
+    one = 1;
+    (void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+
+    if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
+        ca_log_err(errno, "bind() statsd to \"%V\" failed", listen);
+        freeaddrinfo(res);
+        close(fd);
+        return CA_INVALID_FILE;
+    }
+
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+
+static u_char *
+ca_statsd_number(u_char *p, u_char *last, double *value)
+{
+    static const double  pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+        1e22
+    };
+
+    int        exp, e, neg, eneg;
+    double     v;
+    uint64_t   mant;
+    u_char    *digits;
+
+    neg = 0;
+    if (p < last && (*p == '-' || *p == '+')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    mant = 0;
+    exp = 0;
+    digits = p;
+
+    for ( /* void */ ; p < last && *p >= '0' && *p <= '9'; p++) {
+        if (mant < 100000000000000000ULL) {
+            mant = mant * 10 + (*p - '0');
+
+        } else {
+            exp++;
+        }
+    }
+
+    if (p < last && *p == '.') {
+        digits++;
+
+        for (p++; p < last && *p >= '0' && *p <= '9'; p++) {
+            if (mant < 100000000000000000ULL) {
+                mant = mant * 10 + (*p - '0');
+                exp--;
+            }
+        }
+    }
+
+    if (p == digits) {
+        return NULL;
+    }
+
+    if (p < last && (*p == 'e' || *p == 'E')) {
+        p++;
+
+        eneg = 0;
+        if (p < last && (*p == '-' || *p == '+')) {
+            eneg = (*p == '-');
+            p++;
+        }
+
+        if (p == last || *p < '0' || *p > '9') {
+            return NULL;
+        }
+
+        for (e = 0; p < last && *p >= '0' && *p <= '9'; p++) {
+            if (e < 1000) {
+                e = e * 10 + (*p - '0');
+            }
+        }
+
+        exp += eneg ? -e : e;
+    }
+
+    v = (double) mant;
+
+    if (v != 0) {
+        for ( /* void */ ; exp > 22; exp -= 22) {
+            v *= 1e22;
+        }
+
+        for ( /* void */ ; exp < -22; exp += 22) {
+            v /= 1e22;
+        }
+
+        v = (exp < 0) ? v / pow10[-exp] : v * pow10[exp];
+    }
+
+    *value = neg ? -v : v;
+
+    return p;
+}
+
+
+static ca_statsd_metric_t *
+ca_statsd_lookup(u_char *name, size_t len, uint32_t hash)
+{
+    uint32_t             i, m;
+    ca_statsd_metric_t  *metric;
+
+    for (i = hash & ca_s_statsd_info.mask; /* void */ ;
+         i = (i + 1) & ca_s_statsd_info.mask)
+    {
+        m = ca_s_statsd_info.index[i];
+        if (m == 0) {
+            return NULL;
+        }
+
+        metric = &ca_s_statsd_info.metrics[m - 1];
+
+        if (metric->hash == hash && metric->len == len
+            && ca_memcmp(metric->name, name, len) == 0)
+        {
+            return metric;
+        }
+    }
+}
+
+
+static void
+ca_statsd_index(uint32_t m)
+{
+    uint32_t  i;
+
+    for (i = ca_s_statsd_info.metrics[m].hash & ca_s_statsd_info.mask;
+         ca_s_statsd_info.index[i] != 0;
+         i = (i + 1) & ca_s_statsd_info.mask)
+    {
+        /* void */
+    }
+
+    ca_s_statsd_info.index[i] = m + 1;
+}
+
+
+static void
+ca_statsd_window_reset(ca_statsd_metric_t *metric, ca_statsd_window_t *w)
+{
+    if (metric->type == CA_STATSD_TIMER && w->n != 0) {
+        ca_sketch_reset(w->sketch);
+    }
+
+    w->count = 0;
+    w->n = 0;
+    w->gauge = metric->gauge;
+    w->gauge_set = metric->gauge_set;
+}
+
+
+static ca_statsd_metric_t *
+ca_statsd_add(u_char *name, size_t len, uint32_t hash, ca_uint_t type)
+{
+    uint32_t             m;
+    ca_statsd_metric_t  *metric;
+
+    if (ca_s_statsd_info.nfree == 0) {
+        ca_s_statsd_info.dropped++;
+        return NULL;
+    }
+
+    m = ca_s_statsd_info.free[--ca_s_statsd_info.nfree];
+    metric = &ca_s_statsd_info.metrics[m];
+
+    metric->type = type;
+    metric->hash = hash;
+    metric->len = len;
+    metric->gauge = 0;
+    metric->gauge_set = 0;
+    ca_memcpy(metric->name, name, len);
+
+    /*
+     * A new metric gets no value until the next flush.  The sketches of
+     * a slot are reset whatever it was used for before, a cheap call on
+     * a clean one.
+     */
+
+    ca_sketch_reset(metric->window[0].sketch);
+    ca_sketch_reset(metric->window[1].sketch);
+
+    ca_statsd_window_reset(metric, &metric->window[0]);
+    ca_statsd_window_reset(metric, &metric->window[1]);
+
+    pthread_mutex_lock(&ca_s_statsd_info.mutex);
+    ca_statsd_index(m);
+    pthread_mutex_unlock(&ca_s_statsd_info.mutex);
+
+    return metric;
+}
+
+
+/* name:value|type[|@rate][|#tags] */
+static void
+ca_statsd_line(u_char *p, u_char *last, time_t now)
+{
+    u_char              *name;
+    size_t               len;
+    double               value, rate;
+    uint32_t             hash;
+    ca_uint_t            type, relative;
+    ca_statsd_window_t  *w;
+    ca_statsd_metric_t  *metric;
+
+    name = p;
+    hash = CA_STATSD_FNV_BASIS;
+
+    for ( /* void */ ; p < last && *p != ':'; p++) {
+        hash = (hash ^ *p) * CA_STATSD_FNV_PRIME;
+    }
+
+    len = p - name;
+
+    if (p == last || len == 0 || len >= CA_STATSD_NAME_LEN) {
+        goto bad;
+    }
+
+    p++;
+
+    relative = (p < last && (*p == '+' || *p == '-'));
+
+    p = ca_statsd_number(p, last, &value);
+    if (p == NULL || p == last || *p++ != '|' || p == last) {
+        goto bad;
+    }
+
+    switch (*p++) {
+
+    case 'c':
+        type = CA_STATSD_COUNTER;
+        break;
+
+    case 'g':
+        type = CA_STATSD_GAUGE;
+        break;
+
+    case 'm':
+        if (p == last || *p++ != 's') {
+            goto bad;
+        }
+
+        /* fall through */
+
+    case 'h':
+    case 'd':
+        type = CA_STATSD_TIMER;
+        break;
+
+    default:
+        goto bad;
+    }
+
+    rate = 1;
+
+    while (p < last && *p == '|') {
+        p++;
+
+        if (p < last && *p == '@') {
+            p = ca_statsd_number(p + 1, last, &rate);
+            if (p == NULL || !(rate > 0 && rate <= 1)) {
+                goto bad;
+            }
+
+            continue;
+        }
+
+        /* tags and unknown fields */
+
+        while (p < last && *p != '|') {
+            p++;
+        }
+    }
+
+    if (p != last) {
+        goto bad;
+    }
+
+    metric = ca_statsd_lookup(name, len, hash);
+
+    if (metric == NULL) {
+        metric = ca_statsd_add(name, len, hash, type);
+        if (metric == NULL) {
+            return;
+        }
+
+    } else if (metric->type != type) {
+        goto bad;
+    }
+
+    metric->updated = now;
+    w = &metric->window[ca_s_statsd_info.cur];
+
+    switch (type) {
+
+    case CA_STATSD_COUNTER:
+        w->count += value / rate;
+        break;
+
+    case CA_STATSD_GAUGE:
+        metric->gauge = relative ? metric->gauge + value : value;
+        metric->gauge_set = 1;
+        w->gauge = metric->gauge;
+        w->gauge_set = 1;
+        break;
+
+    default: /* CA_STATSD_TIMER */
+        w->count += 1 / rate;
+        ca_sketch_add(w->sketch, value);
+        break;
+    }
+
+    w->n++;
+
+    return;
+
+bad:
+
+    ca_s_statsd_info.bad++;
+}
+
+
+static void
+ca_statsd_recv(int fd, time_t now)
+{
+    int        i, n, b;
+    u_char    *p, *last, *eol;
+
+    for (b = 0; b < CA_STATSD_BATCHES; b++) {
+        n = recvmmsg(fd, ca_s_statsd_info.msgs, CA_STATSD_VLEN,
+                     MSG_DONTWAIT, NULL);
+        if (n == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                ca_log_err(errno, "recvmmsg() statsd failed");
+            }
+
+            return;
+        }
+
+        ca_s_statsd_info.packets += n;
+
+        for (i = 0; i < n; i++) {
+            if (ca_s_statsd_info.msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                ca_s_statsd_info.truncated++;
+                continue;
+            }
+
+            p = ca_s_statsd_info.bufs + (size_t) i * CA_STATSD_MSG_SIZE;
+            last = p + ca_s_statsd_info.msgs[i].msg_len;
+
+            for ( /* void */ ; p < last; p = eol + 1) {
+                eol = memchr(p, '\n', last - p);
+                if (eol == NULL) {
+                    eol = last;
+                }
+
+                if (eol > p) {
+                    ca_statsd_line(p, (eol[-1] == '\r') ? eol - 1 : eol, now);
+                    ca_s_statsd_info.lines++;
+                }
+            }
+        }
+
+        if (n < CA_STATSD_VLEN) {
+            return;
+        }
+    }
+}
+
+
+static void
+ca_statsd_flush(uint64_t now_ms)
+{
+    time_t               now;
+    uint32_t             m;
+    ca_uint_t            expired;
+    ca_statsd_metric_t  *metric;
+
+    now = now_ms / 1000;
+    expired = 0;
+
+    pthread_mutex_lock(&ca_s_statsd_info.mutex);
+
+    ca_s_statsd_info.cur ^= 1;
+    ca_s_statsd_info.interval = (now_ms - ca_s_statsd_info.flushed) / 1000.0;
+    ca_s_statsd_info.flushed = now_ms;
+
+    for (m = 0; m < ca_s_statsd_info.max_metrics; m++) {
+        metric = &ca_s_statsd_info.metrics[m];
+
+        if (metric->type != 0 && now - metric->updated >= CA_STATSD_EXPIRE) {
+            metric->type = 0;
+            ca_s_statsd_info.free[ca_s_statsd_info.nfree++] = m;
+            expired++;
+        }
+    }
+
+    if (expired) {
+        ca_memzero(ca_s_statsd_info.index,
+                (ca_s_statsd_info.mask + 1) * sizeof(uint32_t));
+
+        for (m = 0; m < ca_s_statsd_info.max_metrics; m++) {
+            if (ca_s_statsd_info.metrics[m].type != 0) {
+                ca_statsd_index(m);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&ca_s_statsd_info.mutex);
+
+    for (m = 0; m < ca_s_statsd_info.max_metrics; m++) {
+        metric = &ca_s_statsd_info.metrics[m];
+
+        if (metric->type != 0) {
+            ca_statsd_window_reset(metric,
+                                   &metric->window[ca_s_statsd_info.cur]);
+        }
+    }
+
+    ca_log_debug(0, "statsd flush: %uL packets, %uL lines, %uL bad, "
+                 "%uL truncated, %ud metrics, %ud expired",
+                 ca_s_statsd_info.packets, ca_s_statsd_info.lines,
+                 ca_s_statsd_info.bad, ca_s_statsd_info.truncated,
+                 ca_s_statsd_info.max_metrics - ca_s_statsd_info.nfree,
+                 expired);
+
+    if (ca_s_statsd_info.dropped) {
+        ca_log_warn(0, "statsd metric table is full, %uL updates of new "
+                    "metrics dropped", ca_s_statsd_info.dropped);
+        ca_s_statsd_info.dropped = 0;
+    }
+}
+
+
+static void *
+ca_statsd_cycle(void *dummy)
+{
+    int        n;
+    ca_uint_t  i;
+    uint64_t   now, next;
+
+    for ( ;; ) {
+        if (ca_quit || ca_terminate) {
+            break;
+        }
+
+        now = ca_time_ms();
+
+        if (now < ca_s_statsd_info.flushed) {
+            ca_s_statsd_info.flushed = now;
+        }
+
+        next = ca_s_statsd_info.flushed + ca_s_statsd_info.flush_interval;
+
+        if (now >= next) {
+            ca_statsd_flush(now);
+            next = now + ca_s_statsd_info.flush_interval;
+        }
+
+        n = poll(ca_s_statsd_info.pfds, ca_s_statsd_info.nfds,
+                 (next - now > 1000) ? 1000 : (int) (next - now));
+        if (n <= 0) {
+            continue;
+        }
+
+        for (i = 0; i < ca_s_statsd_info.nfds; i++) {
+            if (ca_s_statsd_info.pfds[i].revents & POLLIN) {
+                ca_statsd_recv(ca_s_statsd_info.pfds[i].fd, now / 1000);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+ca_int_t
+ca_statsd_init(void *conf)
+{
+    int                  fd, rc;
+    size_t               hsize;
+    uint32_t             m;
+    ca_uint_t            i, n;
+    ca_str_t            *listen;
+    sigset_t             set, old;
+    pthread_t            tid;
+    struct iovec        *iov;
+    ca_conf_ctx_t       *ctx = conf;
+    ca_sketch_t         *sketches;
+    ca_statsd_metric_t  *metric;
+
+    if (ctx->statsd_listens == NULL) {
+        return CA_OK;
+    }
+
+    ca_s_statsd_info.listens = ctx->statsd_listens;
+
+    ca_s_statsd_info.flush_interval = CA_STATSD_FLUSH_INTERVAL * 1000;
+    if (ctx->statsd_flush_interval != CA_CONF_UNSET_UINT) {
+        if (ctx->statsd_flush_interval == 0) {
+            ca_log_emerg(0, "statsd_flush_interval must not be 0");
+            return CA_ERROR;
+        }
+
+        ca_s_statsd_info.flush_interval = ctx->statsd_flush_interval * 1000;
+    }
+
+    ca_s_statsd_info.max_metrics = CA_STATSD_MAX_METRICS;
+    if (ctx->statsd_max_metrics != CA_CONF_UNSET_UINT) {
+        if (ctx->statsd_max_metrics == 0) {
+            ca_log_emerg(0, "statsd_max_metrics must not be 0");
+            return CA_ERROR;
+        }
+
+        ca_s_statsd_info.max_metrics = ctx->statsd_max_metrics;
+    }
+
+    n = ca_s_statsd_info.max_metrics;
+
+    for (hsize = 2; hsize < 2 * n; hsize <<= 1) {
+        /* void */
+    }
+
+    /*
+     * Everything is allocated here, the listener does not allocate.
+     * The sketches are only touched for timers.
+     */
+
+    ca_s_statsd_info.metrics = ca_calloc(n, sizeof(ca_statsd_metric_t));
+    ca_s_statsd_info.free = ca_calloc(n, sizeof(uint32_t));
+    ca_s_statsd_info.index = ca_calloc(hsize, sizeof(uint32_t));
+    sketches = ca_calloc(2 * n, sizeof(ca_sketch_t));
+    ca_s_statsd_info.msgs = ca_calloc(CA_STATSD_VLEN, sizeof(struct mmsghdr));
+    iov = ca_calloc(CA_STATSD_VLEN, sizeof(struct iovec));
+    ca_s_statsd_info.bufs = ca_calloc(CA_STATSD_VLEN, CA_STATSD_MSG_SIZE);
+    ca_s_statsd_info.pfds = ca_calloc(ctx->statsd_listens->nelem,
+                                      sizeof(struct pollfd));
+
+    if (ca_s_statsd_info.metrics == NULL || ca_s_statsd_info.free == NULL
+        || ca_s_statsd_info.index == NULL || sketches == NULL
+        || ca_s_statsd_info.msgs == NULL || iov == NULL
+        || ca_s_statsd_info.bufs == NULL || ca_s_statsd_info.pfds == NULL)
+    {
+        ca_log_emerg(0, "alloc statsd tables failed");
+        return CA_ERROR;
+    }
+
+    ca_s_statsd_info.mask = hsize - 1;
+
+    for (m = 0; m < n; m++) {
+        ca_s_statsd_info.free[m] = n - 1 - m;
+
+        metric = &ca_s_statsd_info.metrics[m];
+        metric->window[0].sketch = &sketches[2 * m];
+        metric->window[1].sketch = &sketches[2 * m + 1];
+    }
+
+    ca_s_statsd_info.nfree = n;
+
+    for (i = 0; i < CA_STATSD_VLEN; i++) {
+        iov[i].iov_base = ca_s_statsd_info.bufs + i * CA_STATSD_MSG_SIZE;
+        iov[i].iov_len = CA_STATSD_MSG_SIZE;
+        ca_s_statsd_info.msgs[i].msg_hdr.msg_iov = &iov[i];
+        ca_s_statsd_info.msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    listen = ctx->statsd_listens->elem;
+
+    for (i = 0; i < ctx->statsd_listens->nelem; i++) {
+        if (listen[i].len > 5 && ca_strncmp(listen[i].data, "unix:", 5) == 0) {
+            fd = ca_statsd_open_unix(&listen[i]);
+
+        } else {
+            fd = ca_statsd_open_udp(&listen[i]);
+        }
+
+        if (fd == CA_INVALID_FILE) {
+            return CA_ERROR;
+        }
+
+        ca_statsd_set_rcvbuf(fd);
+
+        ca_s_statsd_info.pfds[i].fd = fd;
+        ca_s_statsd_info.pfds[i].events = POLLIN;
+
+        ca_log_info(0, "statsd listen on \"%V\"", &listen[i]);
+    }
+
+    ca_s_statsd_info.nfds = ctx->statsd_listens->nelem;
+    ca_s_statsd_info.flushed = ca_time_ms();
+
+    /* the signals are left to the main thread's sigsuspend() */
+
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old);
+
+    rc = pthread_create(&tid, NULL, ca_statsd_cycle, NULL);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc != 0) {
+        ca_log_emerg(rc, "pthread_create() statsd failed");
+        return CA_ERROR;
+    }
+
+    pthread_detach(tid);
+
+    return CA_OK;
+}
+
+
+/*
+ * STATSD[<name>[:<stat>]] is a statistic of the metric over the last
+ * flush interval: count or rate of a counter or timer, value of a
+ * gauge, sum, min, max, mean or a percentile "p<n>" of a timer.  The
+ * default is count, value and mean respectively.
+ */
+u_char *
+ca_get_statsd(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char  buf[64];
+
+    u_char              *name, *stat, *last, *p;
+    size_t               len, slen;
+    double               v, pct;
+    uint32_t             hash;
+    ca_uint_t            valid;
+    ca_sketch_t         *sk;
+    ca_statsd_window_t  *w;
+    ca_statsd_metric_t  *metric;
+
+    buf[0] = '\0';
+
+    if (ca_s_statsd_info.metrics == NULL) {
+        return buf;
+    }
+
+    name = key->data;
+    last = key->data + key->len;
+
+    stat = ca_strlchr(name, last, ':');
+    if (stat == NULL) {
+        stat = last;
+        slen = 0;
+
+    } else {
+        slen = last - stat - 1;
+    }
+
+    len = stat - name;
+    stat++;
+
+    hash = CA_STATSD_FNV_BASIS;
+    for (p = name; p < name + len; p++) {
+        hash = (hash ^ *p) * CA_STATSD_FNV_PRIME;
+    }
+
+    pct = -1;
+    if (slen > 1 && stat[0] == 'p') {
+        p = ca_statsd_number(stat + 1, last, &pct);
+        if (p != last || pct <= 0 || pct > 100) {
+            return buf;
+        }
+    }
+
+    valid = 0;
+    v = 0;
+
+    pthread_mutex_lock(&ca_s_statsd_info.mutex);
+
+    metric = ca_statsd_lookup(name, len, hash);
+
+    if (metric == NULL) {
+        if ((slen == 5 && ca_strncmp(stat, "count", 5) == 0)
+            || (slen == 4 && ca_strncmp(stat, "rate", 4) == 0))
+        {
+            valid = 1;
+        }
+
+        goto done;
+    }
+
+    w = &metric->window[ca_s_statsd_info.cur ^ 1];
+
+    if (slen == 0) {
+        if (metric->type == CA_STATSD_COUNTER) {
+            stat = (u_char *) "count";
+            slen = 5;
+
+        } else if (metric->type == CA_STATSD_GAUGE) {
+            stat = (u_char *) "value";
+            slen = 5;
+
+        } else {
+            stat = (u_char *) "mean";
+            slen = 4;
+        }
+    }
+
+    if (metric->type == CA_STATSD_GAUGE) {
+        if (slen == 5 && ca_strncmp(stat, "value", 5) == 0 && w->gauge_set) {
+            v = w->gauge;
+            valid = 1;
+        }
+
+        goto done;
+    }
+
+    if (slen == 5 && ca_strncmp(stat, "count", 5) == 0) {
+        v = w->count;
+        valid = 1;
+        goto done;
+    }
+
+    if (slen == 4 && ca_strncmp(stat, "rate", 4) == 0) {
+        v = (ca_s_statsd_info.interval > 0)
+            ? w->count / ca_s_statsd_info.interval : 0;
+        valid = 1;
+        goto done;
+    }
+
+    if (metric->type != CA_STATSD_TIMER || w->sketch->n == 0) {
+        goto done;
+    }
+
+    sk = w->sketch;
+    valid = 1;
+
+    if (slen == 3 && ca_strncmp(stat, "sum", 3) == 0) {
+        v = sk->sum;
+
+    } else if (slen == 3 && ca_strncmp(stat, "min", 3) == 0) {
+        v = sk->min;
+
+    } else if (slen == 3 && ca_strncmp(stat, "max", 3) == 0) {
+        v = sk->max;
+
+    } else if (slen == 4 && ca_strncmp(stat, "mean", 4) == 0) {
+        v = sk->sum / sk->n;
+
+    } else if (pct > 0) {
+        v = ca_sketch_quantile(sk, pct / 100);
+
+    } else {
+        valid = 0;
+    }
+
+done:
+
+    pthread_mutex_unlock(&ca_s_statsd_info.mutex);
+
+    if (valid) {
+        ca_snprintf(buf, sizeof(buf), "%.2f%Z", v);
+    }
+
+    return buf;
+}
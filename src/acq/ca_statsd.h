@@ -0,0 +1,11 @@
+#ifndef __CA_STATSD_H_INCLUDED__
+#define __CA_STATSD_H_INCLUDED__
+
+
+char *ca_conf_statsd_listen(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+
+ca_int_t ca_statsd_init(void *conf);
+u_char *ca_get_statsd(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_STATSD_H_INCLUDED__ */
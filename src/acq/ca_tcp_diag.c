@@ -0,0 +1,413 @@
+#include "../clagent.h"
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+
+#define CA_TCP_NSTATES          (TCP_CLOSING + 1)
+#define CA_TCP_ALL_STATES       ((1 << CA_TCP_NSTATES) - 2)
+#define CA_TCP_DIAG_BUF_SIZE    65536
+#define CA_TCP_DIAG_TIMEOUT     1000          /* ms */
+
+
+typedef struct {
+    uint16_t    port;
+    ca_uint_t   count[CA_TCP_NSTATES];
+} ca_tcp_port_t;
+
+
+typedef struct {
+    int           fd;
+    uint32_t      states;                     /* requested, bit per state */
+    ca_uint_t     count[CA_TCP_NSTATES];
+    ca_array_t   *ports;                      /* ca_tcp_port_t */
+    uint8_t       port_map[65536 / 8];
+    u_char       *buf;
+    ca_uint_t     timeout;
+    ca_uint_t     seq;
+    unsigned      valid:1;                    /* the last dump completed */
+    time_t        updated;
+} ca_tcp_diag_info_t;
+
+
+static ca_tcp_diag_info_t  ca_s_tcp_diag_info = {
+    .fd      = CA_INVALID_FILE,
+    .timeout = CA_TCP_DIAG_TIMEOUT,
+};
+
+
+static const char  *ca_s_tcp_states[CA_TCP_NSTATES] = {
+    NULL,
+    "established",
+    "syn_sent",
+    "syn_recv",
+    "fin_wait1",
+    "fin_wait2",
+    "time_wait",
+    "close",
+    "close_wait",
+    "last_ack",
+    "listen",
+    "closing",
+};
+
+
+static ca_int_t
+ca_tcp_diag_open(void)
+{
+    ca_s_tcp_diag_info.fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC,
+                                   NETLINK_SOCK_DIAG);
+    if (ca_s_tcp_diag_info.fd == CA_INVALID_FILE) {
+        ca_log_err(errno, "socket(NETLINK_SOCK_DIAG) failed");
+        return CA_ERROR;
+    }
+
+    return CA_OK;
+}
+
+
+static void
+ca_tcp_diag_close(void)
+{
+    close(ca_s_tcp_diag_info.fd);
+    ca_s_tcp_diag_info.fd = CA_INVALID_FILE;
+}
+
+
+static ca_int_t
+ca_tcp_diag_request(uint8_t family)
+{
+    struct sockaddr_nl  sa;
+    struct {
+        struct nlmsghdr          nlh;
+        struct inet_diag_req_v2  r;
+    } req;
+
+    ca_memzero(&sa, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+
+    ca_memzero(&req, sizeof(req));
+    req.nlh.nlmsg_len = sizeof(req);
+    req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+    req.nlh.nlmsg_seq = ++ca_s_tcp_diag_info.seq;
+
+    /* only the requested states, and no extensions */
+
+    req.r.sdiag_family = family;
+    req.r.sdiag_protocol = IPPROTO_TCP;
+    req.r.idiag_states = ca_s_tcp_diag_info.states;
+    req.r.idiag_ext = 0;
+
+    if (sendto(ca_s_tcp_diag_info.fd, &req, sizeof(req), 0,
+               (struct sockaddr *) &sa, sizeof(sa)) < 0)
+    {
+        ca_log_err(errno, "sock_diag request failed");
+        return CA_ERROR;
+    }
+
+    return CA_OK;
+}
+
+
+/*
+ * Count the sockets of one dump, giving up at the deadline: CA_DONE if
+ * the kernel answered it with an error.
+ */
+static ca_int_t
+ca_tcp_diag_dump(uint8_t family, uint64_t deadline)
+{
+    int                     n, wait, err;
+    uint16_t                port;
+    uint64_t                now_us;
+    ca_uint_t               i;
+    ca_tcp_port_t          *tp;
+    struct pollfd           pfd;
+    struct nlmsghdr        *h;
+    struct nlmsgerr        *e;
+    struct inet_diag_msg   *r;
+
+    if (ca_tcp_diag_request(family) != CA_OK) {
+        return CA_ERROR;
+    }
+
+    pfd.fd = ca_s_tcp_diag_info.fd;
+    pfd.events = POLLIN;
+
+    for ( ;; ) {
+        now_us = ca_time_us();
+        if (now_us >= deadline) {
+            return CA_AGAIN;
+        }
+
+        wait = (deadline - now_us + 999) / 1000;
+
+        if (poll(&pfd, 1, wait) <= 0) {
+            return CA_AGAIN;
+        }
+
+        n = recv(ca_s_tcp_diag_info.fd, ca_s_tcp_diag_info.buf,
+                 CA_TCP_DIAG_BUF_SIZE, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+
+            ca_log_err(errno, "sock_diag recv failed");
+            return CA_ERROR;
+        }
+
+        for (h = (struct nlmsghdr *) ca_s_tcp_diag_info.buf;
+             NLMSG_OK(h, (unsigned) n);
+             h = NLMSG_NEXT(h, n))
+        {
+            if (h->nlmsg_seq != ca_s_tcp_diag_info.seq) {
+                continue;
+            }
+
+            if (h->nlmsg_type == NLMSG_DONE) {
+                return CA_OK;
+            }
+
+            /*
+             * an error ends the dump, nothing of it is left queued; a
+             * kernel without IPv6 has no AF_INET6 sockets to count
+             */
+
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                err = 0;
+
+                if (h->nlmsg_len >= NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+                    e = NLMSG_DATA(h);
+                    err = -e->error;
+                }
+
+                if (family == AF_INET6
+                    && (err == ENOENT || err == EAFNOSUPPORT))
+                {
+                    return CA_OK;
+                }
+
+                ca_log_err(err, "sock_diag dump failed");
+                return CA_DONE;
+            }
+
+            if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY) {
+                continue;
+            }
+
+            r = NLMSG_DATA(h);
+
+            if (r->idiag_state >= CA_TCP_NSTATES) {
+                continue;
+            }
+
+            ca_s_tcp_diag_info.count[r->idiag_state]++;
+
+            port = ntohs(r->id.idiag_sport);
+
+            if (!(ca_s_tcp_diag_info.port_map[port >> 3] & (1 << (port & 7))))
+            {
+                continue;
+            }
+
+            tp = ca_s_tcp_diag_info.ports->elem;
+
+            for (i = 0; i < ca_s_tcp_diag_info.ports->nelem; i++) {
+                if (tp[i].port == port) {
+                    tp[i].count[r->idiag_state]++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+static void
+ca_get_tcp_diag_info(void)
+{
+    ca_int_t        rc;
+    ca_uint_t       i;
+    uint64_t        deadline;
+    ca_tcp_port_t  *tp;
+
+    ca_s_tcp_diag_info.updated = time(NULL);
+    ca_s_tcp_diag_info.valid = 0;
+
+    if (ca_s_tcp_diag_info.fd == CA_INVALID_FILE
+        && ca_tcp_diag_open() != CA_OK)
+    {
+        return;
+    }
+
+    ca_memzero(ca_s_tcp_diag_info.count, sizeof(ca_s_tcp_diag_info.count));
+
+    tp = ca_s_tcp_diag_info.ports->elem;
+    for (i = 0; i < ca_s_tcp_diag_info.ports->nelem; i++) {
+        ca_memzero(tp[i].count, sizeof(tp[i].count));
+    }
+
+    deadline = ca_time_us() + (uint64_t) ca_s_tcp_diag_info.timeout * 1000;
+
+    rc = ca_tcp_diag_dump(AF_INET, deadline);
+    if (rc == CA_OK) {
+        rc = ca_tcp_diag_dump(AF_INET6, deadline);
+    }
+
+    if (rc == CA_OK) {
+        ca_s_tcp_diag_info.valid = 1;
+        return;
+    }
+
+    if (rc == CA_DONE) {
+        return;
+    }
+
+    if (rc == CA_AGAIN) {
+        ca_log_warn(0, "sock_diag dump exceeded %uz ms, discarded",
+                    ca_s_tcp_diag_info.timeout);
+    }
+
+    /* the rest of the dump may still be queued on the socket, drop it */
+
+    ca_tcp_diag_close();
+}
+
+
+static ca_int_t
+ca_tcp_diag_state(u_char *name, size_t len)
+{
+    ca_int_t  i;
+
+    for (i = 1; i < CA_TCP_NSTATES; i++) {
+        if (len == ca_strlen(ca_s_tcp_states[i])
+            && ca_strncmp(name, ca_s_tcp_states[i], len) == 0)
+        {
+            return i;
+        }
+    }
+
+    return CA_ERROR;
+}
+
+
+ca_int_t
+ca_tcp_diag_init(void *dummy)
+{
+    ca_conf_ctx_t  *conf = dummy;
+
+    if (conf->tcp_diag_timeout != CA_CONF_UNSET_UINT) {
+        ca_s_tcp_diag_info.timeout = conf->tcp_diag_timeout;
+    }
+
+    ca_s_tcp_diag_info.buf = ca_alloc(CA_TCP_DIAG_BUF_SIZE);
+    ca_s_tcp_diag_info.ports = ca_array_create(4, sizeof(ca_tcp_port_t));
+
+    if (ca_s_tcp_diag_info.buf == NULL || ca_s_tcp_diag_info.ports == NULL) {
+        return CA_ERROR;
+    }
+
+    return CA_OK;
+}
+
+
+/*
+ * tcp_state[<state>] or tcp_state[<state>:<local port>], the state may
+ * be "all".
+ */
+u_char *
+ca_get_tcp_state(ca_str_t *key, time_t now, time_t freq)
+{
+    static u_char   tcp_state[20];
+    u_char         *colon;
+    size_t          len;
+    ca_int_t        state, port;
+    ca_uint_t       i, count;
+    uint32_t        states;
+    ca_tcp_port_t  *tp;
+
+    tcp_state[0] = '\0';
+
+    colon = ca_strlchr(key->data, key->data + key->len, ':');
+    len = colon ? (size_t) (colon - key->data) : key->len;
+    port = -1;
+
+    if (len == 3 && ca_strncmp(key->data, "all", 3) == 0) {
+        state = 0;
+        states = CA_TCP_ALL_STATES;
+
+    } else {
+        state = ca_tcp_diag_state(key->data, len);
+        if (state == CA_ERROR) {
+            return tcp_state;
+        }
+
+        states = 1 << state;
+    }
+
+    if (colon) {
+        port = ca_atoi(colon + 1, key->data + key->len - colon - 1);
+        if (port <= 0 || port > 65535) {
+            return tcp_state;
+        }
+    }
+
+    tp = NULL;
+
+    if (port != -1) {
+        tp = ca_s_tcp_diag_info.ports->elem;
+
+        for (i = 0; i < ca_s_tcp_diag_info.ports->nelem; i++) {
+            if (tp[i].port == port) {
+                break;
+            }
+        }
+
+        if (i == ca_s_tcp_diag_info.ports->nelem) {
+            tp = ca_array_push(ca_s_tcp_diag_info.ports);
+            if (tp == NULL) {
+                return tcp_state;
+            }
+
+            ca_memzero(tp, sizeof(ca_tcp_port_t));
+            tp->port = port;
+            ca_s_tcp_diag_info.port_map[port >> 3] |= 1 << (port & 7);
+
+            /* not counted by the last dump */
+            ca_s_tcp_diag_info.updated = 0;
+
+        } else {
+            tp = &tp[i];
+        }
+    }
+
+    if ((ca_s_tcp_diag_info.states & states) != states) {
+        ca_s_tcp_diag_info.states |= states;
+        ca_s_tcp_diag_info.updated = 0;
+    }
+
+    if (ca_s_tcp_diag_info.updated + freq <= now) {
+        ca_get_tcp_diag_info();
+    }
+
+    if (!ca_s_tcp_diag_info.valid) {
+        return tcp_state;
+    }
+
+    count = 0;
+
+    for (i = 1; i < CA_TCP_NSTATES; i++) {
+        if (states & (1 << i)) {
+            count += tp ? tp->count[i] : ca_s_tcp_diag_info.count[i];
+        }
+    }
+
+    ca_snprintf(tcp_state, sizeof(tcp_state), "%uz%Z", count);
+
+    return tcp_state;
+}
@@ -0,0 +1,9 @@
+#ifndef __CA_TCP_DIAG_H_INCLUDED__
+#define __CA_TCP_DIAG_H_INCLUDED__
+
+
+ca_int_t ca_tcp_diag_init(void *conf);
+u_char *ca_get_tcp_state(ca_str_t *key, time_t now, time_t freq);
+
+
+#endif /* __CA_TCP_DIAG_H_INCLUDED__ */
@@ -1,166 +1,1734 @@
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include "clagent.h"
 #include "json-c/json.h"
+#include "ca_threadpool.h"
 
 
 #define CA_RCV_BUF_SIZE  128
 #define CA_ITEM_DATA_SIZE   8192
+#define CA_ACQ_TICK         1000    /* ms */
 
 
 ca_acq_item_handler_t  ca_acq_item_handlers[] = {
-    { ca_string("CPU_SYSTEM"),          &ca_get_cpu_system,          0 },
-    { ca_string("CPU_USER"),            &ca_get_cpu_user,            0 },
-    { ca_string("CPU_IDLE"),            &ca_get_cpu_idle,            0 },
-    { ca_string("CPU_IO"),              &ca_get_cpu_io,              0 },
-    { ca_string("PROC_RUNNING"),        &ca_get_procs_running,       0 },
-    { ca_string("PROC_BLOCKED"),        &ca_get_procs_blocked,       0 },
-    { ca_string("DISK_IO_UTIL_MAX"),    &ca_get_disk_io_util_max,    0 },
-    { ca_string("PARTITION_MAX_URATE"), &ca_get_partition_max_urate, 0 },
-    { ca_string("LOADAVG_1"),           &ca_get_loadavg_1,           0 },
-    { ca_string("LOADAVG_5"),           &ca_get_loadavg_5,           0 },
-    { ca_string("LOADAVG_15"),          &ca_get_loadavg_15,          0 },
-    { ca_string("MEM_TOTAL"),           &ca_get_mem_total,           0 },
-    { ca_string("MEM_USED"),            &ca_get_mem_used,            0 },
-    { ca_string("MEM_FREE"),            &ca_get_mem_free,            0 },
-    { ca_string("SWAP_TOTAL"),          &ca_get_swap_total,          0 },
-    { ca_string("SWAP_USED"),           &ca_get_swap_used,           0 },
-    { ca_string("SWAP_FREE"),           &ca_get_swap_free,           0 },
-    { ca_string("MEM_CACHED"),          &ca_get_mem_cache,           0 },
-    { ca_string("MEM_BUFFER"),          &ca_get_mem_buffer,          0 },
-    { ca_string("MEM_URATE"),           &ca_get_mem_urate,           0 },
-    { ca_string("SWAP_URATE"),          &ca_get_swap_urate,          0 },
-    { ca_string("INTRANET_FLOW_IN"),    &ca_get_intranet_flow_in,    0 },
-    { ca_string("INTRANET_FLOW_OUT"),   &ca_get_intranet_flow_out,   0 },
-    { ca_string("EXTRANET_FLOW_IN"),    &ca_get_extranet_flow_in,    0 },
-    { ca_string("EXTRANET_FLOW_OUT"),   &ca_get_extranet_flow_out,   0 },
-    { ca_string("INTRANET_PKGS_IN"),    &ca_get_intranet_pkgs_in,    0 },
-    { ca_string("INTRANET_PKGS_OUT"),   &ca_get_intranet_pkgs_out,   0 },
-    { ca_string("EXTRANET_PKGS_IN"),    &ca_get_extranet_pkgs_in,    0 },
-    { ca_string("EXTRANET_PKGS_OUT"),   &ca_get_extranet_pkgs_out,   0 },
-    { ca_string("TOTAL_FLOW_IN"),       &ca_get_total_flow_in,       0 },
-    { ca_string("TOTAL_FLOW_OUT"),      &ca_get_total_flow_out,      0 },
-    { ca_string("TOTAL_PKGS_IN"),       &ca_get_total_pkgs_in,       0 },
-    { ca_string("TOTAL_PKGS_OUT"),      &ca_get_total_pkgs_out,      0 },
+    { ca_string("CPU_SYSTEM"),          &ca_get_cpu_system, CA_ACQ_CPU },
+    { ca_string("CPU_USER"),            &ca_get_cpu_user, CA_ACQ_CPU },
+    { ca_string("CPU_IDLE"),            &ca_get_cpu_idle, CA_ACQ_CPU },
+    { ca_string("CPU_IO"),              &ca_get_cpu_io, CA_ACQ_CPU },
+    { ca_string("PROC_RUNNING"),        &ca_get_procs_running, CA_ACQ_CPU },
+    { ca_string("PROC_BLOCKED"),        &ca_get_procs_blocked, CA_ACQ_CPU },
+    { ca_string("DISK_IO_UTIL_MAX"),
+      &ca_get_disk_io_util_max, CA_ACQ_DISK_IO },
+    { ca_string("DISK_IO_UTIL"),
+      NULL, CA_ACQ_DISK_IO, NULL, NULL, NULL, &ca_get_disk_io_util },
+    { ca_string("PARTITION_MAX_URATE"),
+      &ca_get_partition_max_urate, CA_ACQ_DISK_URATE },
+    { ca_string("PARTITION_MAX_INODE_URATE"),
+      &ca_get_partition_max_inode_urate, CA_ACQ_DISK_URATE },
+    { ca_string("PARTITION_URATE"),
+      NULL, CA_ACQ_DISK_URATE, &ca_get_partition_urate },
+    { ca_string("PARTITION_INODE_URATE"),
+      NULL, CA_ACQ_DISK_URATE, &ca_get_partition_inode_urate },
+    { ca_string("LOADAVG_1"),
+      NULL, CA_ACQ_LOAD_AVERAGE, NULL, &ca_get_loadavg_1 },
+    { ca_string("LOADAVG_5"),
+      NULL, CA_ACQ_LOAD_AVERAGE, NULL, &ca_get_loadavg_5 },
+    { ca_string("LOADAVG_15"),
+      NULL, CA_ACQ_LOAD_AVERAGE, NULL, &ca_get_loadavg_15 },
+    { ca_string("MEM_TOTAL"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_mem_total },
+    { ca_string("MEM_USED"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_mem_used },
+    { ca_string("MEM_FREE"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_mem_free },
+    { ca_string("SWAP_TOTAL"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_swap_total },
+    { ca_string("SWAP_USED"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_swap_used },
+    { ca_string("SWAP_FREE"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_swap_free },
+    { ca_string("MEM_CACHED"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_mem_cache },
+    { ca_string("MEM_BUFFER"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_mem_buffer },
+    { ca_string("MEM_URATE"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_mem_urate },
+    { ca_string("SWAP_URATE"),
+      NULL, CA_ACQ_MEMORY, NULL, &ca_get_swap_urate },
+    { ca_string("INTRANET_FLOW_IN"),
+      &ca_get_intranet_flow_in, CA_ACQ_NET_FLOW },
+    { ca_string("INTRANET_FLOW_OUT"),
+      &ca_get_intranet_flow_out, CA_ACQ_NET_FLOW },
+    { ca_string("EXTRANET_FLOW_IN"),
+      &ca_get_extranet_flow_in, CA_ACQ_NET_FLOW },
+    { ca_string("EXTRANET_FLOW_OUT"),
+      &ca_get_extranet_flow_out, CA_ACQ_NET_FLOW },
+    { ca_string("INTRANET_PKGS_IN"),
+      &ca_get_intranet_pkgs_in, CA_ACQ_NET_FLOW },
+    { ca_string("INTRANET_PKGS_OUT"),
+      &ca_get_intranet_pkgs_out, CA_ACQ_NET_FLOW },
+    { ca_string("EXTRANET_PKGS_IN"),
+      &ca_get_extranet_pkgs_in, CA_ACQ_NET_FLOW },
+    { ca_string("EXTRANET_PKGS_OUT"),
+      &ca_get_extranet_pkgs_out, CA_ACQ_NET_FLOW },
+    { ca_string("TOTAL_FLOW_IN"),
+      &ca_get_total_flow_in, CA_ACQ_NET_FLOW },
+    { ca_string("TOTAL_FLOW_OUT"),
+      &ca_get_total_flow_out, CA_ACQ_NET_FLOW },
+    { ca_string("TOTAL_PKGS_IN"),
+      &ca_get_total_pkgs_in, CA_ACQ_NET_FLOW },
+    { ca_string("TOTAL_PKGS_OUT"),
+      &ca_get_total_pkgs_out, CA_ACQ_NET_FLOW },
+    { ca_string("PRESSURE_SOME_AVG10"), NULL, 0, &ca_get_pressure_some_avg10 },
+    { ca_string("PRESSURE_SOME_AVG60"), NULL, 0, &ca_get_pressure_some_avg60 },
+    { ca_string("PRESSURE_FULL_AVG10"), NULL, 0, &ca_get_pressure_full_avg10 },
+    { ca_string("PRESSURE_FULL_AVG60"), NULL, 0, &ca_get_pressure_full_avg60 },
+    { ca_string("PRESSURE_SOME_RATE"),  NULL, 0, &ca_get_pressure_some_rate },
+    { ca_string("PRESSURE_FULL_RATE"),  NULL, 0, &ca_get_pressure_full_rate },
+    { ca_string("CGROUP_COUNT"),        &ca_get_cgroup_count, 0 },
+    { ca_string("CGROUP_CPU_USAGE"),    NULL, 0, &ca_get_cgroup_cpu_usage },
+    { ca_string("CGROUP_CPU_THROTTLED"),
+      NULL, 0, &ca_get_cgroup_cpu_throttled },
+    { ca_string("CGROUP_CPU_THROTTLED_TIME"),
+      NULL, 0, &ca_get_cgroup_cpu_throttled_time },
+    { ca_string("CGROUP_MEM_CURRENT"),  NULL, 0, &ca_get_cgroup_mem_current },
+    { ca_string("CGROUP_MEM_ANON"),     NULL, 0, &ca_get_cgroup_mem_anon },
+    { ca_string("CGROUP_MEM_FILE"),     NULL, 0, &ca_get_cgroup_mem_file },
+    { ca_string("CGROUP_IO_READ_BYTES"),
+      NULL, 0, &ca_get_cgroup_io_read_bytes },
+    { ca_string("CGROUP_IO_WRITE_BYTES"),
+      NULL, 0, &ca_get_cgroup_io_write_bytes },
+    { ca_string("CGROUP_IO_READ_OPS"),  NULL, 0, &ca_get_cgroup_io_read_ops },
+    { ca_string("CGROUP_IO_WRITE_OPS"), NULL, 0, &ca_get_cgroup_io_write_ops },
+    { ca_string("PROC_COUNT"),          NULL, 0, &ca_get_proc_count },
+    { ca_string("PROC_CPU"),            NULL, 0, &ca_get_proc_cpu },
+    { ca_string("PROC_RSS"),            NULL, 0, &ca_get_proc_rss },
+    { ca_string("PROC_IO_READ"),        NULL, 0, &ca_get_proc_io_read },
+    { ca_string("PROC_IO_WRITE"),       NULL, 0, &ca_get_proc_io_write },
+    { ca_string("PROC_FDS"),            NULL, 0, &ca_get_proc_fds },
+    { ca_string("PROC_TOP_CPU"),        NULL, 0, &ca_get_proc_top_cpu },
+    { ca_string("PROC_TOP_RSS"),        NULL, 0, &ca_get_proc_top_rss },
+    { ca_string("PROC_TOP_IO"),         NULL, 0, &ca_get_proc_top_io },
+    { ca_string("NET_STAT"),
+      NULL, CA_ACQ_NET_STAT, &ca_get_net_stat },
+    { ca_string("NET_STAT_VALUE"),
+      NULL, CA_ACQ_NET_STAT, &ca_get_net_stat_value },
+    { ca_string("TCP_STATE"),
+      NULL, CA_ACQ_TCP_DIAG, &ca_get_tcp_state },
+    { ca_string("MEMINFO"),
+      NULL, CA_ACQ_MEMORY, NULL, NULL, &ca_get_meminfo },
+    { ca_string("VMSTAT"),
+      NULL, CA_ACQ_MEMORY, NULL, NULL, &ca_get_vmstat },
+    { ca_string("CTXT_RATE"),           &ca_get_ctxt_rate, CA_ACQ_CPU },
+    { ca_string("INTR_RATE"),           &ca_get_intr_rate, CA_ACQ_CPU },
+    { ca_string("FORK_RATE"),           &ca_get_fork_rate, CA_ACQ_CPU },
+    { ca_string("SOFTIRQ_RATE"),        &ca_get_softirq_rate, CA_ACQ_CPU },
+    { ca_string("INTERRUPT"),
+      NULL, CA_ACQ_INTERRUPTS, &ca_get_interrupt },
+    { ca_string("SOFTIRQ"),
+      NULL, CA_ACQ_INTERRUPTS, &ca_get_softirq },
+    { ca_string("NUMA_MEM_TOTAL"),
+      NULL, CA_ACQ_NUMA, &ca_get_numa_mem_total },
+    { ca_string("NUMA_MEM_FREE"),
+      NULL, CA_ACQ_NUMA, &ca_get_numa_mem_free },
+    { ca_string("NUMA_MEM_USED"),
+      NULL, CA_ACQ_NUMA, &ca_get_numa_mem_used },
+    { ca_string("NUMA_HIT"),            NULL, CA_ACQ_NUMA, &ca_get_numa_hit },
+    { ca_string("NUMA_MISS"),           NULL, CA_ACQ_NUMA, &ca_get_numa_miss },
+    { ca_string("NUMA_FOREIGN"),
+      NULL, CA_ACQ_NUMA, &ca_get_numa_foreign },
+    { ca_string("NUMA_OTHER_NODE"),
+      NULL, CA_ACQ_NUMA, &ca_get_numa_other_node },
+    { ca_string("FILE_VALUE"),          NULL, 0, &ca_get_file_value },
+    { ca_string("FILE_RATE"),           NULL, 0, &ca_get_file_rate },
+    { ca_string("FILE_DELTA"),          NULL, 0, &ca_get_file_delta },
+    { ca_string("EXEC"),                NULL, 0, &ca_get_exec },
+    { ca_string("LOG_MATCH"),           NULL, 0, &ca_get_log_match },
+    { ca_string("STATSD"),              NULL, 0, &ca_get_statsd },
+    { ca_string("SELF_COLLECTOR_TIME"),
+      NULL, 0, NULL, NULL, &ca_get_self_collector_time },
+    { ca_string("SELF_COLLECTOR_RUNS"),
+      NULL, 0, NULL, NULL, &ca_get_self_collector_runs },
+    { ca_string("SELF_CONNECT_FAILURES"),
+      NULL, 0, NULL, NULL, &ca_get_self_connect_failures },
+    { ca_string("SELF_TICK_LATENESS"),
+      NULL, 0, NULL, &ca_get_self_tick_lateness },
+    { ca_string("SELF_NTASK"),          NULL, 0, NULL, &ca_get_self_ntask },
+    { ca_string("SELF_NFREE"),          NULL, 0, NULL, &ca_get_self_nfree },
+    { ca_string("SELF_PAYLOADS"),       NULL, 0, NULL, &ca_get_self_payloads },
+    { ca_string("SELF_PAYLOAD_BYTES"),
+      NULL, 0, NULL, &ca_get_self_payload_bytes },
+    { ca_string("SELF_SUBMIT_LATENCY"),
+      NULL, 0, NULL, &ca_get_self_submit_latency },
+    { ca_string("SELF_SUBMIT_FAILURES"),
+      NULL, 0, NULL, &ca_get_self_submit_failures },
+    { ca_string("SELF_LOG_ERRORS"),
+      NULL, 0, NULL, &ca_get_self_log_errors },
+    { ca_string("SELF_RSS"),            NULL, 0, NULL, &ca_get_self_rss },
+    { ca_string("SELF_CPU_TIME"),       NULL, 0, NULL, &ca_get_self_cpu_time },
     { ca_null_string,                   NULL }
 };
 
 
+/* the exec runner is forked first, before the others open fds or threads */
+static ca_acq_init_pt  ca_acq_inits[] = {
+    &ca_exec_init,
+    &ca_disk_urate_init,
+    &ca_pressure_init,
+    &ca_cgroup_init,
+    &ca_process_init,
+    &ca_tcp_diag_init,
+    &ca_file_value_init,
+    &ca_log_tail_init,
+    &ca_statsd_init,
+    &ca_plugin_init,
+    &ca_self_init,
+    &ca_admin_init,
+    &ca_prometheus_init,
+    &ca_store_init,
+    NULL
+};
+
+
+/* as the keys of the self_collector_* items, the plugins by their names */
+static ca_str_t  ca_acq_collector_names[] = {
+    ca_string("inline"),
+    ca_string("cpu"),
+    ca_string("disk_io"),
+    ca_string("disk_urate"),
+    ca_string("interrupts"),
+    ca_string("load_average"),
+    ca_string("memory"),
+    ca_string("net_flow"),
+    ca_string("net_stat"),
+    ca_string("numa"),
+    ca_string("tcp_diag"),
+    ca_null_string
+};
+
+
+/* run on every pass of the acq cycle, before the due items are collected */
+static ca_acq_tick_pt  ca_acq_ticks[] = {
+    &ca_process_tick,
+    &ca_file_value_tick,
+    &ca_log_tail_tick,
+    &ca_store_tick,
+    NULL
+};
+
+
 typedef struct ca_acq_data_s      ca_acq_data_t;
 typedef struct ca_acq_data_hdr_s  ca_acq_data_hdr_t;
 
 
-struct ca_acq_data_s {
-    json_object                  *json;
-    STAILQ_ENTRY(ca_acq_data_s)   next;
-};
+struct ca_acq_data_s {
+    json_object                  *json;
+    double                        queued;           /* ms */
+    time_t                        from;             /* of the samples */
+    time_t                        to;
+    ca_uint_t                     kind;
+    ca_uint_t                     tries;
+    STAILQ_ENTRY(ca_acq_data_s)   next;
+};
+
+
+STAILQ_HEAD(ca_acq_data_hdr_s, ca_acq_data_s);
+
+
+/*
+ * The due items of a collector are sampled by one task on the acq pool,
+ * those of a plugin with a single call of it, even without the pool;
+ * a task still running at the deadline is late, its samples are shipped
+ * with the tick after it is over, and its items are not due until then.
+ */
+typedef struct {
+    ca_array_t   *due;
+    ca_uint_t     plugin;                  /* index + 1, 0 if none */
+    time_t        now;
+    ca_uint_t     gen;
+    ca_uint_t     running;
+    ca_uint_t     late;
+    ca_uint_t     done;                    /* under acq_pool_mutex */
+} ca_acq_collector_t;
+
+
+typedef struct {
+    ca_str_t      dims;
+    ca_uint_t     payload;                 /* the last one it is defined in */
+} ca_acq_dims_t;
+
+
+static ca_uint_t          nfree;
+static ca_acq_data_hdr_t  free_queue;
+static ca_uint_t          max_nfree;
+static ca_uint_t          ntask;
+static ca_acq_data_hdr_t  task_queue;
+static ca_acq_data_hdr_t  priority_queue;
+static pthread_mutex_t    free_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t    task_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     task_cond = PTHREAD_COND_INITIALIZER;
+static ca_array_t        *acq_items;
+static ca_array_t        *acq_events;
+static struct pollfd     *acq_pollfds;
+static ca_threadpool_t   *acq_pool;
+static pthread_mutex_t    acq_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     acq_pool_cond = PTHREAD_COND_INITIALIZER;
+static ca_uint_t          acq_pool_gen;
+static ca_uint_t          acq_pool_pending;
+static ca_acq_collector_t acq_collectors[CA_ACQ_NCOLLECTORS];
+static ca_acq_dims_t     *acq_dims;            /* by dims id - 1 */
+static ca_uint_t          acq_payloads;
+static json_object       *acq_payload_data;
+static json_object       *acq_payload_dims;
+static ca_uint_t          acq_ndims;
+static ca_uint_t          acq_dims_nalloc;
+static uint32_t          *acq_dims_index;      /* dims id, 0 if free */
+static ca_uint_t          acq_dims_mask;
+
+
+static void *ca_acq_submit_cycle(void *dummy);
+static void *ca_acq_cycle(void *dummy);
+static ca_int_t ca_select_submit(ca_int_t *pfd, ca_int_t *pindex, char *buf,
+    size_t len, ca_conf_ctx_t *conf);
+static ca_int_t ca_select_send_and_recv(ca_int_t fd, char *buf, size_t len,
+    ca_conf_ctx_t *conf, ca_server_t *server);
+
+
+static ca_acq_data_t *
+ca_acq_task_get(void)
+{
+    ca_acq_data_t  *data = NULL;
+
+    pthread_mutex_lock(&task_mutex);
+
+    if (!STAILQ_EMPTY(&priority_queue)) {
+        data = STAILQ_FIRST(&priority_queue);
+        ntask--;
+        STAILQ_REMOVE_HEAD(&priority_queue, next);
+        STAILQ_NEXT(data, next) = NULL;
+
+    } else if (!STAILQ_EMPTY(&task_queue)) {
+        data = STAILQ_FIRST(&task_queue);
+        ntask--;
+        STAILQ_REMOVE_HEAD(&task_queue, next);
+        STAILQ_NEXT(data, next) = NULL;
+    }
+
+    pthread_mutex_unlock(&task_mutex);
+
+    return data;
+}
+
+
+static void
+ca_acq_task_insert(ca_acq_data_t *data)
+{
+    pthread_mutex_lock(&task_mutex);
+
+    if (data->kind == CA_ACQ_PAYLOAD_ALERT) {
+        STAILQ_INSERT_TAIL(&priority_queue, data, next);
+
+    } else {
+        STAILQ_INSERT_TAIL(&task_queue, data, next);
+    }
+
+    ntask++;
+
+    pthread_cond_signal(&task_cond);
+    pthread_mutex_unlock(&task_mutex);
+}
+
+
+/*
+ * An alert that failed goes back ahead of the payloads, it is tried
+ * again after a second, or as soon as another payload is queued.
+ */
+static void
+ca_acq_task_retry(ca_acq_data_t *data)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+
+    pthread_mutex_lock(&task_mutex);
+
+    STAILQ_INSERT_HEAD(&priority_queue, data, next);
+    ntask++;
+
+    (void) pthread_cond_timedwait(&task_cond, &task_mutex, &ts);
+
+    pthread_mutex_unlock(&task_mutex);
+}
+
+
+/* a second at most, the submit thread is woken up by a payload queued */
+static void
+ca_acq_task_wait(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+
+    pthread_mutex_lock(&task_mutex);
+
+    if (STAILQ_EMPTY(&priority_queue) && STAILQ_EMPTY(&task_queue)) {
+        (void) pthread_cond_timedwait(&task_cond, &task_mutex, &ts);
+    }
+
+    pthread_mutex_unlock(&task_mutex);
+}
+
+
+static ca_acq_data_t *
+ca_acq_data_get(void)
+{
+    ca_acq_data_t  *data;
+
+    pthread_mutex_lock(&free_mutex);
+
+    if (!STAILQ_EMPTY(&free_queue)) {
+        data = STAILQ_FIRST(&free_queue);
+        nfree--;
+        STAILQ_REMOVE_HEAD(&free_queue, next);
+
+    } else {
+
+        data = ca_calloc(sizeof(ca_acq_data_t), 1);
+        if (data == NULL) {
+            pthread_mutex_unlock(&free_mutex);
+            return NULL;
+        }
+    }
+
+    STAILQ_NEXT(data, next) = NULL;
+
+    pthread_mutex_unlock(&free_mutex);
+
+    return data;
+}
+
+
+static void
+ca_acq_data_put(ca_acq_data_t *data)
+{
+    pthread_mutex_lock(&free_mutex);
+
+    if (nfree != 0 && nfree + 1 > max_nfree) {
+        ca_free(data);
+
+    } else {
+        nfree++;
+        STAILQ_INSERT_HEAD(&free_queue, data, next);
+    }
+
+    pthread_mutex_unlock(&free_mutex);
+}
+
+
+static void
+ca_acq_data_remove(ca_acq_data_hdr_t *queue, ca_acq_data_t *data)
+{
+    STAILQ_REMOVE(queue, data, ca_acq_data_s, next);
+    STAILQ_NEXT(data, next) = NULL;
+}
+
+
+static ca_str_t  ca_acq_default_stats = ca_string("min,max,avg,last");
+
+
+ca_int_t
+ca_acq_window_init(ca_acq_t *item, ca_str_t *stats)
+{
+    char             *end;
+    u_char           *p, *last, *comma;
+    size_t            len;
+    ca_uint_t         n;
+    ca_acq_stat_t    *stat;
+    ca_acq_window_t  *win;
+
+    if (stats == NULL) {
+        stats = &ca_acq_default_stats;
+    }
+
+    last = stats->data + stats->len;
+
+    for (n = 1, p = stats->data; p < last; p++) {
+        if (*p == ',') {
+            n++;
+        }
+    }
+
+    win = ca_calloc(1, sizeof(ca_acq_window_t));
+    if (win == NULL) {
+        return CA_ERROR;
+    }
+
+    item->summary = win;
+
+    win->stats = ca_calloc(n, sizeof(ca_acq_stat_t));
+    win->sketch = ca_calloc(1, sizeof(ca_sketch_t));
+    if (win->stats == NULL || win->sketch == NULL) {
+        return CA_ERROR;
+    }
+
+    for (p = stats->data; p < last; p = comma + 1) {
+        comma = ca_strlchr(p, last, ',');
+        if (comma == NULL) {
+            comma = last;
+        }
+
+        len = comma - p;
+        stat = &win->stats[win->nstats];
+
+        stat->name = strndup((char *) p, len);
+        if (stat->name == NULL) {
+            return CA_ERROR;
+        }
+
+        win->nstats++;
+
+        if (len == 3 && ca_strncmp(p, "min", 3) == 0) {
+            stat->type = CA_ACQ_STAT_MIN;
+
+        } else if (len == 3 && ca_strncmp(p, "max", 3) == 0) {
+            stat->type = CA_ACQ_STAT_MAX;
+
+        } else if (len == 3 && ca_strncmp(p, "avg", 3) == 0) {
+            stat->type = CA_ACQ_STAT_AVG;
+
+        } else if (len == 3 && ca_strncmp(p, "sum", 3) == 0) {
+            stat->type = CA_ACQ_STAT_SUM;
+
+        } else if (len == 5 && ca_strncmp(p, "count", 5) == 0) {
+            stat->type = CA_ACQ_STAT_COUNT;
+
+        } else if (len == 4 && ca_strncmp(p, "last", 4) == 0) {
+            stat->type = CA_ACQ_STAT_LAST;
+
+        } else if (len > 1 && p[0] == 'p' && p[1] >= '0' && p[1] <= '9') {
+            stat->type = CA_ACQ_STAT_QUANTILE;
+            stat->q = strtod(stat->name + 1, &end) / 100;
+            if (*end != '\0' || stat->q > 1) {
+                return CA_ERROR;
+            }
+
+        } else {
+            return CA_ERROR;
+        }
+    }
+
+    return CA_OK;
+}
+
+
+void
+ca_acq_window_free(ca_acq_t *item)
+{
+    ca_uint_t         i;
+    ca_acq_window_t  *win;
+
+    win = item->summary;
+    if (win == NULL) {
+        return;
+    }
+
+    for (i = 0; win->stats != NULL && i < win->nstats; i++) {
+        ca_free(win->stats[i].name);
+    }
+
+    ca_free(win->stats);
+    ca_free(win->sketch);
+    ca_free(win->last);
+    ca_free(win->value);
+    ca_free(win);
+
+    item->summary = NULL;
+}
+
+
+/*
+ * Add a sample to a multi-value item, its dimension set formatted by
+ * fmt; the value is to be set by the handler, it is dropped if it is
+ * left NONE.
+ */
+ca_acq_value_t *
+ca_acq_multi_add(ca_acq_multi_t *m, const char *fmt, ...)
+{
+    u_char               *p;
+    va_list               args;
+    ca_uint_t             n;
+    ca_acq_dim_sample_t  *s;
+
+    if (m->nsamples == m->nalloc) {
+        n = m->nalloc ? 2 * m->nalloc : 8;
+
+        s = ca_realloc(m->samples, n * sizeof(ca_acq_dim_sample_t));
+        if (s == NULL) {
+            return NULL;
+        }
+
+        ca_memzero(s + m->nalloc,
+                   (n - m->nalloc) * sizeof(ca_acq_dim_sample_t));
+
+        m->samples = s;
+        m->nalloc = n;
+    }
+
+    s = &m->samples[m->nsamples++];
+
+    va_start(args, fmt);
+    p = ca_vslprintf(s->dims, s->dims + CA_ACQ_DIMS_LEN - 1, fmt, args);
+    va_end(args);
+
+    *p = '\0';
+    s->dims_len = p - s->dims;
+
+    s->value.type = CA_ACQ_VALUE_NONE;
+    s->value.prec = 0;
+    s->value.unit = NULL;
+
+    return &s->value;
+}
+
+
+void
+ca_acq_multi_free(ca_acq_t *item)
+{
+    if (item->multi == NULL) {
+        return;
+    }
+
+    ca_free(item->multi->samples);
+    ca_free(item->multi->seen);
+    ca_free(item->multi);
+
+    item->multi = NULL;
+}
+
+
+static uint32_t
+ca_acq_dims_hash(u_char *p, size_t len)
+{
+    uint32_t  h;
+
+    for (h = 2166136261u; len; len--) {
+        h = (h ^ *p++) * 16777619u;
+    }
+
+    return h;
+}
+
+
+/* the id of a dimension set, interned on its first use; 0 on failure */
+static uint32_t
+ca_acq_dims_intern(u_char *p, size_t len)
+{
+    void      *tmp;
+    uint32_t   h, id, *index;
+    ca_uint_t  i, j, mask;
+
+    h = ca_acq_dims_hash(p, len);
+
+    if (acq_dims_index != NULL) {
+        i = h & acq_dims_mask;
+
+        while (acq_dims_index[i]) {
+            id = acq_dims_index[i];
+
+            if (acq_dims[id - 1].dims.len == len
+                && ca_memcmp(acq_dims[id - 1].dims.data, p, len) == 0)
+            {
+                return id;
+            }
+
+            i = (i + 1) & acq_dims_mask;
+        }
+    }
+
+    if (acq_ndims == acq_dims_nalloc) {
+        j = 2 * acq_dims_nalloc + 64;
+
+        tmp = ca_realloc(acq_dims, j * sizeof(ca_acq_dims_t));
+        if (tmp == NULL) {
+            return 0;
+        }
+
+        acq_dims = tmp;
+        acq_dims_nalloc = j;
+    }
+
+    /* the index is kept at most half full */
+
+    if (2 * (acq_ndims + 1) > acq_dims_mask + 1 || acq_dims_index == NULL) {
+        mask = acq_dims_index ? 2 * acq_dims_mask + 1 : 255;
+
+        index = ca_calloc(mask + 1, sizeof(uint32_t));
+        if (index == NULL) {
+            return 0;
+        }
+
+        for (j = 0; j < acq_ndims; j++) {
+            i = ca_acq_dims_hash(acq_dims[j].dims.data, acq_dims[j].dims.len)
+                & mask;
+
+            while (index[i]) {
+                i = (i + 1) & mask;
+            }
+
+            index[i] = j + 1;
+        }
+
+        ca_free(acq_dims_index);
+        acq_dims_index = index;
+        acq_dims_mask = mask;
+    }
+
+    acq_dims[acq_ndims].dims.data = ca_alloc(len + 1);
+    if (acq_dims[acq_ndims].dims.data == NULL) {
+        return 0;
+    }
+
+    ca_memcpy(acq_dims[acq_ndims].dims.data, p, len);
+    acq_dims[acq_ndims].dims.data[len] = '\0';
+    acq_dims[acq_ndims].dims.len = len;
+    acq_dims[acq_ndims].payload = 0;
+
+    id = ++acq_ndims;
+    i = h & acq_dims_mask;
+
+    while (acq_dims_index[i]) {
+        i = (i + 1) & acq_dims_mask;
+    }
+
+    acq_dims_index[i] = id;
+
+    return id;
+}
+
+
+/* whether the dimension set is within the cardinality cap of the item */
+static ca_uint_t
+ca_acq_multi_admit(ca_acq_t *item, uint32_t id)
+{
+    u_char          *tmp;
+    size_t           size;
+    ca_acq_multi_t  *m;
+
+    m = item->multi;
+
+    if (id / 8 >= m->seen_size) {
+        size = id / 8 + 64;
+
+        tmp = ca_realloc(m->seen, size);
+        if (tmp == NULL) {
+            return 0;
+        }
+
+        ca_memzero(tmp + m->seen_size, size - m->seen_size);
+        m->seen = tmp;
+        m->seen_size = size;
+    }
+
+    if (m->seen[id / 8] & (1 << (id % 8))) {
+        return 1;
+    }
+
+    if (m->ndims >= m->max) {
+        if (m->dropped++ == 0) {
+            ca_log_warn(0, "acq \"%V\" has reached %uL dimension sets, "
+                        "the samples of new ones are dropped",
+                        &item->item, m->max);
+        }
+
+        return 0;
+    }
+
+    m->seen[id / 8] |= 1 << (id % 8);
+    m->ndims++;
+
+    return 1;
+}
+
+
+static ca_int_t
+ca_acq_copy(u_char **buf, size_t *size, u_char *p, size_t len)
+{
+    u_char  *tmp;
+
+    if (len + 1 > *size) {
+        tmp = ca_realloc(*buf, len + 64);
+        if (tmp == NULL) {
+            return CA_ERROR;
+        }
+
+        *buf = tmp;
+        *size = len + 64;
+    }
+
+    ca_memcpy(*buf, p, len);
+    (*buf)[len] = '\0';
+
+    return CA_OK;
+}
+
+
+/* the summary object of a window, the first stat to win->value */
+static json_object *
+ca_acq_window_flush(ca_acq_window_t *win)
+{
+    double          v;
+    u_char          num[64], *p;
+    ca_uint_t       i;
+    json_object    *obj;
+    ca_sketch_t    *sk;
+
+    sk = win->sketch;
+    obj = json_object_new_object();
+
+    if (win->value_size < sizeof(num)) {
+        if (ca_acq_copy(&win->value, &win->value_size,
+                               (u_char *) "", sizeof(num) - 1)
+            != CA_OK)
+        {
+            json_object_put(obj);
+            return NULL;
+        }
+    }
+
+    win->value[0] = '\0';
+
+    for (i = 0; i < win->nstats; i++) {
+        p = num;
+
+        switch (win->stats[i].type) {
+
+        case CA_ACQ_STAT_LAST:
+            p = win->last;
+            break;
+
+        case CA_ACQ_STAT_COUNT:
+            ca_snprintf(num, sizeof(num), "%uL%Z", sk->n);
+            break;
+
+        default:
+
+            if (sk->n == 0) {
+                p = NULL;
+                break;
+            }
+
+            switch (win->stats[i].type) {
+
+            case CA_ACQ_STAT_MIN:
+                v = sk->min;
+                break;
+
+            case CA_ACQ_STAT_MAX:
+                v = sk->max;
+                break;
+
+            case CA_ACQ_STAT_AVG:
+                v = sk->sum / sk->n;
+                break;
+
+            case CA_ACQ_STAT_SUM:
+                v = sk->sum;
+                break;
+
+            default: /* CA_ACQ_STAT_QUANTILE */
+                v = ca_sketch_quantile(sk, win->stats[i].q);
+                break;
+            }
+
+            ca_snprintf(num, sizeof(num), "%.2f%Z", v);
+            break;
+        }
+
+        if (p == NULL) {
+            continue;
+        }
+
+        json_object_object_add(obj, win->stats[i].name,
+                               json_object_new_string((const char *) p));
+
+        if (win->value[0] == '\0'
+            && ca_acq_copy(&win->value, &win->value_size, p,
+                                  ca_strlen(p))
+               != CA_OK)
+        {
+            json_object_put(obj);
+            return NULL;
+        }
+    }
+
+    return obj;
+}
+
+
+/* whether the string is a number, to *d */
+static ca_uint_t
+ca_acq_number(u_char *p, double *d)
+{
+    char  *end;
+
+    *d = strtod((char *) p, &end);
+
+    while (*end == ' ' || *end == '\n') {
+        end++;
+    }
+
+    return end != (char *) p && *end == '\0';
+}
+
+
+ca_uint_t
+ca_acq_value_number(ca_acq_value_t *v, double *d)
+{
+    switch (v->type) {
+
+    case CA_ACQ_VALUE_INT:
+        *d = (double) v->i;
+        return 1;
+
+    case CA_ACQ_VALUE_DOUBLE:
+        *d = v->d;
+        return 1;
+
+    case CA_ACQ_VALUE_STRING:
+        return ca_acq_number(v->str, d);
+
+    default:
+        *d = 0;
+        return 0;
+    }
+}
+
+
+static const char  *ca_acq_double_formats[] = {
+    "%.0f%Z", "%.1f%Z", "%.2f%Z", "%.3f%Z", "%.4f%Z", "%.5f%Z", "%.6f%Z"
+};
+
+
+/* the value as it is shipped, formatted in buf unless it is a string */
+u_char *
+ca_acq_value_format(ca_acq_value_t *v, u_char *buf, size_t size)
+{
+    switch (v->type) {
+
+    case CA_ACQ_VALUE_INT:
+        ca_snprintf(buf, size, "%L%Z", v->i);
+        return buf;
+
+    case CA_ACQ_VALUE_DOUBLE:
+        ca_snprintf(buf, size, ca_acq_double_formats[CA_MIN(v->prec, 6)],
+                    v->d);
+        return buf;
+
+    case CA_ACQ_VALUE_STRING:
+        return v->str;
+
+    default:
+        return (u_char *) "";
+    }
+}
+
+
+/*
+ * Count a sample of a windowed item, p as it is shipped and its number
+ * if numeric; when the window is over, the summary of the samples
+ * before this one is returned and *pp is set to its value.
+ */
+static json_object *
+ca_acq_window_update(ca_acq_t *item, u_char **pp, ca_uint_t numeric,
+    double v, time_t now)
+{
+    u_char           *p;
+    json_object      *obj;
+    ca_acq_window_t  *win;
+
+    win = item->summary;
+    p = *pp;
+    obj = NULL;
+
+    if (win->samples != 0 && now - win->start >= (time_t) item->window) {
+        obj = ca_acq_window_flush(win);
+
+        if (obj != NULL && win->value[0] == '\0') {
+            json_object_put(obj);
+            obj = NULL;
+        }
+
+        if (obj != NULL) {
+            *pp = win->value;
+        }
+
+        win->samples = 0;
+        ca_sketch_reset(win->sketch);
+    }
+
+    if (p == NULL) {
+        return obj;
+    }
+
+    if (win->samples == 0) {
+        win->start = now;
+    }
+
+    win->samples++;
+
+    if (ca_acq_copy(&win->last, &win->last_size, p, ca_strlen(p))
+        != CA_OK)
+    {
+        return obj;
+    }
+
+    if (numeric) {
+        ca_sketch_add(win->sketch, v);
+    }
+
+    return obj;
+}
+
+
+static void
+ca_acq_adapt(ca_acq_t *item, ca_uint_t numeric, double v)
+{
+    double           d;
+    ca_uint_t        freq;
+    ca_acq_adapt_t  *adapt;
+
+    adapt = item->adapt;
+
+    if (!numeric) {
+        adapt->numeric = 0;
+        return;
+    }
+
+    if (!adapt->numeric) {
+        adapt->numeric = 1;
+        adapt->last = v;
+        return;
+    }
+
+    d = CA_ABS(v - adapt->last);
+    freq = item->freq;
+
+    if (d > adapt->abs && d > adapt->rel * CA_ABS(adapt->last)) {
+        adapt->stable = 0;
+        freq = adapt->min;
+
+    } else if (++adapt->stable >= CA_ACQ_ADAPT_STABLE) {
+        adapt->stable = 0;
+        freq = CA_MIN(item->freq * 2, adapt->max);
+    }
+
+    adapt->last = v;
+
+    if (freq == item->freq) {
+        return;
+    }
+
+    ca_log_debug(0, "acq \"%V\" frequence %uL -> %uL",
+                 &item->item, item->freq, freq);
+
+    item->freq = freq;
+
+    /* the oldest change not shipped yet makes room, if ever */
+
+    if (adapt->nchanges == CA_ACQ_ADAPT_CHANGES) {
+        adapt->nchanges--;
+        ca_memmove(&adapt->changes[0], &adapt->changes[1],
+                   adapt->nchanges * sizeof(ca_acq_adapt_change_t));
+    }
+
+    adapt->changes[adapt->nchanges].at = item->sampled;
+    adapt->changes[adapt->nchanges].freq = freq;
+    adapt->nchanges++;
+}
+
+
+/*
+ * "freq", the frequence now, and "freqs", "<time>:<freq>" of every
+ * change, unless it is the single one made by the value shipped.
+ */
+static json_object *
+ca_acq_adapt_attrs(ca_acq_t *item, json_object *attrs)
+{
+    u_char           val[64];
+    ca_uint_t        i;
+    json_object     *arr;
+    ca_acq_adapt_t  *adapt;
+
+    adapt = item->adapt;
+
+    if (attrs == NULL) {
+        attrs = json_object_new_object();
+    }
+
+    ca_snprintf(val, sizeof(val), "%uL%Z", item->freq);
+    json_object_object_add(attrs, "freq",
+                           json_object_new_string((char *) val));
+
+    if (adapt->nchanges > 1 || adapt->changes[0].at != item->sampled) {
+        arr = json_object_new_array();
+
+        for (i = 0; i < adapt->nchanges; i++) {
+            ca_snprintf(val, sizeof(val), "%T:%uL%Z", adapt->changes[i].at,
+                        adapt->changes[i].freq);
+            json_object_array_add(arr, json_object_new_string((char *) val));
+        }
+
+        json_object_object_add(attrs, "freqs", arr);
+    }
+
+    adapt->nchanges = 0;
+
+    return attrs;
+}
+
+
+/*
+ * whether the value is held back by the dead-band of the item, one that
+ * is forced out is still the last one sent
+ */
+static ca_uint_t
+ca_acq_deadband_hold(ca_acq_deadband_t *db, u_char *p, ca_uint_t numeric,
+    double v, ca_uint_t force)
+{
+    double      d;
+    ca_uint_t   same;
+
+    if (db->sent && !force) {
+        if (numeric && db->numeric) {
+            d = CA_ABS(v - db->last);
+            same = (d <= db->abs || d <= db->rel * CA_ABS(db->last));
+
+        } else {
+            same = (ca_strcmp(p, db->last_str) == 0);
+        }
+
+        if (same && (db->heartbeat == 0 || db->held + 1 < db->heartbeat)) {
+            db->held++;
+            return 1;
+        }
+    }
+
+    if (ca_acq_copy(&db->last_str, &db->last_size, p, ca_strlen(p))
+        != CA_OK)
+    {
+        db->sent = 0;
+        return 0;
+    }
+
+    db->sent = 1;
+    db->held = 0;
+    db->numeric = numeric;
+    db->last = v;
+
+    return 0;
+}
+
+
+/* an old handler returns a string, it is copied to the slot */
+static void
+ca_acq_value_adapter(ca_acq_t *item, time_t now, time_t freq,
+    ca_acq_value_t *v)
+{
+    u_char  *p;
+
+    if (item->key_handler) {
+        p = item->key_handler(&item->key, now, freq);
+
+    } else {
+        p = item->handler(now, freq);
+    }
+
+    if (p == NULL
+        || ca_acq_copy(&v->str, &v->str_size, p, ca_strlen(p)) != CA_OK)
+    {
+        return;
+    }
+
+    v->type = CA_ACQ_VALUE_STRING;
+}
+
+
+/*
+ * Call the handler of the item, its value is left in item->sample.  A
+ * forced item is sampled with freq 0, so that a handler reads afresh
+ * what it caches for freq, once for the items of a build-in collector.
+ */
+static void
+ca_acq_sample(ca_acq_t *item, time_t now)
+{
+    time_t           freq;
+    ca_acq_value_t  *v;
+
+    v = &item->sample;
+    v->type = CA_ACQ_VALUE_NONE;
+    v->prec = 0;
+    v->unit = NULL;
+
+    freq = item->forced ? 0 : item->freq;
+
+    if (item->multi_handler) {
+        item->multi->nsamples = 0;
+        item->multi_handler(item->key.len ? &item->key : NULL, now, freq,
+                            item->multi);
+
+    } else if (item->key_value) {
+        item->key_value(&item->key, now, freq, v);
+
+    } else if (item->item_value) {
+        item->item_value(now, freq, v);
+
+    } else {
+        ca_acq_value_adapter(item, now, freq, v);
+    }
+
+    item->forced = 0;
+    item->sampled = now;
+    item->ready = 1;
+}
+
+
+/* sample the due items of a collector, timed */
+static void
+ca_acq_collector_run(ca_acq_collector_t *c, time_t now)
+{
+    u_char       fresh[CA_ACQ_COLLECTORS];
+    double       start;
+    ca_uint_t    i, k, index;
+    ca_acq_t   **itemp;
+
+    index = c - acq_collectors;
+    itemp = c->due->elem;
+    start = ca_self_msec();
+
+    if (c->plugin) {
+        ca_plugin_collect(c->plugin - 1, now, itemp, c->due->nelem);
+
+    } else {
+        ca_memzero(fresh, sizeof(fresh));
+
+        for (i = 0; i < c->due->nelem; i++) {
+            k = itemp[i]->collector;
+
+            /*
+             * the items of a collector read what it caches, it is read
+             * afresh for the first forced one, the others take it up
+             */
+
+            if (itemp[i]->forced && k != CA_ACQ_INLINE
+                && k < CA_ACQ_COLLECTORS)
+            {
+                if (fresh[k]) {
+                    itemp[i]->forced = 0;
+                }
+
+                fresh[k] = 1;
+            }
+
+            ca_acq_sample(itemp[i], now);
+        }
+    }
+
+    ca_self_set(CA_SELF_COLLECTOR_TIME + index, ca_self_msec() - start);
+    ca_self_add(CA_SELF_COLLECTOR_RUNS + index, 1);
+}
+
+
+static void
+ca_acq_collector_task(void *arg)
+{
+    ca_acq_collector_t  *c;
+
+    c = arg;
+
+    ca_acq_collector_run(c, c->now);
+
+    pthread_mutex_lock(&acq_pool_mutex);
+
+    c->done = 1;
+
+    if (c->gen == acq_pool_gen && acq_pool_pending > 0) {
+        if (--acq_pool_pending == 0) {
+            pthread_cond_signal(&acq_pool_cond);
+        }
+    }
+
+    pthread_mutex_unlock(&acq_pool_mutex);
+}
+
+
+/*
+ * Sample the due items: the collectors that may run in parallel are
+ * handed to the acq pool, the inline items are sampled meanwhile on
+ * this thread, then the pool is waited for until the deadline.
+ */
+static void
+ca_acq_collect(ca_conf_ctx_t *conf, time_t now)
+{
+    ca_int_t             interval;
+    ca_uint_t            i, gen;
+    sigset_t             set, old;
+    ca_acq_t            *item, **itemp;
+    struct timeval       tv;
+    struct timespec      ts;
+    ca_acq_collector_t  *c;
+
+    if (acq_pool == NULL && conf->acq_threads > 0) {
+        acq_pool = ca_threadpool_create(1, conf->acq_threads, 0);
+        if (acq_pool == NULL) {
+            ca_log_err(0, "create acq pool failed, collect serially");
+            conf->acq_threads = 0;
+        }
+    }
+
+    for (i = 0; i < CA_ACQ_NCOLLECTORS; i++) {
+        if (acq_collectors[i].due == NULL) {
+            acq_collectors[i].due = ca_array_create(8, sizeof(ca_acq_t *));
+            if (acq_collectors[i].due == NULL) {
+                return;
+            }
+
+            if (i >= CA_ACQ_COLLECTORS) {
+                acq_collectors[i].plugin = i - CA_ACQ_COLLECTORS + 1;
+            }
+        }
+
+        if (!acq_collectors[i].running) {
+            acq_collectors[i].due->nelem = 0;
+        }
+    }
+
+    item = acq_items->elem;
+
+    for (i = 0; i < acq_items->nelem; i++) {
+        interval = now - item[i].accessed;
+
+        if (interval < 0) {
+            item[i].accessed = 0;
+            continue;
+        }
+
+        if (interval < (ca_int_t) item[i].freq) {
+            continue;
+        }
+
+        c = &acq_collectors[CA_ACQ_INLINE];
+
+        if (acq_pool || item[i].collector >= CA_ACQ_COLLECTORS) {
+            c = &acq_collectors[item[i].collector];
+        }
+
+        if (c->running) {
+            continue;
+        }
+
+        itemp = ca_array_push(c->due);
+        if (itemp == NULL) {
+            continue;
+        }
+
+        *itemp = &item[i];
+        item[i].accessed = now;
+
+        ca_log_debug(0, "acq \"%V\"", &item[i].item);
+    }
+
+    /* the pool threads must not take the signals of the main thread */
 
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old);
 
-STAILQ_HEAD(ca_acq_data_hdr_s, ca_acq_data_s);
+    pthread_mutex_lock(&acq_pool_mutex);
 
+    gen = ++acq_pool_gen;
+    acq_pool_pending = 0;
 
-static ca_uint_t          nfree;
-static ca_acq_data_hdr_t  free_queue;
-static ca_uint_t          max_nfree;
-static ca_uint_t          ntask;
-static ca_acq_data_hdr_t  task_queue;
-static pthread_mutex_t    free_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t    task_mutex = PTHREAD_MUTEX_INITIALIZER;
+    for (i = CA_ACQ_INLINE + 1; acq_pool && i < CA_ACQ_NCOLLECTORS; i++) {
+        c = &acq_collectors[i];
 
+        if (c->running || c->due->nelem == 0) {
+            continue;
+        }
 
-static void *ca_acq_submit_cycle(void *dummy);
-static void *ca_acq_cycle(void *dummy);
-static ca_int_t ca_select_submit(ca_int_t *pfd, ca_int_t *pindex, char *buf,
-    size_t len, ca_conf_ctx_t *conf);
-static ca_int_t ca_select_send_and_recv(ca_int_t fd, char *buf, size_t len,
-    ca_conf_ctx_t *conf, ca_server_t *server);
+        c->now = now;
+        c->gen = gen;
+        c->done = 0;
 
+        if (ca_threadpool_add_task(acq_pool, ca_acq_collector_task, c, 0)
+            != 0)
+        {
+            ca_log_err(0, "add acq collector %uL to pool failed", i);
+            continue;
+        }
 
-static ca_acq_data_t *
-ca_acq_task_get(void)
-{
-    ca_acq_data_t  *data = NULL;
+        c->running = 1;
+        acq_pool_pending++;
+    }
 
-    pthread_mutex_lock(&task_mutex);
+    pthread_mutex_unlock(&acq_pool_mutex);
 
-    if (!STAILQ_EMPTY(&task_queue)) {
-        data = STAILQ_FIRST(&task_queue);
-        ntask--;
-        STAILQ_REMOVE_HEAD(&task_queue, next);
-        STAILQ_NEXT(data, next) = NULL;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (acq_collectors[CA_ACQ_INLINE].due->nelem) {
+        ca_acq_collector_run(&acq_collectors[CA_ACQ_INLINE], now);
     }
 
-    pthread_mutex_unlock(&task_mutex);
+    for (i = CA_ACQ_COLLECTORS; !acq_pool && i < CA_ACQ_NCOLLECTORS; i++) {
+        if (acq_collectors[i].due->nelem) {
+            ca_acq_collector_run(&acq_collectors[i], now);
+        }
+    }
 
-    return data;
+    gettimeofday(&tv, NULL);
+    ts.tv_sec = tv.tv_sec + conf->acq_deadline / 1000;
+    ts.tv_nsec = tv.tv_usec * 1000 + (conf->acq_deadline % 1000) * 1000000;
+    if (ts.tv_nsec >= BILLION) {
+        ts.tv_sec++;
+        ts.tv_nsec -= BILLION;
+    }
+
+    pthread_mutex_lock(&acq_pool_mutex);
+
+    while (acq_pool_pending > 0) {
+        if (pthread_cond_timedwait(&acq_pool_cond, &acq_pool_mutex, &ts)
+            == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+
+    acq_pool_pending = 0;
+
+    for (i = CA_ACQ_INLINE + 1; i < CA_ACQ_NCOLLECTORS; i++) {
+        c = &acq_collectors[i];
+
+        if (c->running && c->done) {
+            __atomic_store_n(&c->running, 0, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_mutex_unlock(&acq_pool_mutex);
+
+    for (i = CA_ACQ_INLINE + 1; i < CA_ACQ_NCOLLECTORS; i++) {
+        c = &acq_collectors[i];
+
+        if (c->running && !c->late) {
+            itemp = c->due->elem;
+            c->late = 1;
+
+            ca_log_warn(0, "acq collector of \"%V\" missed the deadline "
+                        "of %uLms, its items are late",
+                        &itemp[0]->item, conf->acq_deadline);
+        }
+    }
+}
+
+
+/* the data array of the payload of this tick, created with its first entry */
+static json_object *
+ca_acq_payload(json_object **json, ca_conf_ctx_t *conf, time_t now)
+{
+    u_char        num[32];
+    json_object  *obj;
+
+    if (*json != NULL) {
+        return acq_payload_data;
+    }
+
+    *json = json_object_new_object();
+    acq_payloads++;
+    acq_payload_dims = NULL;
+
+    obj = json_object_new_string_len((const char *) conf->identify.data,
+                                     (int) conf->identify.len);
+    json_object_object_add(*json, "host", obj);
+
+    ca_snprintf(num, sizeof(num), "%ud%Z", now);
+    obj = json_object_new_string((const char *) num);
+    json_object_object_add(*json, "time", obj);
+
+    acq_payload_data = json_object_new_array();
+    json_object_object_add(*json, "data", acq_payload_data);
+
+    return acq_payload_data;
 }
 
 
+/*
+ * An entry per sample of a multi-value item, with the id of its
+ * dimension set, which is defined in the "dims" object of the payload.
+ */
 static void
-ca_acq_task_insert(ca_acq_data_t *data)
+ca_acq_multi_ship(ca_acq_t *item, json_object **json, ca_conf_ctx_t *conf,
+    time_t now, ca_uint_t late)
 {
-    pthread_mutex_lock(&task_mutex);
+    u_char               *p, val[64], num[32];
+    uint32_t              id;
+    ca_uint_t             i;
+    json_object          *arr, *entry, *attrs;
+    ca_acq_multi_t       *m;
+    ca_acq_dim_sample_t  *s;
 
-    STAILQ_INSERT_TAIL(&task_queue, data, next);
-    ntask++;
+    m = item->multi;
 
-    pthread_mutex_unlock(&task_mutex);
+    for (i = 0; i < m->nsamples; i++) {
+        s = &m->samples[i];
+
+        if (s->value.type == CA_ACQ_VALUE_NONE) {
+            continue;
+        }
+
+        id = ca_acq_dims_intern(s->dims, s->dims_len);
+        if (id == 0 || !ca_acq_multi_admit(item, id)) {
+            continue;
+        }
+
+        arr = ca_acq_payload(json, conf, now);
+        ca_snprintf(num, sizeof(num), "%uD%Z", id);
+
+        if (acq_dims[id - 1].payload != acq_payloads) {
+            if (acq_payload_dims == NULL) {
+                acq_payload_dims = json_object_new_object();
+                json_object_object_add(*json, "dims", acq_payload_dims);
+            }
+
+            json_object_object_add(acq_payload_dims, (const char *) num,
+                json_object_new_string((char *) acq_dims[id - 1].dims.data));
+            acq_dims[id - 1].payload = acq_payloads;
+        }
+
+        entry = json_object_new_array();
+
+        ca_snprintf(val, sizeof(val), "%d%Z", item->id);
+        json_object_array_add(entry, json_object_new_string((char *) val));
+
+        p = ca_acq_value_format(&s->value, val, sizeof(val));
+        json_object_array_add(entry, json_object_new_string((char *) p));
+
+        json_object_array_add(entry, json_object_new_string("1"));
+
+        attrs = json_object_new_object();
+        json_object_object_add(attrs, "dims",
+                               json_object_new_string((char *) num));
+
+        if (late) {
+            ca_snprintf(num, sizeof(num), "%ud%Z", item->sampled);
+            json_object_object_add(attrs, "late",
+                                   json_object_new_string((char *) num));
+        }
+
+        json_object_array_add(entry, attrs);
+        json_object_array_add(arr, entry);
+    }
 }
 
 
-static ca_acq_data_t *
-ca_acq_data_get(void)
+/*
+ * A payload built out of the acq cycle, of samples from from to to; an
+ * alert is submitted before any other payload.
+ */
+ca_int_t
+ca_acq_queue(struct json_object *json, time_t from, time_t to,
+    ca_uint_t kind)
 {
     ca_acq_data_t  *data;
 
-    pthread_mutex_lock(&free_mutex);
+    data = ca_acq_data_get();
+    if (data == NULL) {
+        json_object_put(json);
+        return CA_ERROR;
+    }
 
-    if (!STAILQ_EMPTY(&free_queue)) {
-        data = STAILQ_FIRST(&free_queue);
-        nfree--;
-        STAILQ_REMOVE_HEAD(&free_queue, next);
+    data->json = json;
+    data->queued = ca_self_msec();
+    data->from = from;
+    data->to = to;
+    data->kind = kind;
+    data->tries = 0;
 
-    } else {
+    ca_acq_task_insert(data);
 
-        data = ca_calloc(sizeof(ca_acq_data_t), 1);
-        if (data == NULL) {
-            pthread_mutex_unlock(&free_mutex);
-            return NULL;
+    return CA_OK;
+}
+
+
+ca_int_t
+ca_acq_add_event(ca_acq_event_t *ev)
+{
+    ca_acq_event_t  **evp;
+
+    if (acq_events == NULL) {
+        acq_events = ca_array_create(4, sizeof(ca_acq_event_t *));
+        if (acq_events == NULL) {
+            return CA_ERROR;
         }
     }
 
-    STAILQ_NEXT(data, next) = NULL;
+    evp = ca_array_push(acq_events);
+    if (evp == NULL) {
+        return CA_ERROR;
+    }
 
-    pthread_mutex_unlock(&free_mutex);
+    *evp = ev;
 
-    return data;
+    ca_free(acq_pollfds);
+    acq_pollfds = NULL;
+
+    return CA_OK;
 }
 
 
-static void
-ca_acq_data_put(ca_acq_data_t *data)
+/* the collector of the name, a plugin by the name it declares */
+ca_int_t
+ca_acq_collector_index(ca_str_t *name)
 {
-    pthread_mutex_lock(&free_mutex);
+    ca_int_t  i;
 
-    if (nfree != 0 && nfree + 1 > max_nfree) {
-        ca_free(data);
+    for (i = 0; ca_acq_collector_names[i].len != 0; i++) {
+        if (ca_acq_collector_names[i].len == name->len
+            && ca_strncmp(ca_acq_collector_names[i].data, name->data,
+                          name->len)
+               == 0)
+        {
+            return i;
+        }
+    }
 
-    } else {
-        nfree++;
-        STAILQ_INSERT_HEAD(&free_queue, data, next);
+    i = ca_plugin_index(name);
+
+    return i == CA_ERROR ? CA_ERROR : CA_ACQ_COLLECTORS + i;
+}
+
+
+/* NULL if there is no such collector */
+const char *
+ca_acq_collector_name(ca_uint_t i)
+{
+    if (i < CA_ACQ_COLLECTORS) {
+        return (const char *) ca_acq_collector_names[i].data;
     }
 
+    return ca_plugin_name(i - CA_ACQ_COLLECTORS);
+}
+
+
+/* only for the acq thread, which owns the state */
+void
+ca_acq_collector_state(ca_uint_t i, ca_uint_t *running, ca_uint_t *late)
+{
+    *running = acq_collectors[i].running;
+    *late = acq_collectors[i].late;
+}
+
+
+void
+ca_acq_queues(ca_uint_t *ntask_p, ca_uint_t *nfree_p)
+{
+    pthread_mutex_lock(&task_mutex);
+    *ntask_p = ntask;
+    pthread_mutex_unlock(&task_mutex);
+
+    pthread_mutex_lock(&free_mutex);
+    *nfree_p = nfree;
     pthread_mutex_unlock(&free_mutex);
 }
 
 
+/*
+ * Make the items served by handler (and key, if not NULL) due on the
+ * next pass of the acq cycle.
+ */
+void
+ca_acq_expedite(ca_acq_key_handler_pt handler, ca_str_t *key)
+{
+    ca_uint_t   i;
+    ca_acq_t   *item;
+
+    if (acq_items == NULL) {
+        return;
+    }
+
+    item = acq_items->elem;
+
+    for (i = 0; i < acq_items->nelem; i++) {
+        if (item[i].key_handler != handler) {
+            continue;
+        }
+
+        if (key != NULL
+            && (item[i].key.len != key->len
+                || ca_strncmp(item[i].key.data, key->data, key->len) != 0))
+        {
+            continue;
+        }
+
+        item[i].accessed = 0;
+    }
+}
+
+
+/*
+ * Sleep until the next tick, or until one of the registered events
+ * fires.
+ */
 static void
-ca_acq_data_remove(ca_acq_data_hdr_t *queue, ca_acq_data_t *data)
+ca_acq_wait(ca_int_t timeout)
 {
-    STAILQ_REMOVE(queue, data, ca_acq_data_s, next);
-    STAILQ_NEXT(data, next) = NULL;
+    int               n;
+    ca_uint_t         i;
+    ca_acq_event_t  **evp;
+
+    if (acq_events == NULL || acq_events->nelem == 0) {
+        poll(NULL, 0, timeout);
+        return;
+    }
+
+    evp = acq_events->elem;
+
+    if (acq_pollfds == NULL) {
+        acq_pollfds = ca_calloc(acq_events->nelem, sizeof(struct pollfd));
+        if (acq_pollfds == NULL) {
+            poll(NULL, 0, timeout);
+            return;
+        }
+    }
+
+    /* a handler may change any event, not only its own */
+
+    for (i = 0; i < acq_events->nelem; i++) {
+        acq_pollfds[i].fd = evp[i]->fd;
+        acq_pollfds[i].events = evp[i]->events;
+    }
+
+    n = poll(acq_pollfds, acq_events->nelem, timeout);
+    if (n <= 0) {
+        return;
+    }
+
+    for (i = 0; i < acq_events->nelem; i++) {
+        if (acq_pollfds[i].revents == 0) {
+            continue;
+        }
+
+        if (acq_pollfds[i].revents & POLLNVAL) {
+            ca_log_err(0, "acq event fd %d is invalid, disabled",
+                       acq_pollfds[i].fd);
+            evp[i]->fd = -1;
+            continue;
+        }
+
+        evp[i]->handler(evp[i]);
+    }
 }
 
 
@@ -172,6 +1740,7 @@ ca_acq_data_init(ca_uint_t max)
     max_nfree = max;
     ntask = 0;
     STAILQ_INIT(&task_queue);
+    STAILQ_INIT(&priority_queue);
 }
 
 
@@ -194,6 +1763,14 @@ ca_acq_data_deinit(void)
         ca_free(data);
         ntask--;
     }
+
+    while (!STAILQ_EMPTY(&priority_queue)) {
+        data = STAILQ_FIRST(&priority_queue);
+        ca_acq_data_remove(&priority_queue, data);
+        json_object_put(data->json);
+        ca_free(data);
+        ntask--;
+    }
 }
 
 
@@ -201,6 +1778,7 @@ void
 ca_acq_process_cycle(void *dummy)
 {
     int                 s;
+    ca_int_t            i;
     sigset_t            set;
     ca_conf_ctx_t      *conf;
     pthread_t           acq, submit;
@@ -211,6 +1789,13 @@ ca_acq_process_cycle(void *dummy)
 
     ca_acq_data_init(conf->max_nfree);
 
+    for (i = 0; ca_acq_inits[i] != NULL; i++) {
+        if (ca_acq_inits[i](conf) != CA_OK) {
+            ca_log_crit(0, "init acq collector failed");
+            exit(255);
+        }
+    }
+
     sigemptyset(&set);
     if (pthread_sigmask(SIG_SETMASK, &set, NULL) == -1) {
         ca_log_err(errno, "pthread_sigmask() failed");
@@ -246,6 +1831,8 @@ ca_acq_process_cycle(void *dummy)
     pthread_join(acq, &ret);
     ca_log_debug(0, "acq thread exit");
 
+    ca_plugin_exit();
+
     ca_acq_data_deinit();
 
     ca_log_debug(0, "exit");
@@ -257,13 +1844,16 @@ ca_acq_process_cycle(void *dummy)
 static void *
 ca_acq_cycle(void *dummy)
 {
-    time_t          now;
-    u_char         *p, *tmp, *buf;
-    ca_int_t        i, len, buf_size, interval;
-    ca_acq_t       *item, *value;
-    ca_conf_ctx_t  *conf;
-    json_object    *json, *obj, *data_obj, *arr_obj;
-    ca_acq_data_t  *data;
+    time_t               now, from, to;
+    u_char              *p, *tmp, *buf, val[64];
+    double               num, start, last;
+    ca_int_t             i, len, buf_size;
+    ca_uint_t            numeric, changed;
+    ca_acq_t            *item, *value;
+    ca_conf_ctx_t       *conf;
+    json_object         *json, *obj, *data_obj, *arr_obj, *summary;
+    ca_acq_data_t       *data;
+    ca_acq_collector_t  *c;
 
     conf = dummy;
     buf_size = CA_ITEM_DATA_SIZE;
@@ -272,7 +1862,9 @@ ca_acq_cycle(void *dummy)
         return NULL;
     }
 
+    acq_items = conf->acq_items;
     value = conf->acq_items->elem;
+    last = 0;
 
     for ( ;; ) {
         if (ca_quit || ca_terminate) {
@@ -281,23 +1873,107 @@ ca_acq_cycle(void *dummy)
 
         now = time(&now);
 
+        /* how much later than a tick after the last one it has started */
+
+        start = ca_self_msec();
+
+        if (last != 0) {
+            ca_self_set(CA_SELF_TICK_LATENESS,
+                        CA_MAX(start - last - CA_ACQ_TICK, 0));
+        }
+
+        last = start;
+
+        for (i = 0; ca_acq_ticks[i] != NULL; i++) {
+            ca_acq_ticks[i](now);
+        }
+
+        ca_acq_collect(conf, now);
+
         json = NULL;
+        from = 0;
+        to = 0;
 
         for (i = 0; i < conf->acq_items->nelem; i++) {
             item = &value[i];
+            c = &acq_collectors[item->collector];
+
+            /*
+             * the sample of a running collector is being written by the
+             * pool, it is not looked at before the collector is over
+             */
+
+            if (__atomic_load_n(&c->running, __ATOMIC_ACQUIRE)) {
+                continue;
+            }
+
+            if (item->ready) {
+                item->ready = 0;
+
+                ca_prometheus_sample(i, item);
+                ca_store_sample(i, item);
+                ca_rule_eval(i, item);
+
+                if (item->multi != NULL) {
+                    ca_acq_multi_ship(item, &json, conf, now, c->late);
+                    continue;
+                }
+
+                numeric = ca_acq_value_number(&item->sample, &num);
+                p = NULL;
+
+                if (item->sample.type != CA_ACQ_VALUE_NONE) {
+                    p = ca_acq_value_format(&item->sample, val, sizeof(val));
+                }
+
+                summary = NULL;
+
+                if (item->adapt != NULL && p != NULL) {
+                    ca_acq_adapt(item, numeric, num);
+                }
+
+                if (item->summary != NULL) {
+                    summary = ca_acq_window_update(item, &p, numeric, num,
+                                                   item->sampled);
+                    if (summary == NULL) {
+                        continue;
+                    }
+
+                    numeric = ca_acq_number(p, &num);
+                }
+
+                if (p == NULL) {
+                    continue;
+                }
+
+                /* a change of frequence is not held back */
 
-            interval = now - item->accessed;
+                changed = (item->adapt != NULL && item->adapt->nchanges);
 
-            if (interval < 0) {
-                item->accessed = 0;
+                if (item->deadband != NULL
+                    && ca_acq_deadband_hold(item->deadband, p, numeric, num,
+                                            changed))
+                {
+                    if (summary != NULL) {
+                        json_object_put(summary);
+                    }
 
-            } else if (interval >= item->freq) {
+                    continue;
+                }
 
-                ca_log_debug(0, "acq \"%V\"", &item->item);
+                if (changed) {
+                    summary = ca_acq_adapt_attrs(item, summary);
+                }
 
-                p = item->handler(now, item->freq);
+                if (c->late) {
+                    if (summary == NULL) {
+                        summary = json_object_new_object();
+                    }
 
-                item->accessed = now;
+                    ca_slprintf(buf, buf + buf_size, "%ud%Z", item->sampled);
+                    json_object_object_add(summary, "late",
+                                        json_object_new_string((char *) buf));
+                }
 
                 len = item->id_len + 1 + ca_strlen(p) + 1 + 2 + 1;
 
@@ -334,30 +2010,40 @@ ca_acq_cycle(void *dummy)
                 obj = json_object_new_string("1");
                 json_object_array_add(data_obj, obj);
 
-                if (json == NULL) {
-                    json = json_object_new_object();
-                    obj = json_object_new_string_len(
-                                              (const char *)conf->identify.data,
-                                              (int)conf->identify.len);
-                    json_object_object_add(json, "host", obj);
-        
-                    ca_slprintf(buf, buf + buf_size, "%ud%Z", now);
-                    obj = json_object_new_string((const char *)buf);
-                    json_object_object_add(json, "time", obj);
-        
-                    arr_obj = json_object_new_array();
-                    json_object_object_add(json, "data", arr_obj);
+                if (summary != NULL) {
+                    json_object_array_add(data_obj, summary);
                 }
 
-                ASSERT(json != NULL && arr_obj != NULL && data_obj != NULL);
+                arr_obj = ca_acq_payload(&json, conf, now);
 
                 json_object_array_add(arr_obj, data_obj);
+
+                /* the times of the samples, for an outage to backfill */
+
+                if (from == 0 || item->sampled < from) {
+                    from = item->sampled;
+                }
+
+                to = CA_MAX(to, item->sampled);
+            }
+        }
+
+        for (i = 0; i < CA_ACQ_NCOLLECTORS; i++) {
+            if (!acq_collectors[i].running) {
+                acq_collectors[i].late = 0;
             }
         }
 
+        ca_prometheus_update();
+        ca_rule_flush(now);
+
         if (json) {
             data = ca_acq_data_get(); 
             data->json = json;
+            data->queued = ca_self_msec();
+            data->from = from;
+            data->to = to;
+            data->kind = CA_ACQ_PAYLOAD_BULK;
             ca_acq_task_insert(data);
             json = NULL;
         }
@@ -366,7 +2052,7 @@ ca_acq_cycle(void *dummy)
             break;
         }
 
-        sleep(1);
+        ca_acq_wait(CA_ACQ_TICK);
     }
 
 over:
@@ -407,7 +2093,7 @@ ca_acq_submit_cycle(void *dummy)
                 break;
             }
 
-            sleep(1);
+            ca_acq_task_wait();
             continue;
         }
 
@@ -417,8 +2103,29 @@ ca_acq_submit_cycle(void *dummy)
         ca_log_debug(0, "submit %d '%s'", len, buf);
 
         ret = ca_select_submit(&fd, &index, buf, len, conf);
+
+        ca_self_set(CA_SELF_SUBMIT_SERVER, fd == CA_ERROR ? -1 : index);
         if (ret == CA_ERROR) {
             ca_log_err(0, "submit %d '%s' failed", len, buf);
+            ca_self_add(CA_SELF_SUBMIT_FAILURES, 1);
+
+        } else {
+            ca_self_set(CA_SELF_SUBMIT_LATENCY,
+                        ca_self_msec() - data->queued);
+            ca_self_add(CA_SELF_PAYLOADS, 1);
+            ca_self_add(CA_SELF_PAYLOAD_BYTES, len);
+        }
+
+        ca_store_submitted(data->from, data->to, data->kind, ret);
+
+        if (ret == CA_ERROR && data->kind == CA_ACQ_PAYLOAD_ALERT) {
+            if (++data->tries < CA_ACQ_ALERT_TRIES) {
+                ca_acq_task_retry(data);
+                continue;
+            }
+
+            ca_log_err(0, "alert dropped after %uL tries",
+                       (uint64_t) data->tries);
         }
 
         json_object_put(data->json);
@@ -599,6 +2306,10 @@ ca_select_submit(ca_int_t *pfd, ca_int_t *pindex, char *buf, size_t len,
         fd = tcp_connect_timeout((struct sockaddr *) &server->sin,
                                  conf->connect_timeout);
 
+        if ((fd == CA_AGAIN || fd == CA_ERROR) && index < CA_SELF_SERVERS) {
+            ca_self_add(CA_SELF_CONNECT_FAILURES + index, 1);
+        }
+
         if (fd == CA_AGAIN) {
             ca_log_alert(0, "connect to \"%s\" timeout", server->addr_str);
             continue;
@@ -7,24 +7,258 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+
+
+#define CA_ACQ_VALUE_NONE      0
+#define CA_ACQ_VALUE_INVALID   1
+#define CA_ACQ_VALUE_INT       2
+#define CA_ACQ_VALUE_DOUBLE    3
+#define CA_ACQ_VALUE_STRING    4
+
+/*
+ * A sample as a handler leaves it in the slot of the item, formatted
+ * only when it is shipped, a double with prec decimals.  NONE has no
+ * value yet, the item is left out of this round; INVALID could not be
+ * read and is shipped empty.  A string is what an old handler returned.
+ */
+typedef struct {
+    ca_uint_t               type;
+    ca_uint_t               prec;
+    int64_t                 i;
+    double                  d;
+    const char             *unit;
+    u_char                 *str;
+    size_t                  str_size;
+} ca_acq_value_t;
+
+#define CA_ACQ_DIMS_LEN        128
+#define CA_ACQ_DIMS_MAX        100
+
+/*
+ * A sample of a multi-value item, with its dimension set as
+ * "key=value[,key=value]"; the set is interned into an id when it is
+ * shipped, the payload carries the id and defines it in "dims".
+ */
+typedef struct {
+    ca_acq_value_t          value;
+    u_char                  dims[CA_ACQ_DIMS_LEN];
+    size_t                  dims_len;
+} ca_acq_dim_sample_t;
+
+/*
+ * The samples a multi handler adds with ca_acq_multi_add() in one call.
+ * An item ships at most max dimension sets over its life, the samples
+ * of any other set are dropped.
+ */
+typedef struct {
+    ca_acq_dim_sample_t    *samples;
+    ca_uint_t               nsamples;
+    ca_uint_t               nalloc;
+    ca_uint_t               max;
+    ca_uint_t               ndims;
+    u_char                 *seen;              /* bitmap of dims ids */
+    size_t                  seen_size;
+    ca_uint_t               dropped;
+} ca_acq_multi_t;
+
+
+#include "acq/ca_cgroup.h"
 #include "acq/ca_cpu.h"
 #include "acq/ca_disk_io.h"
 #include "acq/ca_disk_urate.h"
+#include "acq/ca_exec.h"
+#include "acq/ca_file_value.h"
+#include "acq/ca_interrupts.h"
 #include "acq/ca_load_average.h"
+#include "acq/ca_log_tail.h"
 #include "acq/ca_memory.h"
 #include "acq/ca_net_flow.h"
+#include "acq/ca_net_stat.h"
+#include "acq/ca_numa.h"
+#include "acq/ca_pressure.h"
+#include "acq/ca_process.h"
+#include "acq/ca_self.h"
+#include "acq/ca_statsd.h"
+#include "acq/ca_tcp_diag.h"
+
+
+static inline void
+ca_acq_value_int(ca_acq_value_t *v, int64_t n, const char *unit)
+{
+    v->type = CA_ACQ_VALUE_INT;
+    v->i = n;
+    v->unit = unit;
+}
+
+
+static inline void
+ca_acq_value_double(ca_acq_value_t *v, double n, ca_uint_t prec,
+    const char *unit)
+{
+    v->type = CA_ACQ_VALUE_DOUBLE;
+    v->d = n;
+    v->prec = prec;
+    v->unit = unit;
+}
+
+
+static inline void
+ca_acq_value_invalid(ca_acq_value_t *v)
+{
+    v->type = CA_ACQ_VALUE_INVALID;
+}
 
 
 typedef u_char *(*ca_acq_item_handler_pt)(time_t now, time_t freq);
+typedef u_char *(*ca_acq_key_handler_pt)(ca_str_t *key, time_t now,
+    time_t freq);
+typedef void (*ca_acq_item_value_pt)(time_t now, time_t freq,
+    ca_acq_value_t *v);
+typedef void (*ca_acq_key_value_pt)(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_value_t *v);
+typedef void (*ca_acq_multi_pt)(ca_str_t *key, time_t now, time_t freq,
+    ca_acq_multi_t *m);
+typedef ca_int_t (*ca_acq_init_pt)(void *conf);
+typedef void (*ca_acq_tick_pt)(time_t now);
+
+typedef struct ca_acq_event_s  ca_acq_event_t;
+typedef void (*ca_acq_event_handler_pt)(ca_acq_event_t *ev);
+
+/*
+ * A file descriptor polled by the acq thread between ticks, so that a
+ * collector can be woken up by the kernel instead of waiting for the
+ * next sampling tick.  The fd and events are read before every poll, a
+ * handler may set fd to -1 to stop polling it.
+ */
+struct ca_acq_event_s {
+    int                      fd;
+    short                    events;
+    ca_acq_event_handler_pt  handler;
+    void                    *data;
+};
+
+/*
+ * The handlers of a collector share its state, they are called one
+ * after another, but those of different collectors run in parallel on
+ * the acq pool.  A collector with ticks or events is CA_ACQ_INLINE,
+ * its handlers are called on the acq thread.
+ */
+#define CA_ACQ_INLINE          0
+#define CA_ACQ_CPU             1
+#define CA_ACQ_DISK_IO         2
+#define CA_ACQ_DISK_URATE      3
+#define CA_ACQ_INTERRUPTS      4
+#define CA_ACQ_LOAD_AVERAGE    5
+#define CA_ACQ_MEMORY          6
+#define CA_ACQ_NET_FLOW        7
+#define CA_ACQ_NET_STAT        8
+#define CA_ACQ_NUMA            9
+#define CA_ACQ_TCP_DIAG        10
+#define CA_ACQ_COLLECTORS      11
+#define CA_ACQ_NCOLLECTORS     (CA_ACQ_COLLECTORS + CA_ACQ_PLUGINS)
 
+/*
+ * An item is served either by item_handler, or, when it is configured
+ * with a key as "name[key]", by key_handler.  A handler returning NULL
+ * has no value yet, the item is left out of this round.  The typed
+ * item_value and key_value handlers write the value into a slot instead.
+ * A multi handler serves an item with or without a key, the key is NULL
+ * then, and adds many samples, each with its dimension set.
+ */
 typedef struct {
     ca_str_t                name;
     ca_acq_item_handler_pt  item_handler;
-    unsigned                exist:1;           
+    ca_uint_t               collector;
+    ca_acq_key_handler_pt   key_handler;
+    ca_acq_item_value_pt    item_value;
+    ca_acq_key_value_pt     key_value;
+    ca_acq_multi_pt         multi;
+    unsigned                exist:1;
 } ca_acq_item_handler_t;
 
 extern ca_acq_item_handler_t  ca_acq_item_handlers[];
 
+#define CA_ACQ_STAT_MIN        1
+#define CA_ACQ_STAT_MAX        2
+#define CA_ACQ_STAT_AVG        3
+#define CA_ACQ_STAT_SUM        4
+#define CA_ACQ_STAT_COUNT      5
+#define CA_ACQ_STAT_LAST       6
+#define CA_ACQ_STAT_QUANTILE   7
+
+typedef struct {
+    ca_uint_t               type;
+    double                  q;
+    char                   *name;
+} ca_acq_stat_t;
+
+/*
+ * An item with a window is sampled at its frequence, but shipped once
+ * a window with the stats of its samples; the first stat is the value,
+ * all of them are in an object after it.  A sample that is not a
+ * number only counts for "last".
+ */
+typedef struct {
+    ca_acq_stat_t          *stats;
+    ca_uint_t               nstats;
+    time_t                  start;
+    uint64_t                samples;
+    ca_sketch_t            *sketch;
+    u_char                 *last;
+    size_t                  last_size;
+    u_char                 *value;
+    size_t                  value_size;
+} ca_acq_window_t;
+
+#define CA_ACQ_BAND_ABS    1
+#define CA_ACQ_BAND_REL    2
+#define CA_ACQ_HEARTBEAT       10
+
+/*
+ * A value within abs or rel (a fraction) of the last one sent is not
+ * sent again, unless heartbeat - 1 have been held back in a row.  A
+ * value that is not a number is held back if it is the same.
+ */
+typedef struct {
+    double                  abs;
+    double                  rel;
+    ca_uint_t               heartbeat;
+    ca_uint_t               held;
+    ca_uint_t               sent;
+    ca_uint_t               numeric;
+    double                  last;
+    u_char                 *last_str;
+    size_t                  last_size;
+} ca_acq_deadband_t;
+
+#define CA_ACQ_ADAPT_STABLE    3
+#define CA_ACQ_ADAPT_CHANGES   16
+
+typedef struct {
+    time_t                  at;                /* sampled */
+    ca_uint_t               freq;
+} ca_acq_adapt_change_t;
+
+/*
+ * The frequence of an adaptive item drops to min as soon as a value
+ * moves by more than the threshold, abs or rel (a fraction) of the one
+ * before, and doubles up to max after CA_ACQ_ADAPT_STABLE values in a
+ * row that do not.  A change is shipped as "freq" with the value that
+ * made it, past a dead-band; the changes a window takes in are all
+ * shipped with it, as "freqs".
+ */
+typedef struct {
+    ca_uint_t               min;
+    ca_uint_t               max;
+    double                  abs;
+    double                  rel;
+    ca_uint_t               stable;
+    ca_uint_t               numeric;
+    double                  last;
+    ca_uint_t               nchanges;
+    ca_acq_adapt_change_t   changes[CA_ACQ_ADAPT_CHANGES];
+} ca_acq_adapt_t;
+
 typedef struct {
     ca_str_t                item;
     ca_uint_t               freq;
@@ -33,6 +267,22 @@ typedef struct {
     ca_int_t                type;
     ca_uint_t               accessed;
     ca_acq_item_handler_pt  handler;
+    ca_str_t                key;
+    ca_acq_key_handler_pt   key_handler;
+    ca_acq_item_value_pt    item_value;
+    ca_acq_key_value_pt     key_value;
+    ca_acq_multi_pt         multi_handler;
+    ca_acq_multi_t         *multi;
+    ca_uint_t               window;
+    ca_acq_window_t        *summary;
+    ca_acq_deadband_t      *deadband;
+    ca_acq_adapt_t         *adapt;
+    ca_uint_t               collector;
+    ca_uint_t               plugin_item;
+    ca_uint_t               forced;            /* collect out of schedule */
+    ca_uint_t               ready;
+    time_t                  sampled;
+    ca_acq_value_t          sample;
 } ca_acq_t;
 
 
@@ -44,7 +294,36 @@ typedef struct {
 } ca_server_t;
 
 
+/* what a payload is, alerts are submitted before any other */
+#define CA_ACQ_PAYLOAD_BULK      0
+#define CA_ACQ_PAYLOAD_BACKFILL  1
+#define CA_ACQ_PAYLOAD_ALERT     2
+
+/* the times an alert is submitted, a second apart, before it is dropped */
+#define CA_ACQ_ALERT_TRIES       5
+
+
+/* the plugins serve items as collectors after the build-in ones */
+#include "acq/ca_plugin.h"
+
+
+struct json_object;
 
+ca_acq_value_t *ca_acq_multi_add(ca_acq_multi_t *m, const char *fmt, ...);
+void ca_acq_multi_free(ca_acq_t *item);
+ca_int_t ca_acq_window_init(ca_acq_t *item, ca_str_t *stats);
+void ca_acq_window_free(ca_acq_t *item);
+ca_int_t ca_acq_add_event(ca_acq_event_t *ev);
+ca_int_t ca_acq_queue(struct json_object *json, time_t from, time_t to,
+    ca_uint_t kind);
+void ca_acq_expedite(ca_acq_key_handler_pt handler, ca_str_t *key);
+ca_int_t ca_acq_collector_index(ca_str_t *name);
+const char *ca_acq_collector_name(ca_uint_t i);
+void ca_acq_collector_state(ca_uint_t i, ca_uint_t *running,
+    ca_uint_t *late);
+ca_uint_t ca_acq_value_number(ca_acq_value_t *v, double *d);
+u_char *ca_acq_value_format(ca_acq_value_t *v, u_char *buf, size_t size);
+void ca_acq_queues(ca_uint_t *ntask, ca_uint_t *nfree);
 void ca_acq_process_cycle(void *dummy);
 
 
@@ -0,0 +1,671 @@
+#define _GNU_SOURCE                               /* accept4() */
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "clagent.h"
+
+
+/*
+ * The admin socket is served by the acq thread between ticks, as its
+ * other events: a connection sends a command line, gets the answer and
+ * is closed.  Reads and writes never block, a slow client only holds
+ * its connection, for CA_ADMIN_TIMEOUT at most.
+ */
+
+typedef struct {
+    ca_acq_event_t       event;
+    time_t               start;
+    u_char               req[CA_ADMIN_REQUEST];
+    size_t               nreq;
+    u_char              *out;
+    size_t               out_size;
+    size_t               out_len;
+    size_t               out_sent;
+} ca_admin_conn_t;
+
+
+typedef struct {
+    ca_conf_ctx_t       *conf;
+    ca_acq_event_t       listen;
+    ca_admin_conn_t      conns[CA_ADMIN_CONNS];
+} ca_admin_info_t;
+
+
+typedef void (*ca_admin_command_pt)(ca_admin_conn_t *c, char **argv,
+    int argc);
+
+
+typedef struct {
+    char                 *name;
+    ca_admin_command_pt   handler;
+} ca_admin_command_t;
+
+
+static void ca_admin_config(ca_admin_conn_t *c, char **argv, int argc);
+static void ca_admin_items(ca_admin_conn_t *c, char **argv, int argc);
+static void ca_admin_queues(ca_admin_conn_t *c, char **argv, int argc);
+static void ca_admin_servers(ca_admin_conn_t *c, char **argv, int argc);
+static void ca_admin_collectors(ca_admin_conn_t *c, char **argv, int argc);
+static void ca_admin_collect(ca_admin_conn_t *c, char **argv, int argc);
+static void ca_admin_history(ca_admin_conn_t *c, char **argv, int argc);
+static void ca_admin_help(ca_admin_conn_t *c, char **argv, int argc);
+
+
+static ca_admin_command_t  ca_admin_commands[] = {
+    { "config",      ca_admin_config },
+    { "items",       ca_admin_items },
+    { "queues",      ca_admin_queues },
+    { "servers",     ca_admin_servers },
+    { "collectors",  ca_admin_collectors },
+    { "collect",     ca_admin_collect },
+    { "history",     ca_admin_history },
+    { "help",        ca_admin_help },
+    { NULL,          NULL }
+};
+
+
+static ca_admin_info_t  ca_s_admin_info;
+
+
+static void
+ca_admin_out(ca_admin_conn_t *c, const char *fmt, ...)
+{
+    u_char   *p, *tmp;
+    size_t    size;
+    va_list   args;
+
+    for ( ;; ) {
+        va_start(args, fmt);
+        p = ca_vslprintf(c->out + c->out_len, c->out + c->out_size, fmt,
+                         args);
+        va_end(args);
+
+        if (p < c->out + c->out_size) {
+            c->out_len = p - c->out;
+            return;
+        }
+
+        /* the line did not fit, it is written again in a larger one */
+
+        size = 2 * c->out_size;
+
+        tmp = ca_realloc(c->out, size);
+        if (tmp == NULL) {
+            return;
+        }
+
+        c->out = tmp;
+        c->out_size = size;
+    }
+}
+
+
+static void
+ca_admin_close(ca_admin_conn_t *c)
+{
+    close(c->event.fd);
+    c->event.fd = -1;
+}
+
+
+static void
+ca_admin_config(ca_admin_conn_t *c, char **argv, int argc)
+{
+    ca_uint_t       i;
+    ca_acq_t       *item;
+    ca_server_t    *server;
+    ca_conf_ctx_t  *conf;
+
+    conf = ca_s_admin_info.conf;
+
+    ca_admin_out(c, "identify %V\n", &conf->identify);
+    ca_admin_out(c, "acq_threads %uL\n", conf->acq_threads);
+    ca_admin_out(c, "acq_deadline %uLms\n", conf->acq_deadline);
+    ca_admin_out(c, "max_free_object %uL\n", conf->max_nfree);
+
+    server = conf->servers->elem;
+
+    for (i = 0; i < conf->servers->nelem; i++) {
+        ca_admin_out(c, "server %V %s\n", &server[i].host_str,
+                     server[i].addr_str);
+    }
+
+    item = conf->acq_items->elem;
+
+    for (i = 0; i < conf->acq_items->nelem; i++) {
+        ca_admin_out(c, "item %V id %L freq %uLs type %L collector %s",
+                     &item[i].item, item[i].id, item[i].freq, item[i].type,
+                     ca_acq_collector_name(item[i].collector));
+
+        if (item[i].window) {
+            ca_admin_out(c, " window %uLs", item[i].window);
+        }
+
+        if (item[i].deadband != NULL) {
+            ca_admin_out(c, " deadband heartbeat %uL",
+                         item[i].deadband->heartbeat);
+        }
+
+        if (item[i].adapt != NULL) {
+            ca_admin_out(c, " adaptive %uLs:%uLs", item[i].adapt->min,
+                         item[i].adapt->max);
+        }
+
+        if (item[i].multi != NULL) {
+            ca_admin_out(c, " dims %uL", item[i].multi->max);
+        }
+
+        ca_admin_out(c, "\n");
+    }
+}
+
+
+/* the last value of every item, of an item whose collector runs none */
+static void
+ca_admin_items(ca_admin_conn_t *c, char **argv, int argc)
+{
+    u_char               *p, val[64];
+    ca_uint_t             i, j, running, late;
+    ca_acq_t             *item;
+    ca_conf_ctx_t        *conf;
+    ca_acq_dim_sample_t  *s;
+
+    conf = ca_s_admin_info.conf;
+    item = conf->acq_items->elem;
+
+    for (i = 0; i < conf->acq_items->nelem; i++) {
+        ca_acq_collector_state(item[i].collector, &running, &late);
+
+        if (running) {
+            ca_admin_out(c, "%V %L collecting\n", &item[i].item, item[i].id);
+            continue;
+        }
+
+        if (item[i].sampled == 0) {
+            ca_admin_out(c, "%V %L -\n", &item[i].item, item[i].id);
+            continue;
+        }
+
+        if (item[i].multi != NULL) {
+            for (j = 0; j < item[i].multi->nsamples; j++) {
+                s = &item[i].multi->samples[j];
+                p = ca_acq_value_format(&s->value, val, sizeof(val));
+
+                ca_admin_out(c, "%V %L %T %s \"%s\"\n", &item[i].item,
+                             item[i].id, item[i].sampled, s->dims, p);
+            }
+
+            continue;
+        }
+
+        p = (u_char *) "";
+
+        if (item[i].sample.type != CA_ACQ_VALUE_NONE) {
+            p = ca_acq_value_format(&item[i].sample, val, sizeof(val));
+        }
+
+        ca_admin_out(c, "%V %L %T \"%s\"\n", &item[i].item, item[i].id,
+                     item[i].sampled, p);
+    }
+}
+
+
+static void
+ca_admin_queues(ca_admin_conn_t *c, char **argv, int argc)
+{
+    ca_uint_t  ntask, nfree;
+
+    ca_acq_queues(&ntask, &nfree);
+
+    ca_admin_out(c, "ntask %uL\nnfree %uL\n", ntask, nfree);
+}
+
+
+static void
+ca_admin_servers(ca_admin_conn_t *c, char **argv, int argc)
+{
+    double          current;
+    ca_uint_t       i;
+    ca_server_t    *server;
+    ca_conf_ctx_t  *conf;
+
+    conf = ca_s_admin_info.conf;
+    server = conf->servers->elem;
+    current = ca_self_gauge(CA_SELF_SUBMIT_SERVER);
+
+    for (i = 0; i < conf->servers->nelem; i++) {
+        ca_admin_out(c, "%s connect_failures ", server[i].addr_str);
+
+        if (i < CA_SELF_SERVERS) {
+            ca_admin_out(c, "%uL",
+                         ca_self_counter(CA_SELF_CONNECT_FAILURES + i));
+
+        } else {
+            ca_admin_out(c, "-");
+        }
+
+        ca_admin_out(c, "%s\n", current == i ? " current" : "");
+    }
+
+    ca_admin_out(c, "submit_failures %uL\nsubmit_latency %.3fms\n",
+                 ca_self_counter(CA_SELF_SUBMIT_FAILURES),
+                 ca_self_gauge(CA_SELF_SUBMIT_LATENCY));
+}
+
+
+static void
+ca_admin_collectors(ca_admin_conn_t *c, char **argv, int argc)
+{
+    ca_uint_t    i, running, late;
+    const char  *name;
+
+    for (i = 0; i < CA_ACQ_NCOLLECTORS; i++) {
+        name = ca_acq_collector_name(i);
+        if (name == NULL) {
+            continue;
+        }
+
+        ca_acq_collector_state(i, &running, &late);
+
+        ca_admin_out(c, "%s runs %uL last %.3fms %s\n", name,
+                     ca_self_counter(CA_SELF_COLLECTOR_RUNS + i),
+                     ca_self_gauge(CA_SELF_COLLECTOR_TIME + i),
+                     late ? "late" : (running ? "running" : "idle"));
+    }
+
+    ca_admin_out(c, "tick_lateness %.3fms\n",
+                 ca_self_gauge(CA_SELF_TICK_LATENESS));
+}
+
+
+/*
+ * Make the items named, as "name[key]", "name" for all its keys, or by
+ * id, due on the pass of the acq cycle right after this one, their
+ * handlers read afresh.  The items of a collector share what it read,
+ * so all of them are sampled again with one read: their next samples
+ * are a frequence after it.  The items of a collector still running
+ * on the pool are only counted as busy, the pool thread clears their
+ * "forced".
+ */
+static void
+ca_admin_collect(ca_admin_conn_t *c, char **argv, int argc)
+{
+    int             i;
+    size_t          len;
+    u_char          whole[CA_ACQ_NCOLLECTORS];
+    ca_int_t        id;
+    ca_uint_t       j, n, busy, running, late;
+    ca_acq_t       *item;
+    ca_conf_ctx_t  *conf;
+
+    conf = ca_s_admin_info.conf;
+    item = conf->acq_items->elem;
+    n = 0;
+    busy = 0;
+
+    ca_memzero(whole, sizeof(whole));
+
+    for (i = 1; i < argc; i++) {
+        len = ca_strlen(argv[i]);
+        id = ca_atoi((u_char *) argv[i], len);
+
+        for (j = 0; j < conf->acq_items->nelem; j++) {
+            if (item[j].id != id
+                && (item[j].item.len < len
+                    || ca_strncasecmp(item[j].item.data, (u_char *) argv[i],
+                                      len)
+                       != 0
+                    || (item[j].item.len > len
+                        && item[j].item.data[len] != '[')))
+            {
+                continue;
+            }
+
+            ca_acq_collector_state(item[j].collector, &running, &late);
+
+            if (running) {
+                busy++;
+                continue;
+            }
+
+            if (item[j].collector != CA_ACQ_INLINE) {
+                whole[item[j].collector] = 1;
+            }
+
+            item[j].accessed = 0;
+            item[j].forced = 1;
+            n++;
+        }
+    }
+
+    for (j = 0; j < conf->acq_items->nelem; j++) {
+        if (whole[item[j].collector] && !item[j].forced) {
+            item[j].accessed = 0;
+            item[j].forced = 1;
+            n++;
+        }
+    }
+
+    if (busy) {
+        ca_admin_out(c, "ok %uL, %uL busy\n", n, busy);
+        return;
+    }
+
+    ca_admin_out(c, "ok %uL\n", n);
+}
+
+
+typedef struct {
+    ca_admin_conn_t     *conn;
+    ca_acq_t            *item;
+} ca_admin_history_t;
+
+
+static ca_int_t
+ca_admin_history_sample(void *data, time_t t, double v)
+{
+    u_char               val[64];
+    ca_admin_history_t  *h;
+
+    h = data;
+
+    ca_admin_out(h->conn, "%V %L %T %s\n", &h->item->item, h->item->id, t,
+                 ca_store_format(v, val, sizeof(val)));
+
+    return CA_OK;
+}
+
+
+/* the stored samples of the items of a name or id, of the last seconds */
+static void
+ca_admin_history(ca_admin_conn_t *c, char **argv, int argc)
+{
+    size_t               len;
+    time_t               now, secs;
+    ca_int_t             id;
+    ca_uint_t            j;
+    ca_acq_t            *item;
+    ca_conf_ctx_t       *conf;
+    ca_admin_history_t   h;
+
+    if (argc < 2 || argc > 3) {
+        ca_admin_out(c, "history <name>|<name[key]>|<id> [<seconds>]\n");
+        return;
+    }
+
+    secs = 600;
+
+    if (argc == 3) {
+        secs = ca_atoi((u_char *) argv[2], ca_strlen(argv[2]));
+        if (secs == CA_ERROR) {
+            ca_admin_out(c, "invalid seconds \"%s\"\n", argv[2]);
+            return;
+        }
+    }
+
+    conf = ca_s_admin_info.conf;
+    item = conf->acq_items->elem;
+    now = time(NULL);
+    h.conn = c;
+
+    len = ca_strlen(argv[1]);
+    id = ca_atoi((u_char *) argv[1], len);
+
+    for (j = 0; j < conf->acq_items->nelem; j++) {
+        if (item[j].id != id
+            && (item[j].item.len < len
+                || ca_strncasecmp(item[j].item.data, (u_char *) argv[1], len)
+                   != 0
+                || (item[j].item.len > len
+                    && item[j].item.data[len] != '[')))
+        {
+            continue;
+        }
+
+        h.item = &item[j];
+
+        if (ca_store_read(j, now - secs, now, ca_admin_history_sample, &h)
+            == CA_ERROR)
+        {
+            ca_admin_out(c, "%V %L not stored\n", &item[j].item,
+                         item[j].id);
+        }
+    }
+}
+
+
+static void
+ca_admin_help(ca_admin_conn_t *c, char **argv, int argc)
+{
+    ca_uint_t  i;
+
+    for (i = 0; ca_admin_commands[i].name != NULL; i++) {
+        ca_admin_out(c, "%s\n", ca_admin_commands[i].name);
+    }
+
+    ca_admin_out(c, "collect <name>|<name[key]>|<id> ...\n");
+    ca_admin_out(c, "history <name>|<name[key]>|<id> [<seconds>]\n");
+}
+
+
+static void
+ca_admin_process(ca_admin_conn_t *c)
+{
+    int    argc;
+    char  *argv[32];
+    int    i;
+
+    argc = ca_strsplit((char *) c->req, argv, 32);
+
+    if (argc == 0) {
+        ca_admin_help(c, argv, argc);
+        return;
+    }
+
+    for (i = 0; ca_admin_commands[i].name != NULL; i++) {
+        if (ca_strcmp(argv[0], ca_admin_commands[i].name) == 0) {
+            ca_admin_commands[i].handler(c, argv, argc);
+            return;
+        }
+    }
+
+    ca_admin_out(c, "unknown command \"%s\", try \"help\"\n", argv[0]);
+}
+
+
+static void
+ca_admin_conn_handler(ca_acq_event_t *ev)
+{
+    u_char           *nl;
+    ssize_t           n;
+    ca_admin_conn_t  *c;
+
+    c = ev->data;
+
+    if (ev->events & POLLIN) {
+        n = read(ev->fd, c->req + c->nreq, CA_ADMIN_REQUEST - 1 - c->nreq);
+
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+
+        if (n <= 0) {
+            ca_admin_close(c);
+            return;
+        }
+
+        c->nreq += n;
+        c->req[c->nreq] = '\0';
+
+        nl = ca_strlchr(c->req, c->req + c->nreq, '\n');
+
+        if (nl == NULL && c->nreq < CA_ADMIN_REQUEST - 1) {
+            return;
+        }
+
+        if (nl != NULL) {
+            *nl = '\0';
+            ca_admin_process(c);
+
+        } else {
+            ca_admin_out(c, "too long a command\n");
+        }
+
+        ev->events = POLLOUT;
+    }
+
+    while (c->out_sent < c->out_len) {
+        n = write(ev->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return;
+            }
+
+            break;
+        }
+
+        c->out_sent += n;
+    }
+
+    ca_admin_close(c);
+}
+
+
+static void
+ca_admin_accept_handler(ca_acq_event_t *ev)
+{
+    int               fd;
+    time_t            now;
+    ca_uint_t         i;
+    ca_admin_conn_t  *c;
+
+    now = time(NULL);
+
+    for ( ;; ) {
+        fd = accept4(ev->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                ca_log_err(errno, "accept() on admin socket failed");
+            }
+
+            return;
+        }
+
+        c = NULL;
+
+        for (i = 0; i < CA_ADMIN_CONNS; i++) {
+            if (ca_s_admin_info.conns[i].event.fd != -1
+                && now - ca_s_admin_info.conns[i].start > CA_ADMIN_TIMEOUT)
+            {
+                ca_admin_close(&ca_s_admin_info.conns[i]);
+            }
+
+            if (c == NULL && ca_s_admin_info.conns[i].event.fd == -1) {
+                c = &ca_s_admin_info.conns[i];
+            }
+        }
+
+        if (c == NULL) {
+            ca_log_warn(0, "too many admin connections");
+            close(fd);
+            continue;
+        }
+
+        c->event.fd = fd;
+        c->event.events = POLLIN;
+        c->start = now;
+        c->nreq = 0;
+        c->out_len = 0;
+        c->out_sent = 0;
+    }
+}
+
+
+ca_int_t
+ca_admin_init(void *conf)
+{
+    int                  fd, rc;
+    mode_t               mask;
+    ca_uint_t            i;
+    struct stat          st;
+    ca_conf_ctx_t       *ctx = conf;
+    ca_admin_conn_t     *c;
+    struct sockaddr_un   sun;
+
+    if (ctx->admin_socket.len == 0) {
+        return CA_OK;
+    }
+
+    if (ctx->admin_socket.len >= sizeof(sun.sun_path)) {
+        ca_log_crit(0, "too long admin socket path \"%V\"",
+                    &ctx->admin_socket);
+        return CA_ERROR;
+    }
+
+    ca_s_admin_info.conf = ctx;
+
+    ca_memzero(&sun, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    ca_memcpy(sun.sun_path, ctx->admin_socket.data, ctx->admin_socket.len);
+
+    if (lstat(sun.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(sun.sun_path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ca_log_err(errno, "socket() for admin \"%V\" failed",
+                   &ctx->admin_socket);
+        return CA_ERROR;
+    }
+
+    /*
+     * it can make items collected, only the owner may connect; it is
+     * created 0600, a chmod() after bind() leaves a window for others
+     */
+
+    mask = umask(0177);
+    rc = bind(fd, (struct sockaddr *) &sun, sizeof(sun));
+    umask(mask);
+
+    if (rc == -1 || listen(fd, CA_ADMIN_CONNS) == -1) {
+        ca_log_err(errno, "listen on admin socket \"%V\" failed",
+                   &ctx->admin_socket);
+        close(fd);
+        return CA_ERROR;
+    }
+
+    ca_s_admin_info.listen.fd = fd;
+    ca_s_admin_info.listen.events = POLLIN;
+    ca_s_admin_info.listen.handler = ca_admin_accept_handler;
+
+    if (ca_acq_add_event(&ca_s_admin_info.listen) != CA_OK) {
+        return CA_ERROR;
+    }
+
+    for (i = 0; i < CA_ADMIN_CONNS; i++) {
+        c = &ca_s_admin_info.conns[i];
+
+        c->out = ca_alloc(CA_ADMIN_OUT);
+        if (c->out == NULL) {
+            return CA_ERROR;
+        }
+
+        c->out_size = CA_ADMIN_OUT;
+        c->event.fd = -1;
+        c->event.handler = ca_admin_conn_handler;
+        c->event.data = c;
+
+        if (ca_acq_add_event(&c->event) != CA_OK) {
+            return CA_ERROR;
+        }
+    }
+
+    return CA_OK;
+}
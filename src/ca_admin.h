@@ -0,0 +1,14 @@
+#ifndef __CA_ADMIN_H_INCLUDED__
+#define __CA_ADMIN_H_INCLUDED__
+
+
+#define CA_ADMIN_CONNS       8
+#define CA_ADMIN_REQUEST     1024
+#define CA_ADMIN_OUT         4096
+#define CA_ADMIN_TIMEOUT     10         /* s a connection may take */
+
+
+ca_int_t ca_admin_init(void *conf);
+
+
+#endif /* __CA_ADMIN_H_INCLUDED__ */
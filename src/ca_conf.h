@@ -180,9 +180,9 @@ char *ca_conf_set_str_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 char *ca_conf_set_str_array_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 char *ca_conf_set_str_keyval_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 char *ca_conf_set_num_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
-char *ca_conf_set_str_size_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
-char *ca_conf_set_str_msec_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
-char *ca_conf_set_str_sec_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+char *ca_conf_set_size_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+char *ca_conf_set_msec_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+char *ca_conf_set_sec_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 char *ca_conf_set_str_enum_slot(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 char *ca_conf_set_str_bitmask_slot(ca_conf_t *cf, ca_command_t *cmd,
     void *conf);
@@ -168,6 +168,9 @@ ca_log_core(int level, int err, const char *fmt, ...)
     case CA_PROCESS_WORKER:
         proc_name = "worker";
         break;
+    case CA_PROCESS_EXEC:
+        proc_name = "exec";
+        break;
     default:
         proc_name = "unknown";
         break;
@@ -264,3 +267,11 @@ ca_log_stderr(int err, const char *fmt, ...)
         l->nerror++;
     }
 }
+
+
+/* the writes to the log that failed */
+int
+ca_log_nerror(void)
+{
+    return ca_logger.nerror;
+}
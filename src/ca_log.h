@@ -64,6 +64,7 @@ int ca_log_get_level(char *log_level);
 void ca_log_core(int level, int err, const char *fmt, ...);
 void ca_log_stderr(int err, const char *fmt, ...);
 u_char *ca_log_errno(u_char *buf, u_char *last, int err);
+int ca_log_nerror(void);
 
 
 #endif /* __CA_LOG_H_INCLUDED__ */
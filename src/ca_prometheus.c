@@ -0,0 +1,707 @@
+#define _GNU_SOURCE                               /* accept4() */
+#include <unistd.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "clagent.h"
+
+
+/*
+ * The prometheus endpoint is served by the acq thread between ticks, as
+ * the admin socket.  The lines of an item are formatted when a sample
+ * of it is shipped, and joined into a snapshot once a tick when any of
+ * them changed, so a scrape costs a writev() of the header and of the
+ * snapshot.  There are two snapshots: a scrape holds the one it sends
+ * until it is over, the next one is built in the other, or a tick later
+ * if that one is still being sent.
+ */
+
+typedef struct {
+    u_char              *data;
+    size_t               len;
+    size_t               size;
+    ca_uint_t            refs;
+} ca_prometheus_buf_t;
+
+
+typedef struct {
+    ca_acq_event_t        event;
+    time_t                start;
+    u_char                req[CA_PROMETHEUS_REQUEST];
+    size_t                nreq;
+    u_char                header[CA_PROMETHEUS_HEADER];
+    struct iovec          iov[2];
+    ca_uint_t             iov_first;
+    ca_prometheus_buf_t  *buf;
+} ca_prometheus_conn_t;
+
+
+typedef struct {
+    ca_conf_ctx_t         *conf;
+    ca_acq_event_t         listen;
+    ca_prometheus_conn_t   conns[CA_PROMETHEUS_CONNS];
+    ca_str_t              *names;              /* metric name of an item */
+    ca_prometheus_buf_t   *series;             /* lines of an item */
+    ca_uint_t             *order;              /* items sorted by name */
+    ca_uint_t              nitems;
+    ca_prometheus_buf_t    snapshots[2];
+    ca_uint_t              front;
+    ca_uint_t              changed;
+} ca_prometheus_info_t;
+
+
+static ca_prometheus_info_t  ca_s_prometheus_info;
+
+
+static ca_int_t
+ca_prometheus_reserve(ca_prometheus_buf_t *b, size_t len)
+{
+    u_char  *tmp;
+    size_t   size;
+
+    if (b->len + len <= b->size) {
+        return CA_OK;
+    }
+
+    size = b->size ? b->size : 256;
+
+    while (size < b->len + len) {
+        size *= 2;
+    }
+
+    tmp = ca_realloc(b->data, size);
+    if (tmp == NULL) {
+        return CA_ERROR;
+    }
+
+    b->data = tmp;
+    b->size = size;
+
+    return CA_OK;
+}
+
+
+static void
+ca_prometheus_append(ca_prometheus_buf_t *b, u_char *p, size_t len)
+{
+    if (ca_prometheus_reserve(b, len) != CA_OK) {
+        return;
+    }
+
+    ca_memcpy(b->data + b->len, p, len);
+    b->len += len;
+}
+
+
+/* a label value, with backslashes, quotes and new lines escaped */
+static void
+ca_prometheus_label(ca_prometheus_buf_t *b, char *name, u_char *p,
+    size_t len)
+{
+    u_char  *last;
+
+    ca_prometheus_append(b, (u_char *) name, ca_strlen(name));
+    ca_prometheus_append(b, (u_char *) "=\"", 2);
+
+    for (last = p + len; p < last; p++) {
+        switch (*p) {
+
+        case '\\':
+            ca_prometheus_append(b, (u_char *) "\\\\", 2);
+            break;
+
+        case '"':
+            ca_prometheus_append(b, (u_char *) "\\\"", 2);
+            break;
+
+        case '\n':
+            ca_prometheus_append(b, (u_char *) "\\n", 2);
+            break;
+
+        default:
+            ca_prometheus_append(b, p, 1);
+        }
+    }
+
+    ca_prometheus_append(b, (u_char *) "\"", 1);
+}
+
+
+/* what is left of name once the characters not allowed are "_" */
+static void
+ca_prometheus_sanitize(u_char *p, size_t len)
+{
+    size_t  i;
+
+    for (i = 0; i < len; i++) {
+        p[i] = ca_tolower(p[i]);
+
+        if (!((p[i] >= 'a' && p[i] <= 'z') || p[i] == '_'
+              || (i > 0 && p[i] >= '0' && p[i] <= '9')))
+        {
+            p[i] = '_';
+        }
+    }
+}
+
+
+/* the sample line of a value, nothing if it is not a number */
+static void
+ca_prometheus_line(ca_prometheus_buf_t *b, ca_uint_t i, ca_acq_t *item,
+    ca_acq_value_t *v, u_char *dims, size_t dims_len)
+{
+    u_char    *p, *q, *last, *eq, val[64], id[32], label[CA_ACQ_DIMS_LEN];
+    double     num;
+    size_t     len;
+
+    if (!ca_acq_value_number(v, &num)) {
+        return;
+    }
+
+    p = ca_acq_value_format(v, val, sizeof(val));
+
+    for (len = 0; p[len] != '\0' && p[len] != ' ' && p[len] != '\n'; len++) {
+        /* void */
+    }
+
+    ca_prometheus_append(b, ca_s_prometheus_info.names[i].data,
+                         ca_s_prometheus_info.names[i].len);
+    ca_prometheus_append(b, (u_char *) "{", 1);
+
+    last = ca_snprintf(id, sizeof(id), "%L", item->id);
+    ca_prometheus_label(b, "id", id, last - id);
+
+    if (item->key.len) {
+        ca_prometheus_append(b, (u_char *) ",", 1);
+        ca_prometheus_label(b, "key", item->key.data, item->key.len);
+    }
+
+    /* "key=value[,key=value]", as the labels of the sample */
+
+    last = dims + dims_len;
+
+    while (dims < last) {
+        q = ca_strlchr(dims, last, ',');
+        if (q == NULL) {
+            q = last;
+        }
+
+        eq = ca_strlchr(dims, q, '=');
+
+        if (eq != NULL && eq > dims && (size_t) (eq - dims) < sizeof(label))
+        {
+            ca_memcpy(label, dims, eq - dims);
+            ca_prometheus_sanitize(label, eq - dims);
+            label[eq - dims] = '\0';
+
+            ca_prometheus_append(b, (u_char *) ",", 1);
+            ca_prometheus_label(b, (char *) label, eq + 1, q - eq - 1);
+        }
+
+        dims = q + 1;
+    }
+
+    ca_prometheus_append(b, (u_char *) "} ", 2);
+    ca_prometheus_append(b, p, len);
+
+    last = ca_snprintf(val, sizeof(val), " %T000\n", item->sampled);
+    ca_prometheus_append(b, val, last - val);
+}
+
+
+/*
+ * Called by the acq thread for an item it ships, while no collector
+ * writes its sample.
+ */
+void
+ca_prometheus_sample(ca_uint_t i, ca_acq_t *item)
+{
+    ca_uint_t             j;
+    ca_acq_dim_sample_t  *s;
+    ca_prometheus_buf_t  *b;
+
+    if (ca_s_prometheus_info.series == NULL
+        || i >= ca_s_prometheus_info.nitems)
+    {
+        return;
+    }
+
+    /* no sample or a failed one: the lines before are served still */
+
+    if (item->multi != NULL) {
+        if (item->multi->nsamples == 0) {
+            return;
+        }
+
+    } else if (item->sample.type == CA_ACQ_VALUE_NONE
+               || item->sample.type == CA_ACQ_VALUE_INVALID)
+    {
+        return;
+    }
+
+    b = &ca_s_prometheus_info.series[i];
+    b->len = 0;
+
+    if (item->multi != NULL) {
+        for (j = 0; j < item->multi->nsamples; j++) {
+            s = &item->multi->samples[j];
+            ca_prometheus_line(b, i, item, &s->value, s->dims, s->dims_len);
+        }
+
+    } else {
+        ca_prometheus_line(b, i, item, &item->sample, NULL, 0);
+    }
+
+    ca_s_prometheus_info.changed = 1;
+}
+
+
+/* joins the lines of the items into the snapshot not being sent */
+void
+ca_prometheus_update(void)
+{
+    u_char               *p;
+    ca_str_t             *name, *prev;
+    ca_uint_t             i, k;
+    ca_prometheus_buf_t  *snap, *b;
+
+    if (!ca_s_prometheus_info.changed) {
+        return;
+    }
+
+    snap = &ca_s_prometheus_info.snapshots[!ca_s_prometheus_info.front];
+
+    if (snap->refs) {
+        return;
+    }
+
+    snap->len = 0;
+    prev = NULL;
+
+    for (k = 0; k < ca_s_prometheus_info.nitems; k++) {
+        i = ca_s_prometheus_info.order[k];
+        b = &ca_s_prometheus_info.series[i];
+
+        if (b->len == 0) {
+            continue;
+        }
+
+        name = &ca_s_prometheus_info.names[i];
+
+        if (prev == NULL || prev->len != name->len
+            || ca_strncmp(prev->data, name->data, name->len) != 0)
+        {
+            if (ca_prometheus_reserve(snap, name->len + 16) != CA_OK) {
+                return;
+            }
+
+            p = ca_cpymem(snap->data + snap->len, "# TYPE ", 7);
+            p = ca_cpymem(p, name->data, name->len);
+            p = ca_cpymem(p, " gauge\n", 7);
+            snap->len = p - snap->data;
+
+            prev = name;
+        }
+
+        if (ca_prometheus_reserve(snap, b->len) != CA_OK) {
+            return;
+        }
+
+        ca_memcpy(snap->data + snap->len, b->data, b->len);
+        snap->len += b->len;
+    }
+
+    ca_s_prometheus_info.front = !ca_s_prometheus_info.front;
+    ca_s_prometheus_info.changed = 0;
+}
+
+
+static void
+ca_prometheus_close(ca_prometheus_conn_t *c)
+{
+    if (c->buf != NULL) {
+        c->buf->refs--;
+        c->buf = NULL;
+    }
+
+    close(c->event.fd);
+    c->event.fd = -1;
+}
+
+
+static void
+ca_prometheus_respond(ca_prometheus_conn_t *c)
+{
+    u_char               *p, *last;
+    ca_prometheus_buf_t  *snap;
+
+    p = c->req;
+    last = c->req + c->nreq;
+
+    if (last - p < 13
+        || ca_strncmp(p, "GET /metrics", 12) != 0
+        || (p[12] != ' ' && p[12] != '?'))
+    {
+        p = ca_snprintf(c->header, CA_PROMETHEUS_HEADER,
+                        "HTTP/1.0 404 Not Found\r\n"
+                        "Content-Type: text/plain\r\n"
+                        "Content-Length: 10\r\n"
+                        "Connection: close\r\n\r\n"
+                        "not found\n");
+
+        c->iov[0].iov_base = c->header;
+        c->iov[0].iov_len = p - c->header;
+        c->iov[1].iov_len = 0;
+        return;
+    }
+
+    snap = &ca_s_prometheus_info.snapshots[ca_s_prometheus_info.front];
+    snap->refs++;
+    c->buf = snap;
+
+    p = ca_snprintf(c->header, CA_PROMETHEUS_HEADER,
+                    "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: %uz\r\n"
+                    "Connection: close\r\n\r\n", snap->len);
+
+    c->iov[0].iov_base = c->header;
+    c->iov[0].iov_len = p - c->header;
+    c->iov[1].iov_base = snap->data;
+    c->iov[1].iov_len = snap->len;
+}
+
+
+static void
+ca_prometheus_conn_handler(ca_acq_event_t *ev)
+{
+    size_t                 len;
+    ssize_t                n;
+    ca_prometheus_conn_t  *c;
+
+    c = ev->data;
+
+    if (ev->events & POLLIN) {
+        n = read(ev->fd, c->req + c->nreq,
+                 CA_PROMETHEUS_REQUEST - 1 - c->nreq);
+
+        if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+            return;
+        }
+
+        if (n <= 0) {
+            ca_prometheus_close(c);
+            return;
+        }
+
+        c->nreq += n;
+        c->req[c->nreq] = '\0';
+
+        /* the headers are read up to the blank line, but not looked at */
+
+        if (ca_strstrn(c->req, "\r\n\r", 3 - 1) == NULL
+            && ca_strstrn(c->req, "\n\n", 2 - 1) == NULL)
+        {
+            if (c->nreq < CA_PROMETHEUS_REQUEST - 1) {
+                return;
+            }
+        }
+
+        ca_prometheus_respond(c);
+
+        c->iov_first = 0;
+        ev->events = POLLOUT;
+    }
+
+    while (c->iov_first < 2) {
+        if (c->iov[c->iov_first].iov_len == 0) {
+            c->iov_first++;
+            continue;
+        }
+
+        n = writev(ev->fd, &c->iov[c->iov_first], 2 - c->iov_first);
+
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return;
+            }
+
+            break;
+        }
+
+        while (n > 0 && c->iov_first < 2) {
+            len = CA_MIN((size_t) n, c->iov[c->iov_first].iov_len);
+
+            c->iov[c->iov_first].iov_base =
+                (u_char *) c->iov[c->iov_first].iov_base + len;
+            c->iov[c->iov_first].iov_len -= len;
+            n -= len;
+
+            if (c->iov[c->iov_first].iov_len == 0) {
+                c->iov_first++;
+            }
+        }
+    }
+
+    ca_prometheus_close(c);
+}
+
+
+static void
+ca_prometheus_accept_handler(ca_acq_event_t *ev)
+{
+    int                    fd;
+    time_t                 now;
+    ca_uint_t              i;
+    ca_prometheus_conn_t  *c, *conns;
+
+    now = time(NULL);
+    conns = ca_s_prometheus_info.conns;
+
+    for ( ;; ) {
+        fd = accept4(ev->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EINTR) {
+                ca_log_err(errno, "accept() on prometheus listen failed");
+            }
+
+            return;
+        }
+
+        c = NULL;
+
+        for (i = 0; i < CA_PROMETHEUS_CONNS; i++) {
+            if (conns[i].event.fd != -1
+                && now - conns[i].start > CA_PROMETHEUS_TIMEOUT)
+            {
+                ca_prometheus_close(&conns[i]);
+            }
+
+            if (c == NULL && conns[i].event.fd == -1) {
+                c = &conns[i];
+            }
+        }
+
+        if (c == NULL) {
+            ca_log_warn(0, "too many prometheus connections");
+            close(fd);
+            continue;
+        }
+
+        c->event.fd = fd;
+        c->event.events = POLLIN;
+        c->start = now;
+        c->nreq = 0;
+    }
+}
+
+
+static int
+ca_prometheus_open(ca_str_t *addr)
+{
+    int               fd, rc, one;
+    char              host[NI_MAXHOST], port[NI_MAXSERV];
+    u_char           *p, *last, *colon;
+    size_t            len;
+    struct addrinfo   hints, *res;
+
+    p = addr->data;
+    last = p + addr->len;
+
+    colon = NULL;
+    for (p = last; p > addr->data; p--) {
+        if (p[-1] == ':') {
+            colon = p - 1;
+            break;
+        }
+    }
+
+    p = addr->data;
+    host[0] = '\0';
+
+    if (colon != NULL) {
+        len = colon - p;
+
+        if (len >= 2 && p[0] == '[' && p[len - 1] == ']') {
+            p++;
+            len -= 2;
+        }
+
+        if (len >= sizeof(host)) {
+            ca_log_err(0, "invalid prometheus host in \"%V\"", addr);
+            return CA_ERROR;
+        }
+
+        ca_memcpy(host, p, len);
+        host[len] = '\0';
+
+        p = colon + 1;
+    }
+
+    len = CA_MIN((size_t) (last - p), sizeof(port) - 1);
+    ca_memcpy(port, p, len);
+    port[len] = '\0';
+
+    ca_memzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE|AI_NUMERICSERV;
+
+    rc = getaddrinfo((host[0] == '\0' || ca_strcmp(host, "*") == 0)
+                     ? NULL : host, port, &hints, &res);
+    if (rc != 0) {
+        ca_log_err(0, "getaddrinfo() prometheus \"%V\" failed: %s",
+                   addr, gai_strerror(rc));
+        return CA_ERROR;
+    }
+
+    fd = socket(res->ai_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ca_log_err(errno, "socket() for prometheus \"%V\" failed", addr);
+        freeaddrinfo(res);
+        return CA_ERROR;
+    }
+
+    one = 1;
+    (void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+
+    if (bind(fd, res->ai_addr, res->ai_addrlen) == -1
+        || listen(fd, CA_PROMETHEUS_CONNS) == -1)
+    {
+        ca_log_err(errno, "listen on prometheus \"%V\" failed", addr);
+        freeaddrinfo(res);
+        close(fd);
+        return CA_ERROR;
+    }
+
+    freeaddrinfo(res);
+
+    return fd;
+}
+
+
+static int
+ca_prometheus_cmp(const void *one, const void *two)
+{
+    ca_str_t  *a, *b;
+    int        rc;
+
+    a = &ca_s_prometheus_info.names[*(ca_uint_t *) one];
+    b = &ca_s_prometheus_info.names[*(ca_uint_t *) two];
+
+    rc = ca_strncmp(a->data, b->data, CA_MIN(a->len, b->len));
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (a->len != b->len) {
+        return a->len < b->len ? -1 : 1;
+    }
+
+    return *(ca_uint_t *) one < *(ca_uint_t *) two ? -1 : 1;
+}
+
+
+ca_int_t
+ca_prometheus_init(void *conf)
+{
+    int                    fd;
+    u_char                *p, *q;
+    size_t                 len;
+    ca_uint_t              i, n;
+    ca_acq_t              *item;
+    ca_conf_ctx_t         *ctx = conf;
+    ca_prometheus_conn_t  *c;
+
+    if (ctx->prometheus_listen.len == 0) {
+        return CA_OK;
+    }
+
+    ca_s_prometheus_info.conf = ctx;
+
+    /* the names are "clagent_<item>", as they are sorted once */
+
+    n = ctx->acq_items->nelem;
+    item = ctx->acq_items->elem;
+
+    ca_s_prometheus_info.names = ca_calloc(n, sizeof(ca_str_t));
+    ca_s_prometheus_info.series = ca_calloc(n, sizeof(ca_prometheus_buf_t));
+    ca_s_prometheus_info.order = ca_calloc(n, sizeof(ca_uint_t));
+
+    if (n && (ca_s_prometheus_info.names == NULL
+              || ca_s_prometheus_info.series == NULL
+              || ca_s_prometheus_info.order == NULL))
+    {
+        return CA_ERROR;
+    }
+
+    /* "name[key]" is named as name, the key is a label */
+
+    for (i = 0; i < n; i++) {
+        q = ca_strlchr(item[i].item.data, item[i].item.data + item[i].item.len,
+                       '[');
+        len = q ? (size_t) (q - item[i].item.data) : item[i].item.len;
+
+        p = ca_alloc(sizeof("clagent_") - 1 + len);
+        if (p == NULL) {
+            return CA_ERROR;
+        }
+
+        ca_memcpy(p, "clagent_", sizeof("clagent_") - 1);
+        ca_memcpy(p + sizeof("clagent_") - 1, item[i].item.data, len);
+        ca_prometheus_sanitize(p + sizeof("clagent_") - 1, len);
+
+        ca_s_prometheus_info.names[i].data = p;
+        ca_s_prometheus_info.names[i].len = sizeof("clagent_") - 1 + len;
+        ca_s_prometheus_info.order[i] = i;
+    }
+
+    ca_s_prometheus_info.nitems = n;
+
+    if (n) {
+        qsort(ca_s_prometheus_info.order, n, sizeof(ca_uint_t),
+              ca_prometheus_cmp);
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (ca_prometheus_reserve(&ca_s_prometheus_info.snapshots[i],
+                                  CA_PROMETHEUS_SNAPSHOT)
+            != CA_OK)
+        {
+            return CA_ERROR;
+        }
+    }
+
+    fd = ca_prometheus_open(&ctx->prometheus_listen);
+    if (fd == CA_ERROR) {
+        return CA_ERROR;
+    }
+
+    ca_s_prometheus_info.listen.fd = fd;
+    ca_s_prometheus_info.listen.events = POLLIN;
+    ca_s_prometheus_info.listen.handler = ca_prometheus_accept_handler;
+
+    if (ca_acq_add_event(&ca_s_prometheus_info.listen) != CA_OK) {
+        return CA_ERROR;
+    }
+
+    for (i = 0; i < CA_PROMETHEUS_CONNS; i++) {
+        c = &ca_s_prometheus_info.conns[i];
+
+        c->event.fd = -1;
+        c->event.handler = ca_prometheus_conn_handler;
+        c->event.data = c;
+
+        if (ca_acq_add_event(&c->event) != CA_OK) {
+            return CA_ERROR;
+        }
+    }
+
+    ca_log_debug(0, "prometheus endpoint on \"%V\", %uL items",
+                 &ctx->prometheus_listen, (uint64_t) n);
+
+    return CA_OK;
+}
@@ -0,0 +1,17 @@
+#ifndef __CA_PROMETHEUS_H_INCLUDED__
+#define __CA_PROMETHEUS_H_INCLUDED__
+
+
+#define CA_PROMETHEUS_CONNS      16
+#define CA_PROMETHEUS_REQUEST    2048
+#define CA_PROMETHEUS_HEADER     256
+#define CA_PROMETHEUS_SNAPSHOT   16384
+#define CA_PROMETHEUS_TIMEOUT    10     /* s a connection may take */
+
+
+ca_int_t ca_prometheus_init(void *conf);
+void ca_prometheus_sample(ca_uint_t i, ca_acq_t *item);
+void ca_prometheus_update(void);
+
+
+#endif /* __CA_PROMETHEUS_H_INCLUDED__ */
@@ -0,0 +1,463 @@
+#include <stdlib.h>
+#include "clagent.h"
+#include "json-c/json.h"
+
+
+/*
+ * A rule judges every sample of an item as the acq thread ships it: a
+ * threshold on the value, on its rate of change per second, or on how
+ * many standard deviations it is off an exponentially weighted mean.
+ * An alert is queued on the priority lane, ahead of the payloads, when
+ * a rule starts or stops firing.
+ *
+ * The rules are compiled once the configuration is read into a table
+ * sorted by item, an item has the span of its rules in it.
+ */
+
+typedef struct {
+    ca_str_t            name;
+    ca_int_t            id;                    /* of the item */
+    ca_uint_t           kind;
+    ca_uint_t           op;
+    double              value;                 /* or k of a z-score */
+    double              alpha;
+    ca_uint_t           item;                  /* index, once compiled */
+    ca_uint_t           order;
+
+    ca_uint_t           firing;
+    uint64_t            n;
+    double              last;
+    time_t              last_time;
+    double              mean;
+    double              var;
+} ca_rule_t;
+
+
+typedef struct {
+    ca_uint_t           first;
+    ca_uint_t           n;
+} ca_rule_span_t;
+
+
+typedef struct {
+    ca_conf_ctx_t      *conf;
+    ca_rule_t          *rules;
+    ca_uint_t           nrules;
+    ca_rule_span_t     *spans;                 /* by item index */
+    ca_uint_t           nspans;
+    json_object        *json;
+    json_object        *data;
+} ca_rule_info_t;
+
+
+static ca_rule_info_t  ca_s_rule_info;
+
+
+static ca_int_t
+ca_rule_op(ca_str_t *op)
+{
+    if (op->len == 1 && op->data[0] == '>') {
+        return CA_RULE_GT;
+    }
+
+    if (op->len == 2 && ca_strncmp(op->data, ">=", 2) == 0) {
+        return CA_RULE_GE;
+    }
+
+    if (op->len == 1 && op->data[0] == '<') {
+        return CA_RULE_LT;
+    }
+
+    if (op->len == 2 && ca_strncmp(op->data, "<=", 2) == 0) {
+        return CA_RULE_LE;
+    }
+
+    return CA_ERROR;
+}
+
+
+static ca_int_t
+ca_rule_number(ca_str_t *value, double *d)
+{
+    char  *end;
+
+    *d = strtod((char *) value->data, &end);
+
+    if (end == (char *) value->data || *end != '\0') {
+        return CA_ERROR;
+    }
+
+    return CA_OK;
+}
+
+
+/*
+ * "<name> <id> threshold|rate <op> <value>" or
+ * "<name> <id> zscore <k> [<alpha>]"
+ */
+char *
+ca_conf_rule(ca_conf_t *cf, ca_command_t *cmd, void *conf)
+{
+    ca_conf_ctx_t  *ctx = conf;
+    ca_str_t       *value;
+    ca_int_t        id, op;
+    ca_uint_t       i;
+    ca_rule_t      *rule;
+
+    value = cf->args->elem;
+
+    id = ca_atoi(value[2].data, value[2].len);
+    if (id == CA_ERROR) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid item id \"%V\" in rule \"%V\"",
+                          &value[2], &value[1]);
+        return CA_CONF_ERROR;
+    }
+
+    if (ctx->acq_rules == NULL) {
+        ctx->acq_rules = ca_array_create(4, sizeof(ca_rule_t));
+        if (ctx->acq_rules == NULL) {
+            return CA_CONF_ERROR;
+        }
+    }
+
+    rule = ctx->acq_rules->elem;
+
+    for (i = 0; i < ctx->acq_rules->nelem; i++) {
+        if (rule[i].name.len == value[1].len
+            && ca_strncmp(rule[i].name.data, value[1].data, value[1].len)
+               == 0)
+        {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "duplicate rule \"%V\"", &value[1]);
+            return CA_CONF_ERROR;
+        }
+    }
+
+    rule = ca_array_push(ctx->acq_rules);
+    if (rule == NULL) {
+        return CA_CONF_ERROR;
+    }
+
+    ca_memzero(rule, sizeof(ca_rule_t));
+    rule->name = value[1];
+    rule->id = id;
+    rule->order = ctx->acq_rules->nelem - 1;
+    rule->alpha = CA_RULE_ALPHA;
+
+    if (ca_strcmp(value[3].data, "zscore") == 0) {
+        rule->kind = CA_RULE_ZSCORE;
+
+        if (ca_rule_number(&value[4], &rule->value) != CA_OK
+            || rule->value <= 0)
+        {
+            goto invalid;
+        }
+
+        if (cf->args->nelem == 6
+            && (ca_rule_number(&value[5], &rule->alpha) != CA_OK
+                || rule->alpha <= 0 || rule->alpha >= 1))
+        {
+            goto invalid;
+        }
+
+        return CA_CONF_OK;
+    }
+
+    if (ca_strcmp(value[3].data, "threshold") == 0) {
+        rule->kind = CA_RULE_THRESHOLD;
+
+    } else if (ca_strcmp(value[3].data, "rate") == 0) {
+        rule->kind = CA_RULE_RATE;
+
+    } else {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid rule \"%V\", it must be \"threshold\", "
+                          "\"rate\" or \"zscore\"", &value[3]);
+        return CA_CONF_ERROR;
+    }
+
+    op = ca_rule_op(&value[4]);
+
+    if (cf->args->nelem != 6 || op == CA_ERROR
+        || ca_rule_number(&value[5], &rule->value) != CA_OK)
+    {
+        goto invalid;
+    }
+
+    rule->op = op;
+
+    return CA_CONF_OK;
+
+invalid:
+
+    ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                      "invalid rule \"%V\", it must be \"<name> <id> "
+                      "threshold|rate >|>=|<|<= <value>\" or \"<name> <id> "
+                      "zscore <k> [<alpha>]\"", &value[1]);
+
+    return CA_CONF_ERROR;
+}
+
+
+static int
+ca_rule_cmp(const void *one, const void *two)
+{
+    const ca_rule_t  *a = one, *b = two;
+
+    if (a->item != b->item) {
+        return a->item < b->item ? -1 : 1;
+    }
+
+    return a->order < b->order ? -1 : 1;
+}
+
+
+ca_int_t
+ca_rule_compile(void *conf)
+{
+    ca_uint_t       i, j, n;
+    ca_acq_t       *item;
+    ca_rule_t      *rule;
+    ca_conf_ctx_t  *ctx = conf;
+
+    ca_s_rule_info.conf = ctx;
+
+    if (ctx->acq_rules == NULL || ctx->acq_rules->nelem == 0) {
+        return CA_OK;
+    }
+
+    item = ctx->acq_items->elem;
+    n = ctx->acq_rules->nelem;
+
+    rule = ca_calloc(n, sizeof(ca_rule_t));
+    ca_s_rule_info.spans = ca_calloc(ctx->acq_items->nelem,
+                                     sizeof(ca_rule_span_t));
+    if (rule == NULL || ca_s_rule_info.spans == NULL) {
+        ca_free(rule);
+        return CA_ERROR;
+    }
+
+    ca_memcpy(rule, ctx->acq_rules->elem, n * sizeof(ca_rule_t));
+
+    ca_s_rule_info.rules = rule;
+    ca_s_rule_info.nrules = n;
+    ca_s_rule_info.nspans = ctx->acq_items->nelem;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < ctx->acq_items->nelem; j++) {
+            if (item[j].id == rule[i].id) {
+                break;
+            }
+        }
+
+        if (j == ctx->acq_items->nelem) {
+            ca_log_emerg(0, "rule \"%V\" of unknown item %L",
+                         &rule[i].name, rule[i].id);
+            return CA_ERROR;
+        }
+
+        if (item[j].multi_handler != NULL) {
+            ca_log_emerg(0, "rule \"%V\" of multi-value item %L",
+                         &rule[i].name, rule[i].id);
+            return CA_ERROR;
+        }
+
+        rule[i].item = j;
+    }
+
+    qsort(rule, n, sizeof(ca_rule_t), ca_rule_cmp);
+
+    for (i = n; i > 0; i--) {
+        ca_s_rule_info.spans[rule[i - 1].item].first = i - 1;
+        ca_s_rule_info.spans[rule[i - 1].item].n++;
+    }
+
+    return CA_OK;
+}
+
+
+static ca_uint_t
+ca_rule_compare(ca_uint_t op, double v, double value)
+{
+    switch (op) {
+
+    case CA_RULE_GT:
+        return v > value;
+
+    case CA_RULE_GE:
+        return v >= value;
+
+    case CA_RULE_LT:
+        return v < value;
+
+    default:
+        return v <= value;
+    }
+}
+
+
+static void
+ca_rule_alert(ca_rule_t *rule, ca_acq_t *item)
+{
+    u_char         *p, val[64], num[32];
+    json_object    *entry, *attrs, *obj;
+    ca_conf_ctx_t  *conf;
+
+    p = ca_acq_value_format(&item->sample, val, sizeof(val));
+
+    if (rule->firing) {
+        ca_log_warn(0, "rule \"%V\" fires on item %L at \"%s\"",
+                    &rule->name, item->id, p);
+
+    } else {
+        ca_log_notice(0, "rule \"%V\" is over on item %L at \"%s\"",
+                      &rule->name, item->id, p);
+    }
+
+    if (ca_s_rule_info.json == NULL) {
+        conf = ca_s_rule_info.conf;
+
+        ca_s_rule_info.json = json_object_new_object();
+
+        obj = json_object_new_string_len((const char *) conf->identify.data,
+                                         (int) conf->identify.len);
+        json_object_object_add(ca_s_rule_info.json, "host", obj);
+
+        ca_snprintf(num, sizeof(num), "%ud%Z", item->sampled);
+        json_object_object_add(ca_s_rule_info.json, "time",
+                               json_object_new_string((char *) num));
+
+        ca_s_rule_info.data = json_object_new_array();
+        json_object_object_add(ca_s_rule_info.json, "data",
+                               ca_s_rule_info.data);
+    }
+
+    entry = json_object_new_array();
+
+    ca_snprintf(num, sizeof(num), "%d%Z", item->id);
+    json_object_array_add(entry, json_object_new_string((char *) num));
+    json_object_array_add(entry, json_object_new_string((char *) p));
+    json_object_array_add(entry, json_object_new_string("1"));
+
+    attrs = json_object_new_object();
+    json_object_object_add(attrs, "rule",
+        json_object_new_string_len((const char *) rule->name.data,
+                                   (int) rule->name.len));
+    json_object_object_add(attrs, "alert",
+        json_object_new_string(rule->firing ? "firing" : "resolved"));
+
+    ca_snprintf(num, sizeof(num), "%ud%Z", item->sampled);
+    json_object_object_add(attrs, "late",
+                           json_object_new_string((char *) num));
+
+    json_object_array_add(entry, attrs);
+    json_object_array_add(ca_s_rule_info.data, entry);
+}
+
+
+/* called by the acq thread for an item it ships, as soon as it has it */
+void
+ca_rule_eval(ca_uint_t i, ca_acq_t *item)
+{
+    double           v, rate, diff, incr, var;
+    ca_uint_t        j, fire, judged;
+    ca_rule_t       *rule;
+    ca_rule_span_t  *span;
+
+    if (i >= ca_s_rule_info.nspans || ca_s_rule_info.spans[i].n == 0) {
+        return;
+    }
+
+    if (!ca_acq_value_number(&item->sample, &v)) {
+        return;
+    }
+
+    span = &ca_s_rule_info.spans[i];
+
+    for (j = span->first; j < span->first + span->n; j++) {
+        rule = &ca_s_rule_info.rules[j];
+        fire = 0;
+        judged = 1;
+
+        switch (rule->kind) {
+
+        case CA_RULE_THRESHOLD:
+            fire = ca_rule_compare(rule->op, v, rule->value);
+            break;
+
+        case CA_RULE_RATE:
+            if (rule->n == 0 || item->sampled <= rule->last_time) {
+                judged = 0;
+
+            } else {
+                rate = (v - rule->last) / (item->sampled - rule->last_time);
+                fire = ca_rule_compare(rule->op, rate, rule->value);
+            }
+
+            rule->last = v;
+            rule->last_time = item->sampled;
+            break;
+
+        default: /* CA_RULE_ZSCORE */
+
+            /*
+             * judged by the mean and variance before the sample, the
+             * variance of a plateau is taken as a fraction of the mean
+             * squared, so that a step off it fires
+             */
+
+            diff = v - rule->mean;
+            var = CA_MAX(rule->var,
+                         CA_RULE_VAR_FLOOR * rule->mean * rule->mean);
+            judged = (rule->n >= CA_RULE_WARMUP);
+            fire = (diff * diff > rule->value * rule->value * var);
+
+            if (rule->n == 0) {
+                rule->mean = v;
+
+            } else {
+                incr = rule->alpha * diff;
+                rule->mean += incr;
+                rule->var = (1 - rule->alpha) * (rule->var + diff * incr);
+            }
+
+            break;
+        }
+
+        rule->n++;
+
+        if (judged && fire != rule->firing) {
+            rule->firing = fire;
+            ca_rule_alert(rule, item);
+        }
+    }
+}
+
+
+/* the alerts of this tick, ahead of the payloads queued before them */
+void
+ca_rule_flush(time_t now)
+{
+    if (ca_s_rule_info.json == NULL) {
+        return;
+    }
+
+    ca_acq_queue(ca_s_rule_info.json, now, now, CA_ACQ_PAYLOAD_ALERT);
+
+    ca_s_rule_info.json = NULL;
+    ca_s_rule_info.data = NULL;
+}
+
+
+void
+ca_rule_free(void)
+{
+    ca_free(ca_s_rule_info.rules);
+    ca_free(ca_s_rule_info.spans);
+
+    ca_s_rule_info.rules = NULL;
+    ca_s_rule_info.nrules = 0;
+    ca_s_rule_info.spans = NULL;
+    ca_s_rule_info.nspans = 0;
+}
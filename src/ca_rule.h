@@ -0,0 +1,26 @@
+#ifndef __CA_RULE_H_INCLUDED__
+#define __CA_RULE_H_INCLUDED__
+
+
+#define CA_RULE_THRESHOLD    1
+#define CA_RULE_RATE         2
+#define CA_RULE_ZSCORE       3
+
+#define CA_RULE_GT           1
+#define CA_RULE_GE           2
+#define CA_RULE_LT           3
+#define CA_RULE_LE           4
+
+#define CA_RULE_ALPHA        0.1
+#define CA_RULE_WARMUP       10     /* samples before a z-score is judged */
+#define CA_RULE_VAR_FLOOR    1e-6   /* of the mean squared, the least var */
+
+
+char *ca_conf_rule(ca_conf_t *cf, ca_command_t *cmd, void *conf);
+ca_int_t ca_rule_compile(void *conf);
+void ca_rule_eval(ca_uint_t i, ca_acq_t *item);
+void ca_rule_flush(time_t now);
+void ca_rule_free(void);
+
+
+#endif /* __CA_RULE_H_INCLUDED__ */
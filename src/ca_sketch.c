@@ -0,0 +1,258 @@
+#include "clagent.h"
+
+
+#define CA_SKETCH_SUB        (1 << CA_SKETCH_SUB_BITS)
+#define CA_SKETCH_BIAS       (1023 << CA_SKETCH_SUB_BITS)
+#define CA_SKETCH_MIN        1e-9             /* smaller is counted as 0 */
+
+
+static int32_t
+ca_sketch_key(double v)
+{
+    uint64_t  bits;
+
+    ca_memcpy(&bits, &v, sizeof(double));
+
+    return (int32_t) ((bits >> (52 - CA_SKETCH_SUB_BITS))
+                      & ((1 << (11 + CA_SKETCH_SUB_BITS)) - 1))
+           - CA_SKETCH_BIAS;
+}
+
+
+static double
+ca_sketch_lower(int32_t key)
+{
+    double    v;
+    uint64_t  bits;
+
+    bits = (uint64_t) (key + CA_SKETCH_BIAS) << (52 - CA_SKETCH_SUB_BITS);
+    ca_memcpy(&v, &bits, sizeof(double));
+
+    return v;
+}
+
+
+/* the middle of a bucket */
+static double
+ca_sketch_value(int32_t key)
+{
+    return (ca_sketch_lower(key) + ca_sketch_lower(key + 1)) / 2;
+}
+
+
+/* move the bins up by d keys, collapsing the lowest ones into bins[0] */
+static void
+ca_sketch_store_shift_up(ca_sketch_store_t *s, int32_t d)
+{
+    int32_t   k;
+    uint64_t  sum;
+
+    sum = 0;
+
+    for (k = s->lo; k <= s->hi && k < s->offset + d; k++) {
+        sum += s->bins[k - s->offset];
+        s->bins[k - s->offset] = 0;
+    }
+
+    if (d < CA_SKETCH_BINS) {
+        ca_memmove(s->bins, s->bins + d,
+                   (CA_SKETCH_BINS - d) * sizeof(uint32_t));
+        ca_memzero(s->bins + CA_SKETCH_BINS - d, d * sizeof(uint32_t));
+    }
+
+    s->offset += d;
+    s->bins[0] += sum;
+
+    if (s->lo < s->offset) {
+        s->lo = s->offset;
+    }
+
+    if (s->hi < s->offset) {
+        s->hi = s->offset;
+    }
+}
+
+
+static void
+ca_sketch_store_add(ca_sketch_store_t *s, int32_t key, uint32_t count)
+{
+    int32_t  d, room;
+
+    if (s->count == 0) {
+        s->offset = key - CA_SKETCH_BINS / 2;
+        s->lo = key;
+        s->hi = key;
+
+    } else if (key >= s->offset + CA_SKETCH_BINS) {
+        ca_sketch_store_shift_up(s, key - s->offset - CA_SKETCH_BINS + 1);
+
+    } else if (key < s->offset) {
+        room = s->offset + CA_SKETCH_BINS - 1 - s->hi;
+        d = s->offset - key;
+
+        if (d > room) {
+            d = room;
+        }
+
+        if (d > 0) {
+            ca_memmove(s->bins + d, s->bins,
+                       (CA_SKETCH_BINS - d) * sizeof(uint32_t));
+            ca_memzero(s->bins, d * sizeof(uint32_t));
+            s->offset -= d;
+        }
+
+        if (key < s->offset) {
+            key = s->offset;
+        }
+    }
+
+    s->bins[key - s->offset] += count;
+    s->count += count;
+
+    if (key < s->lo) {
+        s->lo = key;
+    }
+
+    if (key > s->hi) {
+        s->hi = key;
+    }
+}
+
+
+void
+ca_sketch_add(ca_sketch_t *sk, double v)
+{
+    if (v != v || v - v != 0) {               /* NaN or inf */
+        return;
+    }
+
+    if (sk->n == 0 || v < sk->min) {
+        sk->min = v;
+    }
+
+    if (sk->n == 0 || v > sk->max) {
+        sk->max = v;
+    }
+
+    sk->n++;
+    sk->sum += v;
+
+    if (v >= CA_SKETCH_MIN) {
+        ca_sketch_store_add(&sk->pos, ca_sketch_key(v), 1);
+
+    } else if (v <= -CA_SKETCH_MIN) {
+        ca_sketch_store_add(&sk->neg, ca_sketch_key(-v), 1);
+
+    } else {
+        sk->zero++;
+    }
+}
+
+
+void
+ca_sketch_merge(ca_sketch_t *dst, ca_sketch_t *src)
+{
+    int32_t  k;
+
+    if (src->n == 0) {
+        return;
+    }
+
+    if (dst->n == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+
+    if (dst->n == 0 || src->max > dst->max) {
+        dst->max = src->max;
+    }
+
+    dst->n += src->n;
+    dst->sum += src->sum;
+    dst->zero += src->zero;
+
+    for (k = src->pos.lo; src->pos.count && k <= src->pos.hi; k++) {
+        if (src->pos.bins[k - src->pos.offset]) {
+            ca_sketch_store_add(&dst->pos, k,
+                                src->pos.bins[k - src->pos.offset]);
+        }
+    }
+
+    for (k = src->neg.lo; src->neg.count && k <= src->neg.hi; k++) {
+        if (src->neg.bins[k - src->neg.offset]) {
+            ca_sketch_store_add(&dst->neg, k,
+                                src->neg.bins[k - src->neg.offset]);
+        }
+    }
+}
+
+
+/* q in [0, 1], the sketch must not be empty */
+double
+ca_sketch_quantile(ca_sketch_t *sk, double q)
+{
+    double    v, rank;
+    int32_t   k;
+    uint64_t  cum;
+
+    rank = q * (sk->n - 1);
+    cum = 0;
+    v = sk->max;
+
+    /* the largest negative magnitudes first */
+
+    for (k = sk->neg.hi; sk->neg.count && k >= sk->neg.lo; k--) {
+        cum += sk->neg.bins[k - sk->neg.offset];
+        if (cum > rank) {
+            v = -ca_sketch_value(k);
+            goto done;
+        }
+    }
+
+    cum += sk->zero;
+    if (cum > rank) {
+        v = 0;
+        goto done;
+    }
+
+    for (k = sk->pos.lo; sk->pos.count && k <= sk->pos.hi; k++) {
+        cum += sk->pos.bins[k - sk->pos.offset];
+        if (cum > rank) {
+            v = ca_sketch_value(k);
+            goto done;
+        }
+    }
+
+done:
+
+    if (v < sk->min) {
+        v = sk->min;
+
+    } else if (v > sk->max) {
+        v = sk->max;
+    }
+
+    return v;
+}
+
+
+void
+ca_sketch_reset(ca_sketch_t *sk)
+{
+    if (sk->pos.count) {
+        ca_memzero(sk->pos.bins + (sk->pos.lo - sk->pos.offset),
+                   (sk->pos.hi - sk->pos.lo + 1) * sizeof(uint32_t));
+        sk->pos.count = 0;
+    }
+
+    if (sk->neg.count) {
+        ca_memzero(sk->neg.bins + (sk->neg.lo - sk->neg.offset),
+                   (sk->neg.hi - sk->neg.lo + 1) * sizeof(uint32_t));
+        sk->neg.count = 0;
+    }
+
+    sk->n = 0;
+    sk->zero = 0;
+    sk->min = 0;
+    sk->max = 0;
+    sk->sum = 0;
+}
@@ -0,0 +1,45 @@
+#ifndef __CA_SKETCH_H_INCLUDED__
+#define __CA_SKETCH_H_INCLUDED__
+
+
+/*
+ * A mergeable quantile sketch: a value is counted in a bucket of its
+ * magnitude, 2^SUB_BITS buckets a power of two taken from the bits of
+ * the double, so a quantile is within 1.6% of the value it stands for.
+ * A store keeps CA_SKETCH_BINS consecutive buckets, a spread of 2^32;
+ * beyond that the smallest magnitudes are collapsed into one bucket.
+ * The sketch is of fixed size and a zeroed one is empty, it may live in
+ * preallocated memory.
+ */
+
+#define CA_SKETCH_SUB_BITS   5
+#define CA_SKETCH_BINS       1024
+
+
+typedef struct {
+    uint64_t    count;
+    int32_t     offset;                       /* key of bins[0] */
+    int32_t     lo;                           /* lowest key used */
+    int32_t     hi;                           /* highest key used */
+    uint32_t    bins[CA_SKETCH_BINS];
+} ca_sketch_store_t;
+
+
+typedef struct {
+    uint64_t            n;
+    uint64_t            zero;
+    double              min;
+    double              max;
+    double              sum;
+    ca_sketch_store_t   pos;
+    ca_sketch_store_t   neg;
+} ca_sketch_t;
+
+
+void ca_sketch_add(ca_sketch_t *sk, double v);
+void ca_sketch_merge(ca_sketch_t *dst, ca_sketch_t *src);
+double ca_sketch_quantile(ca_sketch_t *sk, double q);
+void ca_sketch_reset(ca_sketch_t *sk);
+
+
+#endif /* __CA_SKETCH_H_INCLUDED__ */
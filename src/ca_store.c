@@ -0,0 +1,1009 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "clagent.h"
+#include "json-c/json.h"
+
+
+/*
+ * The store keeps the numeric samples of an item in a ring of blocks in
+ * a file of its own, "<store_path>/<id>.ring", mapped in memory: a
+ * sample is appended to the block at the head by the acq thread with
+ * no system call, the kernel writes the pages back, and the ring is
+ * taken up again when the agent restarts.
+ *
+ * A block is compressed as in Facebook's Gorilla: the first time and
+ * value are in full, the next times as the delta of their delta and the
+ * next values as the xor with the one before, most often a bit or two.
+ * The state of the encoder is in the header of the block, it is written
+ * after the bits of a sample.
+ *
+ * The samples of the payloads that could not be submitted are shipped
+ * again, with their time as "late", once a payload is submitted.  The
+ * time of the oldest sample not known to be submitted is kept in
+ * "<store_path>/state", so that an outage the agent was restarted in,
+ * or the samples it stored before it stopped, are backfilled after.
+ */
+
+typedef struct {
+    uint32_t                magic;
+    uint32_t                version;
+    int64_t                 id;
+    uint32_t                block_size;
+    uint32_t                nblocks;
+    uint32_t                head;
+    uint32_t                reserved;
+    u_char                  name[CA_STORE_NAME];
+} ca_store_header_t;
+
+
+typedef struct {
+    int64_t                 start;
+    int64_t                 last;
+    int64_t                 delta;
+    uint64_t                value;
+    uint32_t                count;
+    uint32_t                nbits;
+    uint8_t                 leading;          /* CA_STORE_NONE before xor */
+    uint8_t                 trailing;
+    uint8_t                 reserved[6];
+} ca_store_block_t;
+
+
+typedef struct {
+    uint32_t                magic;
+    uint32_t                version;
+    int64_t                 since;
+} ca_store_state_t;
+
+
+#define CA_STORE_NONE       0xff
+
+#define CA_STORE_IDLE       0
+#define CA_STORE_INFLIGHT   1
+#define CA_STORE_FAILED     2
+#define CA_STORE_BITS       ((CA_STORE_BLOCK - sizeof(ca_store_block_t)) * 8)
+#define CA_STORE_MAX_BITS   (4 + 32 + 2 + 5 + 6 + 64)
+
+/* the samples a block holds at the least, every one of the most bits */
+#define CA_STORE_MIN_COUNT  ((CA_STORE_BITS - 64) / CA_STORE_MAX_BITS + 1)
+
+
+typedef struct {
+    ca_acq_t               *item;
+    ca_store_header_t      *header;
+    size_t                  size;
+} ca_store_ring_t;
+
+
+typedef struct {
+    time_t                  from;
+    time_t                  to;
+} ca_store_range_t;
+
+
+typedef struct {
+    ca_conf_ctx_t          *conf;
+    ca_store_ring_t        *rings;
+    ca_uint_t               nrings;
+
+    /* written by the submit thread */
+    pthread_mutex_t         mutex;
+    ca_store_range_t        lost;
+    ca_store_range_t        pending[CA_STORE_OUTAGES];
+    ca_uint_t               npending;
+    ca_uint_t               shipped;          /* of the backfill payload */
+    time_t                  acked;            /* the last bulk submitted */
+    time_t                  backfill;         /* from of the one shipped */
+    ca_store_state_t       *state;
+
+    /* the backfill being shipped, a payload after another */
+    ca_uint_t               active;
+    ca_uint_t               ring;
+    time_t                  cursor;
+    time_t                  from;
+    time_t                  to;
+    ca_uint_t               sent_ring;        /* where the payload started */
+    time_t                  sent_cursor;
+} ca_store_info_t;
+
+
+typedef struct {
+    ca_acq_t               *item;
+    time_t                  now;
+    json_object            *json;
+    json_object            *arr;
+    ca_uint_t               n;
+    time_t                  first;
+    time_t                  last;
+    time_t                  at;               /* of the item last shipped */
+} ca_store_backfill_t;
+
+
+static ca_store_info_t  ca_s_store_info = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+
+/* the oldest sample not known to be submitted, with the mutex held */
+static void
+ca_store_persist(ca_store_info_t *s)
+{
+    time_t      since;
+    ca_uint_t   i;
+
+    if (s->state == NULL) {
+        return;
+    }
+
+    since = s->acked + 1;
+
+    if (s->lost.to != 0) {
+        since = CA_MIN(since, s->lost.from);
+    }
+
+    for (i = 0; i < s->npending; i++) {
+        since = CA_MIN(since, s->pending[i].from);
+    }
+
+    if (s->backfill != 0) {
+        since = CA_MIN(since, s->backfill);
+    }
+
+    s->state->since = since;
+}
+
+
+#define ca_store_block(h, b)                                                \
+    ((ca_store_block_t *) ((u_char *) (h) + CA_STORE_BLOCK * ((b) + 1)))
+
+
+static void
+ca_store_put_bits(u_char *buf, uint32_t *pos, uint64_t v, ca_uint_t n)
+{
+    u_char     *p;
+    ca_uint_t   room, k;
+
+    while (n) {
+        p = buf + (*pos >> 3);
+        room = 8 - (*pos & 7);
+        k = CA_MIN(room, n);
+
+        /* the block may have been written before, a byte starts anew */
+
+        if (room == 8) {
+            *p = 0;
+        }
+
+        *p |= (u_char) (((v >> (n - k)) & ((1u << k) - 1)) << (room - k));
+
+        *pos += k;
+        n -= k;
+    }
+}
+
+
+/* the bits past nbits, of a torn block, are read as 0 */
+static uint64_t
+ca_store_get_bits(u_char *buf, uint32_t nbits, uint32_t *pos, ca_uint_t n)
+{
+    uint64_t    v;
+    ca_uint_t   room, k;
+
+    v = 0;
+
+    while (n) {
+        room = 8 - (*pos & 7);
+        k = CA_MIN(room, n);
+
+        v <<= k;
+
+        if (*pos < nbits) {
+            v |= (buf[*pos >> 3] >> (room - k)) & ((1u << k) - 1);
+        }
+
+        *pos += k;
+        n -= k;
+    }
+
+    return v;
+}
+
+
+static void
+ca_store_append(ca_store_ring_t *r, int64_t t, double d)
+{
+    u_char             *data;
+    int64_t             delta, dod;
+    uint64_t            v, x;
+    uint32_t            pos;
+    ca_uint_t           lead, trail, bits;
+    ca_store_block_t   *b;
+    ca_store_header_t  *h;
+
+    h = r->header;
+    b = ca_store_block(h, h->head);
+
+    ca_memcpy(&v, &d, sizeof(uint64_t));
+
+    /* a sample collected again in the same second is not kept */
+
+    if (b->count && t == b->last) {
+        return;
+    }
+
+    if (b->count && (t < b->last || b->nbits + CA_STORE_MAX_BITS
+                                    > CA_STORE_BITS))
+    {
+        h->head = (h->head + 1) % h->nblocks;
+        b = ca_store_block(h, h->head);
+        b->count = 0;
+    }
+
+    data = (u_char *) (b + 1);
+
+    if (b->count == 0) {
+        pos = 0;
+        ca_store_put_bits(data, &pos, v, 64);
+
+        b->start = t;
+        b->last = t;
+        b->delta = 0;
+        b->value = v;
+        b->leading = CA_STORE_NONE;
+        b->trailing = 0;
+        b->nbits = pos;
+        b->count = 1;
+        return;
+    }
+
+    pos = b->nbits;
+    delta = t - b->last;
+    dod = delta - b->delta;
+
+    if (dod == 0) {
+        ca_store_put_bits(data, &pos, 0, 1);
+
+    } else if (dod >= -63 && dod <= 64) {
+        ca_store_put_bits(data, &pos, 2, 2);
+        ca_store_put_bits(data, &pos, dod + 63, 7);
+
+    } else if (dod >= -255 && dod <= 256) {
+        ca_store_put_bits(data, &pos, 6, 3);
+        ca_store_put_bits(data, &pos, dod + 255, 9);
+
+    } else if (dod >= -2047 && dod <= 2048) {
+        ca_store_put_bits(data, &pos, 14, 4);
+        ca_store_put_bits(data, &pos, dod + 2047, 12);
+
+    } else {
+        ca_store_put_bits(data, &pos, 15, 4);
+        ca_store_put_bits(data, &pos, (uint32_t) dod, 32);
+    }
+
+    x = v ^ b->value;
+
+    if (x == 0) {
+        ca_store_put_bits(data, &pos, 0, 1);
+
+    } else {
+        lead = CA_MIN((ca_uint_t) __builtin_clzll(x), 31);
+        trail = __builtin_ctzll(x);
+
+        if (b->leading != CA_STORE_NONE
+            && lead >= b->leading && trail >= b->trailing)
+        {
+            /* within the meaningful bits of the xor before */
+
+            bits = 64 - b->leading - b->trailing;
+
+            ca_store_put_bits(data, &pos, 2, 2);
+            ca_store_put_bits(data, &pos, x >> b->trailing, bits);
+
+        } else {
+            bits = 64 - lead - trail;
+
+            ca_store_put_bits(data, &pos, 3, 2);
+            ca_store_put_bits(data, &pos, lead, 5);
+            ca_store_put_bits(data, &pos, bits & 63, 6);
+            ca_store_put_bits(data, &pos, x >> trail, bits);
+
+            b->leading = lead;
+            b->trailing = trail;
+        }
+    }
+
+    b->last = t;
+    b->delta = delta;
+    b->value = v;
+    b->nbits = pos;
+    b->count++;
+}
+
+
+/* CA_AGAIN if the handler stopped the read */
+static ca_int_t
+ca_store_block_read(ca_store_block_t *b, time_t from, time_t to,
+    ca_store_handler_pt handler, void *data)
+{
+    u_char     *buf;
+    double      d;
+    int64_t     t, delta, dod;
+    uint64_t    v, x;
+    uint32_t    pos, i, nbits;
+    ca_uint_t   lead, trail, bits;
+
+    buf = (u_char *) (b + 1);
+    pos = 0;
+    nbits = CA_MIN(b->nbits, CA_STORE_BITS);
+
+    t = b->start;
+    v = ca_store_get_bits(buf, nbits, &pos, 64);
+    delta = 0;
+    lead = 0;
+    trail = 0;
+
+    for (i = 0; i < b->count; i++) {
+        if (i > 0) {
+            if (pos >= nbits) {
+                break;
+            }
+
+            if (ca_store_get_bits(buf, nbits, &pos, 1) == 0) {
+                dod = 0;
+
+            } else if (ca_store_get_bits(buf, nbits, &pos, 1) == 0) {
+                dod = (int64_t) ca_store_get_bits(buf, nbits, &pos, 7) - 63;
+
+            } else if (ca_store_get_bits(buf, nbits, &pos, 1) == 0) {
+                dod = (int64_t) ca_store_get_bits(buf, nbits, &pos, 9) - 255;
+
+            } else if (ca_store_get_bits(buf, nbits, &pos, 1) == 0) {
+                dod = (int64_t) ca_store_get_bits(buf, nbits, &pos, 12) - 2047;
+
+            } else {
+                dod = (int32_t) ca_store_get_bits(buf, nbits, &pos, 32);
+            }
+
+            delta += dod;
+            t += delta;
+
+            if (ca_store_get_bits(buf, nbits, &pos, 1) == 1) {
+                if (ca_store_get_bits(buf, nbits, &pos, 1) == 1) {
+                    lead = ca_store_get_bits(buf, nbits, &pos, 5);
+                    bits = ca_store_get_bits(buf, nbits, &pos, 6);
+                    bits = bits ? bits : 64;
+
+                    if (lead + bits > 64) {
+                        break;
+                    }
+
+                    trail = 64 - lead - bits;
+                }
+
+                bits = 64 - lead - trail;
+                x = ca_store_get_bits(buf, nbits, &pos, bits);
+                v ^= x << trail;
+            }
+
+            if (pos > nbits) {
+                break;
+            }
+        }
+
+        if (t > to) {
+            break;
+        }
+
+        if (t >= from) {
+            ca_memcpy(&d, &v, sizeof(double));
+
+            if (handler(data, t, d) != CA_OK) {
+                return CA_AGAIN;
+            }
+        }
+    }
+
+    return CA_OK;
+}
+
+
+/* the samples of the ring of item i from from to to, the oldest first */
+ca_int_t
+ca_store_read(ca_uint_t i, time_t from, time_t to,
+    ca_store_handler_pt handler, void *data)
+{
+    uint32_t            k, n;
+    ca_store_block_t   *b;
+    ca_store_header_t  *h;
+
+    if (i >= ca_s_store_info.nrings || ca_s_store_info.rings[i].header == NULL)
+    {
+        return CA_ERROR;
+    }
+
+    h = ca_s_store_info.rings[i].header;
+
+    for (k = 1; k <= h->nblocks; k++) {
+        n = (h->head + k) % h->nblocks;
+        b = ca_store_block(h, n);
+
+        if (b->count == 0 || b->last < from || b->start > to) {
+            continue;
+        }
+
+        if (ca_store_block_read(b, from, to, handler, data) != CA_OK) {
+            return CA_AGAIN;
+        }
+    }
+
+    return CA_OK;
+}
+
+
+/* a value as few digits as it takes, up to 6 decimals */
+u_char *
+ca_store_format(double v, u_char *buf, size_t size)
+{
+    u_char  *p;
+
+    if (v == (double) (int64_t) v && v < 9007199254740992.0
+        && v > -9007199254740992.0)
+    {
+        ca_snprintf(buf, size, "%L%Z", (int64_t) v);
+        return buf;
+    }
+
+    p = ca_snprintf(buf, size - 1, "%.6f", v);
+    *p = '\0';
+
+    while (p > buf + 1 && p[-1] == '0' && p[-2] != '.') {
+        *--p = '\0';
+    }
+
+    return buf;
+}
+
+
+void
+ca_store_sample(ca_uint_t i, ca_acq_t *item)
+{
+    double  d;
+
+    if (i >= ca_s_store_info.nrings
+        || ca_s_store_info.rings[i].header == NULL
+        || !ca_acq_value_number(&item->sample, &d))
+    {
+        return;
+    }
+
+    ca_store_append(&ca_s_store_info.rings[i], item->sampled, d);
+}
+
+
+/*
+ * Called by the submit thread with the times of the samples in a
+ * payload.  The bulk payloads that failed in a row make up an outage,
+ * which is backfilled as soon as one is submitted again; the outages
+ * are kept apart, not to ship again what was submitted between them.
+ * A backfill payload that failed is shipped again from where it started.
+ */
+void
+ca_store_submitted(time_t from, time_t to, ca_uint_t kind, ca_int_t rc)
+{
+    ca_store_info_t   *s;
+    ca_store_range_t  *r;
+
+    s = &ca_s_store_info;
+
+    if (s->rings == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+
+    if (kind == CA_ACQ_PAYLOAD_BACKFILL) {
+        s->shipped = (rc == CA_ERROR) ? CA_STORE_FAILED : CA_STORE_IDLE;
+
+    } else if (kind != CA_ACQ_PAYLOAD_BULK || to == 0) {
+        /* an alert or a payload of no stored sample */
+
+    } else if (rc == CA_ERROR) {
+        if (s->lost.to == 0) {
+            s->lost.from = from;
+            s->lost.to = to;
+
+        } else {
+            s->lost.from = CA_MIN(s->lost.from, from);
+            s->lost.to = CA_MAX(s->lost.to, to);
+        }
+
+    } else if (s->lost.to != 0) {
+
+        /* when too many wait, the last two are merged */
+
+        if (s->npending == CA_STORE_OUTAGES) {
+            r = &s->pending[CA_STORE_OUTAGES - 1];
+            r->from = CA_MIN(r->from, s->lost.from);
+            r->to = CA_MAX(r->to, s->lost.to);
+
+        } else {
+            s->pending[s->npending++] = s->lost;
+        }
+
+        s->lost.from = 0;
+        s->lost.to = 0;
+    }
+
+    if (kind == CA_ACQ_PAYLOAD_BULK && to != 0 && rc != CA_ERROR) {
+        s->acked = CA_MAX(s->acked, to);
+    }
+
+    ca_store_persist(s);
+
+    pthread_mutex_unlock(&s->mutex);
+}
+
+
+static ca_int_t
+ca_store_backfill_sample(void *data, time_t t, double v)
+{
+    u_char               val[64];
+    json_object         *entry, *attrs, *obj;
+    ca_conf_ctx_t       *conf;
+    ca_store_backfill_t  *bf;
+
+    bf = data;
+
+    if (bf->n == CA_STORE_BACKFILL) {
+        return CA_AGAIN;
+    }
+
+    if (bf->json == NULL) {
+        conf = ca_s_store_info.conf;
+
+        bf->json = json_object_new_object();
+
+        obj = json_object_new_string_len((const char *) conf->identify.data,
+                                         (int) conf->identify.len);
+        json_object_object_add(bf->json, "host", obj);
+
+        ca_snprintf(val, sizeof(val), "%ud%Z", bf->now);
+        json_object_object_add(bf->json, "time",
+                               json_object_new_string((char *) val));
+
+        bf->arr = json_object_new_array();
+        json_object_object_add(bf->json, "data", bf->arr);
+
+        bf->first = t;
+    }
+
+    entry = json_object_new_array();
+
+    ca_snprintf(val, sizeof(val), "%d%Z", bf->item->id);
+    json_object_array_add(entry, json_object_new_string((char *) val));
+
+    ca_store_format(v, val, sizeof(val));
+    json_object_array_add(entry, json_object_new_string((char *) val));
+
+    json_object_array_add(entry, json_object_new_string("1"));
+
+    attrs = json_object_new_object();
+    ca_snprintf(val, sizeof(val), "%ud%Z", t);
+    json_object_object_add(attrs, "late",
+                           json_object_new_string((char *) val));
+    json_object_array_add(entry, attrs);
+
+    json_object_array_add(bf->arr, entry);
+
+    bf->first = CA_MIN(bf->first, t);
+    bf->last = CA_MAX(bf->last, t);
+    bf->at = t;
+    bf->n++;
+
+    return CA_OK;
+}
+
+
+/*
+ * Ships at most CA_STORE_BACKFILL samples of an outage a tick, so that
+ * a long one is not sent in a payload as large, nor stalls the tick;
+ * the next payload waits for the one before to be submitted.
+ */
+void
+ca_store_tick(time_t now)
+{
+    ca_int_t              rc;
+    ca_uint_t             shipped;
+    ca_store_info_t      *s;
+    ca_store_backfill_t   bf;
+
+    s = &ca_s_store_info;
+
+    if (s->rings == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+
+    shipped = s->shipped;
+
+    if (shipped == CA_STORE_FAILED) {
+        s->shipped = CA_STORE_IDLE;
+
+    } else if (shipped == CA_STORE_IDLE && !s->active) {
+
+        /* the backfill before, if any, is over */
+
+        s->backfill = 0;
+
+        if (s->npending) {
+            s->from = s->pending[0].from;
+            s->to = s->pending[0].to;
+            s->npending--;
+            ca_memmove(&s->pending[0], &s->pending[1],
+                       s->npending * sizeof(ca_store_range_t));
+
+            s->active = 1;
+            s->ring = 0;
+            s->cursor = s->from;
+            s->backfill = s->from;
+
+            ca_log_notice(0, "store backfills the samples from %T to %T",
+                          s->from, s->to);
+        }
+
+        ca_store_persist(s);
+    }
+
+    pthread_mutex_unlock(&s->mutex);
+
+    if (shipped == CA_STORE_INFLIGHT) {
+        return;
+    }
+
+    if (shipped == CA_STORE_FAILED) {
+        s->ring = s->sent_ring;
+        s->cursor = s->sent_cursor;
+        s->active = 1;
+    }
+
+    if (!s->active) {
+        return;
+    }
+
+    s->sent_ring = s->ring;
+    s->sent_cursor = s->cursor;
+
+    ca_memzero(&bf, sizeof(ca_store_backfill_t));
+    bf.now = now;
+
+    for ( /* void */ ; s->ring < s->nrings; s->ring++) {
+        bf.item = s->rings[s->ring].item;
+        bf.at = s->cursor - 1;
+
+        rc = ca_store_read(s->ring, s->cursor, s->to,
+                           ca_store_backfill_sample, &bf);
+
+        if (rc == CA_AGAIN) {
+            s->cursor = bf.at + 1;
+            break;
+        }
+
+        s->cursor = s->from;
+    }
+
+    if (s->ring == s->nrings) {
+        s->active = 0;
+    }
+
+    if (bf.json == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    s->shipped = CA_STORE_INFLIGHT;
+    pthread_mutex_unlock(&s->mutex);
+
+    if (ca_acq_queue(bf.json, bf.first, bf.last, CA_ACQ_PAYLOAD_BACKFILL)
+        != CA_OK)
+    {
+        pthread_mutex_lock(&s->mutex);
+        s->shipped = CA_STORE_FAILED;
+        pthread_mutex_unlock(&s->mutex);
+    }
+}
+
+
+/* a block torn by a crash, or written over by anything else */
+static ca_uint_t
+ca_store_block_valid(ca_store_block_t *b)
+{
+    if (b->count == 0) {
+        return 1;
+    }
+
+    /* a sample after the first one takes 2 bits at least */
+
+    if (b->nbits < 64 || b->nbits > CA_STORE_BITS
+        || b->count - 1 > (b->nbits - 64) / 2
+        || b->start > b->last)
+    {
+        return 0;
+    }
+
+    if (b->leading != CA_STORE_NONE
+        && (b->leading > 31 || b->leading + b->trailing > 63))
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static ca_int_t
+ca_store_open(ca_store_ring_t *r, ca_str_t *path, ca_uint_t hours)
+{
+    int                 fd;
+    u_char              file[PATH_MAX], *p;
+    size_t              len;
+    uint32_t            k;
+    ca_acq_t           *item;
+    ca_uint_t           freq, nblocks, torn;
+    struct stat         st;
+    ca_store_block_t   *b;
+    ca_store_header_t  *h;
+
+    item = r->item;
+
+    p = ca_snprintf(file, sizeof(file) - 1, "%V/%L.ring", path, item->id);
+    *p = '\0';
+
+    /*
+     * enough blocks for hours of samples however little they compress,
+     * and the one at the head that is being written over
+     */
+
+    freq = item->adapt ? item->adapt->min : item->freq;
+    nblocks = ((uint64_t) hours * 3600 / CA_MAX(freq, 1)
+               + CA_STORE_MIN_COUNT - 1) / CA_STORE_MIN_COUNT + 1;
+
+    r->size = (size_t) CA_STORE_BLOCK * (nblocks + 1);
+
+    fd = open((char *) file, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (fd == -1) {
+        ca_log_crit(errno, "open() store \"%s\" failed", file);
+        return CA_ERROR;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        ca_log_crit(errno, "fstat() store \"%s\" failed", file);
+        close(fd);
+        return CA_ERROR;
+    }
+
+    if ((size_t) st.st_size != r->size && ftruncate(fd, r->size) == -1) {
+        ca_log_crit(errno, "ftruncate() store \"%s\" failed", file);
+        close(fd);
+        return CA_ERROR;
+    }
+
+    h = mmap(NULL, r->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (h == MAP_FAILED) {
+        ca_log_crit(errno, "mmap() store \"%s\" failed", file);
+        return CA_ERROR;
+    }
+
+    r->header = h;
+
+    len = CA_MIN(item->item.len, CA_STORE_NAME - 1);
+
+    if (h->magic == CA_STORE_MAGIC
+        && h->version == CA_STORE_VERSION
+        && h->id == item->id
+        && h->block_size == CA_STORE_BLOCK
+        && h->nblocks == nblocks
+        && h->head < nblocks
+        && ca_strncmp(h->name, item->item.data, len) == 0
+        && h->name[len] == '\0')
+    {
+        torn = 0;
+
+        for (k = 0; k < h->nblocks; k++) {
+            b = ca_store_block(h, k);
+
+            if (!ca_store_block_valid(b)) {
+                ca_memzero(b, sizeof(ca_store_block_t));
+                torn++;
+            }
+        }
+
+        if (torn) {
+            ca_log_warn(0, "store \"%s\" of \"%V\" had %uL torn blocks",
+                        file, &item->item, (uint64_t) torn);
+        }
+
+        ca_log_debug(0, "store \"%s\" of \"%V\" taken up", file,
+                     &item->item);
+        return CA_OK;
+    }
+
+    /* a new ring, or one of another item or geometry */
+
+    ca_memzero(h, r->size);
+
+    h->magic = CA_STORE_MAGIC;
+    h->version = CA_STORE_VERSION;
+    h->id = item->id;
+    h->block_size = CA_STORE_BLOCK;
+    h->nblocks = nblocks;
+    h->head = 0;
+    ca_memcpy(h->name, item->item.data, len);
+
+    ca_log_debug(0, "store \"%s\" of \"%V\" created, %uL blocks", file,
+                 &item->item, (uint64_t) nblocks);
+
+    return CA_OK;
+}
+
+
+/*
+ * The state of a store that was taken up: what was not submitted
+ * before the agent stopped is backfilled up to now.
+ */
+static ca_int_t
+ca_store_state_open(ca_str_t *path, time_t now)
+{
+    int                fd;
+    u_char             file[PATH_MAX], *p;
+    struct stat        st;
+    ca_store_state_t  *state;
+    ca_store_info_t   *s;
+
+    s = &ca_s_store_info;
+
+    p = ca_snprintf(file, sizeof(file) - 1, "%V/state", path);
+    *p = '\0';
+
+    fd = open((char *) file, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    if (fd == -1) {
+        ca_log_crit(errno, "open() store \"%s\" failed", file);
+        return CA_ERROR;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        ca_log_crit(errno, "fstat() store \"%s\" failed", file);
+        close(fd);
+        return CA_ERROR;
+    }
+
+    if ((size_t) st.st_size != sizeof(ca_store_state_t)
+        && ftruncate(fd, sizeof(ca_store_state_t)) == -1)
+    {
+        ca_log_crit(errno, "ftruncate() store \"%s\" failed", file);
+        close(fd);
+        return CA_ERROR;
+    }
+
+    state = mmap(NULL, sizeof(ca_store_state_t), PROT_READ|PROT_WRITE,
+               MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (state == MAP_FAILED) {
+        ca_log_crit(errno, "mmap() store \"%s\" failed", file);
+        return CA_ERROR;
+    }
+
+    if (state->magic == CA_STORE_STATE_MAGIC
+        && state->version == CA_STORE_VERSION
+        && state->since > 0 && state->since < now)
+    {
+        s->pending[0].from = state->since;
+        s->pending[0].to = now;
+        s->npending = 1;
+
+        ca_log_notice(0, "store \"%s\": the samples since %T were not "
+                      "submitted", file, (time_t) state->since);
+    }
+
+    state->magic = CA_STORE_STATE_MAGIC;
+    state->version = CA_STORE_VERSION;
+
+    s->acked = now;
+    s->state = state;
+
+    ca_store_persist(s);
+
+    return CA_OK;
+}
+
+
+/*
+ * Rejects two stored items of an id, they would share a ring file;
+ * called as the configuration is read.
+ */
+ca_int_t
+ca_store_check(void *conf)
+{
+    ca_uint_t        i, j, n;
+    ca_acq_t        *item;
+    ca_conf_ctx_t   *ctx = conf;
+
+    if (ctx->store_path.len == 0) {
+        return CA_OK;
+    }
+
+    n = ctx->acq_items->nelem;
+    item = ctx->acq_items->elem;
+
+    for (i = 0; i < n; i++) {
+        if (item[i].multi_handler != NULL || item[i].window != 0) {
+            continue;
+        }
+
+        for (j = 0; j < i; j++) {
+            if (item[j].multi_handler != NULL || item[j].window != 0
+                || item[j].id != item[i].id)
+            {
+                continue;
+            }
+
+            ca_log_emerg(0, "acq items \"%V\" and \"%V\" are stored "
+                         "with the same id %L", &item[j].item,
+                         &item[i].item, (int64_t) item[i].id);
+            return CA_ERROR;
+        }
+    }
+
+    return CA_OK;
+}
+
+
+/* a multi-value item or an item with a window is not stored */
+ca_int_t
+ca_store_init(void *conf)
+{
+    ca_uint_t        i, n;
+    ca_acq_t        *item;
+    ca_conf_ctx_t   *ctx = conf;
+    ca_store_ring_t *r;
+
+    if (ctx->store_path.len == 0) {
+        return CA_OK;
+    }
+
+    ca_s_store_info.conf = ctx;
+
+    n = ctx->acq_items->nelem;
+    item = ctx->acq_items->elem;
+
+    ca_s_store_info.rings = ca_calloc(n, sizeof(ca_store_ring_t));
+    if (ca_s_store_info.rings == NULL) {
+        return CA_ERROR;
+    }
+
+    ca_s_store_info.nrings = n;
+
+    for (i = 0; i < n; i++) {
+        r = &ca_s_store_info.rings[i];
+        r->item = &item[i];
+
+        if (item[i].multi_handler != NULL || item[i].window != 0) {
+            continue;
+        }
+
+        if (ca_store_open(r, &ctx->store_path, ctx->store_hours) != CA_OK) {
+            return CA_ERROR;
+        }
+    }
+
+    return ca_store_state_open(&ctx->store_path, time(NULL));
+}
@@ -0,0 +1,28 @@
+#ifndef __CA_STORE_H_INCLUDED__
+#define __CA_STORE_H_INCLUDED__
+
+
+#define CA_STORE_MAGIC       0x43415352      /* "CASR" */
+#define CA_STORE_STATE_MAGIC 0x43415353      /* "CASS" */
+#define CA_STORE_VERSION     1
+#define CA_STORE_BLOCK       4096
+#define CA_STORE_NAME        64
+#define CA_STORE_BACKFILL    1000       /* samples shipped a tick */
+#define CA_STORE_OUTAGES     8          /* waiting to be backfilled */
+
+
+typedef ca_int_t (*ca_store_handler_pt)(void *data, time_t t, double v);
+
+
+ca_int_t ca_store_check(void *conf);
+ca_int_t ca_store_init(void *conf);
+void ca_store_sample(ca_uint_t i, ca_acq_t *item);
+void ca_store_tick(time_t now);
+void ca_store_submitted(time_t from, time_t to, ca_uint_t kind,
+    ca_int_t rc);
+ca_int_t ca_store_read(ca_uint_t i, time_t from, time_t to,
+    ca_store_handler_pt handler, void *data);
+u_char *ca_store_format(double v, u_char *buf, size_t size);
+
+
+#endif /* __CA_STORE_H_INCLUDED__ */
@@ -627,3 +627,249 @@ ca_strcasestrn(u_char *s1, char *s2, size_t n)
 
     return --s1;
 }
+
+
+#define CA_AC_NONE      0xffffffff
+#define CA_AC_MATCH     0x80000000      /* a pattern ends in the next state */
+
+
+void
+ca_ac_init(ca_ac_t *ac, ca_uint_t caseless)
+{
+    ca_memzero(ac, sizeof(ca_ac_t));
+    ac->caseless = caseless;
+}
+
+
+/*
+ * Returns the id of the pattern, the order it was added in.
+ */
+ca_int_t
+ca_ac_add(ca_ac_t *ac, u_char *pattern, size_t len)
+{
+    ca_str_t  *patterns;
+
+    if (len == 0) {
+        return CA_ERROR;
+    }
+
+    if (ac->npatterns == ac->nalloc) {
+        ac->nalloc = ac->nalloc ? ac->nalloc * 2 : 8;
+
+        patterns = ca_realloc(ac->patterns, ac->nalloc * sizeof(ca_str_t));
+        if (patterns == NULL) {
+            return CA_ERROR;
+        }
+
+        ac->patterns = patterns;
+    }
+
+    ac->patterns[ac->npatterns].data = ca_alloc(len);
+    if (ac->patterns[ac->npatterns].data == NULL) {
+        return CA_ERROR;
+    }
+
+    ca_memcpy(ac->patterns[ac->npatterns].data, pattern, len);
+    ac->patterns[ac->npatterns].len = len;
+
+    return ac->npatterns++;
+}
+
+
+ca_int_t
+ca_ac_compile(ca_ac_t *ac)
+{
+    u_char     c;
+    size_t     i, n;
+    uint32_t   s, t, f, *fail, *queue, head, tail;
+    ca_uint_t  id, cls, nstates;
+
+    /* the classes, 0 is for the bytes of no pattern */
+
+    ac->nclasses = 1;
+
+    for (id = 0; id < ac->npatterns; id++) {
+        for (i = 0; i < ac->patterns[id].len; i++) {
+            c = ac->patterns[id].data[i];
+
+            if (ac->caseless) {
+                c = ca_tolower(c);
+            }
+
+            if (ac->map[c] == 0) {
+                ac->map[c] = ac->nclasses++;
+            }
+        }
+    }
+
+    if (ac->caseless) {
+        for (c = 'A'; c <= 'Z'; c++) {
+            ac->map[c] = ac->map[c | 0x20];
+        }
+    }
+
+    nstates = 1;
+
+    for (id = 0; id < ac->npatterns; id++) {
+        nstates += ac->patterns[id].len;
+    }
+
+    ac->next = ca_alloc(nstates * ac->nclasses * sizeof(uint32_t));
+    ac->term = ca_alloc(nstates * sizeof(uint32_t));
+    ac->dict = ca_calloc(nstates, sizeof(uint32_t));
+    ac->same = ca_alloc((ac->npatterns + 1) * sizeof(uint32_t));
+    fail = ca_calloc(nstates, sizeof(uint32_t));
+    queue = ca_alloc(nstates * sizeof(uint32_t));
+
+    if (ac->next == NULL || ac->term == NULL || ac->dict == NULL
+        || ac->same == NULL || fail == NULL || queue == NULL)
+    {
+        ca_free(fail);
+        ca_free(queue);
+        return CA_ERROR;
+    }
+
+    ca_memset(ac->next, 0xff, nstates * ac->nclasses * sizeof(uint32_t));
+    ca_memset(ac->term, 0xff, nstates * sizeof(uint32_t));
+
+    /* the trie */
+
+    ac->nstates = 1;
+
+    for (id = 0; id < ac->npatterns; id++) {
+        s = 0;
+
+        for (i = 0; i < ac->patterns[id].len; i++) {
+            cls = ac->map[ac->patterns[id].data[i]];
+            t = ac->next[s * ac->nclasses + cls];
+
+            if (t == CA_AC_NONE) {
+                t = ac->nstates++;
+                ac->next[s * ac->nclasses + cls] = t;
+            }
+
+            s = t;
+        }
+
+        ac->same[id] = ac->term[s];
+        ac->term[s] = id;
+    }
+
+    /*
+     * Breadth first, the fail state of a state is known before its
+     * children, the missing transitions are those of the fail state.
+     */
+
+    head = 0;
+    tail = 0;
+
+    for (cls = 0; cls < ac->nclasses; cls++) {
+        t = ac->next[cls];
+
+        if (t == CA_AC_NONE) {
+            ac->next[cls] = 0;
+
+        } else {
+            queue[tail++] = t;
+        }
+    }
+
+    while (head < tail) {
+        s = queue[head++];
+
+        for (cls = 0; cls < ac->nclasses; cls++) {
+            t = ac->next[s * ac->nclasses + cls];
+            f = ac->next[fail[s] * ac->nclasses + cls] & ~CA_AC_MATCH;
+
+            if (t == CA_AC_NONE) {
+                ac->next[s * ac->nclasses + cls] = f;
+                continue;
+            }
+
+            fail[t] = f;
+            ac->dict[t] = (ac->term[f] != CA_AC_NONE) ? f : ac->dict[f];
+            queue[tail++] = t;
+        }
+    }
+
+    /* flag the transitions to the states ending a pattern */
+
+    n = ac->nstates * ac->nclasses;
+
+    for (i = 0; i < n; i++) {
+        t = ac->next[i];
+
+        if (ac->term[t] != CA_AC_NONE || ac->dict[t] != 0) {
+            ac->next[i] = t | CA_AC_MATCH;
+        }
+    }
+
+    ca_free(fail);
+    ca_free(queue);
+
+    for (id = 0; id < ac->npatterns; id++) {
+        ca_free(ac->patterns[id].data);
+    }
+
+    ca_free(ac->patterns);
+    ac->patterns = NULL;
+
+    return CA_OK;
+}
+
+
+/*
+ * Feed [p, last) to the automaton from state, 0 at the beginning of the
+ * input, and return the state to go on with the next chunk.  handler is
+ * called with the end of every match.
+ */
+uint32_t
+ca_ac_scan(ca_ac_t *ac, uint32_t state, u_char *p, u_char *last,
+    ca_ac_handler_pt handler, void *data)
+{
+    uint32_t   s, x, id, *next;
+    u_char    *map;
+    ca_uint_t  ncls;
+
+    s = state;
+    next = ac->next;
+    map = ac->map;
+    ncls = ac->nclasses;
+
+    while (p < last) {
+        s = next[s * ncls + map[*p++]];
+
+        if (!(s & CA_AC_MATCH)) {
+            continue;
+        }
+
+        s &= ~CA_AC_MATCH;
+
+        for (x = s; x != 0; x = ac->dict[x]) {
+            for (id = ac->term[x]; id != CA_AC_NONE; id = ac->same[id]) {
+                handler(data, id, p);
+            }
+        }
+    }
+
+    return s;
+}
+
+
+void
+ca_ac_free(ca_ac_t *ac)
+{
+    ca_uint_t  id;
+
+    for (id = 0; id < ac->npatterns && ac->patterns; id++) {
+        ca_free(ac->patterns[id].data);
+    }
+
+    ca_free(ac->patterns);
+    ca_free(ac->next);
+    ca_free(ac->term);
+    ca_free(ac->dict);
+    ca_free(ac->same);
+
+    ca_ac_init(ac, ac->caseless);
+}
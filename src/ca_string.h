@@ -82,4 +82,33 @@ u_char *ca_strstrn(u_char *s1, char *s2, size_t n);
 u_char *ca_strcasestrn(u_char *s1, char *s2, size_t n);
 
 
+/*
+ * Aho-Corasick: any number of patterns searched for in a single pass,
+ * the automaton is compiled into a dfa over the byte classes of the
+ * patterns.  A caseless one folds ASCII letters as ca_strcasestrn().
+ */
+typedef struct {
+    ca_uint_t   caseless;
+    ca_str_t   *patterns;          /* until compiled */
+    ca_uint_t   npatterns;
+    ca_uint_t   nalloc;
+    ca_uint_t   nclasses;
+    ca_uint_t   nstates;
+    u_char      map[256];          /* byte to class */
+    uint32_t   *next;              /* nstates x nclasses */
+    uint32_t   *term;              /* first pattern ending in a state */
+    uint32_t   *dict;              /* next state on the fail chain to end one */
+    uint32_t   *same;              /* next pattern ending in the same state */
+} ca_ac_t;
+
+typedef void (*ca_ac_handler_pt)(void *data, ca_uint_t id, u_char *end);
+
+void ca_ac_init(ca_ac_t *ac, ca_uint_t caseless);
+ca_int_t ca_ac_add(ca_ac_t *ac, u_char *pattern, size_t len);
+ca_int_t ca_ac_compile(ca_ac_t *ac);
+uint32_t ca_ac_scan(ca_ac_t *ac, uint32_t state, u_char *p, u_char *last,
+    ca_ac_handler_pt handler, void *data);
+void ca_ac_free(ca_ac_t *ac);
+
+
 #endif /* __CA_STRING_H_INCLUDED__ */
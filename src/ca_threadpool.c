@@ -168,7 +168,10 @@ ca_threadpool_add_task(ca_threadpool_t *pool,
     tq->priority = priority;
 
     ca_pthread_mutex_lock(&pool->mutex);
-    if (pool->threads_idle == 0 && pool->threads_num < pool->threads_max) {
+    /* the idle threads may already be woken up for the queued tasks */
+    if (pool->threads_idle <= pool->task_queue.len
+        && pool->threads_num < pool->threads_max)
+    {
         ca_threadpool_thread_create(pool);
         ++pool->threads_idle;
         ++pool->threads_num;
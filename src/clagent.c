@@ -27,6 +27,8 @@ static pid_t ca_spawn_process(child_proc_pt proc, void *data, const char *name,
 static void ca_signal_child_processes(int signo);
 static char *ca_conf_acq_block(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 static char *ca_conf_acq_item(ca_conf_t *cf, ca_command_t *dummy, void *conf);
+static ca_int_t ca_conf_acq_band(u_char *p, double *band);
+static ca_acq_adapt_t *ca_conf_acq_adapt(ca_str_t *value, ca_uint_t freq);
 static char *ca_conf_server(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 static char *ca_conf_log(ca_conf_t *cf, ca_command_t *cmd, void *conf);
 
@@ -121,6 +123,160 @@ static ca_command_t  ca_conf_commands[] = {
       offsetof(ca_conf_ctx_t, recv_timeout),
       NULL },
 
+    { ca_string("statvfs_timeout"),
+      CA_CONF_TAKE1,
+      ca_conf_set_msec_slot,
+      0,
+      offsetof(ca_conf_ctx_t, statvfs_timeout),
+      NULL },
+
+    { ca_string("statvfs_threads"),
+      CA_CONF_TAKE1,
+      ca_conf_set_num_slot,
+      0,
+      offsetof(ca_conf_ctx_t, statvfs_threads),
+      NULL },
+
+    { ca_string("acq_threads"),
+      CA_CONF_TAKE1,
+      ca_conf_set_num_slot,
+      0,
+      offsetof(ca_conf_ctx_t, acq_threads),
+      NULL },
+
+    { ca_string("acq_deadline"),
+      CA_CONF_TAKE1,
+      ca_conf_set_msec_slot,
+      0,
+      offsetof(ca_conf_ctx_t, acq_deadline),
+      NULL },
+
+    { ca_string("pressure_trigger"),
+      CA_CONF_TAKE4,
+      ca_conf_pressure_trigger,
+      0,
+      0,
+      NULL },
+
+    { ca_string("cgroup_root"),
+      CA_CONF_TAKE1,
+      ca_conf_set_str_slot,
+      0,
+      offsetof(ca_conf_ctx_t, cgroup_root),
+      NULL },
+
+    { ca_string("process_match"),
+      CA_CONF_TAKE3,
+      ca_conf_process_match,
+      0,
+      0,
+      NULL },
+
+    { ca_string("process_scan_interval"),
+      CA_CONF_TAKE1,
+      ca_conf_set_sec_slot,
+      0,
+      offsetof(ca_conf_ctx_t, process_scan_interval),
+      NULL },
+
+    { ca_string("process_scan_budget"),
+      CA_CONF_TAKE1,
+      ca_conf_set_msec_slot,
+      0,
+      offsetof(ca_conf_ctx_t, process_scan_budget),
+      NULL },
+
+    { ca_string("tcp_diag_timeout"),
+      CA_CONF_TAKE1,
+      ca_conf_set_msec_slot,
+      0,
+      offsetof(ca_conf_ctx_t, tcp_diag_timeout),
+      NULL },
+
+    { ca_string("exec_command"),
+      CA_CONF_TAKE4,
+      ca_conf_exec_command,
+      0,
+      0,
+      NULL },
+
+    { ca_string("exec_concurrency"),
+      CA_CONF_TAKE1,
+      ca_conf_set_num_slot,
+      0,
+      offsetof(ca_conf_ctx_t, exec_concurrency),
+      NULL },
+
+    { ca_string("log_match"),
+      CA_CONF_TAKE3|CA_CONF_TAKE4,
+      ca_conf_log_match,
+      0,
+      0,
+      NULL },
+
+    { ca_string("admin_socket"),
+      CA_CONF_TAKE1,
+      ca_conf_set_str_slot,
+      0,
+      offsetof(ca_conf_ctx_t, admin_socket),
+      NULL },
+
+    { ca_string("prometheus_listen"),
+      CA_CONF_TAKE1,
+      ca_conf_set_str_slot,
+      0,
+      offsetof(ca_conf_ctx_t, prometheus_listen),
+      NULL },
+
+    { ca_string("store_path"),
+      CA_CONF_TAKE1,
+      ca_conf_set_str_slot,
+      0,
+      offsetof(ca_conf_ctx_t, store_path),
+      NULL },
+
+    { ca_string("store_hours"),
+      CA_CONF_TAKE1,
+      ca_conf_set_num_slot,
+      0,
+      offsetof(ca_conf_ctx_t, store_hours),
+      NULL },
+
+    { ca_string("rule"),
+      CA_CONF_TAKE4|CA_CONF_TAKE5,
+      ca_conf_rule,
+      0,
+      0,
+      NULL },
+
+    { ca_string("acq_plugin"),
+      CA_CONF_TAKE1,
+      ca_conf_acq_plugin,
+      0,
+      0,
+      NULL },
+
+    { ca_string("statsd_listen"),
+      CA_CONF_TAKE1,
+      ca_conf_statsd_listen,
+      0,
+      0,
+      NULL },
+
+    { ca_string("statsd_flush_interval"),
+      CA_CONF_TAKE1,
+      ca_conf_set_sec_slot,
+      0,
+      offsetof(ca_conf_ctx_t, statsd_flush_interval),
+      NULL },
+
+    { ca_string("statsd_max_metrics"),
+      CA_CONF_TAKE1,
+      ca_conf_set_num_slot,
+      0,
+      offsetof(ca_conf_ctx_t, statsd_max_metrics),
+      NULL },
+
     { ca_string("max_free_object"),
       CA_CONF_TAKE1,
       ca_conf_set_num_slot,
@@ -313,14 +469,20 @@ static char *
 ca_conf_acq_item(ca_conf_t *cf, ca_command_t *dummy, void *conf)
 {
     ca_conf_ctx_t          *ctx = conf;
-    ca_str_t               *value;
-    ca_int_t                id, i;
-    ca_uint_t               freq;
+    ca_str_t               *value, *stats, name, key;
+    ca_int_t                id, i, n;
+    ca_uint_t               freq, window, heartbeat, deadband, dims;
+    ca_uint_t               plugin, plugin_item;
     ca_int_t                type;
+    double                  band;
+    u_char                 *p;
     ca_acq_t               *item;
-    ca_acq_item_handler_t  *handler;
+    ca_acq_adapt_t         *adapt;
+    ca_acq_multi_t         *multi;
+    ca_acq_deadband_t      *db;
+    ca_acq_item_handler_t  *handler, plugin_handler;
 
-    if (cf->args->nelem != 4) {
+    if (cf->args->nelem < 4 || cf->args->nelem > 10) {
         ca_conf_log_error(CA_LOG_EMERG, cf, 0,
                           "invalid number of acq parameters");
         return CA_CONF_ERROR;
@@ -328,50 +490,214 @@ ca_conf_acq_item(ca_conf_t *cf, ca_command_t *dummy, void *conf)
 
     value = cf->args->elem;
     handler = NULL;
+    plugin_item = 0;
+
+    /* "name[key]" */
+
+    name = value[0];
+    ca_str_null(&key);
+
+    p = ca_strlchr(value[0].data, value[0].data + value[0].len, '[');
+    if (p != NULL) {
+        if (value[0].data[value[0].len - 1] != ']'
+            || p + 1 == value[0].data + value[0].len - 1)
+        {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "invalid key of acq item \"%V\"", &value[0]);
+            return CA_CONF_ERROR;
+        }
+
+        name.len = p - value[0].data;
+        key.len = value[0].len - name.len - 2;
+        key.data = (u_char *) strndup((char *) p + 1, key.len);
+        if (key.data == NULL) {
+            return CA_CONF_ERROR;
+        }
+    }
 
     for (i = 0; ca_acq_item_handlers[i].name.len != 0; i++) {
-        if (value[0].len != ca_acq_item_handlers[i].name.len
-            || ca_strcasecmp(ca_acq_item_handlers[i].name.data, value[0].data)
+        if (name.len != ca_acq_item_handlers[i].name.len
+            || ca_strncasecmp(ca_acq_item_handlers[i].name.data, name.data,
+                              name.len)
                != 0)
         {
             continue;
         }
 
+        if (ca_acq_item_handlers[i].multi == NULL
+            && ((key.len == 0 && ca_acq_item_handlers[i].item_handler == NULL
+                 && ca_acq_item_handlers[i].item_value == NULL)
+                || (key.len != 0
+                    && ca_acq_item_handlers[i].key_handler == NULL
+                    && ca_acq_item_handlers[i].key_value == NULL)))
+        {
+            continue;
+        }
+
         handler = &ca_acq_item_handlers[i];
         ca_acq_item_handlers[i].exist = 1;
         break;
     }
 
+    /* an item of a plugin is sampled by its collector only */
+
+    if (handler == NULL
+        && ca_plugin_item(&name, &plugin, &plugin_item) == CA_OK)
+    {
+        ca_memzero(&plugin_handler, sizeof(ca_acq_item_handler_t));
+        plugin_handler.name = name;
+        plugin_handler.collector = CA_ACQ_COLLECTORS + plugin;
+        handler = &plugin_handler;
+    }
+
     if (handler == NULL) {
         ca_conf_log_error(CA_LOG_EMERG, cf, 0, "invalid acq item \"%V\"",
                           &value[0]);
-        return CA_CONF_ERROR;
+        goto failed;
     }
 
     id = ca_atoi(value[1].data, value[1].len);
     if (id == CA_ERROR) {
         ca_conf_log_error(CA_LOG_EMERG, cf, 0,
                           "invalid \"id\" field of acq parameters");
-        return CA_CONF_ERROR;
+        goto failed;
     }
 
     freq = ca_parse_time(&value[2], 1);
     if (freq == CA_ERROR) {
         ca_conf_log_error(CA_LOG_EMERG, cf, 0,
                           "invalid \"freq\" field of acq parameters");
-        return CA_CONF_ERROR;
+        goto failed;
     }
 
     type = ca_atoi(value[3].data, value[3].len);
     if (type == CA_ERROR) {
         ca_conf_log_error(CA_LOG_EMERG, cf, 0,
                           "invalid \"type\" field of acq parameters");
-        return CA_CONF_ERROR;
+        goto failed;
+    }
+
+    /*
+     * [<window> [<stats>]] [deadband=<abs>|<rel>%] [heartbeat=<n>]
+     * [adaptive=<min>:<max>:<threshold>] [dims=<n>]
+     */
+
+    window = 0;
+    stats = NULL;
+    band = 0;
+    deadband = 0;
+    adapt = NULL;
+    heartbeat = CA_ACQ_HEARTBEAT;
+    dims = CA_ACQ_DIMS_MAX;
+
+    for (i = 4, n = 0; i < (ca_int_t) cf->args->nelem; i++) {
+
+        if (ca_strncmp(value[i].data, "deadband=", 9) == 0) {
+            deadband = ca_conf_acq_band(value[i].data + 9, &band);
+            if (deadband == (ca_uint_t) CA_ERROR) {
+                ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                                  "invalid \"%V\" of acq parameters",
+                                  &value[i]);
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ca_strncmp(value[i].data, "adaptive=", 9) == 0) {
+            if (adapt != NULL) {
+                ca_free(adapt);
+            }
+
+            adapt = ca_conf_acq_adapt(&value[i], freq);
+            if (adapt == NULL) {
+                ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                                  "invalid \"%V\" of acq parameters, "
+                                  "\"freq\" must be within its min and max",
+                                  &value[i]);
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ca_strncmp(value[i].data, "heartbeat=", 10) == 0) {
+            heartbeat = ca_atoi(value[i].data + 10, value[i].len - 10);
+            if (heartbeat == (ca_uint_t) CA_ERROR) {
+                ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                                  "invalid \"%V\" of acq parameters",
+                                  &value[i]);
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ca_strncmp(value[i].data, "dims=", 5) == 0) {
+            dims = ca_atoi(value[i].data + 5, value[i].len - 5);
+            if (dims == (ca_uint_t) CA_ERROR || dims == 0
+                || handler->multi == NULL)
+            {
+                ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                                  "invalid \"%V\" of acq parameters",
+                                  &value[i]);
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (n == 0) {
+            window = ca_parse_time(&value[i], 1);
+            if (window == CA_ERROR || window < freq) {
+                ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                                  "invalid \"window\" field of acq "
+                                  "parameters, it must not be less than "
+                                  "\"freq\"");
+                goto failed;
+            }
+
+        } else if (n == 1) {
+            stats = &value[i];
+
+        } else {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "invalid number of acq parameters");
+            goto failed;
+        }
+
+        n++;
+    }
+
+    if (adapt != NULL && window != 0 && window < adapt->max) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "\"window\" field of acq parameters must not be "
+                          "less than the adaptive max");
+        goto failed;
+    }
+
+    multi = NULL;
+
+    if (handler->multi != NULL) {
+        if (window != 0 || deadband || adapt != NULL) {
+            ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                              "acq item \"%V\" has many values, it takes "
+                              "no window, deadband or adaptive", &value[0]);
+            goto failed;
+        }
+
+        multi = ca_calloc(1, sizeof(ca_acq_multi_t));
+        if (multi == NULL) {
+            goto failed;
+        }
+
+        multi->max = dims;
     }
 
     item = ca_array_push(ctx->acq_items);
     if (item == NULL) {
-        return CA_CONF_ERROR;
+        ca_free(multi);
+        goto failed;
     }
 
     item->item = value[0];
@@ -380,9 +706,151 @@ ca_conf_acq_item(ca_conf_t *cf, ca_command_t *dummy, void *conf)
     item->freq = freq;
     item->type = type;
     item->handler = handler->item_handler;
+    item->key = key;
+    item->key_handler = key.len ? handler->key_handler : NULL;
+    item->item_value = key.len ? NULL : handler->item_value;
+    item->key_value = key.len ? handler->key_value : NULL;
     item->accessed = 0;
+    item->window = window;
+    item->summary = NULL;
+    item->deadband = NULL;
+    item->collector = handler->collector;
+    item->plugin_item = plugin_item;
+    item->forced = 0;
+    item->ready = 0;
+    item->multi_handler = handler->multi;
+    item->multi = multi;
+    ca_memzero(&item->sample, sizeof(ca_acq_value_t));
+
+    if (window != 0 && ca_acq_window_init(item, stats) != CA_OK) {
+        ca_conf_log_error(CA_LOG_EMERG, cf, 0,
+                          "invalid \"stats\" field of acq parameters");
+        ca_acq_window_free(item);
+        ctx->acq_items->nelem--;
+        goto failed;
+    }
+
+    if (deadband) {
+        db = ca_calloc(1, sizeof(ca_acq_deadband_t));
+        if (db == NULL) {
+            ca_acq_window_free(item);
+            ctx->acq_items->nelem--;
+            goto failed;
+        }
+
+        if (deadband == CA_ACQ_BAND_ABS) {
+            db->abs = band;
+
+        } else {
+            db->rel = band;
+        }
+
+        db->heartbeat = heartbeat;
+        item->deadband = db;
+    }
+
+    item->adapt = adapt;
 
     return CA_CONF_OK;
+
+failed:
+
+    if (key.data != NULL) {
+        ca_free(key.data);
+    }
+
+    if (adapt != NULL) {
+        ca_free(adapt);
+    }
+
+    return CA_CONF_ERROR;
+}
+
+
+/* "<abs>" or "<rel>%" */
+static ca_int_t
+ca_conf_acq_band(u_char *p, double *band)
+{
+    char      *end;
+    ca_int_t   type;
+
+    *band = strtod((char *) p, &end);
+    type = CA_ACQ_BAND_ABS;
+
+    if (*end == '%') {
+        *band /= 100;
+        type = CA_ACQ_BAND_REL;
+        end++;
+    }
+
+    if (end == (char *) p || *end != '\0' || *band < 0) {
+        return CA_ERROR;
+    }
+
+    return type;
+}
+
+
+/* "<min>:<max>:<threshold>" */
+static ca_acq_adapt_t *
+ca_conf_acq_adapt(ca_str_t *value, ca_uint_t freq)
+{
+    u_char          *p, *last, *colon;
+    ca_str_t         min, max;
+    ca_int_t         type;
+    double           threshold;
+    ca_acq_adapt_t  *adapt;
+
+    p = value->data + 9;
+    last = value->data + value->len;
+
+    colon = ca_strlchr(p, last, ':');
+    if (colon == NULL) {
+        return NULL;
+    }
+
+    min.data = p;
+    min.len = colon - p;
+
+    p = colon + 1;
+
+    colon = ca_strlchr(p, last, ':');
+    if (colon == NULL) {
+        return NULL;
+    }
+
+    max.data = p;
+    max.len = colon - p;
+
+    type = ca_conf_acq_band(colon + 1, &threshold);
+    if (type == CA_ERROR) {
+        return NULL;
+    }
+
+    adapt = ca_calloc(1, sizeof(ca_acq_adapt_t));
+    if (adapt == NULL) {
+        return NULL;
+    }
+
+    adapt->min = ca_parse_time(&min, 1);
+    adapt->max = ca_parse_time(&max, 1);
+
+    if (adapt->min == (ca_uint_t) CA_ERROR || adapt->min == 0
+        || adapt->max == (ca_uint_t) CA_ERROR || adapt->max < adapt->min
+        || freq < adapt->min || freq > adapt->max)
+    {
+        ca_free(adapt);
+        return NULL;
+    }
+
+    if (type == CA_ACQ_BAND_ABS) {
+        adapt->abs = threshold;
+
+    } else {
+        adapt->rel = threshold;
+    }
+
+    return adapt;
 }
 
 
@@ -850,6 +1318,7 @@ main(int argc, char **argv)
     int            ret;
     ca_conf_t      conf;
     ca_int_t       i, pid;
+    ca_acq_t      *item;
     ca_server_t   *server;
 
     ca_parse_options(argc, argv);
@@ -863,6 +1332,17 @@ main(int argc, char **argv)
     conf_ctx.connect_timeout = CA_CONF_UNSET_UINT;
     conf_ctx.send_timeout = CA_CONF_UNSET_UINT;
     conf_ctx.recv_timeout = CA_CONF_UNSET_UINT;
+    conf_ctx.statvfs_timeout = CA_CONF_UNSET_UINT;
+    conf_ctx.statvfs_threads = CA_CONF_UNSET_UINT;
+    conf_ctx.acq_threads = CA_CONF_UNSET_UINT;
+    conf_ctx.acq_deadline = CA_CONF_UNSET_UINT;
+    conf_ctx.process_scan_interval = CA_CONF_UNSET_UINT;
+    conf_ctx.process_scan_budget = CA_CONF_UNSET_UINT;
+    conf_ctx.tcp_diag_timeout = CA_CONF_UNSET_UINT;
+    conf_ctx.exec_concurrency = CA_CONF_UNSET_UINT;
+    conf_ctx.statsd_flush_interval = CA_CONF_UNSET_UINT;
+    conf_ctx.statsd_max_metrics = CA_CONF_UNSET_UINT;
+    conf_ctx.store_hours = CA_CONF_UNSET_UINT;
     conf_ctx.max_nfree = CA_CONF_UNSET_UINT;
     conf_ctx.log_level = CA_CONF_UNSET;
 
@@ -871,6 +1351,10 @@ main(int argc, char **argv)
     ca_str_null(&conf_ctx.update_exe);
     ca_str_null(&conf_ctx.identify);
     ca_str_null(&conf_ctx.log_file);
+    ca_str_null(&conf_ctx.cgroup_root);
+    ca_str_null(&conf_ctx.admin_socket);
+    ca_str_null(&conf_ctx.prometheus_listen);
+    ca_str_null(&conf_ctx.store_path);
 
     ca_memzero(&conf, sizeof(ca_conf_t));
     conf.ctx = &conf_ctx;
@@ -892,6 +1376,9 @@ main(int argc, char **argv)
     ca_conf_init_uint_value(conf_ctx.send_timeout, 60);
     ca_conf_init_uint_value(conf_ctx.recv_timeout, 60);
     ca_conf_init_uint_value(conf_ctx.max_nfree, 64);
+    ca_conf_init_uint_value(conf_ctx.acq_threads, 4);
+    ca_conf_init_uint_value(conf_ctx.acq_deadline, 500);
+    ca_conf_init_uint_value(conf_ctx.store_hours, 24);
 
     if (conf_ctx.log_file.len == 0) {
         ca_str_set(&conf_ctx.log_file, CA_LOG_PATH);
@@ -936,6 +1423,16 @@ main(int argc, char **argv)
         goto out;
     }
 
+    if (ca_rule_compile(&conf_ctx) != CA_OK) {
+        ret = -1;
+        goto out;
+    }
+
+    if (ca_store_check(&conf_ctx) != CA_OK) {
+        ret = -1;
+        goto out;
+    }
+
     if (conf_ctx.pid.len == 0) {
         ca_str_set(&conf_ctx.pid, CA_PID_PATH);
     }
@@ -1065,9 +1562,56 @@ out:
     }
 
     if (conf_ctx.acq_items) {
+        item = conf_ctx.acq_items->elem;
+        for (i = 0; i < conf_ctx.acq_items->nelem; i++) {
+            if (item[i].key.data != NULL) {
+                ca_free(item[i].key.data);
+            }
+
+            ca_acq_window_free(&item[i]);
+
+            if (item[i].deadband != NULL) {
+                ca_free(item[i].deadband->last_str);
+                ca_free(item[i].deadband);
+            }
+
+            if (item[i].adapt != NULL) {
+                ca_free(item[i].adapt);
+            }
+
+            ca_free(item[i].sample.str);
+            ca_acq_multi_free(&item[i]);
+        }
         ca_array_destroy(conf_ctx.acq_items);
     }
 
+    ca_plugin_unload();
+    ca_rule_free();
+
+    if (conf_ctx.acq_rules) {
+        ca_array_destroy(conf_ctx.acq_rules);
+    }
+
+    if (conf_ctx.pressure_triggers) {
+        ca_array_destroy(conf_ctx.pressure_triggers);
+    }
+
+    if (conf_ctx.process_matches) {
+        ca_array_destroy(conf_ctx.process_matches);
+    }
+
+    if (conf_ctx.exec_commands) {
+        ca_array_destroy(conf_ctx.exec_commands);
+    }
+
+    if (conf_ctx.log_matches) {
+        ca_array_destroy(conf_ctx.log_matches);
+    }
+
+    if (conf_ctx.statsd_listens) {
+        ca_array_destroy(conf_ctx.statsd_listens);
+    }
+
     if (conf_ctx.servers) {
         server = conf_ctx.servers->elem;
         for (i = 0; i < conf_ctx.servers->nelem; i++) {
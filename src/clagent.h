@@ -14,10 +14,15 @@
 #include "ca_array.h"
 #include "ca_buf.h"
 #include "ca_util.h"
+#include "ca_sketch.h"
 #include "ca_conf.h"
 #include "ca_daemon.h"
 #include "ca_update.h"
 #include "ca_acquisition.h"
+#include "ca_admin.h"
+#include "ca_prometheus.h"
+#include "ca_store.h"
+#include "ca_rule.h"
 #include "ca_worker.h"
 
 
@@ -35,6 +40,7 @@
 #define UPDATE_PROCESS_NAME  	PROG_NAME"[update]"
 #define ACQ_PROCESS_NAME     	PROG_NAME"[acq]"
 #define WORKER_PROCESS_NAME     PROG_NAME"[worker]"
+#define EXEC_PROCESS_NAME       PROG_NAME"[exec]"
 
 
 #define CA_START                    0
@@ -53,6 +59,7 @@
 #define CA_PROCESS_UPDATE           2
 #define CA_PROCESS_NETWORK          3
 #define CA_PROCESS_WORKER           4
+#define CA_PROCESS_EXEC             5
 
 
 typedef struct {
@@ -70,7 +77,28 @@ typedef struct {
     ca_uint_t    connect_timeout;
     ca_uint_t    send_timeout;
     ca_uint_t    recv_timeout;
+    ca_uint_t    statvfs_timeout;
+    ca_uint_t    statvfs_threads;
+    ca_uint_t    acq_threads;
+    ca_uint_t    acq_deadline;
+    ca_str_t     admin_socket;
+    ca_str_t     prometheus_listen;
+    ca_str_t     store_path;
+    ca_uint_t    store_hours;
+    ca_array_t  *pressure_triggers;
+    ca_str_t     cgroup_root;
+    ca_array_t  *process_matches;
+    ca_uint_t    process_scan_interval;
+    ca_uint_t    process_scan_budget;
+    ca_uint_t    tcp_diag_timeout;
+    ca_array_t  *exec_commands;
+    ca_uint_t    exec_concurrency;
+    ca_array_t  *log_matches;
+    ca_array_t  *statsd_listens;
+    ca_uint_t    statsd_flush_interval;
+    ca_uint_t    statsd_max_metrics;
     ca_array_t  *acq_items;
+    ca_array_t  *acq_rules;
     ca_array_t  *servers;
 } ca_conf_ctx_t;
 